@@ -74,7 +74,8 @@ typedef struct pa_daemon_conf {
         log_meta,
         log_time,
         flat_volumes,
-        lock_memory;
+        lock_memory,
+        virtual_clock;
     int exit_idle_time,
         scache_idle_time,
         auto_log_target,
@@ -875,6 +875,10 @@ int main(int argc, char *argv[]) {
 
     pa_memtrap_install();
 
+    /* Needs to happen before the first IO thread or timer is set up */
+    if (conf->virtual_clock)
+        pa_rtclock_virtual_enable();
+
     if (!getenv("PULSE_NO_SIMD")) {
         pa_cpu_init_x86();
         pa_cpu_init_arm();
@@ -25,6 +25,7 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <limits.h>
 #include <asoundlib.h>
 
@@ -2476,6 +2477,7 @@ void pa_alsa_profile_set_free(pa_alsa_profile_set *ps) {
         pa_hashmap_free(ps->mappings, NULL, NULL);
     }
 
+    pa_xfree(ps->fingerprint);
     pa_xfree(ps);
 }
 
@@ -3079,6 +3081,7 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
     char *fn;
     int r;
     void *state;
+    struct stat st;
 
     static pa_config_item items[] = {
         /* [General] */
@@ -3120,6 +3123,12 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
                               PA_ALSA_PROFILE_SETS_DIR);
 
     r = pa_config_parse(fn, NULL, items, ps);
+
+    if (r >= 0 && stat(fn, &st) >= 0)
+        ps->fingerprint = pa_sprintf_malloc("%s:%llu:%llu", fn, (unsigned long long) st.st_mtime, (unsigned long long) st.st_size);
+    else
+        ps->fingerprint = pa_xstrdup(fn);
+
     pa_xfree(fn);
 
     if (r < 0)
@@ -3313,6 +3322,76 @@ void pa_alsa_profile_set_probe(
     ps->probed = TRUE;
 }
 
+char *pa_alsa_profile_set_probe_to_string(pa_alsa_profile_set *ps) {
+    pa_strbuf *buf;
+    pa_alsa_profile *p;
+    void *state;
+
+    pa_assert(ps);
+    pa_assert(ps->probed);
+
+    buf = pa_strbuf_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+        if (!pa_strbuf_isempty(buf))
+            pa_strbuf_puts(buf, " ");
+
+        pa_strbuf_puts(buf, p->name);
+    }
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+int pa_alsa_profile_set_probe_from_string(pa_alsa_profile_set *ps, const char *s) {
+    pa_alsa_profile *p;
+    char *n;
+    const char *split_state = NULL;
+    uint32_t idx;
+    int r = 0;
+
+    pa_assert(ps);
+    pa_assert(s);
+
+    if (ps->probed)
+        return 0;
+
+    /* Check everything first so that a stale result leaves the set
+     * untouched and ready for a real probe */
+    while ((n = pa_split_spaces(s, &split_state))) {
+        p = pa_hashmap_get(ps->profiles, n);
+        pa_xfree(n);
+
+        if (!p)
+            return -1;
+    }
+
+    split_state = NULL;
+    while ((n = pa_split_spaces(s, &split_state))) {
+        pa_alsa_mapping *m;
+
+        p = pa_hashmap_get(ps->profiles, n);
+        pa_xfree(n);
+
+        /* Profiles marked supported in the config file have already
+         * been counted by profile_verify() */
+        if (p->supported)
+            continue;
+
+        p->supported = TRUE;
+        r++;
+
+        if (p->output_mappings)
+            PA_IDXSET_FOREACH(m, p->output_mappings, idx)
+                m->supported++;
+
+        if (p->input_mappings)
+            PA_IDXSET_FOREACH(m, p->input_mappings, idx)
+                m->supported++;
+    }
+
+    return r;
+}
+
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
     pa_alsa_profile *p;
     pa_alsa_mapping *m;
@@ -261,6 +261,9 @@ struct pa_alsa_profile_set {
     pa_hashmap *mappings;
     pa_hashmap *profiles;
 
+    /* Changes whenever the configuration file is edited */
+    char *fingerprint;
+
     pa_bool_t auto_profiles;
     pa_bool_t probed:1;
 };
@@ -271,6 +274,14 @@ void pa_alsa_profile_dump(pa_alsa_profile *p);
 pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel_map *bonus);
 void pa_alsa_profile_set_probe(pa_alsa_profile_set *ps, const char *dev_id, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec);
 void pa_alsa_profile_set_free(pa_alsa_profile_set *s);
+
+/* Serialize the profiles a probe found to be supported, and mark the
+ * profiles of such a list as supported without probing them. The
+ * latter returns how many profiles it marked, or fails if a profile
+ * is unknown. pa_alsa_profile_set_probe() still needs to be called
+ * afterwards for all others. */
+char *pa_alsa_profile_set_probe_to_string(pa_alsa_profile_set *s);
+int pa_alsa_profile_set_probe_from_string(pa_alsa_profile_set *s, const char *str);
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *s);
 
 snd_mixer_t *pa_alsa_open_mixer_for_pcm(snd_pcm_t *pcm, char **ctl_device);
@@ -125,6 +125,15 @@ struct userdata {
 
     pa_bool_t first, after_rewind;
 
+    /* What we negotiated with the device, reapplied on resume */
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_uframes_t sw_params_avail_min;
+
+    /* When the last resume started, until the first sample is
+     * written */
+    pa_usec_t resume_time;
+
     pa_rtpoll_item *alsa_rtpoll_item;
 
     snd_mixer_selem_channel_id_t mixer_map[SND_MIXER_SCHN_LAST];
@@ -927,9 +936,20 @@ static int update_sw_params(struct userdata *u) {
 
     pa_log_debug("setting avail_min=%lu", (unsigned long) avail_min);
 
-    if ((err = pa_alsa_set_sw_params(u->pcm_handle, avail_min, !u->use_tsched)) < 0) {
-        pa_log("Failed to set software parameters: %s", pa_alsa_strerror(err));
-        return err;
+    if (u->sw_params && u->sw_params_avail_min == avail_min &&
+        pa_alsa_restore_sw_params(u->pcm_handle, u->sw_params) >= 0)
+        pa_log_debug("Reapplied cached software parameters.");
+    else {
+        if ((err = pa_alsa_set_sw_params(u->pcm_handle, avail_min, !u->use_tsched)) < 0) {
+            pa_log("Failed to set software parameters: %s", pa_alsa_strerror(err));
+            return err;
+        }
+
+        if (u->sw_params)
+            snd_pcm_sw_params_free(u->sw_params);
+
+        u->sw_params = pa_alsa_save_sw_params(u->pcm_handle);
+        u->sw_params_avail_min = avail_min;
     }
 
     pa_sink_set_max_request_within_thread(u->sink, u->hwbuf_size - u->hwbuf_unused);
@@ -938,25 +958,14 @@ static int update_sw_params(struct userdata *u) {
 }
 
 /* Called from IO context */
-static int unsuspend(struct userdata *u) {
+static int negotiate_hw_params(struct userdata *u) {
     pa_sample_spec ss;
     int err;
     pa_bool_t b, d;
     snd_pcm_uframes_t period_size, buffer_size;
 
     pa_assert(u);
-    pa_assert(!u->pcm_handle);
-
-    pa_log_info("Trying resume...");
-
-    if ((err = snd_pcm_open(&u->pcm_handle, u->device_name, SND_PCM_STREAM_PLAYBACK,
-                            SND_PCM_NONBLOCK|
-                            SND_PCM_NO_AUTO_RESAMPLE|
-                            SND_PCM_NO_AUTO_CHANNELS|
-                            SND_PCM_NO_AUTO_FORMAT)) < 0) {
-        pa_log("Error opening PCM device %s: %s", u->device_name, pa_alsa_strerror(err));
-        goto fail;
-    }
+    pa_assert(u->pcm_handle);
 
     ss = u->sink->sample_spec;
     period_size = u->fragment_size / u->frame_size;
@@ -966,17 +975,17 @@ static int unsuspend(struct userdata *u) {
 
     if ((err = pa_alsa_set_hw_params(u->pcm_handle, &ss, &period_size, &buffer_size, 0, &b, &d, TRUE)) < 0) {
         pa_log("Failed to set hardware parameters: %s", pa_alsa_strerror(err));
-        goto fail;
+        return -1;
     }
 
     if (b != u->use_mmap || d != u->use_tsched) {
         pa_log_warn("Resume failed, couldn't get original access mode.");
-        goto fail;
+        return -1;
     }
 
     if (!pa_sample_spec_equal(&ss, &u->sink->sample_spec)) {
         pa_log_warn("Resume failed, couldn't restore original sample settings.");
-        goto fail;
+        return -1;
     }
 
     if (period_size*u->frame_size != u->fragment_size ||
@@ -984,9 +993,55 @@ static int unsuspend(struct userdata *u) {
         pa_log_warn("Resume failed, couldn't restore original fragment settings. (Old: %lu/%lu, New %lu/%lu)",
                     (unsigned long) u->hwbuf_size, (unsigned long) u->fragment_size,
                     (unsigned long) (buffer_size*u->frame_size), (unsigned long) (period_size*u->frame_size));
+        return -1;
+    }
+
+    /* Remember what we got for the next time */
+    if (u->hw_params)
+        snd_pcm_hw_params_free(u->hw_params);
+
+    u->hw_params = pa_alsa_save_hw_params(u->pcm_handle);
+
+    /* The software parameters depend on the hardware configuration
+     * (e.g. the boundary), hence don't trust the old ones anymore */
+    if (u->sw_params) {
+        snd_pcm_sw_params_free(u->sw_params);
+        u->sw_params = NULL;
+    }
+
+    return 0;
+}
+
+/* Called from IO context */
+static int unsuspend(struct userdata *u) {
+    int err;
+    pa_usec_t opened;
+
+    pa_assert(u);
+    pa_assert(!u->pcm_handle);
+
+    pa_log_info("Trying resume...");
+
+    u->resume_time = pa_rtclock_now();
+
+    if ((err = snd_pcm_open(&u->pcm_handle, u->device_name, SND_PCM_STREAM_PLAYBACK,
+                            SND_PCM_NONBLOCK|
+                            SND_PCM_NO_AUTO_RESAMPLE|
+                            SND_PCM_NO_AUTO_CHANNELS|
+                            SND_PCM_NO_AUTO_FORMAT)) < 0) {
+        pa_log("Error opening PCM device %s: %s", u->device_name, pa_alsa_strerror(err));
         goto fail;
     }
 
+    opened = pa_rtclock_now();
+
+    /* Try the configuration we had before, if the device still takes
+     * it we can skip the negotiation */
+    if (u->hw_params && pa_alsa_restore_hw_params(u->pcm_handle, u->hw_params) >= 0)
+        pa_log_debug("Reapplied cached hardware parameters.");
+    else if (negotiate_hw_params(u) < 0)
+        goto fail;
+
     if (update_sw_params(u) < 0)
         goto fail;
 
@@ -1001,7 +1056,9 @@ static int unsuspend(struct userdata *u) {
     u->first = TRUE;
     u->since_start = 0;
 
-    pa_log_info("Resumed successfully...");
+    pa_log_info("Resumed successfully in %0.2f ms (%0.2f ms for opening the device)...",
+                (double) (pa_rtclock_now() - u->resume_time) / PA_USEC_PER_MSEC,
+                (double) (opened - u->resume_time) / PA_USEC_PER_MSEC);
 
     return 0;
 
@@ -1011,6 +1068,8 @@ fail:
         u->pcm_handle = NULL;
     }
 
+    u->resume_time = 0;
+
     return -PA_ERR_IO;
 }
 
@@ -1383,6 +1442,12 @@ static void thread_func(void *userdata) {
                     pa_log_info("Starting playback.");
                     snd_pcm_start(u->pcm_handle);
 
+                    if (u->resume_time > 0) {
+                        pa_log_info("First sample %0.2f ms after resume.",
+                                    (double) (pa_rtclock_now() - u->resume_time) / PA_USEC_PER_MSEC);
+                        u->resume_time = 0;
+                    }
+
                     pa_smoother_resume(u->smoother, pa_rtclock_now(), TRUE);
                 }
 
@@ -1790,6 +1855,8 @@ pa_sink *pa_alsa_sink_new(pa_module *m, pa_modargs *ma, const char*driver, pa_ca
     if (mapping)
         pa_log_info("Selected mapping '%s' (%s).", mapping->description, mapping->name);
 
+    u->hw_params = pa_alsa_save_hw_params(u->pcm_handle);
+
     if (use_mmap && !b) {
         pa_log_info("Device doesn't support mmap(), falling back to UNIX read/write mode.");
         u->use_mmap = use_mmap = FALSE;
@@ -1978,6 +2045,12 @@ static void userdata_free(struct userdata *u) {
         snd_pcm_close(u->pcm_handle);
     }
 
+    if (u->hw_params)
+        snd_pcm_hw_params_free(u->hw_params);
+
+    if (u->sw_params)
+        snd_pcm_sw_params_free(u->sw_params);
+
     if (u->mixer_fdl)
         pa_alsa_fdlist_free(u->mixer_fdl);
 
@@ -458,6 +458,86 @@ int pa_alsa_set_sw_params(snd_pcm_t *pcm, snd_pcm_uframes_t avail_min, pa_bool_t
     return 0;
 }
 
+snd_pcm_hw_params_t* pa_alsa_save_hw_params(snd_pcm_t *pcm) {
+    snd_pcm_hw_params_t *hwparams;
+    int err;
+
+    pa_assert(pcm);
+
+    if ((err = snd_pcm_hw_params_malloc(&hwparams)) < 0)
+        return NULL;
+
+    if ((err = snd_pcm_hw_params_current(pcm, hwparams)) < 0) {
+        pa_log_debug("snd_pcm_hw_params_current() failed: %s", pa_alsa_strerror(err));
+        snd_pcm_hw_params_free(hwparams);
+        return NULL;
+    }
+
+    return hwparams;
+}
+
+snd_pcm_sw_params_t* pa_alsa_save_sw_params(snd_pcm_t *pcm) {
+    snd_pcm_sw_params_t *swparams;
+    int err;
+
+    pa_assert(pcm);
+
+    if ((err = snd_pcm_sw_params_malloc(&swparams)) < 0)
+        return NULL;
+
+    if ((err = snd_pcm_sw_params_current(pcm, swparams)) < 0) {
+        pa_log_debug("snd_pcm_sw_params_current() failed: %s", pa_alsa_strerror(err));
+        snd_pcm_sw_params_free(swparams);
+        return NULL;
+    }
+
+    return swparams;
+}
+
+/* The saved configuration is fully determined, hence ALSA can install
+ * it right away, without the refinement steps that
+ * pa_alsa_set_hw_params() goes through. */
+int pa_alsa_restore_hw_params(snd_pcm_t *pcm, const snd_pcm_hw_params_t *saved) {
+    snd_pcm_hw_params_t *hwparams;
+    int err;
+
+    pa_assert(pcm);
+    pa_assert(saved);
+
+    snd_pcm_hw_params_alloca(&hwparams);
+    snd_pcm_hw_params_copy(hwparams, saved);
+
+    if ((err = snd_pcm_hw_params(pcm, hwparams)) < 0) {
+        pa_log_debug("Failed to reapply hardware parameters: %s", pa_alsa_strerror(err));
+        return err;
+    }
+
+    if ((err = snd_pcm_prepare(pcm)) < 0) {
+        pa_log_info("snd_pcm_prepare() failed: %s", pa_alsa_strerror(err));
+        return err;
+    }
+
+    return 0;
+}
+
+int pa_alsa_restore_sw_params(snd_pcm_t *pcm, const snd_pcm_sw_params_t *saved) {
+    snd_pcm_sw_params_t *swparams;
+    int err;
+
+    pa_assert(pcm);
+    pa_assert(saved);
+
+    snd_pcm_sw_params_alloca(&swparams);
+    snd_pcm_sw_params_copy(swparams, saved);
+
+    if ((err = snd_pcm_sw_params(pcm, swparams)) < 0) {
+        pa_log_debug("Failed to reapply software parameters: %s", pa_alsa_strerror(err));
+        return err;
+    }
+
+    return 0;
+}
+
 snd_pcm_t *pa_alsa_open_by_device_id_auto(
         const char *dev_id,
         char **dev,
@@ -54,6 +54,15 @@ int pa_alsa_set_sw_params(
         snd_pcm_uframes_t avail_min,
         pa_bool_t period_event);
 
+/* Snapshots of the currently installed parameters, to be reapplied
+ * when the device is reopened without negotiating them again. Free
+ * with snd_pcm_hw_params_free()/snd_pcm_sw_params_free(). */
+snd_pcm_hw_params_t* pa_alsa_save_hw_params(snd_pcm_t *pcm);
+snd_pcm_sw_params_t* pa_alsa_save_sw_params(snd_pcm_t *pcm);
+
+int pa_alsa_restore_hw_params(snd_pcm_t *pcm, const snd_pcm_hw_params_t *saved);
+int pa_alsa_restore_sw_params(snd_pcm_t *pcm, const snd_pcm_sw_params_t *saved);
+
 /* Picks a working mapping from the profile set based on the specified ss/map */
 snd_pcm_t *pa_alsa_open_by_device_id_auto(
         const char *dev_id,
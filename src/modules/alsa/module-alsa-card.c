@@ -23,10 +23,18 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+#include <errno.h>
+#include <sys/utsname.h>
+
 #include <pulse/xmalloc.h>
 #include <pulse/i18n.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/database.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/queue.h>
 
@@ -63,7 +71,8 @@ PA_MODULE_USAGE(
         "tsched_buffer_size=<buffer size when using timer based scheduling> "
         "tsched_buffer_watermark=<lower fill watermark> "
         "profile=<profile name> "
-        "ignore_dB=<ignore dB information from the device?>");
+        "ignore_dB=<ignore dB information from the device?> "
+        "probe_cache=<reuse profile probe results from earlier starts?>");
 
 static const char* const valid_modargs[] = {
     "name",
@@ -84,6 +93,7 @@ static const char* const valid_modargs[] = {
     "tsched_buffer_watermark",
     "profile",
     "ignore_dB",
+    "probe_cache",
     NULL
 };
 
@@ -278,6 +288,153 @@ static void set_card_name(pa_card_new_data *data, pa_modargs *ma, const char *de
     pa_xfree(t);
 }
 
+/* Identifies the card itself, independently of its index */
+static char *probe_cache_key(int alsa_card_index) {
+    char *driver, *longname, *k = NULL;
+
+    if (!(driver = pa_alsa_get_driver_name(alsa_card_index)))
+        return NULL;
+
+    if (snd_card_get_longname(alsa_card_index, &longname) >= 0) {
+        k = pa_sprintf_malloc("%s:%s", driver, longname);
+        free(longname);
+    }
+
+    pa_xfree(driver);
+    return k;
+}
+
+/* Everything else the outcome of a probe depends on: the profile set
+ * configuration, the software that interprets it, the kernel driver
+ * and the format we probe with */
+static char *probe_cache_fingerprint(struct userdata *u) {
+    char ss[PA_SAMPLE_SPEC_SNPRINT_MAX], cm[PA_CHANNEL_MAP_SNPRINT_MAX];
+    struct utsname un;
+
+    if (uname(&un) < 0)
+        return NULL;
+
+    return pa_sprintf_malloc("%s|%s|%s|%s|%s|%s|%u|%u",
+                             u->profile_set->fingerprint,
+                             PACKAGE_VERSION,
+                             snd_asoundlib_version(),
+                             un.release,
+                             pa_sample_spec_snprint(ss, sizeof(ss), &u->core->default_sample_spec),
+                             pa_channel_map_snprint(cm, sizeof(cm), &u->core->default_channel_map),
+                             u->core->default_n_fragments,
+                             u->core->default_fragment_size_msec);
+}
+
+/* Only positive results are cached: a profile that failed might just
+ * have been busy. Returns how many profiles were taken from the cache,
+ * or -1. The cached list is returned in *profiles. */
+static int probe_from_cache(struct userdata *u, pa_database *database, const char *k, const char *fingerprint, char **profiles) {
+    pa_datum key, data;
+    char *v, *e;
+    int r = -1;
+
+    key.data = (char*) k;
+    key.size = strlen(k);
+
+    if (!pa_database_get(database, &key, &data))
+        return -1;
+
+    v = pa_xstrndup(data.data, data.size);
+    pa_datum_free(&data);
+
+    if (!(e = strchr(v, '\n')) ||
+        (size_t) (e - v) != strlen(fingerprint) ||
+        strncmp(v, fingerprint, (size_t) (e - v))) {
+        pa_log_debug("Cached probe results for card %s are out of date.", u->device_id);
+        goto finish;
+    }
+
+    if ((r = pa_alsa_profile_set_probe_from_string(u->profile_set, e + 1)) < 0) {
+        pa_log_debug("Cached probe results for card %s refer to unknown profiles.", u->device_id);
+        goto finish;
+    }
+
+    *profiles = pa_xstrdup(e + 1);
+
+finish:
+    pa_xfree(v);
+    return r;
+}
+
+static void probe_to_cache(struct userdata *u, pa_database *database, const char *k, const char *fingerprint, const char *old_profiles) {
+    pa_datum key, data;
+    char *profiles, *v;
+
+    profiles = pa_alsa_profile_set_probe_to_string(u->profile_set);
+
+    /* Nothing new was found, so spare us the write */
+    if (old_profiles && pa_streq(profiles, old_profiles)) {
+        pa_xfree(profiles);
+        return;
+    }
+
+    v = pa_sprintf_malloc("%s\n%s", fingerprint, profiles);
+    pa_xfree(profiles);
+
+    key.data = (char*) k;
+    key.size = strlen(k);
+
+    data.data = v;
+    data.size = strlen(v);
+
+    if (pa_database_set(database, &key, &data, TRUE) < 0 ||
+        pa_database_sync(database) < 0)
+        pa_log_warn("Failed to store probe results for card %s.", u->device_id);
+
+    pa_xfree(v);
+}
+
+static void probe_profile_set(struct userdata *u, int alsa_card_index, pa_bool_t use_cache) {
+    pa_database *database = NULL;
+    char *k = NULL, *fingerprint = NULL, *cached_profiles = NULL;
+    int cached = -1;
+    pa_usec_t begin;
+
+    begin = pa_rtclock_now();
+
+    if (use_cache) {
+        char *fname;
+
+        if ((fname = pa_state_path("alsa-probe", TRUE))) {
+            if (!(database = pa_database_open(fname, TRUE)))
+                pa_log_warn("Failed to open probe cache '%s': %s", fname, pa_cstrerror(errno));
+
+            pa_xfree(fname);
+        }
+    }
+
+    if (database) {
+        k = probe_cache_key(alsa_card_index);
+        fingerprint = probe_cache_fingerprint(u);
+
+        if (k && fingerprint)
+            cached = probe_from_cache(u, database, k, fingerprint, &cached_profiles);
+    }
+
+    /* Whatever did not come from the cache is probed for real */
+    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &u->core->default_sample_spec, u->core->default_n_fragments, u->core->default_fragment_size_msec);
+
+    if (database && k && fingerprint)
+        probe_to_cache(u, database, k, fingerprint, cached_profiles);
+
+    pa_log_info("Probed profiles of card %s in %0.1f ms, %i of them taken from the cache.",
+                u->device_id,
+                (double) (pa_rtclock_now() - begin) / PA_USEC_PER_MSEC,
+                PA_MAX(cached, 0));
+
+    if (database)
+        pa_database_close(database);
+
+    pa_xfree(k);
+    pa_xfree(fingerprint);
+    pa_xfree(cached_profiles);
+}
+
 int pa__init(pa_module *m) {
     pa_card_new_data data;
     pa_modargs *ma;
@@ -286,6 +443,7 @@ int pa__init(pa_module *m) {
     pa_reserve_wrapper *reserve = NULL;
     const char *description;
     char *fn = NULL;
+    pa_bool_t use_cache;
 
     pa_alsa_refcnt_inc();
 
@@ -329,7 +487,13 @@ int pa__init(pa_module *m) {
     if (!u->profile_set)
         goto fail;
 
-    pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
+    use_cache = TRUE;
+    if (pa_modargs_get_value_boolean(ma, "probe_cache", &use_cache) < 0) {
+        pa_log("Failed to parse probe_cache argument.");
+        goto fail;
+    }
+
+    probe_profile_set(u, alsa_card_index, use_cache);
 
     pa_card_new_data_init(&data);
     data.driver = __FILE__;
@@ -47,6 +47,8 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/broadcast-ring.h>
+#include <pulsecore/rate-control.h>
 
 #include "module-combine-symdef.h"
 
@@ -73,6 +75,11 @@ PA_MODULE_USAGE(
 
 #define BLOCK_USEC (PA_USEC_PER_MSEC * 200)
 
+/* How often the outputs update their rates, and by how much they may
+ * deviate from ours */
+#define RATE_CONTROL_INTERVAL_USEC (250*PA_USEC_PER_MSEC)
+#define MAX_RATE_DEVIATION 0.01
+
 static const char* const valid_modargs[] = {
     "sink_name",
     "sink_properties",
@@ -93,16 +100,24 @@ struct output {
     pa_sink_input *sink_input;
     pa_bool_t ignore_state_change;
 
-    pa_asyncmsgq *inq,    /* Message queue from the sink thread to this sink input */
-                 *outq;   /* Message queue from this sink input to the sink thread */
-    pa_rtpoll_item *inq_rtpoll_item_read, *inq_rtpoll_item_write;
+    pa_asyncmsgq *outq;   /* Message queue from this sink input to the sink thread */
     pa_rtpoll_item *outq_rtpoll_item_read, *outq_rtpoll_item_write;
 
+    /* Our read cursor in the ring the sink thread renders into */
+    pa_broadcast_ring_reader *reader;
+
     pa_memblockq *memblockq;
 
     /* For communication of the stream latencies to the main thread */
     pa_usec_t total_latency;
 
+    /* For communication of the latency to aim for to the sink
+     * thread, 0 if unknown */
+    pa_atomic_t target_latency;
+
+    /* Managed in the sink thread */
+    pa_rate_control *rate_control;
+
     /* For coomunication of the stream parameters to the sink thread */
     pa_atomic_t max_request;
     pa_atomic_t requested_latency;
@@ -133,6 +148,10 @@ struct userdata {
 
     pa_idxset* outputs; /* managed in main context */
 
+    /* Set while a request for more data from one of the outputs is
+     * on its way to the sink thread */
+    pa_atomic_t need_posted;
+
     struct {
         PA_LLIST_HEAD(struct output, active_outputs); /* managed in IO thread context */
         pa_atomic_t running;  /* we cache that value here, so that every thread can query it cheaply */
@@ -140,6 +159,7 @@ struct userdata {
         pa_bool_t in_null_mode;
         pa_smoother *smoother;
         uint64_t counter;
+        pa_broadcast_ring *ring;
     } thread_info;
 };
 
@@ -152,10 +172,6 @@ enum {
     SINK_MESSAGE_UPDATE_REQUESTED_LATENCY
 };
 
-enum {
-    SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
-};
-
 static void output_disable(struct output *o);
 static void output_enable(struct output *o);
 static void output_free(struct output *o);
@@ -164,7 +180,6 @@ static int output_create_sink_input(struct output *o);
 static void adjust_rates(struct userdata *u) {
     struct output *o;
     pa_usec_t max_sink_latency = 0, min_total_latency = (pa_usec_t) -1, target_latency, avg_total_latency = 0;
-    uint32_t base_rate;
     uint32_t idx;
     unsigned n = 0;
 
@@ -211,26 +226,14 @@ static void adjust_rates(struct userdata *u) {
     pa_log_info("[%s] avg total latency is %0.2f msec.", u->sink->name, (double) avg_total_latency / PA_USEC_PER_MSEC);
     pa_log_info("[%s] target latency is %0.2f msec.", u->sink->name, (double) target_latency / PA_USEC_PER_MSEC);
 
-    base_rate = u->sink->sample_spec.rate;
-
+    /* The rates themselves are adjusted by each output's sink thread,
+     * we just tell it where to go */
     PA_IDXSET_FOREACH(o, u->outputs, idx) {
-        uint32_t r = base_rate;
 
         if (!o->sink_input || !PA_SINK_IS_OPENED(pa_sink_get_state(o->sink)))
             continue;
 
-        if (o->total_latency < target_latency)
-            r -= (uint32_t) ((((double) (target_latency - o->total_latency))/(double)u->adjust_time)*(double)r);
-        else if (o->total_latency > target_latency)
-            r += (uint32_t) ((((double) (o->total_latency - target_latency))/(double)u->adjust_time)*(double)r);
-
-        if (r < (uint32_t) (base_rate*0.9) || r > (uint32_t) (base_rate*1.1)) {
-            pa_log_warn("[%s] sample rates too different, not adjusting (%u vs. %u).", o->sink_input->sink->name, base_rate, r);
-            pa_sink_input_set_rate(o->sink_input, base_rate);
-        } else {
-            pa_log_info("[%s] new rate is %u Hz; ratio is %0.3f; latency is %0.0f usec.", o->sink_input->sink->name, r, (double) r / base_rate, (float) o->total_latency);
-            pa_sink_input_set_rate(o->sink_input, r);
-        }
+        pa_atomic_store(&o->target_latency, (int) target_latency);
     }
 
     pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_UPDATE_LATENCY, NULL, (int64_t) avg_total_latency, NULL);
@@ -337,26 +340,29 @@ finish:
 }
 
 /* Called from I/O thread context */
-static void render_memblock(struct userdata *u, struct output *o, size_t length) {
+static void render_ahead(struct userdata *u, size_t length) {
+    size_t target;
+
     pa_assert(u);
-    pa_assert(o);
 
-    /* We are run by the sink thread, on behalf of an output (o). The
-     * output is waiting for us, hence it is safe to access its
-     * mainblockq and asyncmsgq directly. */
+    /* We render into a ring that is shared by all outputs, each of
+     * which reads from it at its own pace from its own thread. Hence
+     * N outputs cost us a single push per block and no output ever
+     * has to wait for us or another output. */
+
+    pa_atomic_store(&u->need_posted, 0);
 
     /* If we are not running, we cannot produce any data */
     if (!pa_atomic_load(&u->thread_info.running))
         return;
 
-    /* Maybe there's some data in the requesting output's queue
-     * now? */
-    while (pa_asyncmsgq_process_one(o->inq) > 0)
-        ;
+    if (length <= 0)
+        length = u->sink->thread_info.max_request;
+
+    target = length * PA_BROADCAST_RING_COMBINE_RENDER_AHEAD;
 
-    /* Ok, now let's prepare some data if we really have to */
-    while (!pa_memblockq_is_readable(o->memblockq)) {
-        struct output *j;
+    while (!pa_broadcast_ring_is_full(u->thread_info.ring) &&
+           pa_broadcast_ring_get_length(u->thread_info.ring) < target) {
         pa_memchunk chunk;
 
         /* Render data! */
@@ -364,39 +370,59 @@ static void render_memblock(struct userdata *u, struct output *o, size_t length)
 
         u->thread_info.counter += chunk.length;
 
-        /* OK, let's send this data to the other threads */
-        PA_LLIST_FOREACH(j, u->thread_info.active_outputs) {
-            if (j == o)
-                continue;
-
-            pa_asyncmsgq_post(j->inq, PA_MSGOBJECT(j->sink_input), SINK_INPUT_MESSAGE_POST, NULL, 0, &chunk, NULL);
-        }
-
-        /* And place it directly into the requesting output's queue */
-        pa_memblockq_push_align(o->memblockq, &chunk);
+        pa_broadcast_ring_push(u->thread_info.ring, &chunk);
         pa_memblock_unref(chunk.memblock);
     }
 }
 
 /* Called from I/O thread context */
 static void request_memblock(struct output *o, size_t length) {
+    struct userdata *u;
+    pa_memchunk chunk;
+
     pa_assert(o);
     pa_sink_input_assert_ref(o->sink_input);
-    pa_sink_assert_ref(o->userdata->sink);
+    pa_assert_se(u = o->userdata);
+    pa_sink_assert_ref(u->sink);
 
-    /* If another thread already prepared some data we received
-     * the data over the asyncmsgq, hence let's first process
-     * it. */
-    while (pa_asyncmsgq_process_one(o->inq) > 0)
-        ;
+    /* Take what the sink thread already rendered for us */
+    while (pa_memblockq_get_length(o->memblockq) < length &&
+           pa_broadcast_ring_reader_pop(o->reader, &chunk) >= 0) {
 
-    /* Check whether we're now readable */
-    if (pa_memblockq_is_readable(o->memblockq))
+        pa_memblockq_push_align(o->memblockq, &chunk);
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    /* If the ring is running low ask the sink thread to render more,
+     * but don't wait for it. There's only a single such request in
+     * flight for all outputs. */
+    if (pa_broadcast_ring_reader_get_length(o->reader) < length &&
+        pa_atomic_load(&u->thread_info.running) &&
+        pa_atomic_cmpxchg(&u->need_posted, 0, 1))
+        pa_asyncmsgq_post(o->outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_NEED, NULL, (int64_t) length, NULL, NULL);
+}
+
+/* Called from I/O thread context */
+static void update_rate(struct output *o) {
+    pa_usec_t target, latency;
+    size_t length;
+    double rate;
+
+    pa_assert(o);
+
+    if ((target = (pa_usec_t) pa_atomic_load(&o->target_latency)) <= 0)
         return;
 
-    /* OK, we need to prepare new data, but only if the sink is actually running */
-    if (pa_atomic_load(&o->userdata->thread_info.running))
-        pa_asyncmsgq_send(o->outq, PA_MSGOBJECT(o->userdata->sink), SINK_MESSAGE_NEED, o, (int64_t) length, NULL);
+    /* The same as what the main thread measures in adjust_rates(),
+     * but without the round trip */
+    length = pa_memblockq_get_length(o->memblockq) + pa_broadcast_ring_reader_get_length(o->reader);
+    latency =
+        pa_bytes_to_usec(length, &o->sink_input->sample_spec) +
+        pa_bytes_to_usec(pa_memblockq_get_length(o->sink_input->thread_info.render_memblockq), &o->sink->sample_spec) +
+        pa_sink_get_latency_within_thread(o->sink);
+
+    if (pa_rate_control_update(o->rate_control, pa_rtclock_now(), latency, target, &rate))
+        pa_sink_input_set_rate_within_thread(o->sink_input, rate);
 }
 
 /* Called from I/O thread context */
@@ -409,6 +435,8 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     /* If necessary, get some new data */
     request_memblock(o, nbytes);
 
+    update_rate(o);
+
     /* pa_log("%s q size is %u + %u (%u/%u)", */
     /*        i->sink->name, */
     /*        pa_memblockq_get_nblocks(o->memblockq), */
@@ -488,13 +516,8 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    /* Set up the queue from the sink thread to us */
-    pa_assert(!o->inq_rtpoll_item_read && !o->outq_rtpoll_item_write);
-
-    o->inq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
-            i->sink->thread_info.rtpoll,
-            PA_RTPOLL_LATE,  /* This one is not that important, since we check for data in _peek() anyway. */
-            o->inq);
+    /* Set up the queue from us to the sink thread */
+    pa_assert(!o->outq_rtpoll_item_write);
 
     o->outq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
             i->sink->thread_info.rtpoll,
@@ -503,6 +526,9 @@ static void sink_input_attach_cb(pa_sink_input *i) {
 
     pa_sink_input_request_rewind(i, 0, FALSE, TRUE, TRUE);
 
+    /* Our new sink has a clock of its own */
+    pa_rate_control_reset(o->rate_control);
+
     pa_atomic_store(&o->max_request, (int) pa_sink_input_get_max_request(i));
 
     c = pa_sink_get_requested_latency_within_thread(i->sink);
@@ -519,11 +545,6 @@ static void sink_input_detach_cb(pa_sink_input *i) {
     pa_sink_input_assert_ref(i);
     pa_assert_se(o = i->userdata);
 
-    if (o->inq_rtpoll_item_read) {
-        pa_rtpoll_item_free(o->inq_rtpoll_item_read);
-        o->inq_rtpoll_item_read = NULL;
-    }
-
     if (o->outq_rtpoll_item_write) {
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
         o->outq_rtpoll_item_write = NULL;
@@ -550,21 +571,12 @@ static int sink_input_process_msg(pa_msgobject *obj, int code, void *data, int64
         case PA_SINK_INPUT_MESSAGE_GET_LATENCY: {
              pa_usec_t *r = data;
 
-            *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq), &o->sink_input->sample_spec);
+            *r = pa_bytes_to_usec(pa_memblockq_get_length(o->memblockq) + pa_broadcast_ring_reader_get_length(o->reader), &o->sink_input->sample_spec);
 
             /* Fall through, the default handler will add in the extra
              * latency added by the resampler */
             break;
         }
-
-        case SINK_INPUT_MESSAGE_POST:
-
-            if (PA_SINK_IS_OPENED(o->sink_input->sink->thread_info.state))
-                pa_memblockq_push_align(o->memblockq, chunk);
-            else
-                pa_memblockq_flush_write(o->memblockq, TRUE);
-
-            return 0;
     }
 
     return pa_sink_input_process_msg(obj, code, data, offset, chunk);
@@ -687,16 +699,14 @@ static void output_add_within_thread(struct output *o) {
 
     PA_LLIST_PREPEND(struct output, o->userdata->thread_info.active_outputs, o);
 
-    pa_assert(!o->outq_rtpoll_item_read && !o->inq_rtpoll_item_write);
+    pa_assert(!o->outq_rtpoll_item_read && !o->reader);
 
     o->outq_rtpoll_item_read = pa_rtpoll_item_new_asyncmsgq_read(
             o->userdata->rtpoll,
             PA_RTPOLL_EARLY-1,  /* This item is very important */
             o->outq);
-    o->inq_rtpoll_item_write = pa_rtpoll_item_new_asyncmsgq_write(
-            o->userdata->rtpoll,
-            PA_RTPOLL_EARLY,
-            o->inq);
+
+    o->reader = pa_broadcast_ring_reader_new(o->userdata->thread_info.ring);
 }
 
 /* Called from thread context of the io thread */
@@ -711,9 +721,9 @@ static void output_remove_within_thread(struct output *o) {
         o->outq_rtpoll_item_read = NULL;
     }
 
-    if (o->inq_rtpoll_item_write) {
-        pa_rtpoll_item_free(o->inq_rtpoll_item_write);
-        o->inq_rtpoll_item_write = NULL;
+    if (o->reader) {
+        pa_broadcast_ring_reader_free(o->reader);
+        o->reader = NULL;
     }
 }
 
@@ -762,7 +772,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
             return 0;
 
         case SINK_MESSAGE_NEED:
-            render_memblock(u, (struct output*) data, (size_t) offset);
+            render_ahead(u, (size_t) offset);
             return 0;
 
         case SINK_MESSAGE_UPDATE_LATENCY: {
@@ -879,7 +889,6 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
 
     o = pa_xnew0(struct output, 1);
     o->userdata = u;
-    o->inq = pa_asyncmsgq_new(0);
     o->outq = pa_asyncmsgq_new(0);
     o->sink = sink;
     o->memblockq = pa_memblockq_new(
@@ -891,6 +900,7 @@ static struct output *output_new(struct userdata *u, pa_sink *sink) {
             0,
             0,
             &u->sink->silence);
+    o->rate_control = pa_rate_control_new(u->sink->sample_spec.rate, RATE_CONTROL_INTERVAL_USEC, MAX_RATE_DEVIATION);
 
     pa_assert_se(pa_idxset_put(u->outputs, o, NULL) == 0);
     update_description(u);
@@ -907,25 +917,20 @@ static void output_free(struct output *o) {
     pa_assert_se(pa_idxset_remove_by_data(o->userdata->outputs, o, NULL));
     update_description(o->userdata);
 
-    if (o->inq_rtpoll_item_read)
-        pa_rtpoll_item_free(o->inq_rtpoll_item_read);
-    if (o->inq_rtpoll_item_write)
-        pa_rtpoll_item_free(o->inq_rtpoll_item_write);
-
     if (o->outq_rtpoll_item_read)
         pa_rtpoll_item_free(o->outq_rtpoll_item_read);
     if (o->outq_rtpoll_item_write)
         pa_rtpoll_item_free(o->outq_rtpoll_item_write);
 
-    if (o->inq)
-        pa_asyncmsgq_unref(o->inq);
-
     if (o->outq)
         pa_asyncmsgq_unref(o->outq);
 
     if (o->memblockq)
         pa_memblockq_free(o->memblockq);
 
+    if (o->rate_control)
+        pa_rate_control_free(o->rate_control);
+
     pa_xfree(o);
 }
 
@@ -983,7 +988,6 @@ static void output_disable(struct output *o) {
 
     /* Finally, drop all queued data */
     pa_memblockq_flush_write(o->memblockq, TRUE);
-    pa_asyncmsgq_flush(o->inq, FALSE);
     pa_asyncmsgq_flush(o->outq, FALSE);
 }
 
@@ -1128,6 +1132,8 @@ int pa__init(pa_module*m) {
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->resample_method = resample_method;
     u->outputs = pa_idxset_new(NULL, NULL);
+    pa_atomic_store(&u->need_posted, 0);
+    u->thread_info.ring = pa_broadcast_ring_new(PA_BROADCAST_RING_COMBINE_SLOTS);
     u->thread_info.smoother = pa_smoother_new(
             PA_USEC_PER_SEC,
             PA_USEC_PER_SEC*2,
@@ -1379,5 +1385,8 @@ void pa__done(pa_module*m) {
     if (u->thread_info.smoother)
         pa_smoother_free(u->thread_info.smoother);
 
+    if (u->thread_info.ring)
+        pa_broadcast_ring_free(u->thread_info.ring);
+
     pa_xfree(u);
 }
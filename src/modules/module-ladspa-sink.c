@@ -41,6 +41,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/strbuf.h>
 
 #include "module-ladspa-sink-symdef.h"
 #include "ladspa.h"
@@ -57,29 +58,50 @@ PA_MODULE_USAGE(
           "rate=<sample rate> "
           "channels=<number of channels> "
           "channel_map=<channel map> "
-          "plugin=<ladspa plugin name> "
-          "label=<ladspa plugin label> "
-          "control=<comma seperated list of input control values>"));
+          "plugin=<ladspa plugin name, or a | separated list of names for a chain> "
+          "label=<ladspa plugin label, or a | separated list of labels> "
+          "control=<comma seperated list of input control values, | separated for each plugin>"));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
-struct userdata {
-    pa_module *module;
+#define MAX_PLUGINS 16
 
-    pa_sink *sink;
-    pa_sink_input *sink_input;
+struct plugin {
+    lt_dlhandle dl;
 
     const LADSPA_Descriptor *descriptor;
-    unsigned channels;
     LADSPA_Handle handle[PA_CHANNELS_MAX];
-    LADSPA_Data *input, *output;
-    size_t block_size;
     unsigned long input_port, output_port;
     LADSPA_Data *control;
 
     /* This is a dummy buffer. Every port must be connected, but we don't care
        about control out ports. We connect them all to this single buffer. */
     LADSPA_Data control_out;
+};
+
+struct userdata {
+    pa_module *module;
+
+    pa_sink *sink;
+    pa_sink_input *sink_input;
+
+    struct plugin plugins[MAX_PLUGINS];
+    unsigned n_plugins;
+    unsigned channels;
+
+    /* Two sets of planar buffers, one plane of block_frames samples
+     * per channel. They are allocated once and shared by all plugins
+     * of the chain: plugins that can work in place read and write the
+     * same set, the others write to the other set. The input always
+     * goes to set 0, the output is taken from output_set. */
+    LADSPA_Data *buffer[2];
+    unsigned output_set;
+    size_t block_size;
+    unsigned block_frames;
+
+    /* The block we returned from the last pop, reused once nobody
+     * else holds a reference to it anymore */
+    pa_memblock *out_block;
 
     pa_memblockq *memblockq;
 
@@ -206,12 +228,65 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+static LADSPA_Data *plane(struct userdata *u, unsigned set, unsigned c) {
+    return u->buffer[set] + c * u->block_frames;
+}
+
+/* Splits n interleaved frames into one plane per channel. Written as
+ * simple loops over contiguous memory, so that the compiler can
+ * vectorize them. */
+static void deinterleave(struct userdata *u, const float *src, unsigned n) {
+    unsigned c, k;
+
+    if (u->channels == 2) {
+        LADSPA_Data *l = plane(u, 0, 0), *r = plane(u, 0, 1);
+
+        for (k = 0; k < n; k++) {
+            l[k] = PA_CLAMP_UNLIKELY(src[2*k], -1.0f, 1.0f);
+            r[k] = PA_CLAMP_UNLIKELY(src[2*k+1], -1.0f, 1.0f);
+        }
+
+        return;
+    }
+
+    for (c = 0; c < u->channels; c++) {
+        LADSPA_Data *d = plane(u, 0, c);
+        const float *s = src + c;
+
+        for (k = 0; k < n; k++, s += u->channels)
+            d[k] = PA_CLAMP_UNLIKELY(*s, -1.0f, 1.0f);
+    }
+}
+
+static void interleave(struct userdata *u, float *dst, unsigned n) {
+    unsigned c, k;
+
+    if (u->channels == 2) {
+        const LADSPA_Data *l = plane(u, u->output_set, 0), *r = plane(u, u->output_set, 1);
+
+        for (k = 0; k < n; k++) {
+            dst[2*k] = PA_CLAMP_UNLIKELY(l[k], -1.0f, 1.0f);
+            dst[2*k+1] = PA_CLAMP_UNLIKELY(r[k], -1.0f, 1.0f);
+        }
+
+        return;
+    }
+
+    for (c = 0; c < u->channels; c++) {
+        const LADSPA_Data *s = plane(u, u->output_set, c);
+        float *d = dst + c;
+
+        for (k = 0; k < n; k++, d += u->channels)
+            *d = PA_CLAMP_UNLIKELY(s[k], -1.0f, 1.0f);
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, c;
+    unsigned n, c, p;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -237,22 +312,32 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
     pa_assert(n > 0);
 
+    /* Unless the sink input still holds on to what we returned last
+     * time, we can simply overwrite it */
+    if (u->out_block && !pa_memblock_ref_is_one(u->out_block)) {
+        pa_memblock_unref(u->out_block);
+        u->out_block = NULL;
+    }
+
+    if (!u->out_block)
+        u->out_block = pa_memblock_new(i->sink->core->mempool, u->block_size);
+
     chunk->index = 0;
     chunk->length = n*fs;
-    chunk->memblock = pa_memblock_new(i->sink->core->mempool, chunk->length);
+    chunk->memblock = pa_memblock_ref(u->out_block);
 
     pa_memblockq_drop(u->memblockq, chunk->length);
 
     src = (float*) ((uint8_t*) pa_memblock_acquire(tchunk.memblock) + tchunk.index);
-    dst = (float*) pa_memblock_acquire(chunk->memblock);
+    deinterleave(u, src, n);
+    pa_memblock_release(tchunk.memblock);
 
-    for (c = 0; c < u->channels; c++) {
-        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input, sizeof(float), src+c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[c], n);
-        pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst+c, u->channels*sizeof(float), u->output, sizeof(float), n);
-    }
+    for (p = 0; p < u->n_plugins; p++)
+        for (c = 0; c < u->channels; c++)
+            u->plugins[p].descriptor->run(u->plugins[p].handle[c], n);
 
-    pa_memblock_release(tchunk.memblock);
+    dst = (float*) pa_memblock_acquire(chunk->memblock);
+    interleave(u, dst, n);
     pa_memblock_release(chunk->memblock);
 
     pa_memblock_unref(tchunk.memblock);
@@ -276,19 +361,23 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
+            unsigned c, p;
 
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
-            pa_log_debug("Resetting plugin");
+            pa_log_debug("Resetting plugins");
 
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < u->channels; c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < u->channels; c++)
-                    u->descriptor->activate(u->handle[c]);
+            /* Reset the plugins */
+            for (p = 0; p < u->n_plugins; p++) {
+                const LADSPA_Descriptor *d = u->plugins[p].descriptor;
+
+                if (d->deactivate)
+                    for (c = 0; c < u->channels; c++)
+                        d->deactivate(u->plugins[p].handle[c]);
+                if (d->activate)
+                    for (c = 0; c < u->channels; c++)
+                        d->activate(u->plugins[p].handle[c]);
+            }
         }
     }
 
@@ -460,65 +549,15 @@ static void sink_input_mute_changed_cb(pa_sink_input *i) {
     pa_sink_mute_changed(u->sink, i->muted);
 }
 
-int pa__init(pa_module*m) {
-    struct userdata *u;
-    pa_sample_spec ss;
-    pa_channel_map map;
-    pa_modargs *ma;
+/* Called from main context */
+static int plugin_load(struct userdata *u, struct plugin *pl, const char *plugin, const char *label, const char *cdata, const pa_sample_spec *ss) {
     char *t;
-    pa_sink *master;
-    pa_sink_input_new_data sink_input_data;
-    pa_sink_new_data sink_data;
-    const char *plugin, *label;
     LADSPA_Descriptor_Function descriptor_func;
-    const char *e, *cdata;
+    const char *e;
     const LADSPA_Descriptor *d;
     unsigned long input_port, output_port, p, j, n_control;
-    unsigned c;
+    unsigned c, in_set, out_set;
     pa_bool_t *use_default = NULL;
-    pa_memchunk silence;
-
-    pa_assert(m);
-
-    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
-
-    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
-        pa_log("Failed to parse module arguments.");
-        goto fail;
-    }
-
-    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
-        pa_log("Master sink not found");
-        goto fail;
-    }
-
-    ss = master->sample_spec;
-    ss.format = PA_SAMPLE_FLOAT32;
-    map = master->channel_map;
-    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
-        pa_log("Invalid sample format specification or channel map");
-        goto fail;
-    }
-
-    if (!(plugin = pa_modargs_get_value(ma, "plugin", NULL))) {
-        pa_log("Missing LADSPA plugin name");
-        goto fail;
-    }
-
-    if (!(label = pa_modargs_get_value(ma, "label", NULL))) {
-        pa_log("Missing LADSPA plugin label");
-        goto fail;
-    }
-
-    cdata = pa_modargs_get_value(ma, "control", NULL);
-
-    u = pa_xnew0(struct userdata, 1);
-    u->module = m;
-    m->userdata = u;
-
-    pa_silence_memchunk_get(&m->core->silence_cache, m->core->mempool, &silence, &ss, 0);
-    u->memblockq = pa_memblockq_new(0, MEMBLOCKQ_MAXLENGTH, 0, pa_frame_size(&ss), 1, 1, 0, &silence);
-    pa_memblock_unref(silence.memblock);
 
     if (!(e = getenv("LADSPA_PATH")))
         e = LADSPA_PATH;
@@ -526,16 +565,16 @@ int pa__init(pa_module*m) {
     /* FIXME: This is not exactly thread safe */
     t = pa_xstrdup(lt_dlgetsearchpath());
     lt_dlsetsearchpath(e);
-    m->dl = lt_dlopenext(plugin);
+    pl->dl = lt_dlopenext(plugin);
     lt_dlsetsearchpath(t);
     pa_xfree(t);
 
-    if (!m->dl) {
+    if (!pl->dl) {
         pa_log("Failed to load LADSPA plugin: %s", lt_dlerror());
         goto fail;
     }
 
-    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(m->dl, NULL, "ladspa_descriptor"))) {
+    if (!(descriptor_func = (LADSPA_Descriptor_Function) pa_load_sym(pl->dl, NULL, "ladspa_descriptor"))) {
         pa_log("LADSPA module lacks ladspa_descriptor() symbol.");
         goto fail;
     }
@@ -551,7 +590,7 @@ int pa__init(pa_module*m) {
             break;
     }
 
-    u->descriptor = d;
+    pl->descriptor = d;
 
     pa_log_debug("Module: %s", plugin);
     pa_log_debug("Label: %s", d->Label);
@@ -600,26 +639,29 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
-    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+    pl->input_port = input_port;
+    pl->output_port = output_port;
 
-    u->input = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    if (LADSPA_IS_INPLACE_BROKEN(d->Properties))
-        u->output = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-    else
-        u->output = u->input;
+    /* Plugins that can't work in place write to the other set of
+     * buffers, the next plugin then reads from there */
+    in_set = u->output_set;
+    out_set = LADSPA_IS_INPLACE_BROKEN(d->Properties) ? !in_set : in_set;
 
-    u->channels = ss.channels;
+    if (!u->buffer[out_set])
+        u->buffer[out_set] = pa_xnew(LADSPA_Data, u->block_frames * u->channels);
 
-    for (c = 0; c < ss.channels; c++) {
-        if (!(u->handle[c] = d->instantiate(d, ss.rate))) {
+    for (c = 0; c < u->channels; c++) {
+        if (!(pl->handle[c] = d->instantiate(d, ss->rate))) {
             pa_log("Failed to instantiate plugin %s with label %s for channel %i", plugin, d->Label, c);
             goto fail;
         }
 
-        d->connect_port(u->handle[c], input_port, u->input);
-        d->connect_port(u->handle[c], output_port, u->output);
+        d->connect_port(pl->handle[c], input_port, plane(u, in_set, c));
+        d->connect_port(pl->handle[c], output_port, plane(u, out_set, c));
     }
 
+    u->output_set = out_set;
+
     if (!cdata && n_control > 0) {
         pa_log("This plugin requires specification of %lu control parameters.", n_control);
         goto fail;
@@ -630,7 +672,7 @@ int pa__init(pa_module*m) {
         char *k;
         unsigned long h;
 
-        u->control = pa_xnew(LADSPA_Data, (unsigned) n_control);
+        pl->control = pa_xnew(LADSPA_Data, (unsigned) n_control);
         use_default = pa_xnew(pa_bool_t, (unsigned) n_control);
         p = 0;
 
@@ -652,7 +694,7 @@ int pa__init(pa_module*m) {
             pa_xfree(k);
 
             use_default[p] = FALSE;
-            u->control[p++] = (LADSPA_Data) f;
+            pl->control[p++] = (LADSPA_Data) f;
         }
 
         /* The previous loop doesn't take the last control value into account
@@ -682,8 +724,8 @@ int pa__init(pa_module*m) {
                 continue;
 
             if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
-                for (c = 0; c < ss.channels; c++)
-                    d->connect_port(u->handle[c], p, &u->control_out);
+                for (c = 0; c < u->channels; c++)
+                    d->connect_port(pl->handle[c], p, &pl->control_out);
                 continue;
             }
 
@@ -701,55 +743,55 @@ int pa__init(pa_module*m) {
                 upper = d->PortRangeHints[p].UpperBound;
 
                 if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
-                    lower *= (LADSPA_Data) ss.rate;
-                    upper *= (LADSPA_Data) ss.rate;
+                    lower *= (LADSPA_Data) ss->rate;
+                    upper *= (LADSPA_Data) ss->rate;
                 }
 
                 switch (hint & LADSPA_HINT_DEFAULT_MASK) {
 
                     case LADSPA_HINT_DEFAULT_MINIMUM:
-                        u->control[h] = lower;
+                        pl->control[h] = lower;
                         break;
 
                     case LADSPA_HINT_DEFAULT_MAXIMUM:
-                        u->control[h] = upper;
+                        pl->control[h] = upper;
                         break;
 
                     case LADSPA_HINT_DEFAULT_LOW:
                         if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                            u->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
+                            pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.75 + log(upper) * 0.25);
                         else
-                            u->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
+                            pl->control[h] = (LADSPA_Data) (lower * 0.75 + upper * 0.25);
                         break;
 
                     case LADSPA_HINT_DEFAULT_MIDDLE:
                         if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                            u->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
+                            pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.5 + log(upper) * 0.5);
                         else
-                            u->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
+                            pl->control[h] = (LADSPA_Data) (lower * 0.5 + upper * 0.5);
                         break;
 
                     case LADSPA_HINT_DEFAULT_HIGH:
                         if (LADSPA_IS_HINT_LOGARITHMIC(hint))
-                            u->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
+                            pl->control[h] = (LADSPA_Data) exp(log(lower) * 0.25 + log(upper) * 0.75);
                         else
-                            u->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
+                            pl->control[h] = (LADSPA_Data) (lower * 0.25 + upper * 0.75);
                         break;
 
                     case LADSPA_HINT_DEFAULT_0:
-                        u->control[h] = 0;
+                        pl->control[h] = 0;
                         break;
 
                     case LADSPA_HINT_DEFAULT_1:
-                        u->control[h] = 1;
+                        pl->control[h] = 1;
                         break;
 
                     case LADSPA_HINT_DEFAULT_100:
-                        u->control[h] = 100;
+                        pl->control[h] = 100;
                         break;
 
                     case LADSPA_HINT_DEFAULT_440:
-                        u->control[h] = 440;
+                        pl->control[h] = 440;
                         break;
 
                     default:
@@ -758,12 +800,12 @@ int pa__init(pa_module*m) {
             }
 
             if (LADSPA_IS_HINT_INTEGER(hint))
-                u->control[h] = roundf(u->control[h]);
+                pl->control[h] = roundf(pl->control[h]);
 
-            pa_log_debug("Binding %f to port %s", u->control[h], d->PortNames[p]);
+            pa_log_debug("Binding %f to port %s", pl->control[h], d->PortNames[p]);
 
-            for (c = 0; c < ss.channels; c++)
-                d->connect_port(u->handle[c], p, &u->control[h]);
+            for (c = 0; c < u->channels; c++)
+                d->connect_port(pl->handle[c], p, &pl->control[h]);
 
             h++;
         }
@@ -773,7 +815,135 @@ int pa__init(pa_module*m) {
 
     if (d->activate)
         for (c = 0; c < u->channels; c++)
-            d->activate(u->handle[c]);
+            d->activate(pl->handle[c]);
+
+    pa_xfree(use_default);
+
+    return 0;
+
+fail:
+    pa_xfree(use_default);
+
+    return -1;
+}
+
+/* Called from main context */
+static void plugin_free(struct userdata *u, struct plugin *pl) {
+    unsigned c;
+
+    for (c = 0; c < u->channels; c++)
+        if (pl->handle[c]) {
+            if (pl->descriptor->deactivate)
+                pl->descriptor->deactivate(pl->handle[c]);
+            pl->descriptor->cleanup(pl->handle[c]);
+        }
+
+    pa_xfree(pl->control);
+
+    if (pl->dl)
+        lt_dlclose(pl->dl);
+}
+
+int pa__init(pa_module*m) {
+    struct userdata *u;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_modargs *ma;
+    pa_sink *master;
+    pa_sink_input_new_data sink_input_data;
+    pa_sink_new_data sink_data;
+    const char *plugins, *labels, *controls;
+    const char *plugin_state = NULL, *label_state = NULL, *control_state = NULL;
+    char *plugin, *label, *control;
+    pa_strbuf *sb_label, *sb_name, *sb_maker, *sb_copyright, *sb_unique_id;
+    char *t;
+    unsigned j;
+    pa_memchunk silence;
+
+    pa_assert(m);
+
+    pa_assert_cc(sizeof(LADSPA_Data) == sizeof(float));
+
+    if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
+        pa_log("Failed to parse module arguments.");
+        goto fail;
+    }
+
+    if (!(master = pa_namereg_get(m->core, pa_modargs_get_value(ma, "master", NULL), PA_NAMEREG_SINK))) {
+        pa_log("Master sink not found");
+        goto fail;
+    }
+
+    ss = master->sample_spec;
+    ss.format = PA_SAMPLE_FLOAT32;
+    map = master->channel_map;
+    if (pa_modargs_get_sample_spec_and_channel_map(ma, &ss, &map, PA_CHANNEL_MAP_DEFAULT) < 0) {
+        pa_log("Invalid sample format specification or channel map");
+        goto fail;
+    }
+
+    if (!(plugins = pa_modargs_get_value(ma, "plugin", NULL)) || !*plugins) {
+        pa_log("Missing LADSPA plugin name");
+        goto fail;
+    }
+
+    if (!(labels = pa_modargs_get_value(ma, "label", NULL))) {
+        pa_log("Missing LADSPA plugin label");
+        goto fail;
+    }
+
+    controls = pa_modargs_get_value(ma, "control", NULL);
+
+    u = pa_xnew0(struct userdata, 1);
+    u->module = m;
+    m->userdata = u;
+
+    pa_silence_memchunk_get(&m->core->silence_cache, m->core->mempool, &silence, &ss, 0);
+    u->memblockq = pa_memblockq_new(0, MEMBLOCKQ_MAXLENGTH, 0, pa_frame_size(&ss), 1, 1, 0, &silence);
+    pa_memblock_unref(silence.memblock);
+
+    u->channels = ss.channels;
+    u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
+    u->block_frames = (unsigned) (u->block_size / pa_frame_size(&ss));
+    u->buffer[0] = pa_xnew(LADSPA_Data, u->block_frames * u->channels);
+    u->output_set = 0;
+
+    /* Build the chain, the output of each plugin feeds the next one */
+    while ((plugin = pa_split(plugins, "|", &plugin_state))) {
+        int r;
+
+        if (u->n_plugins >= MAX_PLUGINS) {
+            pa_log("Too many plugins, at most %u are supported.", MAX_PLUGINS);
+            pa_xfree(plugin);
+            goto fail;
+        }
+
+        if (!(label = pa_split(labels, "|", &label_state))) {
+            pa_log("Missing LADSPA plugin label for plugin %s", plugin);
+            pa_xfree(plugin);
+            goto fail;
+        }
+
+        /* Trailing empty control lists are dropped by pa_split() */
+        control = NULL;
+        if (controls && !(control = pa_split(controls, "|", &control_state)))
+            control = pa_xstrdup("");
+
+        r = plugin_load(u, &u->plugins[u->n_plugins++], plugin, label, control, &ss);
+
+        pa_xfree(plugin);
+        pa_xfree(label);
+        pa_xfree(control);
+
+        if (r < 0)
+            goto fail;
+    }
+
+    if ((label = pa_split(labels, "|", &label_state))) {
+        pa_log("More LADSPA plugin labels than plugins passed.");
+        pa_xfree(label);
+        goto fail;
+    }
 
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
@@ -785,12 +955,41 @@ int pa__init(pa_module*m) {
     pa_sink_new_data_set_channel_map(&sink_data, &map);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_MASTER_DEVICE, master->name);
     pa_proplist_sets(sink_data.proplist, PA_PROP_DEVICE_CLASS, "filter");
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugin);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", d->Label);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", d->Name);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", d->Maker);
-    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", d->Copyright);
-    pa_proplist_setf(sink_data.proplist, "device.ladspa.unique_id", "%lu", (unsigned long) d->UniqueID);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.module", plugins);
+
+    /* For chains these are | separated lists, just like the arguments */
+    sb_label = pa_strbuf_new();
+    sb_name = pa_strbuf_new();
+    sb_maker = pa_strbuf_new();
+    sb_copyright = pa_strbuf_new();
+    sb_unique_id = pa_strbuf_new();
+
+    for (j = 0; j < u->n_plugins; j++) {
+        const LADSPA_Descriptor *d = u->plugins[j].descriptor;
+        const char *sep = j > 0 ? "|" : "";
+
+        pa_strbuf_printf(sb_label, "%s%s", sep, d->Label);
+        pa_strbuf_printf(sb_name, "%s%s", sep, d->Name);
+        pa_strbuf_printf(sb_maker, "%s%s", sep, d->Maker);
+        pa_strbuf_printf(sb_copyright, "%s%s", sep, d->Copyright);
+        pa_strbuf_printf(sb_unique_id, "%s%lu", sep, (unsigned long) d->UniqueID);
+    }
+
+    t = pa_strbuf_tostring_free(sb_label);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.label", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(sb_name);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.name", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(sb_maker);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.maker", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(sb_copyright);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.copyright", t);
+    pa_xfree(t);
+    t = pa_strbuf_tostring_free(sb_unique_id);
+    pa_proplist_sets(sink_data.proplist, "device.ladspa.unique_id", t);
+    pa_xfree(t);
 
     if (pa_modargs_get_proplist(ma, "sink_properties", sink_data.proplist, PA_UPDATE_REPLACE) < 0) {
         pa_log("Invalid properties");
@@ -802,7 +1001,8 @@ int pa__init(pa_module*m) {
         const char *z;
 
         z = pa_proplist_gets(master->proplist, PA_PROP_DEVICE_DESCRIPTION);
-        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s", d->Name, z ? z : master->name);
+        pa_proplist_setf(sink_data.proplist, PA_PROP_DEVICE_DESCRIPTION, "LADSPA Plugin %s on %s",
+                         pa_proplist_gets(sink_data.proplist, "device.ladspa.name"), z ? z : master->name);
     }
 
     u->sink = pa_sink_new(m->core, &sink_data,
@@ -862,16 +1062,12 @@ int pa__init(pa_module*m) {
 
     pa_modargs_free(ma);
 
-    pa_xfree(use_default);
-
     return 0;
 
 fail:
     if (ma)
         pa_modargs_free(ma);
 
-    pa_xfree(use_default);
-
     pa__done(m);
 
     return -1;
@@ -888,7 +1084,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned j;
 
     pa_assert(m);
 
@@ -910,22 +1106,17 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    for (c = 0; c < u->channels; c++)
-        if (u->handle[c]) {
-            if (u->descriptor->deactivate)
-                u->descriptor->deactivate(u->handle[c]);
-            u->descriptor->cleanup(u->handle[c]);
-        }
+    for (j = 0; j < u->n_plugins; j++)
+        plugin_free(u, &u->plugins[j]);
 
-    if (u->output != u->input)
-        pa_xfree(u->output);
+    if (u->out_block)
+        pa_memblock_unref(u->out_block);
 
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
-    pa_xfree(u->input);
-
-    pa_xfree(u->control);
+    pa_xfree(u->buffer[0]);
+    pa_xfree(u->buffer[1]);
 
     pa_xfree(u);
 }
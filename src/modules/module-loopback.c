@@ -35,6 +35,7 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/rate-control.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
@@ -61,6 +62,11 @@ PA_MODULE_USAGE(
 
 #define DEFAULT_ADJUST_TIME_USEC (10*PA_USEC_PER_SEC)
 
+/* How often we update the rate, and by how much it may deviate from
+ * the source's */
+#define RATE_CONTROL_INTERVAL_USEC (250*PA_USEC_PER_MSEC)
+#define MAX_RATE_DEVIATION 0.01
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -85,6 +91,9 @@ struct userdata {
     pa_bool_t in_pop;
     size_t min_memblockq_length;
 
+    /* Managed in the sink thread, NULL if adjust_time is 0 */
+    pa_rate_control *rate_control;
+
     struct {
         int64_t send_counter;
         size_t source_output_buffer;
@@ -96,6 +105,7 @@ struct userdata {
 
         size_t min_memblockq_length;
         size_t max_request;
+        double rate;
     } latency_snapshot;
 };
 
@@ -113,8 +123,7 @@ static const char* const valid_modargs[] = {
 enum {
     SINK_INPUT_MESSAGE_POST = PA_SINK_INPUT_MESSAGE_MAX,
     SINK_INPUT_MESSAGE_REWIND,
-    SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED
+    SINK_INPUT_MESSAGE_LATENCY_SNAPSHOT
 };
 
 enum {
@@ -144,9 +153,8 @@ static void teardown(struct userdata *u) {
 }
 
 /* Called from main context */
-static void adjust_rates(struct userdata *u) {
-    size_t buffer, fs;
-    uint32_t old_rate, base_rate, new_rate;
+static void report_latency(struct userdata *u) {
+    size_t buffer;
     pa_usec_t buffer_latency;
 
     pa_assert(u);
@@ -176,18 +184,8 @@ static void adjust_rates(struct userdata *u) {
                 u->latency_snapshot.max_request*2,
                 u->latency_snapshot.min_memblockq_length);
 
-    fs = pa_frame_size(&u->sink_input->sample_spec);
-    old_rate = u->sink_input->sample_spec.rate;
-    base_rate = u->source_output->sample_spec.rate;
-
-    if (u->latency_snapshot.min_memblockq_length < u->latency_snapshot.max_request*2)
-        new_rate = base_rate - (((u->latency_snapshot.max_request*2 - u->latency_snapshot.min_memblockq_length) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-    else
-        new_rate = base_rate + (((u->latency_snapshot.min_memblockq_length - u->latency_snapshot.max_request*2) / fs) *PA_USEC_PER_SEC)/u->adjust_time;
-
-    pa_log_info("Old rate %lu Hz, new rate %lu Hz", (unsigned long) old_rate, (unsigned long) new_rate);
-
-    pa_sink_input_set_rate(u->sink_input, new_rate);
+    /* The rate itself is adjusted continuously by the sink thread */
+    pa_log_info("Current rate %0.3f Hz", u->latency_snapshot.rate);
 
     pa_core_rttime_restart(u->core, u->time_event, pa_rtclock_now() + u->adjust_time);
 }
@@ -200,7 +198,7 @@ static void time_callback(pa_mainloop_api *a, pa_time_event *e, const struct tim
     pa_assert(a);
     pa_assert(u->time_event == e);
 
-    adjust_rates(u);
+    report_latency(u);
 }
 
 /* Called from input thread context */
@@ -367,6 +365,27 @@ static void update_min_memblockq_length(struct userdata *u) {
         u->min_memblockq_length = length;
 }
 
+/* Called from output thread context */
+static void update_rate(struct userdata *u) {
+    pa_usec_t latency, target;
+    double rate;
+
+    pa_assert(u);
+    pa_sink_input_assert_io_context(u->sink_input);
+
+    if (!u->rate_control)
+        return;
+
+    /* We try to keep two requests worth of data buffered, which is
+     * what we need to survive the sink asking for a full request
+     * right before the source delivers */
+    latency = pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq), &u->sink_input->sample_spec);
+    target = pa_bytes_to_usec(pa_sink_input_get_max_request(u->sink_input)*2, &u->sink_input->sample_spec);
+
+    if (pa_rate_control_update(u->rate_control, pa_rtclock_now(), latency, target, &rate))
+        pa_sink_input_set_rate_within_thread(u->sink_input, rate);
+}
+
 /* Called from output thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -390,6 +409,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     pa_memblockq_drop(u->memblockq, chunk->length);
 
     update_min_memblockq_length(u);
+    update_rate(u);
 
     return 0;
 }
@@ -483,17 +503,8 @@ static int sink_input_process_msg_cb(pa_msgobject *obj, int code, void *data, in
             u->latency_snapshot.min_memblockq_length = u->min_memblockq_length;
             u->min_memblockq_length = (size_t) -1;
 
-            return 0;
-        }
-
-        case SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED: {
-            /* This message is sent from the IO thread to the main
-             * thread! So don't be confused. All the user cases above
-             * are executed in thread context, but this one is not! */
-
-            pa_assert_ctl_context();
+            u->latency_snapshot.rate = u->rate_control ? pa_rate_control_get_rate(u->rate_control) : (double) u->sink_input->thread_info.sample_spec.rate;
 
-            adjust_rates(u);
             return 0;
         }
     }
@@ -518,6 +529,10 @@ static void sink_input_attach_cb(pa_sink_input *i) {
     pa_memblockq_set_maxrewind(u->memblockq, pa_sink_input_get_max_rewind(i));
 
     u->min_memblockq_length = (size_t) -1;
+
+    /* The new sink has a clock of its own */
+    if (u->rate_control)
+        pa_rate_control_reset(u->rate_control);
 }
 
 /* Called from output thread context */
@@ -555,7 +570,6 @@ static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes) {
 
     pa_memblockq_set_prebuf(u->memblockq, nbytes*2);
     pa_log_info("Max request changed");
-    pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(u->sink_input), SINK_INPUT_MESSAGE_MAX_REQUEST_CHANGED, NULL, 0, NULL, NULL);
 }
 
 /* Called from main thread */
@@ -698,6 +712,9 @@ int pa__init(pa_module *m) {
 
     pa_sink_input_set_requested_latency(u->sink_input, u->latency/3);
 
+    if (u->adjust_time > 0)
+        u->rate_control = pa_rate_control_new(ss.rate, RATE_CONTROL_INTERVAL_USEC, MAX_RATE_DEVIATION);
+
     pa_source_output_new_data_init(&source_output_data);
     source_output_data.driver = __FILE__;
     source_output_data.module = m;
@@ -780,5 +797,8 @@ void pa__done(pa_module*m) {
     if (u->time_event)
         u->core->mainloop->time_free(u->time_event);
 
+    if (u->rate_control)
+        pa_rate_control_free(u->rate_control);
+
     pa_xfree(u);
 }
@@ -48,6 +48,7 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/io-pool.h>
 
 #include "module-null-sink-symdef.h"
 
@@ -61,10 +62,14 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate> "
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "batch=<render ahead as far as the streams allow?> "
+        "batch_latency_msec=<maximum render-ahead in batch mode> "
+        "io_pool=<run on the shared IO threads instead of an own thread?>");
 
 #define DEFAULT_SINK_NAME "null"
 #define BLOCK_USEC (PA_USEC_PER_SEC * 2)
+#define DEFAULT_BATCH_USEC (PA_USEC_PER_SEC * 2)
 
 struct userdata {
     pa_core *core;
@@ -72,11 +77,18 @@ struct userdata {
     pa_sink *sink;
 
     pa_thread *thread;
+    pa_io_pool *io_pool;
+    pa_io_pool_job *io_job;
     pa_thread_mq thread_mq;
     pa_rtpoll *rtpoll;
 
     pa_usec_t block_usec;
     pa_usec_t timestamp;
+
+    /* In batch mode we render up to batch_usec ahead, in as few
+     * wakeups as possible */
+    pa_bool_t batch;
+    pa_usec_t batch_usec;
 };
 
 static const char* const valid_modargs[] = {
@@ -86,6 +98,9 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "batch",
+    "batch_latency_msec",
+    "io_pool",
     "description", /* supported for compatibility reasons, made redundant by sink_properties= */
     NULL
 };
@@ -120,6 +135,11 @@ static int sink_process_msg(
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+/* How much we might have rendered ahead at most */
+static size_t max_ahead_bytes(struct userdata *u) {
+    return pa_usec_to_bytes(u->batch ? PA_MAX(u->block_usec, u->batch_usec) : u->block_usec, &u->sink->sample_spec);
+}
+
 static void sink_update_requested_latency_cb(pa_sink *s) {
     struct userdata *u;
     size_t nbytes;
@@ -132,7 +152,7 @@ static void sink_update_requested_latency_cb(pa_sink *s) {
     if (u->block_usec == (pa_usec_t) -1)
         u->block_usec = s->thread_info.max_latency;
 
-    nbytes = pa_usec_to_bytes(u->block_usec, &s->sample_spec);
+    nbytes = max_ahead_bytes(u);
     pa_sink_set_max_rewind_within_thread(s, nbytes);
     pa_sink_set_max_request_within_thread(s, nbytes);
 }
@@ -202,6 +222,75 @@ static void process_render(struct userdata *u, pa_usec_t now) {
 /*     pa_log_debug("Ate in sum %lu bytes (of %lu)", (unsigned long) ate, (unsigned long) nbytes); */
 }
 
+static void process_render_batch(struct userdata *u, pa_usec_t now) {
+    pa_usec_t ahead, target;
+
+    pa_assert(u);
+
+    /* Render as far as all streams have data queued, but never more
+     * than batch_usec ahead of now. If no stream is running we only
+     * produce silence, hence the full budget may be used. At least
+     * we render as much as we would have without batching. */
+    ahead = pa_sink_get_render_ahead_within_thread(u->sink);
+
+    target = now + u->batch_usec;
+
+    if (ahead != (pa_usec_t) -1 && u->timestamp + ahead < target)
+        target = u->timestamp + ahead;
+
+    target = PA_MAX(target, now + u->block_usec);
+
+    while (u->timestamp < target) {
+        pa_memchunk chunk;
+        size_t nbytes;
+
+        if ((nbytes = pa_usec_to_bytes(target - u->timestamp, &u->sink->sample_spec)) <= 0)
+            break;
+
+        pa_sink_render(u->sink, nbytes, &chunk);
+        pa_memblock_unref(chunk.memblock);
+
+        u->timestamp += pa_bytes_to_usec(chunk.length, &u->sink->sample_spec);
+    }
+}
+
+/* One iteration of the IO loop, up to going to sleep */
+static void iterate(struct userdata *u) {
+
+    /* Render some data and drop it immediately */
+    if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+        pa_usec_t now;
+
+        now = pa_rtclock_now();
+
+        if (u->sink->thread_info.rewind_requested) {
+            if (u->sink->thread_info.rewind_nbytes > 0)
+                process_rewind(u, now);
+            else
+                pa_sink_process_rewind(u->sink, 0);
+        }
+
+        if (u->timestamp <= now) {
+            if (u->batch)
+                process_render_batch(u, now);
+            else
+                process_render(u, now);
+        }
+
+        pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
+    } else
+        pa_rtpoll_set_timer_disabled(u->rtpoll);
+}
+
+static int io_job_cb(pa_io_pool_job *j, void *userdata) {
+    struct userdata *u = userdata;
+
+    pa_assert(u);
+
+    iterate(u);
+    return 0;
+}
+
 static void thread_func(void *userdata) {
     struct userdata *u = userdata;
 
@@ -216,25 +305,7 @@ static void thread_func(void *userdata) {
     for (;;) {
         int ret;
 
-        /* Render some data and drop it immediately */
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            pa_usec_t now;
-
-            now = pa_rtclock_now();
-
-            if (u->sink->thread_info.rewind_requested) {
-                if (u->sink->thread_info.rewind_nbytes > 0)
-                    process_rewind(u, now);
-                else
-                    pa_sink_process_rewind(u->sink, 0);
-            }
-
-            if (u->timestamp <= now)
-                process_render(u, now);
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
-        } else
-            pa_rtpoll_set_timer_disabled(u->rtpoll);
+        iterate(u);
 
         /* Hmm, nothing to do. Let's sleep */
         if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
@@ -260,7 +331,8 @@ int pa__init(pa_module*m) {
     pa_channel_map map;
     pa_modargs *ma = NULL;
     pa_sink_new_data data;
-    size_t nbytes;
+    pa_bool_t batch = FALSE, io_pool = FALSE;
+    uint32_t batch_msec = (uint32_t) (DEFAULT_BATCH_USEC / PA_USEC_PER_MSEC);
 
     pa_assert(m);
 
@@ -276,9 +348,26 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "batch", &batch) < 0) {
+        pa_log("batch= expects a boolean argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "batch_latency_msec", &batch_msec) < 0 || batch_msec <= 0) {
+        pa_log("Invalid batch_latency_msec.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "io_pool", &io_pool) < 0) {
+        pa_log("io_pool= expects a boolean argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
+    u->batch = batch;
+    u->batch_usec = (pa_usec_t) batch_msec * PA_USEC_PER_MSEC;
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
 
@@ -313,11 +402,19 @@ int pa__init(pa_module*m) {
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
     u->block_usec = BLOCK_USEC;
-    nbytes = pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec);
-    pa_sink_set_max_rewind(u->sink, nbytes);
-    pa_sink_set_max_request(u->sink, nbytes);
+    pa_sink_set_max_rewind(u->sink, max_ahead_bytes(u));
+    pa_sink_set_max_request(u->sink, max_ahead_bytes(u));
+
+    if (io_pool) {
+        u->io_pool = pa_io_pool_get(m->core);
+        u->timestamp = pa_rtclock_now();
 
-    if (!(u->thread = pa_thread_new(thread_func, u))) {
+        if (!(u->io_job = pa_io_pool_job_new(u->io_pool, m, u->rtpoll, &u->thread_mq, io_job_cb, u))) {
+            pa_log("Failed to run on the shared IO threads.");
+            goto fail;
+        }
+
+    } else if (!(u->thread = pa_thread_new(thread_func, u))) {
         pa_log("Failed to create thread.");
         goto fail;
     }
@@ -362,6 +459,14 @@ void pa__done(pa_module*m) {
         pa_thread_free(u->thread);
     }
 
+    if (u->io_job) {
+        pa_asyncmsgq_send(u->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_io_pool_job_free(u->io_job);
+    }
+
+    if (u->io_pool)
+        pa_io_pool_unref(u->io_pool);
+
     pa_thread_mq_done(&u->thread_mq);
 
     if (u->sink)
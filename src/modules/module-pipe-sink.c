@@ -34,6 +34,7 @@
 #include <sys/ioctl.h>
 #include <poll.h>
 
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-error.h>
@@ -45,6 +46,7 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/sample-util.h>
 
 #include "module-pipe-sink-symdef.h"
 
@@ -59,10 +61,13 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "rate=<sample rate>"
         "channels=<number of channels> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "batch=<render ahead as far as the streams allow?> "
+        "batch_latency_msec=<maximum render-ahead in batch mode>");
 
 #define DEFAULT_FILE_NAME "fifo_output"
 #define DEFAULT_SINK_NAME "fifo_output"
+#define DEFAULT_BATCH_USEC (PA_USEC_PER_SEC * 2)
 
 struct userdata {
     pa_core *core;
@@ -81,6 +86,11 @@ struct userdata {
     pa_rtpoll_item *rtpoll_item;
 
     int write_type;
+
+    /* In batch mode we render up to batch_size bytes at once and
+     * write as much of it as the FIFO takes per wakeup */
+    pa_bool_t batch;
+    size_t batch_size;
 };
 
 static const char* const valid_modargs[] = {
@@ -91,6 +101,8 @@ static const char* const valid_modargs[] = {
     "rate",
     "channels",
     "channel_map",
+    "batch",
+    "batch_latency_msec",
     NULL
 };
 
@@ -118,11 +130,30 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
     return pa_sink_process_msg(o, code, data, offset, chunk);
 }
 
+static void render_batch(struct userdata *u) {
+    pa_usec_t ahead;
+    size_t nbytes;
+
+    /* Render as much as all streams have queued, within our budget */
+    nbytes = u->batch_size;
+
+    if ((ahead = pa_sink_get_render_ahead_within_thread(u->sink)) != (pa_usec_t) -1)
+        nbytes = PA_MIN(nbytes, pa_usec_to_bytes(ahead, &u->sink->sample_spec));
+
+    nbytes = PA_MAX(nbytes, pa_frame_align(pa_pipe_buf(u->fd), &u->sink->sample_spec));
+
+    pa_sink_render_full(u->sink, nbytes, &u->memchunk);
+}
+
 static int process_render(struct userdata *u) {
     pa_assert(u);
 
-    if (u->memchunk.length <= 0)
-        pa_sink_render(u->sink, pa_pipe_buf(u->fd), &u->memchunk);
+    if (u->memchunk.length <= 0) {
+        if (u->batch)
+            render_batch(u);
+        else
+            pa_sink_render(u->sink, pa_pipe_buf(u->fd), &u->memchunk);
+    }
 
     pa_assert(u->memchunk.length > 0);
 
@@ -155,7 +186,9 @@ static int process_render(struct userdata *u) {
             if (u->memchunk.length <= 0) {
                 pa_memblock_unref(u->memchunk.memblock);
                 pa_memchunk_reset(&u->memchunk);
-            }
+            } else if (u->batch)
+                /* Fill the FIFO as far as it goes */
+                continue;
         }
 
         return 0;
@@ -226,6 +259,8 @@ int pa__init(pa_module*m) {
     pa_modargs *ma;
     struct pollfd *pollfd;
     pa_sink_new_data data;
+    pa_bool_t batch = FALSE;
+    uint32_t batch_msec = (uint32_t) (DEFAULT_BATCH_USEC / PA_USEC_PER_MSEC);
 
     pa_assert(m);
 
@@ -241,6 +276,16 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "batch", &batch) < 0) {
+        pa_log("batch= expects a boolean argument.");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "batch_latency_msec", &batch_msec) < 0 || batch_msec <= 0) {
+        pa_log("Invalid batch_latency_msec.");
+        goto fail;
+    }
+
     u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -249,6 +294,8 @@ int pa__init(pa_module*m) {
     u->rtpoll = pa_rtpoll_new();
     pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
     u->write_type = 0;
+    u->batch = batch;
+    u->batch_size = pa_usec_to_bytes((pa_usec_t) batch_msec * PA_USEC_PER_MSEC, &ss);
 
     u->filename = pa_runtime_path(pa_modargs_get_value(ma, "file", DEFAULT_FILE_NAME));
 
@@ -299,8 +346,23 @@ int pa__init(pa_module*m) {
 
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
-    pa_sink_set_max_request(u->sink, pa_pipe_buf(u->fd));
-    pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(pa_pipe_buf(u->fd), &u->sink->sample_spec));
+
+    if (u->batch) {
+#ifdef F_SETPIPE_SZ
+        /* Let the FIFO take a whole batch, so that we need fewer
+         * wakeups. This is just an optimization, hence ignore
+         * failures */
+        if (fcntl(u->fd, F_SETPIPE_SZ, (int) u->batch_size) < 0)
+            pa_log_debug("Failed to enlarge FIFO: %s", pa_cstrerror(errno));
+#endif
+
+        /* Ask the clients to keep a whole batch queued */
+        pa_sink_set_max_request(u->sink, u->batch_size);
+        pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(u->batch_size, &u->sink->sample_spec));
+    } else {
+        pa_sink_set_max_request(u->sink, pa_pipe_buf(u->fd));
+        pa_sink_set_fixed_latency(u->sink, pa_bytes_to_usec(pa_pipe_buf(u->fd), &u->sink->sample_spec));
+    }
 
     u->rtpoll_item = pa_rtpoll_item_new(u->rtpoll, PA_RTPOLL_NEVER, 1);
     pollfd = pa_rtpoll_item_get_pollfd(u->rtpoll_item, NULL);
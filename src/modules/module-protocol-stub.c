@@ -118,7 +118,7 @@
 #  define TCPWRAP_SERVICE "pulseaudio-native"
 #  define IPV4_PORT PA_NATIVE_DEFAULT_PORT
 #  define UNIX_SOCKET PA_NATIVE_DEFAULT_UNIX_SOCKET
-#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous",
+#  define MODULE_ARGUMENTS_COMMON "cookie", "auth-cookie", "auth-cookie-enabled", "auth-anonymous", "subscription-interval-msec",
 
 #  ifdef USE_TCP_SOCKETS
 #    include "module-native-protocol-tcp-symdef.h"
@@ -141,6 +141,7 @@
   PA_MODULE_USAGE("auth-anonymous=<don't check for cookies?> "
                   "auth-cookie=<path to cookie file> "
                   "auth-cookie-enabled=<enable cookie authentification? "
+                  "subscription-interval-msec=<minimum time between subscription event deliveries> "
                   AUTH_USAGE
                   SOCKET_USAGE);
 #elif defined(USE_PROTOCOL_ESOUND)
@@ -88,10 +88,20 @@ struct userdata {
         *source_put_hook_slot,
         *sink_unlink_hook_slot,
         *source_unlink_hook_slot,
+        *sink_input_put_hook_slot,
+        *sink_input_unlink_hook_slot,
+        *source_output_put_hook_slot,
+        *source_output_unlink_hook_slot,
         *connection_unlink_hook_slot;
     pa_time_event *save_time_event;
     pa_database* database;
 
+    /* Decoded database entries by name, cache_entry by device name,
+     * and the cache_entry of every linked stream */
+    pa_hashmap *cache;
+    pa_hashmap *by_device;
+    pa_hashmap *streams;
+
     pa_bool_t restore_device:1;
     pa_bool_t restore_volume:1;
     pa_bool_t restore_muted:1;
@@ -114,6 +124,30 @@ struct entry {
     char card[PA_NAME_MAX];
 } PA_GCC_PACKED;
 
+/* The database entries are decoded only once and then kept here. All
+ * changes to the database go through write_entry(), delete_entry()
+ * and clear_entries(), which keep the cache coherent. Entries that
+ * are not in the database are only kept while linked streams use
+ * them. */
+struct cache_entry {
+    char *name;
+    pa_bool_t valid;
+    struct entry entry;
+
+    /* The device this entry is listed under in u->by_device, if any */
+    char *device;
+
+    /* The linked streams using this entry, only tracked if we handle
+     * hotplug */
+    pa_idxset *sink_inputs;
+    pa_idxset *source_outputs;
+};
+
+struct device_entries {
+    char *name;
+    pa_idxset *entries;
+};
+
 enum {
     SUBCOMMAND_TEST,
     SUBCOMMAND_READ,
@@ -163,7 +197,7 @@ static char *get_name(pa_proplist *p, const char *prefix) {
     return t;
 }
 
-static struct entry* read_entry(struct userdata *u, const char *name) {
+static struct entry* load_entry(struct userdata *u, const char *name) {
     pa_datum key, data;
     struct entry *e;
 
@@ -230,6 +264,185 @@ fail:
     return NULL;
 }
 
+/* Lists the entry under its current device in u->by_device */
+static void cache_index(struct userdata *u, struct cache_entry *ce) {
+    const char *device;
+    struct device_entries *d;
+
+    device = ce->valid && ce->entry.device_valid ? ce->entry.device : NULL;
+
+    if (ce->device) {
+        if (device && pa_streq(ce->device, device))
+            return;
+
+        pa_assert_se(d = pa_hashmap_get(u->by_device, ce->device));
+        pa_idxset_remove_by_data(d->entries, ce, NULL);
+
+        if (pa_idxset_isempty(d->entries)) {
+            pa_hashmap_remove(u->by_device, d->name);
+            pa_idxset_free(d->entries, NULL, NULL);
+            pa_xfree(d->name);
+            pa_xfree(d);
+        }
+
+        pa_xfree(ce->device);
+        ce->device = NULL;
+    }
+
+    if (!device)
+        return;
+
+    if (!(d = pa_hashmap_get(u->by_device, device))) {
+        d = pa_xnew(struct device_entries, 1);
+        d->name = pa_xstrdup(device);
+        d->entries = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+        pa_hashmap_put(u->by_device, d->name, d);
+    }
+
+    pa_idxset_put(d->entries, ce, NULL);
+    ce->device = pa_xstrdup(device);
+}
+
+static void cache_entry_free(struct cache_entry *ce) {
+    pa_assert(ce);
+    pa_assert(!ce->device);
+
+    if (ce->sink_inputs)
+        pa_idxset_free(ce->sink_inputs, NULL, NULL);
+    if (ce->source_outputs)
+        pa_idxset_free(ce->source_outputs, NULL, NULL);
+
+    pa_xfree(ce->name);
+    pa_xfree(ce);
+}
+
+static struct cache_entry* cache_get(struct userdata *u, const char *name) {
+    struct cache_entry *ce;
+    struct entry *e;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    if ((ce = pa_hashmap_get(u->cache, name)))
+        return ce;
+
+    ce = pa_xnew0(struct cache_entry, 1);
+    ce->name = pa_xstrdup(name);
+
+    if ((e = load_entry(u, name))) {
+        ce->entry = *e;
+        ce->valid = TRUE;
+        pa_xfree(e);
+    }
+
+    pa_hashmap_put(u->cache, ce->name, ce);
+    cache_index(u, ce);
+
+    return ce;
+}
+
+static pa_bool_t cache_entry_in_use(struct cache_entry *ce) {
+    return
+        (ce->sink_inputs && !pa_idxset_isempty(ce->sink_inputs)) ||
+        (ce->source_outputs && !pa_idxset_isempty(ce->source_outputs));
+}
+
+/* Drops the entry if it is neither in the database nor in use */
+static void cache_release(struct userdata *u, struct cache_entry *ce) {
+    pa_assert(u);
+    pa_assert(ce);
+
+    if (ce->valid || cache_entry_in_use(ce))
+        return;
+
+    pa_hashmap_remove(u->cache, ce->name);
+    cache_entry_free(ce);
+}
+
+static struct entry* read_entry(struct userdata *u, const char *name) {
+    struct cache_entry *ce;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    ce = cache_get(u, name);
+
+    if (!ce->valid) {
+        cache_release(u, ce);
+        return NULL;
+    }
+
+    return pa_xmemdup(&ce->entry, sizeof(struct entry));
+}
+
+static int write_entry(struct userdata *u, const char *name, const struct entry *e, pa_bool_t overwrite) {
+    struct cache_entry *ce;
+    pa_datum key, data;
+
+    pa_assert(u);
+    pa_assert(name);
+    pa_assert(e);
+
+    key.data = (char*) name;
+    key.size = strlen(name);
+
+    data.data = (void*) e;
+    data.size = sizeof(struct entry);
+
+    if (pa_database_set(u->database, &key, &data, overwrite) < 0)
+        return -1;
+
+    ce = cache_get(u, name);
+    ce->entry = *e;
+    ce->valid = TRUE;
+    cache_index(u, ce);
+
+    return 0;
+}
+
+static void delete_entry(struct userdata *u, const char *name) {
+    struct cache_entry *ce;
+    pa_datum key;
+
+    pa_assert(u);
+    pa_assert(name);
+
+    key.data = (char*) name;
+    key.size = strlen(name);
+
+    pa_database_unset(u->database, &key);
+
+    if ((ce = pa_hashmap_get(u->cache, name))) {
+        ce->valid = FALSE;
+        cache_index(u, ce);
+        cache_release(u, ce);
+    }
+}
+
+static void clear_entries(struct userdata *u) {
+    struct cache_entry *ce;
+    pa_hashmap *old;
+
+    pa_assert(u);
+
+    pa_database_clear(u->database);
+
+    old = u->cache;
+    u->cache = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    while ((ce = pa_hashmap_steal_first(old))) {
+        ce->valid = FALSE;
+        cache_index(u, ce);
+
+        if (cache_entry_in_use(ce))
+            pa_hashmap_put(u->cache, ce->name, ce);
+        else
+            cache_entry_free(ce);
+    }
+
+    pa_hashmap_free(old, NULL, NULL);
+}
+
 static void trigger_save(struct userdata *u) {
     pa_native_connection *c;
     uint32_t idx;
@@ -283,7 +496,6 @@ static void subscribe_callback(pa_core *c, pa_subscription_event_type_t t, uint3
     struct userdata *u = userdata;
     struct entry entry, *old;
     char *name;
-    pa_datum key, data;
 
     pa_assert(c);
     pa_assert(u);
@@ -366,15 +578,9 @@ static void subscribe_callback(pa_core *c, pa_subscription_event_type_t t, uint3
         pa_xfree(old);
     }
 
-    key.data = name;
-    key.size = strlen(name);
-
-    data.data = &entry;
-    data.size = sizeof(entry);
-
     pa_log_info("Storing volume/mute/device for stream %s.", name);
 
-    pa_database_set(u->database, &key, &data, TRUE);
+    write_entry(u, name, &entry, TRUE);
 
     pa_xfree(name);
 
@@ -521,8 +727,90 @@ static pa_hook_result_t source_output_new_hook_callback(pa_core *c, pa_source_ou
     return PA_HOOK_OK;
 }
 
+static pa_hook_result_t sink_input_put_hook_callback(pa_core *c, pa_sink_input *si, struct userdata *u) {
+    struct cache_entry *ce;
+    char *name;
+
+    pa_assert(c);
+    pa_assert(si);
+    pa_assert(u);
+
+    if (!(name = get_name(si->proplist, "sink-input")))
+        return PA_HOOK_OK;
+
+    ce = cache_get(u, name);
+    pa_xfree(name);
+
+    if (!ce->sink_inputs)
+        ce->sink_inputs = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    pa_idxset_put(ce->sink_inputs, si, NULL);
+    pa_hashmap_put(u->streams, si, ce);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t sink_input_unlink_hook_callback(pa_core *c, pa_sink_input *si, struct userdata *u) {
+    struct cache_entry *ce;
+
+    pa_assert(c);
+    pa_assert(si);
+    pa_assert(u);
+
+    if (!(ce = pa_hashmap_remove(u->streams, si)))
+        return PA_HOOK_OK;
+
+    pa_idxset_remove_by_data(ce->sink_inputs, si, NULL);
+    cache_release(u, ce);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t source_output_put_hook_callback(pa_core *c, pa_source_output *so, struct userdata *u) {
+    struct cache_entry *ce;
+    char *name;
+
+    pa_assert(c);
+    pa_assert(so);
+    pa_assert(u);
+
+    if (so->direct_on_input)
+        return PA_HOOK_OK;
+
+    if (!(name = get_name(so->proplist, "source-output")))
+        return PA_HOOK_OK;
+
+    ce = cache_get(u, name);
+    pa_xfree(name);
+
+    if (!ce->source_outputs)
+        ce->source_outputs = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
+    pa_idxset_put(ce->source_outputs, so, NULL);
+    pa_hashmap_put(u->streams, so, ce);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t source_output_unlink_hook_callback(pa_core *c, pa_source_output *so, struct userdata *u) {
+    struct cache_entry *ce;
+
+    pa_assert(c);
+    pa_assert(so);
+    pa_assert(u);
+
+    if (!(ce = pa_hashmap_remove(u->streams, so)))
+        return PA_HOOK_OK;
+
+    pa_idxset_remove_by_data(ce->source_outputs, so, NULL);
+    cache_release(u, ce);
+
+    return PA_HOOK_OK;
+}
+
 static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, struct userdata *u) {
-    pa_sink_input *si;
+    struct device_entries *d;
+    struct cache_entry *ce;
     uint32_t idx;
 
     pa_assert(c);
@@ -530,45 +818,46 @@ static pa_hook_result_t sink_put_hook_callback(pa_core *c, pa_sink *sink, struct
     pa_assert(u);
     pa_assert(u->on_hotplug && u->restore_device);
 
-    PA_IDXSET_FOREACH(si, c->sink_inputs, idx) {
-        char *name;
-        struct entry *e;
+    /* Only look at the streams whose entry refers to this sink */
+    if (!(d = pa_hashmap_get(u->by_device, sink->name)))
+        return PA_HOOK_OK;
 
-        if (si->sink == sink)
-            continue;
+    PA_IDXSET_FOREACH(ce, d->entries, idx) {
+        pa_sink_input *si;
+        uint32_t sidx;
 
-        if (si->save_sink)
+        if (!ce->sink_inputs)
             continue;
 
-        /* Skip this if it is already in the process of being moved
-         * anyway */
-        if (!si->sink)
-            continue;
+        PA_IDXSET_FOREACH(si, ce->sink_inputs, sidx) {
 
-        /* It might happen that a stream and a sink are set up at the
-           same time, in which case we want to make sure we don't
-           interfere with that */
-        if (!PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(si)))
-            continue;
+            if (si->sink == sink)
+                continue;
 
-        if (!(name = get_name(si->proplist, "sink-input")))
-            continue;
+            if (si->save_sink)
+                continue;
 
-        if ((e = read_entry(u, name))) {
-            if (e->device_valid && pa_streq(e->device, sink->name))
-                pa_sink_input_move_to(si, sink, TRUE);
+            /* Skip this if it is already in the process of being moved
+             * anyway */
+            if (!si->sink)
+                continue;
 
-            pa_xfree(e);
-        }
+            /* It might happen that a stream and a sink are set up at the
+               same time, in which case we want to make sure we don't
+               interfere with that */
+            if (!PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(si)))
+                continue;
 
-        pa_xfree(name);
+            pa_sink_input_move_to(si, sink, TRUE);
+        }
     }
 
     return PA_HOOK_OK;
 }
 
 static pa_hook_result_t source_put_hook_callback(pa_core *c, pa_source *source, struct userdata *u) {
-    pa_source_output *so;
+    struct device_entries *d;
+    struct cache_entry *ce;
     uint32_t idx;
 
     pa_assert(c);
@@ -576,40 +865,40 @@ static pa_hook_result_t source_put_hook_callback(pa_core *c, pa_source *source,
     pa_assert(u);
     pa_assert(u->on_hotplug && u->restore_device);
 
-    PA_IDXSET_FOREACH(so, c->source_outputs, idx) {
-        char *name;
-        struct entry *e;
+    /* Only look at the streams whose entry refers to this source */
+    if (!(d = pa_hashmap_get(u->by_device, source->name)))
+        return PA_HOOK_OK;
 
-        if (so->source == source)
-            continue;
+    PA_IDXSET_FOREACH(ce, d->entries, idx) {
+        pa_source_output *so;
+        uint32_t sidx;
 
-        if (so->save_source)
+        if (!ce->source_outputs)
             continue;
 
-        if (so->direct_on_input)
-            continue;
+        PA_IDXSET_FOREACH(so, ce->source_outputs, sidx) {
 
-        /* Skip this if it is already in the process of being moved anyway */
-        if (!so->source)
-            continue;
+            if (so->source == source)
+                continue;
 
-        /* It might happen that a stream and a source are set up at the
-           same time, in which case we want to make sure we don't
-           interfere with that */
-        if (!PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(so)))
-            continue;
+            if (so->save_source)
+                continue;
 
-        if (!(name = get_name(so->proplist, "source-input")))
-            continue;
+            if (so->direct_on_input)
+                continue;
 
-        if ((e = read_entry(u, name))) {
-            if (e->device_valid && pa_streq(e->device, source->name))
-                pa_source_output_move_to(so, source, TRUE);
+            /* Skip this if it is already in the process of being moved anyway */
+            if (!so->source)
+                continue;
 
-            pa_xfree(e);
-        }
+            /* It might happen that a stream and a source are set up at the
+               same time, in which case we want to make sure we don't
+               interfere with that */
+            if (!PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(so)))
+                continue;
 
-        pa_xfree(name);
+            pa_source_output_move_to(so, source, TRUE);
+        }
     }
 
     return PA_HOOK_OK;
@@ -890,13 +1179,12 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                 goto fail;
 
             if (mode == PA_UPDATE_SET)
-                pa_database_clear(u->database);
+                clear_entries(u);
 
             while (!pa_tagstruct_eof(t)) {
                 const char *name, *device;
                 pa_bool_t muted;
                 struct entry entry;
-                pa_datum key, data;
 
                 pa_zero(entry);
                 entry.version = ENTRY_VERSION;
@@ -928,17 +1216,11 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
                     !pa_namereg_is_valid_name(entry.device))
                     goto fail;
 
-                key.data = (char*) name;
-                key.size = strlen(name);
-
-                data.data = &entry;
-                data.size = sizeof(entry);
-
                 pa_log_debug("Client %s changes entry %s.",
                              pa_strnull(pa_proplist_gets(pa_native_connection_get_client(c)->proplist, PA_PROP_APPLICATION_PROCESS_BINARY)),
                              name);
 
-                if (pa_database_set(u->database, &key, &data, mode == PA_UPDATE_REPLACE) == 0)
+                if (write_entry(u, name, &entry, mode == PA_UPDATE_REPLACE) == 0)
                     if (apply_immediately)
                         apply_entry(u, name, &entry);
             }
@@ -952,15 +1234,11 @@ static int extension_cb(pa_native_protocol *p, pa_module *m, pa_native_connectio
 
             while (!pa_tagstruct_eof(t)) {
                 const char *name;
-                pa_datum key;
 
-                if (pa_tagstruct_gets(t, &name) < 0)
+                if (pa_tagstruct_gets(t, &name) < 0 || !name)
                     goto fail;
 
-                key.data = (char*) name;
-                key.size = strlen(name);
-
-                pa_database_unset(u->database, &key);
+                delete_entry(u, name);
             }
 
             trigger_save(u);
@@ -1044,6 +1322,9 @@ int pa__init(pa_module*m) {
     u->on_hotplug = on_hotplug;
     u->on_rescue = on_rescue;
     u->subscribed = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+    u->cache = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    u->by_device = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    u->streams = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     u->protocol = pa_native_protocol_get(m->core);
     pa_native_protocol_install_ext(u->protocol, m, extension_cb);
@@ -1062,6 +1343,13 @@ int pa__init(pa_module*m) {
         /* A little bit earlier than module-intended-roles ... */
         u->sink_put_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_PUT], PA_HOOK_LATE, (pa_hook_cb_t) sink_put_hook_callback, u);
         u->source_put_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SOURCE_PUT], PA_HOOK_LATE, (pa_hook_cb_t) source_put_hook_callback, u);
+
+        /* Track which streams use which entry, so that we don't have
+         * to look at all streams when a device shows up */
+        u->sink_input_put_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_PUT], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_put_hook_callback, u);
+        u->sink_input_unlink_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_INPUT_UNLINK], PA_HOOK_NORMAL, (pa_hook_cb_t) sink_input_unlink_hook_callback, u);
+        u->source_output_put_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_PUT], PA_HOOK_NORMAL, (pa_hook_cb_t) source_output_put_hook_callback, u);
+        u->source_output_unlink_hook_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SOURCE_OUTPUT_UNLINK], PA_HOOK_NORMAL, (pa_hook_cb_t) source_output_unlink_hook_callback, u);
     }
 
     if (restore_device && on_rescue) {
@@ -1085,12 +1373,20 @@ int pa__init(pa_module*m) {
     pa_log_info("Sucessfully opened database file '%s'.", fname);
     pa_xfree(fname);
 
-    PA_IDXSET_FOREACH(si, m->core->sink_inputs, idx)
+    PA_IDXSET_FOREACH(si, m->core->sink_inputs, idx) {
         subscribe_callback(m->core, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, si->index, u);
 
-    PA_IDXSET_FOREACH(so, m->core->source_outputs, idx)
+        if (u->sink_input_put_hook_slot && PA_SINK_INPUT_IS_LINKED(pa_sink_input_get_state(si)))
+            sink_input_put_hook_callback(m->core, si, u);
+    }
+
+    PA_IDXSET_FOREACH(so, m->core->source_outputs, idx) {
         subscribe_callback(m->core, PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT|PA_SUBSCRIPTION_EVENT_NEW, so->index, u);
 
+        if (u->source_output_put_hook_slot && PA_SOURCE_OUTPUT_IS_LINKED(pa_source_output_get_state(so)))
+            source_output_put_hook_callback(m->core, so, u);
+    }
+
     pa_modargs_free(ma);
     return 0;
 
@@ -1131,6 +1427,15 @@ void pa__done(pa_module*m) {
     if (u->source_unlink_hook_slot)
         pa_hook_slot_free(u->source_unlink_hook_slot);
 
+    if (u->sink_input_put_hook_slot)
+        pa_hook_slot_free(u->sink_input_put_hook_slot);
+    if (u->sink_input_unlink_hook_slot)
+        pa_hook_slot_free(u->sink_input_unlink_hook_slot);
+    if (u->source_output_put_hook_slot)
+        pa_hook_slot_free(u->source_output_put_hook_slot);
+    if (u->source_output_unlink_hook_slot)
+        pa_hook_slot_free(u->source_output_unlink_hook_slot);
+
     if (u->connection_unlink_hook_slot)
         pa_hook_slot_free(u->connection_unlink_hook_slot);
 
@@ -1148,5 +1453,23 @@ void pa__done(pa_module*m) {
     if (u->subscribed)
         pa_idxset_free(u->subscribed, NULL, NULL);
 
+    if (u->streams)
+        pa_hashmap_free(u->streams, NULL, NULL);
+
+    if (u->cache) {
+        struct cache_entry *ce;
+
+        while ((ce = pa_hashmap_steal_first(u->cache))) {
+            ce->valid = FALSE;
+            cache_index(u, ce);
+            cache_entry_free(ce);
+        }
+
+        pa_hashmap_free(u->cache, NULL, NULL);
+    }
+
+    if (u->by_device)
+        pa_hashmap_free(u->by_device, NULL, NULL);
+
     pa_xfree(u);
 }
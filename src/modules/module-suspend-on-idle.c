@@ -41,15 +41,20 @@ PA_MODULE_AUTHOR("Lennart Poettering");
 PA_MODULE_DESCRIPTION("When a sink/source is idle for too long, suspend it");
 PA_MODULE_VERSION(PACKAGE_VERSION);
 PA_MODULE_LOAD_ONCE(TRUE);
+PA_MODULE_USAGE(
+        "timeout=<timeout> "
+        "prewarm=<wake up devices when corked streams are created?>");
 
 static const char* const valid_modargs[] = {
     "timeout",
+    "prewarm",
     NULL,
 };
 
 struct userdata {
     pa_core *core;
     pa_usec_t timeout;
+    pa_bool_t prewarm;
     pa_hashmap *device_infos;
     pa_hook_slot
         *sink_new_slot,
@@ -138,6 +143,32 @@ static void resume(struct device_info *d) {
     }
 }
 
+/* A stream is created that won't play right away. Wake up the device
+ * already, so that it is ready when the stream is started, but let it
+ * fall asleep again if that doesn't happen in time. */
+static void prewarm(struct device_info *d) {
+    pa_bool_t suspended = FALSE;
+
+    pa_assert(d);
+
+    if (d->sink && (d->sink->suspend_cause & PA_SUSPEND_IDLE))
+        suspended = TRUE;
+
+    if (d->source && (d->source->suspend_cause & PA_SUSPEND_IDLE))
+        suspended = TRUE;
+
+    if (!suspended)
+        return;
+
+    if (d->sink)
+        pa_log_debug("Pre-warming sink %s.", d->sink->name);
+    if (d->source)
+        pa_log_debug("Pre-warming source %s.", d->source->name);
+
+    resume(d);
+    restart(d);
+}
+
 static pa_hook_result_t sink_input_fixate_hook_cb(pa_core *c, pa_sink_input_new_data *data, struct userdata *u) {
     struct device_info *d;
 
@@ -145,11 +176,13 @@ static pa_hook_result_t sink_input_fixate_hook_cb(pa_core *c, pa_sink_input_new_
     pa_assert(data);
     pa_assert(u);
 
-    if (data->flags & PA_SINK_INPUT_START_CORKED)
+    if (!(d = pa_hashmap_get(u->device_infos, data->sink)))
         return PA_HOOK_OK;
 
-    if ((d = pa_hashmap_get(u->device_infos, data->sink)))
+    if (!(data->flags & PA_SINK_INPUT_START_CORKED))
         resume(d);
+    else if (u->prewarm)
+        prewarm(d);
 
     return PA_HOOK_OK;
 }
@@ -161,16 +194,18 @@ static pa_hook_result_t source_output_fixate_hook_cb(pa_core *c, pa_source_outpu
     pa_assert(data);
     pa_assert(u);
 
-    if (data->flags & PA_SOURCE_OUTPUT_START_CORKED)
-        return PA_HOOK_OK;
-
     if (data->source->monitor_of)
         d = pa_hashmap_get(u->device_infos, data->source->monitor_of);
     else
         d = pa_hashmap_get(u->device_infos, data->source);
 
-    if (d)
+    if (!d)
+        return PA_HOOK_OK;
+
+    if (!(data->flags & PA_SOURCE_OUTPUT_START_CORKED))
         resume(d);
+    else if (u->prewarm)
+        prewarm(d);
 
     return PA_HOOK_OK;
 }
@@ -418,6 +453,7 @@ int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
     uint32_t timeout = 5;
+    pa_bool_t prewarm = FALSE;
     uint32_t idx;
     pa_sink *sink;
     pa_source *source;
@@ -434,9 +470,15 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "prewarm", &prewarm) < 0) {
+        pa_log("prewarm= expects a boolean argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew(struct userdata, 1);
     u->core = m->core;
     u->timeout = timeout;
+    u->prewarm = prewarm;
     u->device_infos = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
     for (sink = pa_idxset_first(m->core->sinks, &idx); sink; sink = pa_idxset_next(m->core->sinks, &idx))
@@ -1368,32 +1368,39 @@ static void request_info(struct userdata *u) {
 /* Called from main context */
 static void command_subscribe_event(pa_pdispatch *pd,  uint32_t command,  uint32_t tag, pa_tagstruct *t, void *userdata) {
     struct userdata *u = userdata;
-    pa_subscription_event_type_t e;
-    uint32_t idx;
+    pa_bool_t relevant = FALSE;
 
     pa_assert(pd);
     pa_assert(t);
     pa_assert(u);
     pa_assert(command == PA_COMMAND_SUBSCRIBE_EVENT);
 
-    if (pa_tagstruct_getu32(t, &e) < 0 ||
-        pa_tagstruct_getu32(t, &idx) < 0) {
-        pa_log("Invalid protocol reply");
-        pa_module_unload_request(u->module, TRUE);
-        return;
-    }
+    /* Since protocol v17 a single packet may carry several events */
+    do {
+        pa_subscription_event_type_t e;
+        uint32_t idx;
+
+        if (pa_tagstruct_getu32(t, &e) < 0 ||
+            pa_tagstruct_getu32(t, &idx) < 0) {
+            pa_log("Invalid protocol reply");
+            pa_module_unload_request(u->module, TRUE);
+            return;
+        }
 
-    if (e != (PA_SUBSCRIPTION_EVENT_SERVER|PA_SUBSCRIPTION_EVENT_CHANGE) &&
+        if (e == (PA_SUBSCRIPTION_EVENT_SERVER|PA_SUBSCRIPTION_EVENT_CHANGE) ||
 #ifdef TUNNEL_SINK
-        e != (PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE) &&
-        e != (PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE)
+            e == (PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE) ||
+            e == (PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE)
 #else
-        e != (PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE)
+            e == (PA_SUBSCRIPTION_EVENT_SOURCE|PA_SUBSCRIPTION_EVENT_CHANGE)
 #endif
-        )
-        return;
+            )
+            relevant = TRUE;
 
-    request_info(u);
+    } while (u->version >= 17 && !pa_tagstruct_eof(t));
+
+    if (relevant)
+        request_info(u);
 }
 
 /* Called from main context */
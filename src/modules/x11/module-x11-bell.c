@@ -71,6 +71,7 @@ struct userdata {
 static int x11_event_cb(pa_x11_wrapper *w, XEvent *e, void *userdata) {
     XkbBellNotifyEvent *bne;
     struct userdata *u = userdata;
+    pa_sink *sink;
 
     pa_assert(w);
     pa_assert(e);
@@ -82,7 +83,9 @@ static int x11_event_cb(pa_x11_wrapper *w, XEvent *e, void *userdata) {
 
     bne = (XkbBellNotifyEvent*) e;
 
-    if (pa_scache_play_item_by_name(u->core, u->scache_item, u->sink_name, ((pa_volume_t) bne->percent*PA_VOLUME_NORM)/100U, NULL, NULL) < 0) {
+    /* Don't block the X11 event handling on loading a lazy sample */
+    if (!(sink = pa_namereg_get(u->core, u->sink_name, PA_NAMEREG_SINK)) ||
+        pa_scache_play_item_async(u->core, u->scache_item, sink, ((pa_volume_t) bne->percent*PA_VOLUME_NORM)/100U, NULL, NULL, NULL) < 0) {
         pa_log_info("Ringing bell failed, reverting to X11 device bell.");
         XkbForceDeviceBell(pa_x11_wrapper_get_display(w), bne->device, bne->bell_class, bne->bell_id, bne->percent);
     }
@@ -72,6 +72,7 @@
 #include <pulsecore/socket-util.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/proplist-util.h>
 
 #include "internal.h"
@@ -85,6 +86,10 @@
 
 #include "context.h"
 
+/* The newest protocol version that changed the commands we send
+ * ahead in a pipelined handshake */
+#define PIPELINE_MIN_VERSION 15
+
 void pa_command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
@@ -108,6 +113,74 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 };
 static void context_free(pa_context *c);
 
+/* The memory pool of the last context that went away is kept, so that
+ * the next context of this process can reuse it. The server then
+ * recognizes the segment and can reuse its mapping, too. */
+static pa_static_mutex pool_cache_mutex = PA_STATIC_MUTEX_INIT;
+static pa_mempool *cached_pool = NULL;
+static size_t cached_pool_size = 0;
+static pid_t cached_pool_pid = 0;
+
+static void pool_cache_free(void) PA_GCC_DESTRUCTOR;
+
+static void pool_cache_free(void) {
+    if (cached_pool) {
+        pa_mempool_free(cached_pool);
+        cached_pool = NULL;
+    }
+}
+
+static pa_mempool* pool_cache_get(size_t size) {
+    pa_mempool *pool = NULL;
+    pa_mutex *m;
+
+    m = pa_static_mutex_get(&pool_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if (cached_pool) {
+
+        /* Don't share a pool with our parent process */
+        if (cached_pool_pid == getpid() && cached_pool_size == size)
+            pool = cached_pool;
+        else
+            pa_mempool_free(cached_pool);
+
+        cached_pool = NULL;
+    }
+
+    pa_mutex_unlock(m);
+
+    return pool;
+}
+
+static void pool_cache_put(pa_mempool *pool, size_t size) {
+    pa_mutex *m;
+
+    pa_assert(pool);
+
+    /* Only anonymous segments are worth keeping, and only if nobody
+     * still holds a block */
+    if (pa_mempool_get_memfd(pool) < 0 ||
+        pa_atomic_load(&pa_mempool_get_stat(pool)->n_allocated) > 0) {
+        pa_mempool_free(pool);
+        return;
+    }
+
+    pa_mempool_vacuum(pool);
+
+    m = pa_static_mutex_get(&pool_cache_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if (cached_pool)
+        pa_mempool_free(cached_pool);
+
+    cached_pool = pool;
+    cached_pool_size = size;
+    cached_pool_pid = getpid();
+
+    pa_mutex_unlock(m);
+}
+
 #ifdef HAVE_DBUS
 static DBusHandlerResult filter_cb(DBusConnection *bus, DBusMessage *message, void *userdata);
 #endif
@@ -183,7 +256,10 @@ pa_context *pa_context_new_with_proplist(pa_mainloop_api *mainloop, const char *
 #endif
     pa_client_conf_env(c->conf);
 
-    if (!(c->mempool = pa_mempool_new(!c->conf->disable_shm, c->conf->shm_size))) {
+    if (!c->conf->disable_shm)
+        c->mempool = pool_cache_get(c->conf->shm_size);
+
+    if (!c->mempool && !(c->mempool = pa_mempool_new(!c->conf->disable_shm, c->conf->shm_size))) {
 
         if (!c->conf->disable_shm)
             c->mempool = pa_mempool_new(FALSE, c->conf->shm_size);
@@ -257,7 +333,7 @@ static void context_free(pa_context *c) {
         pa_hashmap_free(c->playback_streams, NULL, NULL);
 
     if (c->mempool)
-        pa_mempool_free(c->mempool);
+        pool_cache_put(c->mempool, c->conf->shm_size);
 
     if (c->conf)
         pa_client_conf_free(c->conf);
@@ -419,6 +495,74 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, pa
     return 0;
 }
 
+static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+
+static void send_client_name(pa_context *c) {
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
+
+    if (c->version >= 13) {
+        pa_init_proplist(c->proplist);
+        pa_tagstruct_put_proplist(t, c->proplist);
+    } else
+        pa_tagstruct_puts(t, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
+
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+}
+
+/* Sends the create commands of the streams that were connected before
+ * we could do that */
+static void send_deferred_streams(pa_context *c) {
+    pa_stream *s;
+
+    pa_assert(c);
+
+    s = c->streams ? pa_stream_ref(c->streams) : NULL;
+    while (s) {
+        pa_stream *n = s->next ? pa_stream_ref(s->next) : NULL;
+        pa_stream_send_deferred_create(s);
+        pa_stream_unref(s);
+        s = n;
+    }
+}
+
+static int try_next_connection(pa_context *c);
+
+/* What we sent ahead assumed a newer server. Start over on a new
+ * connection to the same server, this time waiting for every reply. */
+static void reconnect_sequential(pa_context *c) {
+    pa_stream *s;
+
+    pa_assert(c);
+
+    pa_log_debug("Server too old for a pipelined handshake, reconnecting without.");
+
+    c->pipelined = FALSE;
+    c->pipelining_failed = TRUE;
+
+    if (c->pdispatch) {
+        pa_pdispatch_unref(c->pdispatch);
+        c->pdispatch = NULL;
+    }
+
+    if (c->pstream) {
+        pa_pstream_unlink(c->pstream);
+        pa_pstream_unref(c->pstream);
+        c->pstream = NULL;
+    }
+
+    for (s = c->streams; s; s = s->next)
+        pa_stream_defer_create(s);
+
+    c->server_list = pa_strlist_prepend(c->server_list, c->server);
+    try_next_connection(c);
+}
+
 static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
 
@@ -435,7 +579,6 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
 
     switch(c->state) {
         case PA_CONTEXT_AUTHORIZING: {
-            pa_tagstruct *reply;
             pa_bool_t shm_on_remote = FALSE;
 
             if (pa_tagstruct_getu32(t, &c->version) < 0 ||
@@ -460,6 +603,12 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
 
             pa_log_debug("Protocol version: remote %u, local %u", c->version, PA_PROTOCOL_VERSION);
 
+            /* What we sent ahead assumed the server understands it */
+            if (c->pipelined && c->version < PIPELINE_MIN_VERSION) {
+                reconnect_sequential(c);
+                goto finish;
+            }
+
             /* Enable shared memory support if possible */
             if (c->do_shm)
                 if (c->version < 10 || (c->version >= 13 && !shm_on_remote))
@@ -481,16 +630,14 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
             pa_log_debug("Negotiated SHM: %s", pa_yes_no(c->do_shm));
             pa_pstream_enable_shm(c->pstream, c->do_shm);
 
-            reply = pa_tagstruct_command(c, PA_COMMAND_SET_CLIENT_NAME, &tag);
-
-            if (c->version >= 13) {
-                pa_init_proplist(c->proplist);
-                pa_tagstruct_put_proplist(reply, c->proplist);
-            } else
-                pa_tagstruct_puts(reply, pa_proplist_gets(c->proplist, PA_PROP_APPLICATION_NAME));
+#ifdef HAVE_CREDS
+            /* Newer servers accept our pool as fd, too */
+            if (c->do_shm && c->version >= 17)
+                pa_pstream_enable_memfd(c->pstream);
+#endif
 
-            pa_pstream_send_tagstruct(c->pstream, reply);
-            pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
+            if (!c->pipelined)
+                send_client_name(c);
 
             pa_context_set_state(c, PA_CONTEXT_SETTING_NAME);
             break;
@@ -505,6 +652,7 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
                 goto finish;
             }
 
+            send_deferred_streams(c);
             pa_context_set_state(c, PA_CONTEXT_READY);
             break;
 
@@ -569,6 +717,18 @@ static void setup_context(pa_context *c, pa_iochannel *io) {
 
     pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, setup_complete_callback, c, NULL);
 
+    /* On local connections the server is most likely as new as we
+     * are, so don't wait for the AUTH reply before sending the client
+     * name and the streams that are already connected. The server
+     * handles them in order. */
+    c->pipelined = c->is_local && !c->pipelining_failed;
+
+    if (c->pipelined) {
+        c->version = PA_PROTOCOL_VERSION;
+        send_client_name(c);
+        send_deferred_streams(c);
+    }
+
     pa_context_set_state(c, PA_CONTEXT_AUTHORIZING);
 
     pa_context_unref(c);
@@ -874,7 +1034,8 @@ static void on_connection(pa_socket_client *client, pa_iochannel*io, void *userd
 
     pa_assert(client);
     pa_assert(c);
-    pa_assert(c->state == PA_CONTEXT_CONNECTING);
+    /* We stay in AUTHORIZING while reconnecting without pipelining */
+    pa_assert(c->state == PA_CONTEXT_CONNECTING || (c->state == PA_CONTEXT_AUTHORIZING && c->pipelining_failed));
 
     pa_context_ref(c);
 
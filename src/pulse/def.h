@@ -866,6 +866,52 @@ static inline int PA_SOURCE_IS_OPENED(pa_source_state_t x) {
 #define PA_SOURCE_IS_OPENED PA_SOURCE_IS_OPENED
 /** \endcond */
 
+/** Types of the events in the server's stream timing trace, see
+ * pa_context_get_trace(). \since 0.9.22 */
+typedef enum pa_trace_event_type {
+    PA_TRACE_REQUEST,
+    /**< A playback stream asked its client for data. object is the
+     * sink input, a the number of bytes missing */
+
+    PA_TRACE_PUSH,
+    /**< Data was queued for a sink input. a is the number of bytes,
+     * b the write index afterwards */
+
+    PA_TRACE_PEEK,
+    /**< The sink took data from a sink input. a is the number of
+     * bytes asked for, b the number of bytes returned */
+
+    PA_TRACE_UNDERRUN,
+    /**< A sink input had no data and silence was played instead. a is
+     * the number of bytes of silence, b the length of the underrun so
+     * far */
+
+    PA_TRACE_REWIND,
+    /**< A sink rewound its buffer. object is the sink, a the number of
+     * bytes */
+
+    PA_TRACE_RENDER
+    /**< A sink mixed its inputs. object is the sink, a the number of
+     * bytes, b the time it took in usec */
+} pa_trace_event_type_t;
+
+/** \cond fulldocs */
+#define PA_TRACE_REQUEST PA_TRACE_REQUEST
+#define PA_TRACE_PUSH PA_TRACE_PUSH
+#define PA_TRACE_PEEK PA_TRACE_PEEK
+#define PA_TRACE_UNDERRUN PA_TRACE_UNDERRUN
+#define PA_TRACE_REWIND PA_TRACE_REWIND
+#define PA_TRACE_RENDER PA_TRACE_RENDER
+/** \endcond */
+
+/** An event of the stream timing trace. \since 0.9.22 */
+typedef struct pa_trace_event {
+    pa_usec_t time;               /**< Monotonic time of the event in usec */
+    pa_trace_event_type_t type;   /**< What happened */
+    uint32_t object;              /**< Index of the sink input or sink it happened to */
+    int64_t a, b;                 /**< Event specific values, see pa_trace_event_type_t */
+} pa_trace_event;
+
 /** A generic free() like callback prototype */
 typedef void (*pa_free_cb_t)(void *p);
 
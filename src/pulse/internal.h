@@ -42,6 +42,11 @@
 #include <pulsecore/hashmap.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/time-smoother.h>
+#include <pulsecore/shm.h>
+#include <pulsecore/shmasyncq.h>
+#include <pulsecore/asyncq.h>
+#include <pulsecore/aupdate.h>
+#include <pulsecore/atomic.h>
 #ifdef HAVE_DBUS
 #include <pulsecore/dbus-util.h>
 #endif
@@ -91,6 +96,12 @@ struct pa_context {
     pa_bool_t do_autospawn:1;
     pa_bool_t use_rtclock:1;
     pa_bool_t filter_added:1;
+    /* SET_CLIENT_NAME and stream creation were sent along with AUTH,
+     * without waiting for the replies */
+    pa_bool_t pipelined:1;
+    /* The server turned out to be too old for that, so we reconnected
+     * with the sequential handshake */
+    pa_bool_t pipelining_failed:1;
     pa_spawn_api spawn_api;
 
     pa_strlist *server_list;
@@ -122,6 +133,34 @@ typedef struct pa_index_correction {
     pa_bool_t corrupt:1;
 } pa_index_correction;
 
+/* Data that did not fit into the playback ring and waits for the
+ * server to free some cells, or a stream command that has to wait
+ * until that data went into the ring */
+typedef struct pa_ring_pending {
+    PA_LLIST_FIELDS(struct pa_ring_pending);
+    pa_tagstruct *command;
+    void *data;
+    size_t length, index;
+    int64_t offset;
+    pa_seek_mode_t seek;
+} pa_ring_pending;
+
+/* What pa_stream_get_latency() returned at a certain point in time,
+ * for threads that may not take the lock */
+typedef struct pa_stream_timing_snapshot {
+    pa_bool_t valid:1;
+
+    /* Whether the stream time advances after the snapshot was taken */
+    pa_bool_t running:1;
+
+    pa_usec_t taken;
+    int64_t latency;
+
+    /* Bytes submitted with pa_stream_write_lockfree() that are
+     * accounted for in latency */
+    uint32_t drained;
+} pa_stream_timing_snapshot;
+
 struct pa_stream {
     PA_REFCNT_DECLARE;
     PA_LLIST_FIELDS(pa_stream);
@@ -146,6 +185,18 @@ struct pa_stream {
     pa_bool_t timing_info_valid:1;
     pa_bool_t auto_timing_update_requested:1;
 
+    /* The server sent timing data with a data request since the
+     * auto timing update timer fired last */
+    pa_bool_t timing_pushed:1;
+
+    /* pa_stream_connect_*() was called while the context was still
+     * connecting, the create command is sent once it can be. Device
+     * and volume are kept for sending it again after a reconnect. */
+    pa_bool_t create_deferred:1;
+    pa_bool_t create_volume_set:1;
+    char *create_device;
+    pa_cvolume create_volume;
+
     uint32_t channel;
     uint32_t syncid;
     uint32_t stream_index;
@@ -160,9 +211,38 @@ struct pa_stream {
     pa_memblock *write_memblock;
     void *write_data;
 
+    /* playback ring shared with the server's IO thread, see
+     * PA_COMMAND_CREATE_PLAYBACK_RING */
+    pa_shm ring_shm;
+    pa_shmasyncq *ring;
+    void *ring_cell;
+    size_t ring_cell_max;
+    pa_io_event *ring_io_event;
+    pa_bool_t ring_waiting:1;
+    PA_LLIST_HEAD(pa_ring_pending, ring_pending);
+    pa_ring_pending *ring_pending_tail;
+
+    /* lock-free submission, see pa_stream_enable_lockfree(). The
+     * queue and the pool stay around until the stream is freed, since
+     * the submitting thread might still be using them when the stream
+     * is unlinked. */
+    pa_asyncq *lockfree_queue;
+    pa_mempool *lockfree_mempool;
+    pa_io_event *lockfree_io_event;
+    pa_bool_t lockfree_waiting:1;
+    pa_atomic_t lockfree_ready;
+    pa_atomic_t lockfree_submitted;
+    pa_atomic_t lockfree_credit;
+    uint32_t lockfree_drained;
+
+    pa_aupdate *timing_aupdate;
+    pa_stream_timing_snapshot timing_snapshot[2];
+
     /* recording */
     pa_memchunk peek_memchunk;
     void *peek_data;
+    pa_memchunk *peekv_chunks;
+    unsigned n_peekv_chunks, n_peekv_allocated;
     pa_memblockq *record_memblockq;
 
     /* Store latest latency info */
@@ -253,6 +333,8 @@ int pa_context_handle_error(pa_context *c, uint32_t command, pa_tagstruct *t, pa
 pa_operation* pa_context_send_simple_command(pa_context *c, uint32_t command, void (*internal_callback)(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata), void (*cb)(void), void *userdata);
 
 void pa_stream_set_state(pa_stream *s, pa_stream_state_t st);
+void pa_stream_send_deferred_create(pa_stream *s);
+void pa_stream_defer_create(pa_stream *s);
 
 pa_tagstruct *pa_tagstruct_command(pa_context *c, uint32_t command, uint32_t *tag);
 
@@ -33,6 +33,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/pstream-util.h>
+#include <pulsecore/trace.h>
 
 #include "internal.h"
 #include "fork-detect.h"
@@ -83,6 +84,117 @@ pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdat
     return pa_context_send_simple_command(c, PA_COMMAND_STAT, context_stat_callback, (pa_operation_cb_t) cb, userdata);
 }
 
+/*** Stream Timing Trace ***/
+
+static void context_get_trace_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_trace_event *events = NULL;
+    unsigned n_allocated = 0;
+    int eol = 1;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    if (!o->context)
+        goto finish;
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(o->context, command, t, FALSE) < 0)
+            goto finish;
+
+        eol = -1;
+    } else {
+
+        while (!pa_tagstruct_eof(t)) {
+            pa_trace_info i;
+            unsigned j;
+
+            pa_zero(i);
+
+            if (pa_tagstruct_getu32(t, &i.thread) < 0 ||
+                pa_tagstruct_getu32(t, &i.n_events) < 0 ||
+                i.n_events > PA_TRACE_RING_SIZE) {
+
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+            if (i.n_events > n_allocated) {
+                pa_xfree(events);
+                events = pa_xnew(pa_trace_event, i.n_events);
+                n_allocated = i.n_events;
+            }
+
+            for (j = 0; j < i.n_events; j++) {
+                uint32_t type;
+
+                if (pa_tagstruct_get_usec(t, &events[j].time) < 0 ||
+                    pa_tagstruct_getu32(t, &type) < 0 ||
+                    pa_tagstruct_getu32(t, &events[j].object) < 0 ||
+                    pa_tagstruct_gets64(t, &events[j].a) < 0 ||
+                    pa_tagstruct_gets64(t, &events[j].b) < 0) {
+
+                    pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                    goto finish;
+                }
+
+                events[j].type = (pa_trace_event_type_t) type;
+            }
+
+            i.events = events;
+
+            if (o->callback) {
+                pa_trace_info_cb_t cb = (pa_trace_info_cb_t) o->callback;
+                cb(o->context, &i, 0, o->userdata);
+            }
+        }
+    }
+
+    if (o->callback) {
+        pa_trace_info_cb_t cb = (pa_trace_info_cb_t) o->callback;
+        cb(o->context, NULL, eol, o->userdata);
+    }
+
+finish:
+    pa_xfree(events);
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+pa_operation* pa_context_get_trace(pa_context *c, pa_trace_info_cb_t cb, void *userdata) {
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 17, PA_ERR_NOTSUPPORTED);
+
+    return pa_context_send_simple_command(c, PA_COMMAND_GET_TRACE, context_get_trace_callback, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_set_trace(pa_context *c, int enable, pa_context_success_cb_t cb, void *userdata) {
+    pa_operation *o;
+    pa_tagstruct *t;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 17, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, (pa_operation_cb_t) cb, userdata);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_SET_TRACE, &tag);
+    pa_tagstruct_put_boolean(t, !!enable);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, pa_context_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
 /*** Server Info ***/
 
 static void context_get_server_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -78,6 +78,14 @@
  * Statistics about memory usage can be fetched using pa_context_stat(),
  * giving a pa_stat_info structure.
  *
+ * \subsection trace_subsec Stream Timing Trace
+ *
+ * The server can record a trace of when playback streams asked for
+ * data, got it, and were mixed, to find out where an underrun came
+ * from. It is switched on and off with pa_context_set_trace() and
+ * fetched with pa_context_get_trace(), which gives one pa_trace_info
+ * structure per server thread.
+ *
  * \subsection sinksrc_subsec Sinks and Sources
  *
  * The server can have an arbitrary number of sinks and sources. Each sink
@@ -589,6 +597,30 @@ pa_operation* pa_context_stat(pa_context *c, pa_stat_info_cb_t cb, void *userdat
 
 /** @} */
 
+/** @{ \name Stream Timing Trace */
+
+/** The stream timing events one server thread recorded. Please note
+ * that this structure can be extended as part of evolutionary API
+ * updates at any time in any new release. \since 0.9.22 */
+typedef struct pa_trace_info {
+    uint32_t thread;                 /**< Number of the thread, only meaningful within one trace */
+    unsigned n_events;               /**< Number of entries in events */
+    const pa_trace_event *events;    /**< The events, oldest first */
+} pa_trace_info;
+
+/** Callback prototype for pa_context_get_trace(). \since 0.9.22 */
+typedef void (*pa_trace_info_cb_t)(pa_context *c, const pa_trace_info *i, int eol, void *userdata);
+
+/** Get the most recent events of the stream timing trace. Each
+ * thread keeps the last few thousand events only. \since 0.9.22 */
+pa_operation* pa_context_get_trace(pa_context *c, pa_trace_info_cb_t cb, void *userdata);
+
+/** Start or stop recording the stream timing trace. Events recorded
+ * earlier are kept when it is stopped. \since 0.9.22 */
+pa_operation* pa_context_set_trace(pa_context *c, int enable, pa_context_success_cb_t cb, void *userdata);
+
+/** @} */
+
 /** @{ \name Cached Samples */
 
 /** Stores information about sample cache entries. Please note that this structure
@@ -38,6 +38,10 @@
 #include <pulsecore/poll.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifndef HAVE_PIPE
 #include <pulsecore/pipe.h>
 #endif
@@ -49,8 +53,10 @@
 
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/llist.h>
 #include <pulsecore/log.h>
+#include <pulsecore/prioq.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/winsock.h>
 #include <pulsecore/macro.h>
@@ -66,6 +72,9 @@ struct pa_io_event {
     pa_io_event_flags_t events;
     struct pollfd *pollfd;
 
+    /* Our key in the epoll set */
+    uint32_t index;
+
     pa_io_event_cb_t callback;
     void *userdata;
     pa_io_event_destroy_cb_t destroy_callback;
@@ -81,6 +90,13 @@ struct pa_time_event {
     pa_bool_t use_rtclock:1;
     pa_usec_t time;
 
+    /* Set while enabled */
+    pa_prioq_item *prioq_item;
+
+    /* Due events are collected before they are dispatched */
+    pa_bool_t dispatch_pending:1;
+    pa_time_event *dispatch_next;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -113,8 +129,25 @@ struct pa_mainloop {
     struct pollfd *pollfds;
     unsigned max_pollfds, n_pollfds;
 
+    /* Enabled time events, ordered by their deadlines */
+    pa_prioq *time_events_prioq;
+
+    /* If epoll is available all IO events are registered with it, and
+     * we just poll on the epoll fd. Then only the IO events that are
+     * ready are looked at after the poll. If registering an fd fails
+     * we fall back to polling on all fds at once for good. */
+    int epoll_fd;
+    pa_bool_t epoll_failed:1;
+    pa_idxset *io_events_by_index;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event *epoll_events;
+    unsigned max_epoll_events, n_epoll_events;
+#endif
+
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
+
+    /* Only with the virtual clock */
+    pa_rtclock_participant *participant;
 
     pa_mainloop_api api;
 
@@ -154,6 +187,58 @@ static pa_io_event_flags_t map_flags_from_libc(short flags) {
         (flags & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t map_flags_to_epoll(pa_io_event_flags_t flags) {
+    return
+        (flags & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+        (flags & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+        (flags & PA_IO_EVENT_ERROR ? EPOLLERR : 0) |
+        (flags & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t map_flags_from_epoll(uint32_t flags) {
+    return
+        (flags & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+        (flags & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+        (flags & EPOLLERR ? PA_IO_EVENT_ERROR : 0) |
+        (flags & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+static int epoll_update(pa_mainloop *m, int op, int fd, pa_io_event_flags_t events, uint32_t index) {
+    struct epoll_event ev;
+
+    pa_assert(m);
+
+    if (m->epoll_fd < 0 || m->epoll_failed)
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = map_flags_to_epoll(events);
+    ev.data.u32 = index;
+
+    if (epoll_ctl(m->epoll_fd, op, fd, &ev) < 0) {
+
+        /* If the fd has already been closed it has already been
+         * removed from the set */
+        if (op == EPOLL_CTL_DEL)
+            return 0;
+
+        /* Happens for fds that are registered twice and for files that
+         * do not support polling */
+        pa_log_debug("epoll_ctl() failed, falling back to poll(): %s", pa_cstrerror(errno));
+
+        /* Another thread might be polling on the epoll fd right now,
+         * so we switch over in pa_mainloop_prepare() */
+        m->epoll_failed = TRUE;
+        m->rebuild_pollfds = TRUE;
+        pa_mainloop_wakeup(m);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
 /* IO events */
 static pa_io_event* mainloop_io_new(
         pa_mainloop_api*a,
@@ -206,6 +291,13 @@ static pa_io_event* mainloop_io_new(
     m->rebuild_pollfds = TRUE;
     m->n_io_events ++;
 
+    pa_assert_se(pa_idxset_put(m->io_events_by_index, e, &e->index) >= 0);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (!e->dead)
+        epoll_update(m, EPOLL_CTL_ADD, fd, events, e->index);
+#endif
+
     pa_mainloop_wakeup(m);
 
     return e;
@@ -220,6 +312,10 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
 
     e->events = events;
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_update(e->mainloop, EPOLL_CTL_MOD, e->fd, events, e->index);
+#endif
+
     if (e->pollfd)
         e->pollfd->events = map_flags_to_libc(events);
     else
@@ -238,6 +334,10 @@ static void mainloop_io_free(pa_io_event *e) {
     e->mainloop->n_io_events --;
     e->mainloop->rebuild_pollfds = TRUE;
 
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_update(e->mainloop, EPOLL_CTL_DEL, e->fd, 0, e->index);
+#endif
+
     pa_mainloop_wakeup(e->mainloop);
 }
 
@@ -363,13 +463,7 @@ static pa_time_event* mainloop_time_new(
         e->use_rtclock= use_rtclock;
 
         m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        e->prioq_item = pa_prioq_put(m->time_events_prioq, e);
     }
 
     e->callback = callback;
@@ -393,26 +487,30 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
 
     t = make_rt(tv, &use_rtclock);
 
+    /* If it was due, whatever the owner asks for now supersedes that */
+    e->dispatch_pending = FALSE;
+
     valid = (t != PA_USEC_INVALID);
     if (e->enabled && !valid) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
+
+        pa_prioq_remove(e->mainloop->time_events_prioq, e->prioq_item);
+        e->prioq_item = NULL;
     } else if (!e->enabled && valid)
         e->mainloop->n_enabled_time_events++;
 
     if ((e->enabled = valid)) {
         e->time = t;
         e->use_rtclock = use_rtclock;
-        pa_mainloop_wakeup(e->mainloop);
-    }
 
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
+        if (e->prioq_item)
+            pa_prioq_reshuffle(e->mainloop->time_events_prioq, e->prioq_item);
+        else
+            e->prioq_item = pa_prioq_put(e->mainloop->time_events_prioq, e);
 
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
-    } else if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+        pa_mainloop_wakeup(e->mainloop);
+    }
 }
 
 static void mainloop_time_free(pa_time_event *e) {
@@ -421,15 +519,16 @@ static void mainloop_time_free(pa_time_event *e) {
 
     e->dead = TRUE;
     e->mainloop->time_events_please_scan ++;
+    e->dispatch_pending = FALSE;
 
     if (e->enabled) {
         pa_assert(e->mainloop->n_enabled_time_events > 0);
         e->mainloop->n_enabled_time_events--;
         e->enabled = FALSE;
-    }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+        pa_prioq_remove(e->mainloop->time_events_prioq, e->prioq_item);
+        e->prioq_item = NULL;
+    }
 
     /* no wakeup needed here. Think about it! */
 }
@@ -475,6 +574,16 @@ static const pa_mainloop_api vtable = {
     .quit = mainloop_quit,
 };
 
+static int time_event_compare(const void *a, const void *b) {
+    const pa_time_event *x = a, *y = b;
+
+    if (x->time < y->time)
+        return -1;
+    if (x->time > y->time)
+        return 1;
+    return 0;
+}
+
 pa_mainloop *pa_mainloop_new(void) {
     pa_mainloop *m;
 
@@ -495,6 +604,23 @@ pa_mainloop *pa_mainloop_new(void) {
 
     m->rebuild_pollfds = TRUE;
 
+    m->time_events_prioq = pa_prioq_new(time_event_compare);
+    m->io_events_by_index = pa_idxset_new(NULL, NULL);
+
+    m->epoll_fd = -1;
+#ifdef HAVE_SYS_EPOLL_H
+    if ((m->epoll_fd = epoll_create(64)) >= 0) {
+        pa_make_fd_cloexec(m->epoll_fd);
+
+        /* The wakeup pipe is the only entry without an IO event */
+        epoll_update(m, EPOLL_CTL_ADD, m->wakeup_pipe[0], PA_IO_EVENT_INPUT, PA_IDXSET_INVALID);
+    } else
+        pa_log_debug("epoll_create() failed, using poll(): %s", pa_cstrerror(errno));
+#endif
+
+    if (pa_rtclock_is_virtual())
+        m->participant = pa_rtclock_participant_new();
+
     m->api = vtable;
     m->api.userdata = m;
 
@@ -515,6 +641,7 @@ static void cleanup_io_events(pa_mainloop *m, pa_bool_t force) {
 
         if (force || e->dead) {
             PA_LLIST_REMOVE(pa_io_event, m->io_events, e);
+            pa_assert_se(pa_idxset_remove_by_index(m->io_events_by_index, e->index) == e);
 
             if (e->dead) {
                 pa_assert(m->io_events_please_scan > 0);
@@ -553,6 +680,9 @@ static void cleanup_time_events(pa_mainloop *m, pa_bool_t force) {
                 pa_assert(m->n_enabled_time_events > 0);
                 m->n_enabled_time_events--;
                 e->enabled = FALSE;
+
+                pa_prioq_remove(m->time_events_prioq, e->prioq_item);
+                e->prioq_item = NULL;
             }
 
             if (e->destroy_callback)
@@ -607,8 +737,20 @@ void pa_mainloop_free(pa_mainloop* m) {
 
     pa_xfree(m->pollfds);
 
+    pa_prioq_free(m->time_events_prioq, NULL, NULL);
+    pa_idxset_free(m->io_events_by_index, NULL, NULL);
+
+    if (m->epoll_fd >= 0)
+        pa_close(m->epoll_fd);
+#ifdef HAVE_SYS_EPOLL_H
+    pa_xfree(m->epoll_events);
+#endif
+
     pa_close_pipe(m->wakeup_pipe);
 
+    if (m->participant)
+        pa_rtclock_participant_free(m->participant);
+
     pa_xfree(m);
 }
 
@@ -640,6 +782,17 @@ static void rebuild_pollfds(pa_mainloop *m) {
     m->n_pollfds = 0;
     p = m->pollfds;
 
+    if (m->epoll_fd >= 0) {
+        /* The wakeup pipe is part of the epoll set */
+        m->pollfds[0].fd = m->epoll_fd;
+        m->pollfds[0].events = POLLIN;
+        m->pollfds[0].revents = 0;
+        m->n_pollfds = 1;
+
+        m->rebuild_pollfds = FALSE;
+        return;
+    }
+
     if (m->wakeup_pipe[0] >= 0) {
         m->pollfds[0].fd = m->wakeup_pipe[0];
         m->pollfds[0].events = POLLIN;
@@ -666,12 +819,64 @@ static void rebuild_pollfds(pa_mainloop *m) {
     m->rebuild_pollfds = FALSE;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+static int collect_epoll(pa_mainloop *m) {
+    int r;
+
+    pa_assert(m);
+    pa_assert(m->epoll_fd >= 0);
+
+    if (m->max_epoll_events < m->n_io_events + 1) {
+        m->max_epoll_events = (m->n_io_events + 1) * 2;
+        m->epoll_events = pa_xrealloc(m->epoll_events, sizeof(struct epoll_event) * m->max_epoll_events);
+    }
+
+    m->n_epoll_events = 0;
+
+    if ((r = epoll_wait(m->epoll_fd, m->epoll_events, (int) m->max_epoll_events, 0)) < 0)
+        return r;
+
+    m->n_epoll_events = (unsigned) r;
+    return r;
+}
+
+static unsigned dispatch_epoll(pa_mainloop *m) {
+    unsigned r = 0, i;
+
+    for (i = 0; i < m->n_epoll_events; i++) {
+        pa_io_event *e;
+
+        if (m->quit)
+            break;
+
+        /* The event might have been freed by one of the callbacks
+         * before, but then it is still around, just marked dead. */
+        if (!(e = pa_idxset_get_by_index(m->io_events_by_index, m->epoll_events[i].data.u32)) || e->dead)
+            continue;
+
+        pa_assert(e->callback);
+
+        e->callback(&m->api, e, e->fd, map_flags_from_epoll(m->epoll_events[i].events), e->userdata);
+        r++;
+    }
+
+    m->n_epoll_events = 0;
+
+    return r;
+}
+#endif
+
 static unsigned dispatch_pollfds(pa_mainloop *m) {
     pa_io_event *e;
     unsigned r = 0, k;
 
     pa_assert(m->poll_func_ret > 0);
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (m->n_epoll_events > 0)
+        return dispatch_epoll(m);
+#endif
+
     k = m->poll_func_ret;
 
     PA_LLIST_FOREACH(e, m->io_events) {
@@ -718,28 +923,9 @@ static unsigned dispatch_defer(pa_mainloop *m) {
 }
 
 static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
     pa_assert(m);
 
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
-
-    m->cached_next_time_event = n;
-    return n;
+    return pa_prioq_peek(m->time_events_prioq);
 }
 
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
@@ -747,7 +933,7 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     pa_usec_t clock_now;
 
     if (m->n_enabled_time_events <= 0)
-        return PA_USEC_INVALID;
+        return m->participant ? PA_RTCLOCK_VIRTUAL_SLICE_USEC : PA_USEC_INVALID;
 
     pa_assert_se(t = find_next_time_event(m));
 
@@ -759,11 +945,16 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     if (t->time <= clock_now)
         return 0;
 
+    /* The virtual clock might move ahead while we sleep, so check
+     * back often */
+    if (m->participant)
+        return PA_MIN(t->time - clock_now, PA_RTCLOCK_VIRTUAL_SLICE_USEC);
+
     return t->time - clock_now;
 }
 
 static unsigned dispatch_timeout(pa_mainloop *m) {
-    pa_time_event *e;
+    pa_time_event *e, *n, *due = NULL, **tail = &due;
     pa_usec_t now;
     unsigned r = 0;
     pa_assert(m);
@@ -773,25 +964,41 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* First take all events that are due off the queue, so that an
+     * event that is restarted from a callback with a time in the past
+     * is not dispatched again before the next iteration. */
+    while ((e = find_next_time_event(m)) && e->time <= now) {
+        pa_assert(e->enabled);
+        pa_assert(!e->dead);
 
-        if (m->quit)
-            break;
+        /* Disable time event */
+        mainloop_time_restart(e, NULL);
 
-        if (e->dead || !e->enabled)
+        e->dispatch_pending = TRUE;
+        e->dispatch_next = NULL;
+        *tail = e;
+        tail = &e->dispatch_next;
+    }
+
+    /* Events that are freed meanwhile stay around until scan_dead(),
+     * so walking the list is safe. */
+    for (e = due; e; e = n) {
+        struct timeval tv;
+
+        n = e->dispatch_next;
+
+        if (!e->dispatch_pending)
             continue;
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+        e->dispatch_pending = FALSE;
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        if (m->quit)
+            continue;
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        pa_assert(e->callback);
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
 
-            r++;
-        }
+        r++;
     }
 
     return r;
@@ -832,6 +1039,11 @@ int pa_mainloop_prepare(pa_mainloop *m, int timeout) {
     if (m->quit)
         goto quit;
 
+    if (m->epoll_failed && m->epoll_fd >= 0) {
+        pa_close(m->epoll_fd);
+        m->epoll_fd = -1;
+    }
+
     if (m->n_enabled_defer_events <= 0) {
 
         if (m->rebuild_pollfds)
@@ -861,6 +1073,22 @@ static int usec_to_timeout(pa_usec_t u) {
     return (u + PA_USEC_PER_MSEC - 1) / PA_USEC_PER_MSEC;
 }
 
+/* With the virtual clock we poll in short slices (see
+ * calc_next_timeout()). A slice that passed without any event means we
+ * are idle until our next timer, and the clock may skip ahead to
+ * it. Anything else means we have work to do. */
+static void update_participant(pa_mainloop *m) {
+    pa_time_event *t;
+
+    if (m->poll_func_ret != 0 || m->prepared_timeout == 0 || m->n_enabled_defer_events > 0) {
+        pa_rtclock_participant_busy(m->participant);
+        return;
+    }
+
+    t = m->n_enabled_time_events > 0 ? find_next_time_event(m) : NULL;
+    pa_rtclock_participant_idle(m->participant, t ? t->time : PA_USEC_INVALID);
+}
+
 int pa_mainloop_poll(pa_mainloop *m) {
     pa_assert(m);
     pa_assert(m->state == STATE_PREPARED);
@@ -901,8 +1129,24 @@ int pa_mainloop_poll(pa_mainloop *m) {
             else
                 pa_log("poll(): %s", pa_cstrerror(errno));
         }
+
+#ifdef HAVE_SYS_EPOLL_H
+        /* We polled on the epoll fd only, now find out what is ready.
+         * This costs one more syscall, but keeps ppoll()'s timer
+         * precision and the poll function semantics. */
+        if (m->poll_func_ret > 0 && m->epoll_fd >= 0)
+            if ((m->poll_func_ret = collect_epoll(m)) < 0) {
+                if (errno == EINTR)
+                    m->poll_func_ret = 0;
+                else
+                    pa_log("epoll_wait(): %s", pa_cstrerror(errno));
+            }
+#endif
     }
 
+    if (m->participant)
+        update_participant(m);
+
     m->state = m->poll_func_ret < 0 ? STATE_PASSIVE : STATE_POLLED;
     return m->poll_func_ret;
 
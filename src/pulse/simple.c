@@ -29,9 +29,11 @@
 #include <stdlib.h>
 
 #include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
 #include <pulse/thread-mainloop.h>
 #include <pulse/xmalloc.h>
 
+#include <pulsecore/core-rtclock.h>
 #include <pulsecore/native-common.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -48,6 +50,16 @@ struct pa_simple {
     size_t read_index, read_length;
 
     int operation_success;
+
+    pa_bool_t buffered;
+    size_t frame_size, chunk_size;
+
+    /* If non-zero the blocked thread is only woken up once this many
+     * bytes can be transferred */
+    size_t wake_bytes;
+
+    pa_time_event *timeout_event;
+    pa_bool_t timed_out;
 };
 
 #define CHECK_VALIDITY_RETURN_ANY(rerror, expression, error, ret)       \
@@ -126,6 +138,16 @@ static void stream_request_cb(pa_stream *s, size_t length, void *userdata) {
     pa_simple *p = userdata;
     pa_assert(p);
 
+    if (p->wake_bytes > 0) {
+
+        /* Data written lock-free might not have been passed on yet */
+        if (p->buffered && p->direction == PA_STREAM_PLAYBACK)
+            length = pa_stream_writable_size_lockfree(s);
+
+        if (length < p->wake_bytes)
+            return;
+    }
+
     pa_threaded_mainloop_signal(p->mainloop, 0);
 }
 
@@ -137,7 +159,60 @@ static void stream_latency_update_cb(pa_stream *s, void *userdata) {
     pa_threaded_mainloop_signal(p->mainloop, 0);
 }
 
-pa_simple* pa_simple_new(
+static void timeout_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_simple *p = userdata;
+
+    pa_assert(p);
+    pa_assert(p->timeout_event == e);
+
+    p->timed_out = TRUE;
+    pa_threaded_mainloop_signal(p->mainloop, 0);
+}
+
+/* Called with the lock held. Waits until one of the callbacks signals
+ * us, returns FALSE if the deadline passed instead. */
+static pa_bool_t wait_until(pa_simple *p, pa_usec_t deadline) {
+    pa_assert(p);
+
+    if (deadline != PA_USEC_INVALID) {
+
+        if (!p->timeout_event) {
+            pa_mainloop_api *a;
+            struct timeval tv;
+
+            if (deadline <= pa_rtclock_now())
+                return FALSE;
+
+            a = pa_threaded_mainloop_get_api(p->mainloop);
+            p->timed_out = FALSE;
+            p->timeout_event = a->time_new(a, pa_timeval_rtstore(&tv, deadline, TRUE), timeout_cb, p);
+        }
+
+        if (p->timed_out)
+            return FALSE;
+    }
+
+    pa_threaded_mainloop_wait(p->mainloop);
+    return TRUE;
+}
+
+/* Called with the lock held */
+static void wait_done(pa_simple *p) {
+    pa_assert(p);
+
+    if (p->timeout_event) {
+        pa_mainloop_api *a;
+
+        a = pa_threaded_mainloop_get_api(p->mainloop);
+        a->time_free(p->timeout_event);
+        p->timeout_event = NULL;
+    }
+
+    p->timed_out = FALSE;
+    p->wake_bytes = 0;
+}
+
+static pa_simple* simple_new(
         const char *server,
         const char *name,
         pa_stream_direction_t dir,
@@ -146,6 +221,7 @@ pa_simple* pa_simple_new(
         const pa_sample_spec *ss,
         const pa_channel_map *map,
         const pa_buffer_attr *attr,
+        pa_bool_t buffered,
         int *rerror) {
 
     pa_simple *p;
@@ -159,6 +235,8 @@ pa_simple* pa_simple_new(
 
     p = pa_xnew0(pa_simple, 1);
     p->direction = dir;
+    p->buffered = buffered;
+    p->frame_size = pa_frame_size(ss);
 
     if (!(p->mainloop = pa_threaded_mainloop_new()))
         goto fail;
@@ -205,6 +283,11 @@ pa_simple* pa_simple_new(
     pa_stream_set_write_callback(p->stream, stream_request_cb, p);
     pa_stream_set_latency_update_callback(p->stream, stream_latency_update_cb, p);
 
+    if (buffered && dir == PA_STREAM_PLAYBACK && pa_stream_enable_lockfree(p->stream) < 0) {
+        error = pa_context_errno(p->context);
+        goto unlock_and_fail;
+    }
+
     if (dir == PA_STREAM_PLAYBACK)
         r = pa_stream_connect_playback(p->stream, dev, attr,
                                        PA_STREAM_INTERPOLATE_TIMING
@@ -238,6 +321,22 @@ pa_simple* pa_simple_new(
         pa_threaded_mainloop_wait(p->mainloop);
     }
 
+    if (buffered) {
+        const pa_buffer_attr *a;
+
+        /* Move data in pieces of what the server asks for at once */
+        a = pa_stream_get_buffer_attr(p->stream);
+        p->chunk_size = dir == PA_STREAM_PLAYBACK ? a->minreq : a->fragsize;
+
+        if (p->chunk_size <= 0 || p->chunk_size == (size_t) -1)
+            p->chunk_size = pa_usec_to_bytes(10*PA_USEC_PER_MSEC, ss);
+
+        p->chunk_size -= p->chunk_size % p->frame_size;
+
+        if (p->chunk_size <= 0)
+            p->chunk_size = p->frame_size;
+    }
+
     pa_threaded_mainloop_unlock(p->mainloop);
 
     return p;
@@ -252,6 +351,34 @@ fail:
     return NULL;
 }
 
+pa_simple* pa_simple_new(
+        const char *server,
+        const char *name,
+        pa_stream_direction_t dir,
+        const char *dev,
+        const char *stream_name,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_buffer_attr *attr,
+        int *rerror) {
+
+    return simple_new(server, name, dir, dev, stream_name, ss, map, attr, FALSE, rerror);
+}
+
+pa_simple* pa_simple_new_buffered(
+        const char *server,
+        const char *name,
+        pa_stream_direction_t dir,
+        const char *dev,
+        const char *stream_name,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_buffer_attr *attr,
+        int *rerror) {
+
+    return simple_new(server, name, dir, dev, stream_name, ss, map, attr, TRUE, rerror);
+}
+
 void pa_simple_free(pa_simple *s) {
     pa_assert(s);
 
@@ -272,27 +399,80 @@ void pa_simple_free(pa_simple *s) {
     pa_xfree(s);
 }
 
-int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
+static ssize_t simple_write(pa_simple *p, const void*data, size_t length, pa_usec_t deadline, int *rerror) {
+    size_t done = 0;
+
     pa_assert(p);
 
     CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE, -1);
     CHECK_VALIDITY_RETURN_ANY(rerror, data, PA_ERR_INVALID, -1);
     CHECK_VALIDITY_RETURN_ANY(rerror, length > 0, PA_ERR_INVALID, -1);
-
-    pa_threaded_mainloop_lock(p->mainloop);
-
-    CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+    CHECK_VALIDITY_RETURN_ANY(rerror, !p->buffered || length % p->frame_size == 0, PA_ERR_INVALID, -1);
 
     while (length > 0) {
         size_t l;
         int r;
 
-        while (!(l = pa_stream_writable_size(p->stream))) {
-            pa_threaded_mainloop_wait(p->mainloop);
-            CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+        if (p->buffered) {
+            size_t writable;
+
+            /* As long as the server has room for it we copy the data
+             * right into the memory pool and leave it to the event
+             * loop thread to pass it on, without taking the lock */
+
+            writable = pa_stream_writable_size_lockfree(p->stream);
+            l = PA_MIN(length, p->chunk_size);
+            l = PA_MIN(l, writable);
+            l -= l % p->frame_size;
+
+            if (l > 0) {
+                r = pa_stream_write_lockfree(p->stream, data, l);
+
+                if (r == 0)
+                    goto next;
+
+                if (r == -PA_ERR_TOOLARGE && p->chunk_size > p->frame_size) {
+                    p->chunk_size /= 2;
+                    p->chunk_size -= p->chunk_size % p->frame_size;
+                    continue;
+                }
+
+                /* The queue is full, or the stream died, the slow
+                 * path will sort it out */
+            }
+        }
+
+        pa_threaded_mainloop_lock(p->mainloop);
+
+        CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+
+        if (p->buffered) {
+            /* Don't wake us up for every little request */
+            p->wake_bytes = PA_MIN(length, p->chunk_size);
+
+            while ((l = pa_stream_writable_size_lockfree(p->stream)) < p->frame_size) {
+                if (!wait_until(p, deadline))
+                    goto unlock_and_finish;
+
+                CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+            }
+
+            l = PA_MIN(l, p->chunk_size);
+            l -= l % p->frame_size;
+
+        } else {
+
+            while (!(l = pa_stream_writable_size(p->stream))) {
+                if (!wait_until(p, deadline))
+                    goto unlock_and_finish;
+
+                CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
+            }
+
+            CHECK_SUCCESS_GOTO(p, rerror, l != (size_t) -1, unlock_and_fail);
         }
 
-        CHECK_SUCCESS_GOTO(p, rerror, l != (size_t) -1, unlock_and_fail);
+        wait_done(p);
 
         if (l > length)
             l = length;
@@ -300,19 +480,42 @@ int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
         r = pa_stream_write(p->stream, data, l, NULL, 0LL, PA_SEEK_RELATIVE);
         CHECK_SUCCESS_GOTO(p, rerror, r >= 0, unlock_and_fail);
 
+        pa_threaded_mainloop_unlock(p->mainloop);
+
+    next:
         data = (const uint8_t*) data + l;
         length -= l;
+        done += l;
     }
 
+    return (ssize_t) done;
+
+unlock_and_finish:
+    wait_done(p);
     pa_threaded_mainloop_unlock(p->mainloop);
-    return 0;
+    return (ssize_t) done;
 
 unlock_and_fail:
+    wait_done(p);
     pa_threaded_mainloop_unlock(p->mainloop);
     return -1;
 }
 
-int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
+int pa_simple_write(pa_simple *p, const void*data, size_t length, int *rerror) {
+    return simple_write(p, data, length, PA_USEC_INVALID, rerror) < 0 ? -1 : 0;
+}
+
+ssize_t pa_simple_write_with_timeout(pa_simple *p, const void*data, size_t length, pa_usec_t timeout, int *rerror) {
+    pa_usec_t deadline;
+
+    deadline = timeout == PA_USEC_INVALID ? PA_USEC_INVALID : pa_rtclock_now() + timeout;
+
+    return simple_write(p, data, length, deadline, rerror);
+}
+
+static ssize_t simple_read(pa_simple *p, void*data, size_t length, pa_usec_t deadline, int *rerror) {
+    size_t done = 0;
+
     pa_assert(p);
 
     CHECK_VALIDITY_RETURN_ANY(rerror, p->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE, -1);
@@ -333,7 +536,14 @@ int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
             CHECK_SUCCESS_GOTO(p, rerror, r == 0, unlock_and_fail);
 
             if (!p->read_data) {
-                pa_threaded_mainloop_wait(p->mainloop);
+
+                /* Don't wake us up for every little fragment */
+                if (p->buffered)
+                    p->wake_bytes = PA_MIN(length, p->chunk_size);
+
+                if (!wait_until(p, deadline))
+                    goto unlock_and_finish;
+
                 CHECK_DEAD_GOTO(p, rerror, unlock_and_fail);
             } else
                 p->read_index = 0;
@@ -344,6 +554,7 @@ int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
 
         data = (uint8_t*) data + l;
         length -= l;
+        done += l;
 
         p->read_index += l;
         p->read_length -= l;
@@ -360,14 +571,29 @@ int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
         }
     }
 
+unlock_and_finish:
+    wait_done(p);
     pa_threaded_mainloop_unlock(p->mainloop);
-    return 0;
+    return (ssize_t) done;
 
 unlock_and_fail:
+    wait_done(p);
     pa_threaded_mainloop_unlock(p->mainloop);
     return -1;
 }
 
+int pa_simple_read(pa_simple *p, void*data, size_t length, int *rerror) {
+    return simple_read(p, data, length, PA_USEC_INVALID, rerror) < 0 ? -1 : 0;
+}
+
+ssize_t pa_simple_read_with_timeout(pa_simple *p, void*data, size_t length, pa_usec_t timeout, int *rerror) {
+    pa_usec_t deadline;
+
+    deadline = timeout == PA_USEC_INVALID ? PA_USEC_INVALID : pa_rtclock_now() + timeout;
+
+    return simple_read(p, data, length, deadline, rerror);
+}
+
 static void success_cb(pa_stream *s, int success, void *userdata) {
     pa_simple *p = userdata;
 
@@ -28,6 +28,7 @@
 #include <pulse/sample.h>
 #include <pulse/channelmap.h>
 #include <pulse/def.h>
+#include <pulse/timeval.h>
 #include <pulse/cdecl.h>
 #include <pulse/version.h>
 
@@ -85,6 +86,20 @@
  * \li pa_simple_get_playback_latency() - Will return the total latency of
  *                                        the playback pipeline.
  *
+ * \section buffered_sec Buffered connections
+ *
+ * Applications that move lots of small pieces of data, or that must
+ * not block for long, may create the connection with
+ * pa_simple_new_buffered() instead. Playback data is then copied
+ * straight into the shared memory pool and handed to the event loop
+ * thread without waiting for it, as long as the server has room for
+ * it. Threads blocked in pa_simple_write() or pa_simple_read() are
+ * only woken up once a whole fragment can be transferred.
+ *
+ * pa_simple_write_with_timeout() and pa_simple_read_with_timeout()
+ * give up after the specified time and return how much could be
+ * transferred until then.
+ *
  * \section cleanup_sec Cleanup
  *
  * Once playback or capture is complete, the connection should be closed
@@ -125,18 +140,45 @@ pa_simple* pa_simple_new(
     int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
     );
 
+/** Like pa_simple_new(), but avoids locking and waking up the
+ * calling thread as far as possible, see \ref buffered_sec. Playback
+ * data must be written in whole frames. \since 0.9.22 */
+pa_simple* pa_simple_new_buffered(
+    const char *server,                 /**< Server name, or NULL for default */
+    const char *name,                   /**< A descriptive name for this client (application name, ...) */
+    pa_stream_direction_t dir,          /**< Open this stream for recording or playback? */
+    const char *dev,                    /**< Sink (resp. source) name, or NULL for default */
+    const char *stream_name,            /**< A descriptive name for this client (application name, song title, ...) */
+    const pa_sample_spec *ss,           /**< The sample type to use */
+    const pa_channel_map *map,          /**< The channel map to use, or NULL for default */
+    const pa_buffer_attr *attr,         /**< Buffering attributes, or NULL for default */
+    int *error                          /**< A pointer where the error code is stored when the routine returns NULL. It is OK to pass NULL here. */
+    );
+
 /** Close and free the connection to the server. The connection objects becomes invalid when this is called. */
 void pa_simple_free(pa_simple *s);
 
 /** Write some data to the server */
 int pa_simple_write(pa_simple *s, const void*data, size_t bytes, int *error);
 
+/** Write some data to the server, but block for at most timeout
+ * usec. Returns the number of bytes written, which is less than bytes
+ * if the time ran out, or a negative value on failure. Pass
+ * PA_USEC_INVALID to block as long as necessary. \since 0.9.22 */
+ssize_t pa_simple_write_with_timeout(pa_simple *s, const void*data, size_t bytes, pa_usec_t timeout, int *error);
+
 /** Wait until all data already written is played by the daemon */
 int pa_simple_drain(pa_simple *s, int *error);
 
 /** Read some data from the server */
 int pa_simple_read(pa_simple *s, void*data, size_t bytes, int *error);
 
+/** Read some data from the server, but block for at most timeout
+ * usec. Returns the number of bytes read, which is less than bytes if
+ * the time ran out, or a negative value on failure. Pass
+ * PA_USEC_INVALID to block as long as necessary. \since 0.9.22 */
+ssize_t pa_simple_read_with_timeout(pa_simple *s, void*data, size_t bytes, pa_usec_t timeout, int *error);
+
 /** Return the playback latency. */
 pa_usec_t pa_simple_get_latency(pa_simple *s, int *error);
 
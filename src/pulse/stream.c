@@ -40,6 +40,7 @@
 #include <pulsecore/macro.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/flist.h>
 
 #include "fork-detect.h"
 #include "internal.h"
@@ -51,6 +52,10 @@
 #define SMOOTHER_HISTORY_TIME (5000*PA_USEC_PER_MSEC)
 #define SMOOTHER_MIN_HISTORY (4)
 
+#define LOCKFREE_QUEUE_SIZE 128
+
+PA_STATIC_FLIST_DECLARE(lockfree_chunks, 0, pa_xfree);
+
 pa_stream *pa_stream_new(pa_context *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map) {
     return pa_stream_new_with_proplist(c, name, ss, map, NULL);
 }
@@ -149,8 +154,30 @@ pa_stream *pa_stream_new_with_proplist(
     s->write_memblock = NULL;
     s->write_data = NULL;
 
+    pa_zero(s->ring_shm);
+    s->ring = NULL;
+    s->ring_cell = NULL;
+    s->ring_cell_max = 0;
+    s->ring_io_event = NULL;
+    s->ring_waiting = FALSE;
+    PA_LLIST_HEAD_INIT(pa_ring_pending, s->ring_pending);
+    s->ring_pending_tail = NULL;
+
+    s->lockfree_queue = NULL;
+    s->lockfree_mempool = NULL;
+    s->lockfree_io_event = NULL;
+    s->lockfree_waiting = FALSE;
+    pa_atomic_store(&s->lockfree_ready, 0);
+    pa_atomic_store(&s->lockfree_submitted, 0);
+    pa_atomic_store(&s->lockfree_credit, 0);
+    s->lockfree_drained = 0;
+    s->timing_aupdate = NULL;
+    memset(s->timing_snapshot, 0, sizeof(s->timing_snapshot));
+
     pa_memchunk_reset(&s->peek_memchunk);
     s->peek_data = NULL;
+    s->peekv_chunks = NULL;
+    s->n_peekv_chunks = s->n_peekv_allocated = 0;
     s->record_memblockq = NULL;
 
     memset(&s->timing_info, 0, sizeof(s->timing_info));
@@ -166,6 +193,7 @@ pa_stream *pa_stream_new_with_proplist(
 
     s->auto_timing_update_event = NULL;
     s->auto_timing_update_requested = FALSE;
+    s->timing_pushed = FALSE;
     s->auto_timing_interval_usec = AUTO_TIMING_INTERVAL_START_USEC;
 
     reset_callbacks(s);
@@ -179,6 +207,179 @@ pa_stream *pa_stream_new_with_proplist(
     return s;
 }
 
+static void ring_pending_free(pa_ring_pending *p) {
+    pa_assert(p);
+
+    if (p->command)
+        pa_tagstruct_free(p->command);
+
+    pa_xfree(p->data);
+    pa_xfree(p);
+}
+
+static void ring_pending_append(pa_stream *s, pa_ring_pending *p) {
+    pa_assert(s);
+    pa_assert(p);
+
+    if (s->ring_pending_tail)
+        PA_LLIST_INSERT_AFTER(pa_ring_pending, s->ring_pending, s->ring_pending_tail, p);
+    else
+        PA_LLIST_PREPEND(pa_ring_pending, s->ring_pending, p);
+
+    s->ring_pending_tail = p;
+}
+
+/* Drops the data that still waits for room in the ring. Commands
+ * queued behind it are sent right away, since nothing they need to
+ * wait for is left. */
+static void ring_drop_pending(pa_stream *s) {
+    pa_ring_pending *p;
+
+    pa_assert(s);
+
+    while ((p = s->ring_pending)) {
+        PA_LLIST_REMOVE(pa_ring_pending, s->ring_pending, p);
+
+        if (p->command) {
+            pa_pstream_send_tagstruct(s->context->pstream, p->command);
+            p->command = NULL;
+        }
+
+        ring_pending_free(p);
+    }
+
+    s->ring_pending_tail = NULL;
+}
+
+static void ring_free(pa_stream *s) {
+    pa_ring_pending *p;
+
+    pa_assert(s);
+
+    while ((p = s->ring_pending)) {
+        PA_LLIST_REMOVE(pa_ring_pending, s->ring_pending, p);
+        ring_pending_free(p);
+    }
+
+    s->ring_pending_tail = NULL;
+
+    if (s->ring_io_event) {
+        pa_assert(s->mainloop);
+        s->mainloop->io_free(s->ring_io_event);
+        s->ring_io_event = NULL;
+    }
+
+    if (s->ring) {
+        if (s->ring_waiting)
+            pa_shmasyncq_write_after_poll(s->ring);
+
+        pa_shmasyncq_free(s->ring);
+        s->ring = NULL;
+    }
+
+    s->ring_waiting = FALSE;
+    s->ring_cell = NULL;
+
+    if (s->ring_shm.ptr)
+        pa_shm_free(&s->ring_shm);
+}
+
+static void lockfree_chunk_free(pa_memchunk *c) {
+    pa_assert(c);
+
+    pa_memblock_unref(c->memblock);
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(lockfree_chunks), c) < 0)
+        pa_xfree(c);
+}
+
+/* Stops taking data from the submitting thread. It might be in the
+ * middle of pa_stream_write_lockfree() right now, hence the queue and
+ * the pool stay until lockfree_free(). */
+static void lockfree_unlink(pa_stream *s) {
+    pa_memchunk *c;
+
+    pa_assert(s);
+
+    pa_atomic_store(&s->lockfree_ready, 0);
+
+    if (s->lockfree_io_event) {
+        pa_assert(s->mainloop);
+        s->mainloop->io_free(s->lockfree_io_event);
+        s->lockfree_io_event = NULL;
+    }
+
+    if (s->lockfree_queue) {
+        if (s->lockfree_waiting)
+            pa_asyncq_read_after_poll(s->lockfree_queue);
+
+        while ((c = pa_asyncq_pop(s->lockfree_queue, FALSE)))
+            lockfree_chunk_free(c);
+    }
+
+    s->lockfree_waiting = FALSE;
+}
+
+static void lockfree_free(pa_stream *s) {
+    pa_memchunk *c;
+
+    pa_assert(s);
+
+    lockfree_unlink(s);
+
+    if (s->lockfree_queue) {
+        /* Whatever was pushed after we were unlinked */
+        while ((c = pa_asyncq_pop(s->lockfree_queue, FALSE)))
+            lockfree_chunk_free(c);
+
+        pa_asyncq_free(s->lockfree_queue, NULL);
+        s->lockfree_queue = NULL;
+    }
+
+    if (s->lockfree_mempool) {
+        pa_mempool_free(s->lockfree_mempool);
+        s->lockfree_mempool = NULL;
+    }
+}
+
+/* Makes what pa_stream_get_latency() would return right now available
+ * to pa_stream_get_latency_lockfree() */
+static void lockfree_publish_timing(pa_stream *s) {
+    pa_stream_timing_snapshot *t;
+    pa_usec_t usec;
+    int negative = 0;
+    unsigned j;
+
+    pa_assert(s);
+
+    if (!s->timing_aupdate)
+        return;
+
+    j = pa_aupdate_write_begin(s->timing_aupdate);
+    t = &s->timing_snapshot[j];
+
+    /* Check first, so that we don't touch the context error */
+    t->valid =
+        s->context &&
+        s->state == PA_STREAM_READY &&
+        s->direction != PA_STREAM_UPLOAD &&
+        s->timing_info_valid &&
+        !s->timing_info.write_index_corrupt &&
+        !s->timing_info.read_index_corrupt &&
+        pa_stream_get_latency(s, &usec, &negative) >= 0;
+
+    if (t->valid) {
+        t->taken = pa_rtclock_now();
+        t->latency = negative ? -(int64_t) usec : (int64_t) usec;
+        t->running = s->smoother && !s->corked && !s->suspended && s->timing_info.playing;
+        t->drained = s->lockfree_drained;
+    }
+
+    j = pa_aupdate_write_swap(s->timing_aupdate);
+    s->timing_snapshot[j] = *t;
+    pa_aupdate_write_end(s->timing_aupdate);
+}
+
 static void stream_unlink(pa_stream *s) {
     pa_operation *o, *n;
     pa_assert(s);
@@ -216,9 +417,27 @@ static void stream_unlink(pa_stream *s) {
         s->mainloop->time_free(s->auto_timing_update_event);
     }
 
+    ring_free(s);
+    lockfree_unlink(s);
+    lockfree_publish_timing(s);
+
     reset_callbacks(s);
 }
 
+static void peekv_release(pa_stream *s) {
+    unsigned i;
+
+    pa_assert(s);
+
+    for (i = 0; i < s->n_peekv_chunks; i++)
+        if (s->peekv_chunks[i].memblock) {
+            pa_memblock_release(s->peekv_chunks[i].memblock);
+            pa_memblock_unref(s->peekv_chunks[i].memblock);
+        }
+
+    s->n_peekv_chunks = 0;
+}
+
 static void stream_free(pa_stream *s) {
     pa_assert(s);
 
@@ -226,7 +445,7 @@ static void stream_free(pa_stream *s) {
 
     if (s->write_memblock) {
         pa_memblock_release(s->write_memblock);
-        pa_memblock_unref(s->write_data);
+        pa_memblock_unref(s->write_memblock);
     }
 
     if (s->peek_memchunk.memblock) {
@@ -235,6 +454,11 @@ static void stream_free(pa_stream *s) {
         pa_memblock_unref(s->peek_memchunk.memblock);
     }
 
+    peekv_release(s);
+    pa_xfree(s->peekv_chunks);
+
+    lockfree_free(s);
+
     if (s->record_memblockq)
         pa_memblockq_free(s->record_memblockq);
 
@@ -244,6 +468,10 @@ static void stream_free(pa_stream *s) {
     if (s->smoother)
         pa_smoother_free(s->smoother);
 
+    if (s->timing_aupdate)
+        pa_aupdate_free(s->timing_aupdate);
+
+    pa_xfree(s->create_device);
     pa_xfree(s->device_name);
     pa_xfree(s);
 }
@@ -299,6 +527,9 @@ void pa_stream_set_state(pa_stream *s, pa_stream_state_t st) {
 
     s->state = st;
 
+    pa_atomic_store(&s->lockfree_ready, st == PA_STREAM_READY && s->lockfree_queue);
+    lockfree_publish_timing(s);
+
     if (s->state_callback)
         s->state_callback(s, s->state_userdata);
 
@@ -315,8 +546,12 @@ static void request_auto_timing_update(pa_stream *s, pa_bool_t force) {
     if (!(s->flags & PA_STREAM_AUTO_TIMING_UPDATE))
         return;
 
-    if (s->state == PA_STREAM_READY &&
-        (force || !s->auto_timing_update_requested)) {
+    if (!force && s->timing_pushed)
+        /* The server sent us fresh timing data with a data request,
+         * no need to ask for it on the timer */
+        s->timing_pushed = FALSE;
+    else if (s->state == PA_STREAM_READY &&
+             (force || !s->auto_timing_update_requested)) {
         pa_operation *o;
 
 /*         pa_log("Automatically requesting new timing data"); */
@@ -412,6 +647,8 @@ static void check_smoother_status(pa_stream *s, pa_bool_t aposteriori, pa_bool_t
 
     /* Please note that we have no idea if playback actually started
      * if prebuf is non-zero! */
+
+    lockfree_publish_timing(s);
 }
 
 void pa_command_stream_moved(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -715,6 +952,77 @@ finish:
         pa_proplist_free(pl);
 }
 
+static void update_smoother(pa_stream *s);
+
+/* Applies the timing snapshot the server may append to a data request
+ * since protocol version 17 */
+static int handle_pushed_timing(pa_stream *s, pa_tagstruct *t) {
+    pa_timing_info *i;
+    pa_bool_t has_timing, playing;
+    pa_usec_t sink_usec;
+    struct timeval remote, now;
+    int64_t read_index;
+    uint64_t underrun_for, playing_for;
+
+    if (pa_tagstruct_get_boolean(t, &has_timing) < 0)
+        return -1;
+
+    if (!has_timing)
+        return 0;
+
+    if (pa_tagstruct_get_usec(t, &sink_usec) < 0 ||
+        pa_tagstruct_get_boolean(t, &playing) < 0 ||
+        pa_tagstruct_get_timeval(t, &remote) < 0 ||
+        pa_tagstruct_gets64(t, &read_index) < 0 ||
+        pa_tagstruct_getu64(t, &underrun_for) < 0 ||
+        pa_tagstruct_getu64(t, &playing_for) < 0)
+        return -1;
+
+    if (!s || s->state != PA_STREAM_READY)
+        return 0;
+
+    i = &s->timing_info;
+
+    /* We need a full update first to learn the write index and the
+     * transport latency, and after a flush or seek a snapshot might
+     * have been taken before the server processed it */
+    if (!s->timing_info_valid || i->read_index_corrupt)
+        return 0;
+
+    pa_gettimeofday(&now);
+
+    if (i->synchronized_clocks) {
+
+        /* Don't go back in time, a reply to an explicit update might
+         * have been more recent */
+        if (pa_timeval_cmp(&remote, &i->timestamp) < 0 || pa_timeval_cmp(&remote, &now) > 0)
+            return 0;
+
+        i->transport_usec = pa_timeval_diff(&now, &remote);
+        i->timestamp = remote;
+    } else {
+        /* Assume it took as long as the last time */
+        i->timestamp = now;
+        pa_timeval_sub(&i->timestamp, i->transport_usec);
+    }
+
+    i->sink_usec = sink_usec;
+    i->read_index = read_index;
+    i->playing = (int) playing;
+    i->since_underrun = (int64_t) (playing ? playing_for : underrun_for);
+
+    update_smoother(s);
+
+    s->timing_pushed = TRUE;
+
+    lockfree_publish_timing(s);
+
+    if (s->latency_update_callback)
+        s->latency_update_callback(s, s->latency_update_userdata);
+
+    return 0;
+}
+
 void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_stream *s;
     pa_context *c = userdata;
@@ -729,19 +1037,24 @@ void pa_command_request(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tag
     pa_context_ref(c);
 
     if (pa_tagstruct_getu32(t, &channel) < 0 ||
-        pa_tagstruct_getu32(t, &bytes) < 0 ||
-        !pa_tagstruct_eof(t)) {
+        pa_tagstruct_getu32(t, &bytes) < 0) {
         pa_context_fail(c, PA_ERR_PROTOCOL);
         goto finish;
     }
 
-    if (!(s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel))))
+    s = pa_hashmap_get(c->playback_streams, PA_UINT32_TO_PTR(channel));
+
+    if ((c->version >= 17 && handle_pushed_timing(s, t) < 0) ||
+        !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
         goto finish;
+    }
 
-    if (s->state != PA_STREAM_READY)
+    if (!s || s->state != PA_STREAM_READY)
         goto finish;
 
     s->requested_bytes += bytes;
+    pa_atomic_add(&s->lockfree_credit, (int) bytes);
 
     /* pa_log("got request for %lli, now at %lli", (long long) bytes, (long long) s->requested_bytes); */
 
@@ -904,6 +1217,108 @@ static void patch_buffer_attr(pa_stream *s, pa_buffer_attr *attr, pa_stream_flag
         attr->fragsize = attr->tlength; /* Pass data to the app only when the buffer is filled up once */
 }
 
+#ifdef HAVE_CREDS
+static void ring_reply_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_stream *s = userdata;
+    uint32_t n_cells, cell_size, size;
+    size_t fs;
+    int fds[3];
+
+    pa_assert(pd);
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(s->state == PA_STREAM_CREATING);
+
+    pa_stream_ref(s);
+
+    if (command != PA_COMMAND_REPLY) {
+        if (pa_context_handle_error(s->context, command, t, FALSE) < 0)
+            goto finish;
+
+        pa_log_debug("Server refused to set up a playback ring, data will be sent over the socket.");
+        goto complete;
+    }
+
+    if (pa_tagstruct_getu32(t, &n_cells) < 0 ||
+        pa_tagstruct_getu32(t, &cell_size) < 0 ||
+        pa_tagstruct_getu32(t, &size) < 0 ||
+        !pa_tagstruct_eof(t) ||
+        pa_pstream_take_fds(s->context->pstream, fds, 3) < 0) {
+        pa_context_fail(s->context, PA_ERR_PROTOCOL);
+        goto finish;
+    }
+
+    if (pa_shm_attach_fd(&s->ring_shm, fds[0], TRUE) < 0) {
+        pa_close(fds[0]);
+        pa_close(fds[1]);
+        pa_close(fds[2]);
+        goto complete;
+    }
+
+    if (!(s->ring = pa_shmasyncq_open(s->ring_shm.ptr, s->ring_shm.size, fds+1))) {
+        pa_shm_free(&s->ring_shm);
+        goto complete;
+    }
+
+    fs = pa_frame_size(&s->sample_spec);
+    s->ring_cell_max = ((pa_shmasyncq_get_element_size(s->ring) - PA_NATIVE_RING_CELL_HEADER_SIZE) / fs) * fs;
+
+    if (pa_shmasyncq_get_element_size(s->ring) <= PA_NATIVE_RING_CELL_HEADER_SIZE || s->ring_cell_max <= 0) {
+        ring_free(s);
+        goto complete;
+    }
+
+    pa_log_debug("Using a %u*%u byte playback ring.", pa_shmasyncq_get_n_elements(s->ring), (unsigned) pa_shmasyncq_get_element_size(s->ring));
+
+complete:
+    create_stream_complete(s);
+
+finish:
+    pa_stream_unref(s);
+}
+
+/* Asks the server for a ring the playback data can be passed through
+ * without any per-block socket traffic. Returns FALSE if that is not
+ * possible with this connection. */
+static pa_bool_t ring_request(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag, n_cells;
+    size_t fs, payload, max_payload;
+
+    pa_assert(s);
+    pa_assert(s->direction == PA_STREAM_PLAYBACK);
+
+    if (s->context->version < 17 ||
+        !s->context->is_local ||
+        !pa_pstream_get_shm(s->context->pstream))
+        return FALSE;
+
+    fs = pa_frame_size(&s->sample_spec);
+    max_payload = ((PA_NATIVE_RING_CELL_SIZE_MAX - PA_NATIVE_RING_CELL_HEADER_SIZE) / fs) * fs;
+
+    if (max_payload <= 0)
+        return FALSE;
+
+    /* One cell should take what the server usually asks for at once,
+     * and the ring should have room for twice the target length */
+    payload = (s->buffer_attr.minreq / fs) * fs;
+    payload = PA_CLAMP(payload, fs, max_payload);
+
+    for (n_cells = 2; n_cells < PA_NATIVE_RING_N_CELLS_MAX; n_cells *= 2)
+        if ((size_t) n_cells * payload >= 2 * (size_t) s->buffer_attr.tlength)
+            break;
+
+    t = pa_tagstruct_command(s->context, PA_COMMAND_CREATE_PLAYBACK_RING, &tag);
+    pa_tagstruct_putu32(t, s->channel);
+    pa_tagstruct_putu32(t, n_cells);
+    pa_tagstruct_putu32(t, (uint32_t) (PA_NATIVE_RING_CELL_HEADER_SIZE + payload));
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, ring_reply_callback, s, NULL);
+
+    return TRUE;
+}
+#endif
+
 void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_stream *s = userdata;
     uint32_t requested_bytes = 0;
@@ -932,6 +1347,7 @@ void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     }
 
     s->requested_bytes = (int64_t) requested_bytes;
+    pa_atomic_store(&s->lockfree_credit, (int) requested_bytes);
 
     if (s->context->version >= 9) {
         if (s->direction == PA_STREAM_PLAYBACK) {
@@ -1021,12 +1437,116 @@ void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag,
     s->channel_valid = TRUE;
     pa_hashmap_put((s->direction == PA_STREAM_RECORD) ? s->context->record_streams : s->context->playback_streams, PA_UINT32_TO_PTR(s->channel), s);
 
+#ifdef HAVE_CREDS
+    /* The stream becomes ready once the ring is set up (or refused),
+     * so that all data takes the same path to the server */
+    if (s->direction == PA_STREAM_PLAYBACK && ring_request(s))
+        goto finish;
+#endif
+
     create_stream_complete(s);
 
 finish:
     pa_stream_unref(s);
 }
 
+static void send_create(pa_stream *s) {
+    pa_tagstruct *t;
+    uint32_t tag;
+    const pa_cvolume *volume;
+
+    /* Only now we know the version of the server for sure */
+    patch_buffer_attr(s, &s->buffer_attr, &s->flags);
+
+    volume = s->create_volume_set ? &s->create_volume : NULL;
+
+    t = pa_tagstruct_command(
+            s->context,
+            (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_CREATE_PLAYBACK_STREAM : PA_COMMAND_CREATE_RECORD_STREAM),
+            &tag);
+
+    if (s->context->version < 13)
+        pa_tagstruct_puts(t, pa_proplist_gets(s->proplist, PA_PROP_MEDIA_NAME));
+
+    pa_tagstruct_put(
+            t,
+            PA_TAG_SAMPLE_SPEC, &s->sample_spec,
+            PA_TAG_CHANNEL_MAP, &s->channel_map,
+            PA_TAG_U32, PA_INVALID_INDEX,
+            PA_TAG_STRING, s->create_device,
+            PA_TAG_U32, s->buffer_attr.maxlength,
+            PA_TAG_BOOLEAN, s->corked,
+            PA_TAG_INVALID);
+
+    if (s->direction == PA_STREAM_PLAYBACK) {
+        pa_cvolume cv;
+
+        pa_tagstruct_put(
+                t,
+                PA_TAG_U32, s->buffer_attr.tlength,
+                PA_TAG_U32, s->buffer_attr.prebuf,
+                PA_TAG_U32, s->buffer_attr.minreq,
+                PA_TAG_U32, s->syncid,
+                PA_TAG_INVALID);
+
+        if (!volume)
+            volume = pa_cvolume_reset(&cv, s->sample_spec.channels);
+
+        pa_tagstruct_put_cvolume(t, volume);
+    } else
+        pa_tagstruct_putu32(t, s->buffer_attr.fragsize);
+
+    if (s->context->version >= 12) {
+        pa_tagstruct_put(
+                t,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_NO_REMAP_CHANNELS,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_NO_REMIX_CHANNELS,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_FIX_FORMAT,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_FIX_RATE,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_FIX_CHANNELS,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_DONT_MOVE,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_VARIABLE_RATE,
+                PA_TAG_INVALID);
+    }
+
+    if (s->context->version >= 13) {
+
+        if (s->direction == PA_STREAM_PLAYBACK)
+            pa_tagstruct_put_boolean(t, s->flags & PA_STREAM_START_MUTED);
+        else
+            pa_tagstruct_put_boolean(t, s->flags & PA_STREAM_PEAK_DETECT);
+
+        pa_tagstruct_put(
+                t,
+                PA_TAG_BOOLEAN, s->flags & PA_STREAM_ADJUST_LATENCY,
+                PA_TAG_PROPLIST, s->proplist,
+                PA_TAG_INVALID);
+
+        if (s->direction == PA_STREAM_RECORD)
+            pa_tagstruct_putu32(t, s->direct_on_input);
+    }
+
+    if (s->context->version >= 14) {
+
+        if (s->direction == PA_STREAM_PLAYBACK)
+            pa_tagstruct_put_boolean(t, s->create_volume_set);
+
+        pa_tagstruct_put_boolean(t, s->flags & PA_STREAM_EARLY_REQUESTS);
+    }
+
+    if (s->context->version >= 15) {
+
+        if (s->direction == PA_STREAM_PLAYBACK)
+            pa_tagstruct_put_boolean(t, s->flags & (PA_STREAM_START_MUTED|PA_STREAM_START_UNMUTED));
+
+        pa_tagstruct_put_boolean(t, s->flags & PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND);
+        pa_tagstruct_put_boolean(t, s->flags & PA_STREAM_FAIL_ON_SUSPEND);
+    }
+
+    pa_pstream_send_tagstruct(s->context->pstream, t);
+    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_create_stream_callback, s, NULL);
+}
+
 static int create_stream(
         pa_stream_direction_t direction,
         pa_stream *s,
@@ -1036,9 +1556,7 @@ static int create_stream(
         const pa_cvolume *volume,
         pa_stream *sync_stream) {
 
-    pa_tagstruct *t;
-    uint32_t tag;
-    pa_bool_t volume_set = FALSE;
+    pa_bool_t ready;
 
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -1066,9 +1584,17 @@ static int create_stream(
                                               PA_STREAM_START_UNMUTED|
                                               PA_STREAM_FAIL_ON_SUSPEND)), PA_ERR_INVALID);
 
-    PA_CHECK_VALIDITY(s->context, s->context->version >= 12 || !(flags & PA_STREAM_VARIABLE_RATE), PA_ERR_NOTSUPPORTED);
-    PA_CHECK_VALIDITY(s->context, s->context->version >= 13 || !(flags & PA_STREAM_PEAK_DETECT), PA_ERR_NOTSUPPORTED);
-    PA_CHECK_VALIDITY(s->context, s->context->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    /* A stream may be connected while the context is still connecting,
+     * in which case the server version is checked later */
+    ready = s->context->state == PA_CONTEXT_READY;
+
+    PA_CHECK_VALIDITY(s->context, !ready || s->context->version >= 12 || !(flags & PA_STREAM_VARIABLE_RATE), PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY(s->context, !ready || s->context->version >= 13 || !(flags & PA_STREAM_PEAK_DETECT), PA_ERR_NOTSUPPORTED);
+    PA_CHECK_VALIDITY(s->context,
+                      ready ||
+                      s->context->state == PA_CONTEXT_CONNECTING ||
+                      s->context->state == PA_CONTEXT_AUTHORIZING ||
+                      s->context->state == PA_CONTEXT_SETTING_NAME, PA_ERR_BADSTATE);
     /* Althought some of the other flags are not supported on older
      * version, we don't check for them here, because it doesn't hurt
      * when they are passed but actually not supported. This makes
@@ -1089,7 +1615,6 @@ static int create_stream(
 
     if (attr)
         s->buffer_attr = *attr;
-    patch_buffer_attr(s, &s->buffer_attr, &flags);
 
     s->flags = flags;
     s->corked = !!(flags & PA_STREAM_START_CORKED);
@@ -1113,98 +1638,54 @@ static int create_stream(
     if (!dev)
         dev = s->direction == PA_STREAM_PLAYBACK ? s->context->conf->default_sink : s->context->conf->default_source;
 
-    t = pa_tagstruct_command(
-            s->context,
-            (uint32_t) (s->direction == PA_STREAM_PLAYBACK ? PA_COMMAND_CREATE_PLAYBACK_STREAM : PA_COMMAND_CREATE_RECORD_STREAM),
-            &tag);
-
-    if (s->context->version < 13)
-        pa_tagstruct_puts(t, pa_proplist_gets(s->proplist, PA_PROP_MEDIA_NAME));
-
-    pa_tagstruct_put(
-            t,
-            PA_TAG_SAMPLE_SPEC, &s->sample_spec,
-            PA_TAG_CHANNEL_MAP, &s->channel_map,
-            PA_TAG_U32, PA_INVALID_INDEX,
-            PA_TAG_STRING, dev,
-            PA_TAG_U32, s->buffer_attr.maxlength,
-            PA_TAG_BOOLEAN, s->corked,
-            PA_TAG_INVALID);
-
-    if (s->direction == PA_STREAM_PLAYBACK) {
-        pa_cvolume cv;
-
-        pa_tagstruct_put(
-                t,
-                PA_TAG_U32, s->buffer_attr.tlength,
-                PA_TAG_U32, s->buffer_attr.prebuf,
-                PA_TAG_U32, s->buffer_attr.minreq,
-                PA_TAG_U32, s->syncid,
-                PA_TAG_INVALID);
+    /* Kept until the stream is freed, in case the command has to be
+     * sent again on a new connection */
+    s->create_device = pa_xstrdup(dev);
 
-        volume_set = !!volume;
+    if ((s->create_volume_set = !!volume))
+        s->create_volume = *volume;
 
-        if (!volume)
-            volume = pa_cvolume_reset(&cv, s->sample_spec.channels);
-
-        pa_tagstruct_put_cvolume(t, volume);
-    } else
-        pa_tagstruct_putu32(t, s->buffer_attr.fragsize);
-
-    if (s->context->version >= 12) {
-        pa_tagstruct_put(
-                t,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_NO_REMAP_CHANNELS,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_NO_REMIX_CHANNELS,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_FIX_FORMAT,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_FIX_RATE,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_FIX_CHANNELS,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_DONT_MOVE,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_VARIABLE_RATE,
-                PA_TAG_INVALID);
-    }
-
-    if (s->context->version >= 13) {
-
-        if (s->direction == PA_STREAM_PLAYBACK)
-            pa_tagstruct_put_boolean(t, flags & PA_STREAM_START_MUTED);
-        else
-            pa_tagstruct_put_boolean(t, flags & PA_STREAM_PEAK_DETECT);
-
-        pa_tagstruct_put(
-                t,
-                PA_TAG_BOOLEAN, flags & PA_STREAM_ADJUST_LATENCY,
-                PA_TAG_PROPLIST, s->proplist,
-                PA_TAG_INVALID);
-
-        if (s->direction == PA_STREAM_RECORD)
-            pa_tagstruct_putu32(t, s->direct_on_input);
-    }
+    /* With a pipelined handshake the command may follow AUTH right
+     * away, otherwise it has to wait until the context is ready */
+    if (ready || (s->context->pipelined && s->context->pstream))
+        send_create(s);
+    else
+        s->create_deferred = TRUE;
 
-    if (s->context->version >= 14) {
+    pa_stream_set_state(s, PA_STREAM_CREATING);
 
-        if (s->direction == PA_STREAM_PLAYBACK)
-            pa_tagstruct_put_boolean(t, volume_set);
+    pa_stream_unref(s);
+    return 0;
+}
 
-        pa_tagstruct_put_boolean(t, flags & PA_STREAM_EARLY_REQUESTS);
-    }
+void pa_stream_send_deferred_create(pa_stream *s) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
-    if (s->context->version >= 15) {
+    if (!s->create_deferred || s->state != PA_STREAM_CREATING)
+        return;
 
-        if (s->direction == PA_STREAM_PLAYBACK)
-            pa_tagstruct_put_boolean(t, flags & (PA_STREAM_START_MUTED|PA_STREAM_START_UNMUTED));
+    s->create_deferred = FALSE;
 
-        pa_tagstruct_put_boolean(t, flags & PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND);
-        pa_tagstruct_put_boolean(t, flags & PA_STREAM_FAIL_ON_SUSPEND);
+    /* We didn't know the server version when we checked these */
+    if ((s->context->version < 12 && (s->flags & PA_STREAM_VARIABLE_RATE)) ||
+        (s->context->version < 13 && (s->flags & PA_STREAM_PEAK_DETECT))) {
+        pa_context_set_error(s->context, PA_ERR_NOTSUPPORTED);
+        pa_stream_set_state(s, PA_STREAM_FAILED);
+        return;
     }
 
-    pa_pstream_send_tagstruct(s->context->pstream, t);
-    pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_create_stream_callback, s, NULL);
+    send_create(s);
+}
 
-    pa_stream_set_state(s, PA_STREAM_CREATING);
+void pa_stream_defer_create(pa_stream *s) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
 
-    pa_stream_unref(s);
-    return 0;
+    /* The create command went out on a connection that is gone now,
+     * before the server could answer it */
+    if (s->state == PA_STREAM_CREATING && !s->channel_valid)
+        s->create_deferred = TRUE;
 }
 
 int pa_stream_connect_playback(
@@ -1233,6 +1714,162 @@ int pa_stream_connect_record(
     return create_stream(PA_STREAM_RECORD, s, dev, attr, flags, NULL, NULL);
 }
 
+/* Copies data into as many free ring cells as there are. Returns
+ * TRUE if everything was queued, otherwise *idx tells how far we
+ * got. */
+static pa_bool_t ring_fill(pa_stream *s, const uint8_t *data, size_t length, size_t *idx, int64_t *offset, pa_seek_mode_t *seek) {
+    pa_assert(s);
+    pa_assert(s->ring);
+    pa_assert(idx);
+    pa_assert(offset);
+    pa_assert(seek);
+
+    do {
+        pa_native_ring_cell *cell;
+        size_t l;
+
+        if (!(cell = pa_shmasyncq_push_begin(s->ring, FALSE)))
+            return FALSE;
+
+        l = PA_MIN(length - *idx, s->ring_cell_max);
+
+        cell->length = (uint32_t) l;
+        cell->seek = (uint32_t) *seek;
+        cell->offset = *offset;
+        memcpy((uint8_t*) cell + PA_NATIVE_RING_CELL_HEADER_SIZE, data + *idx, l);
+
+        pa_shmasyncq_push_commit(s->ring);
+
+        *idx += l;
+        *offset = 0;
+        *seek = PA_SEEK_RELATIVE;
+
+    } while (*idx < length);
+
+    return TRUE;
+}
+
+static void ring_io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata);
+static void update_write_index(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek);
+static void write_done(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek);
+static void lockfree_flush(pa_stream *s);
+
+/* Moves as much pending data into the ring as possible and sleeps on
+ * the ring if something is left over */
+static void ring_flush(pa_stream *s) {
+    pa_assert(s);
+    pa_assert(s->ring);
+
+    if (s->ring_waiting) {
+        pa_shmasyncq_write_after_poll(s->ring);
+        s->ring_waiting = FALSE;
+    }
+
+    for (;;) {
+        pa_ring_pending *p;
+
+        while ((p = s->ring_pending)) {
+
+            if (p->command) {
+                /* Everything in front of it is in the ring now, and
+                 * the server empties the ring before it handles a
+                 * stream command */
+                pa_pstream_send_tagstruct(s->context->pstream, p->command);
+                p->command = NULL;
+
+            } else if (!ring_fill(s, p->data, p->length, &p->index, &p->offset, &p->seek))
+                break;
+
+            PA_LLIST_REMOVE(pa_ring_pending, s->ring_pending, p);
+            ring_pending_free(p);
+        }
+
+        if (!s->ring_pending) {
+            s->ring_pending_tail = NULL;
+
+            if (s->ring_io_event)
+                s->mainloop->io_enable(s->ring_io_event, PA_IO_EVENT_NULL);
+
+            return;
+        }
+
+        /* If the server freed a cell in the meantime, try again */
+        if (pa_shmasyncq_write_before_poll(s->ring) >= 0)
+            break;
+    }
+
+    s->ring_waiting = TRUE;
+
+    if (s->ring_io_event)
+        s->mainloop->io_enable(s->ring_io_event, PA_IO_EVENT_INPUT);
+    else
+        s->ring_io_event = s->mainloop->io_new(s->mainloop, pa_shmasyncq_write_fd(s->ring), PA_IO_EVENT_INPUT, ring_io_callback, s);
+}
+
+static void ring_io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(m);
+    pa_assert(e);
+    pa_assert(s);
+    pa_assert(s->ring_io_event == e);
+
+    if (!s->ring_waiting)
+        return;
+
+    pa_stream_ref(s);
+    ring_flush(s);
+    pa_stream_unref(s);
+}
+
+/* Queues data for the server via the ring. What does not fit right
+ * now is kept and pushed as soon as the server catches up. */
+static void ring_write(pa_stream *s, const void *data, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    pa_ring_pending *p;
+    size_t idx = 0;
+
+    pa_assert(s);
+    pa_assert(s->ring);
+
+    if (length <= 0 && seek == PA_SEEK_RELATIVE && offset == 0)
+        return;
+
+    if (!s->ring_pending && ring_fill(s, data, length, &idx, &offset, &seek))
+        return;
+
+    p = pa_xnew(pa_ring_pending, 1);
+    p->command = NULL;
+    p->data = pa_xmemdup((const uint8_t*) data + idx, length - idx);
+    p->length = length - idx;
+    p->index = 0;
+    p->offset = offset;
+    p->seek = seek;
+
+    ring_pending_append(s, p);
+    ring_flush(s);
+}
+
+/* Sends a stream command, unless data is still waiting for room in
+ * the ring. In that case the command is queued behind that data and
+ * goes out as soon as the data went into the ring, so that it cannot
+ * overtake it. */
+static void ring_send_command(pa_stream *s, pa_tagstruct *t) {
+    pa_ring_pending *p;
+
+    pa_assert(s);
+    pa_assert(t);
+
+    if (!s->ring_pending) {
+        pa_pstream_send_tagstruct(s->context->pstream, t);
+        return;
+    }
+
+    p = pa_xnew0(pa_ring_pending, 1);
+    p->command = t;
+
+    ring_pending_append(s, p);
+}
+
 int pa_stream_begin_write(
         pa_stream *s,
         void **data,
@@ -1258,6 +1895,30 @@ int pa_stream_begin_write(
             *nbytes = m;
     }
 
+    /* Whatever the lock-free writer queued goes first */
+    if (s->lockfree_queue)
+        lockfree_flush(s);
+
+    /* If we have a ring, nothing is queued in front of it and the
+     * caller asks for no more than fits into one cell, let the caller
+     * fill the next cell in place. Larger requests get a memory
+     * block, which is copied into as many cells as it takes. */
+    if (s->ring && !s->write_memblock && !s->ring_pending &&
+        *nbytes != (size_t) -1 && *nbytes <= s->ring_cell_max) {
+
+        if (!s->ring_cell)
+            s->ring_cell = pa_shmasyncq_push_begin(s->ring, FALSE);
+
+        if (s->ring_cell) {
+            *data = (uint8_t*) s->ring_cell + PA_NATIVE_RING_CELL_HEADER_SIZE;
+            return 0;
+        }
+    }
+
+    /* A cell handed out before is not committed yet, so we may just
+     * forget about it */
+    s->ring_cell = NULL;
+
     if (!s->write_memblock) {
         s->write_memblock = pa_memblock_new(s->context->mempool, *nbytes);
         s->write_data = pa_memblock_acquire(s->write_memblock);
@@ -1278,7 +1939,18 @@ int pa_stream_cancel_write(
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
-    PA_CHECK_VALIDITY(s->context, s->write_memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->write_memblock || s->ring_cell, PA_ERR_BADSTATE);
+
+    if (s->ring_cell) {
+        /* Nothing was committed yet, so we simply hand out the very
+         * same cell on the next pa_stream_begin_write() call */
+        s->ring_cell = NULL;
+
+        if (s->lockfree_queue)
+            lockfree_flush(s);
+
+        return 0;
+    }
 
     pa_assert(s->write_data);
 
@@ -1312,9 +1984,49 @@ int pa_stream_write(
                       ((data >= s->write_data) &&
                        ((const char*) data + length <= (const char*) s->write_data + pa_memblock_get_length(s->write_memblock))),
                       PA_ERR_INVALID);
-    PA_CHECK_VALIDITY(s->context, !free_cb || !s->write_memblock, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context,
+                      !s->ring_cell ||
+                      (((const uint8_t*) data >= (uint8_t*) s->ring_cell + PA_NATIVE_RING_CELL_HEADER_SIZE) &&
+                       ((const uint8_t*) data + length <= (uint8_t*) s->ring_cell + PA_NATIVE_RING_CELL_HEADER_SIZE + s->ring_cell_max)),
+                      PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, !free_cb || (!s->write_memblock && !s->ring_cell), PA_ERR_INVALID);
 
-    if (s->write_memblock) {
+    /* Whatever the lock-free writer queued goes first */
+    if (s->lockfree_queue)
+        lockfree_flush(s);
+
+    if (s->ring_cell) {
+        pa_native_ring_cell *cell = s->ring_cell;
+        uint8_t *d = (uint8_t*) cell + PA_NATIVE_RING_CELL_HEADER_SIZE;
+
+        /* pa_stream_begin_write() handed out a ring cell, so the data
+         * is already where the server will pick it up. */
+
+        if ((const uint8_t*) data != d)
+            memmove(d, data, length);
+
+        cell->length = (uint32_t) length;
+        cell->seek = (uint32_t) seek;
+        cell->offset = offset;
+
+        s->ring_cell = NULL;
+        pa_shmasyncq_push_commit(s->ring);
+
+    } else if (s->ring) {
+
+        /* No socket traffic for the data itself, we copy it into the
+         * ring */
+        ring_write(s, data, length, offset, seek);
+
+        if (s->write_memblock) {
+            pa_memblock_release(s->write_memblock);
+            pa_memblock_unref(s->write_memblock);
+            s->write_memblock = NULL;
+            s->write_data = NULL;
+        } else if (free_cb)
+            free_cb((void*) data);
+
+    } else if (s->write_memblock) {
         pa_memchunk chunk;
 
         /* pa_stream_write_begin() was called before */
@@ -1373,6 +2085,257 @@ int pa_stream_write(
             free_cb((void*) data);
     }
 
+    write_done(s, length, offset, seek);
+
+    return 0;
+}
+
+int pa_stream_writev(
+        pa_stream *s,
+        const pa_stream_iovec *iov,
+        unsigned n,
+        pa_free_cb_t free_cb,
+        int64_t offset,
+        pa_seek_mode_t seek) {
+
+    pa_memchunk chunk;
+    size_t length = 0, left;
+    pa_seek_mode_t t_seek = seek;
+    int64_t t_offset = offset;
+    unsigned i;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->write_memblock && !s->ring_cell, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, iov && n > 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, seek <= PA_SEEK_RELATIVE_END, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_INVALID);
+
+    for (i = 0; i < n; i++) {
+        PA_CHECK_VALIDITY(s->context, iov[i].data || iov[i].length == 0, PA_ERR_INVALID);
+        length += iov[i].length;
+    }
+
+    /* Whatever the lock-free writer queued goes first */
+    if (s->lockfree_queue)
+        lockfree_flush(s);
+
+    if (s->ring) {
+
+        for (i = 0; i < n; i++) {
+            if (iov[i].length <= 0)
+                continue;
+
+            ring_write(s, iov[i].data, iov[i].length, t_offset, t_seek);
+
+            t_offset = 0;
+            t_seek = PA_SEEK_RELATIVE;
+        }
+
+    } else if (free_cb && !pa_pstream_get_shm(s->context->pstream)) {
+
+        /* Every fragment becomes a memblock item of its own that
+         * refers to the caller's memory, nothing is copied before the
+         * data is written to the socket */
+
+        for (i = 0; i < n; i++) {
+            if (iov[i].length <= 0)
+                continue;
+
+            chunk.memblock = pa_memblock_new_user(s->context->mempool, (void*) iov[i].data, iov[i].length, free_cb, 1);
+            chunk.index = 0;
+            chunk.length = iov[i].length;
+
+            pa_pstream_send_memblock(s->context->pstream, s->channel, t_offset, t_seek, &chunk);
+            pa_memblock_unref(chunk.memblock);
+
+            t_offset = 0;
+            t_seek = PA_SEEK_RELATIVE;
+        }
+
+        /* The memblocks own the fragments now */
+        free_cb = NULL;
+
+    } else {
+        uint8_t *d = NULL;
+        size_t max;
+
+        /* Gather the fragments into as few blocks as possible, which
+         * with SHM are handed to the server without further copies */
+
+        max = pa_mempool_block_size_max(s->context->mempool);
+        pa_memchunk_reset(&chunk);
+        left = length;
+
+        for (i = 0; i < n; i++) {
+            const uint8_t *p = iov[i].data;
+            size_t l = iov[i].length;
+
+            while (l > 0) {
+                size_t k;
+
+                if (!chunk.memblock) {
+                    chunk.memblock = pa_memblock_new(s->context->mempool, PA_MIN(left, max));
+                    chunk.index = chunk.length = 0;
+                    d = pa_memblock_acquire(chunk.memblock);
+                }
+
+                k = PA_MIN(l, pa_memblock_get_length(chunk.memblock) - chunk.length);
+                memcpy(d + chunk.length, p, k);
+
+                chunk.length += k;
+                p += k;
+                l -= k;
+                left -= k;
+
+                if (chunk.length >= pa_memblock_get_length(chunk.memblock) || left <= 0) {
+                    pa_memblock_release(chunk.memblock);
+                    pa_pstream_send_memblock(s->context->pstream, s->channel, t_offset, t_seek, &chunk);
+                    pa_memblock_unref(chunk.memblock);
+                    pa_memchunk_reset(&chunk);
+
+                    t_offset = 0;
+                    t_seek = PA_SEEK_RELATIVE;
+                }
+            }
+        }
+
+        pa_assert(!chunk.memblock);
+    }
+
+    if (free_cb)
+        for (i = 0; i < n; i++)
+            if (iov[i].length > 0)
+                free_cb((void*) iov[i].data);
+
+    write_done(s, length, offset, seek);
+
+    return 0;
+}
+
+/* Interleave n frames starting at frame idx of the planes into dst */
+static void interleave(const void *planes[], unsigned channels, size_t ss, size_t idx, void *dst, size_t n) {
+    unsigned c;
+    size_t k;
+
+    if (ss == 4) {
+        for (c = 0; c < channels; c++) {
+            const uint32_t *s = (const uint32_t*) planes[c] + idx;
+            uint32_t *d = (uint32_t*) dst + c;
+
+            for (k = 0; k < n; k++, d += channels)
+                *d = s[k];
+        }
+
+    } else if (ss == 2) {
+        for (c = 0; c < channels; c++) {
+            const uint16_t *s = (const uint16_t*) planes[c] + idx;
+            uint16_t *d = (uint16_t*) dst + c;
+
+            for (k = 0; k < n; k++, d += channels)
+                *d = s[k];
+        }
+
+    } else {
+        size_t fs = ss * channels;
+
+        for (c = 0; c < channels; c++) {
+            const uint8_t *s = (const uint8_t*) planes[c] + idx * ss;
+            uint8_t *d = (uint8_t*) dst + c * ss;
+
+            for (k = 0; k < n; k++, s += ss, d += fs)
+                memcpy(d, s, ss);
+        }
+    }
+}
+
+int pa_stream_write_planar(
+        pa_stream *s,
+        const void *planes[],
+        size_t nframes,
+        int64_t offset,
+        pa_seek_mode_t seek) {
+
+    size_t ss, fs, idx = 0;
+    unsigned c;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || s->direction == PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->write_memblock && !s->ring_cell, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, planes && nframes > 0, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, seek <= PA_SEEK_RELATIVE_END, PA_ERR_INVALID);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_PLAYBACK || (seek == PA_SEEK_RELATIVE && offset == 0), PA_ERR_INVALID);
+
+    for (c = 0; c < s->sample_spec.channels; c++)
+        PA_CHECK_VALIDITY(s->context, planes[c], PA_ERR_INVALID);
+
+    ss = pa_sample_size(&s->sample_spec);
+    fs = pa_frame_size(&s->sample_spec);
+
+    /* The frames are interleaved right into the memory that is passed
+     * to the server, be it a memblock or a cell of the playback
+     * ring */
+    while (idx < nframes) {
+        void *d;
+        size_t n, l;
+
+        l = (nframes - idx) * fs;
+
+        if (pa_stream_begin_write(s, &d, &l) < 0)
+            return -1;
+
+        /* Not even a single frame fits into what we got */
+        if ((n = PA_MIN(l / fs, nframes - idx)) <= 0) {
+            pa_stream_cancel_write(s);
+            return -pa_context_set_error(s->context, PA_ERR_TOOLARGE);
+        }
+
+        interleave(planes, s->sample_spec.channels, ss, idx, d, n);
+
+        /* Don't leave the buffer begun if we fail halfway */
+        if (pa_stream_write(s, d, n * fs, NULL, offset, seek) < 0) {
+            if (s->write_memblock || s->ring_cell)
+                pa_stream_cancel_write(s);
+
+            return -1;
+        }
+
+        offset = 0;
+        seek = PA_SEEK_RELATIVE;
+        idx += n;
+    }
+
+    return 0;
+}
+
+/* Called after the data of pa_stream_write() and pa_stream_writev()
+ * has been sent */
+static void write_done(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    pa_assert(s);
+
+    update_write_index(s, length, offset, seek);
+
+    if (s->lockfree_queue) {
+        pa_atomic_sub(&s->lockfree_credit, (int) ((seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length));
+
+        /* A ring cell might have held off the lock-free writer */
+        lockfree_flush(s);
+        lockfree_publish_timing(s);
+    }
+}
+
+/* Bookkeeping after data has been written to the server */
+static void update_write_index(pa_stream *s, size_t length, int64_t offset, pa_seek_mode_t seek) {
+    pa_assert(s);
+
     /* This is obviously wrong since we ignore the seeking index . But
      * that's OK, the server side applies the same error */
     s->requested_bytes -= (seek == PA_SEEK_RELATIVE ? offset : 0) + (int64_t) length;
@@ -1411,6 +2374,220 @@ int pa_stream_write(
         if (!s->timing_info_valid || s->timing_info.write_index_corrupt)
             request_auto_timing_update(s, TRUE);
     }
+}
+
+static void lockfree_write_chunk(pa_stream *s, pa_memchunk *c) {
+    pa_assert(s);
+    pa_assert(c);
+
+    if (s->state == PA_STREAM_READY) {
+
+        if (s->ring) {
+            void *d;
+
+            d = pa_memblock_acquire(c->memblock);
+            ring_write(s, (uint8_t*) d + c->index, c->length, 0, PA_SEEK_RELATIVE);
+            pa_memblock_release(c->memblock);
+        } else
+            pa_pstream_send_memblock(s->context->pstream, s->channel, 0, PA_SEEK_RELATIVE, c);
+
+        update_write_index(s, c->length, 0, PA_SEEK_RELATIVE);
+    }
+
+    s->lockfree_drained += (uint32_t) c->length;
+    lockfree_chunk_free(c);
+}
+
+/* Sends everything the lock-free writer queued so far, then sleeps on
+ * the queue again */
+static void lockfree_flush(pa_stream *s) {
+    pa_memchunk *c;
+    pa_bool_t written = FALSE;
+
+    pa_assert(s);
+    pa_assert(s->lockfree_queue);
+
+    if (s->lockfree_waiting) {
+        pa_asyncq_read_after_poll(s->lockfree_queue);
+        s->lockfree_waiting = FALSE;
+    }
+
+    /* A ring cell handed out by pa_stream_begin_write() must be
+     * committed first. pa_stream_write() and pa_stream_cancel_write()
+     * call us again. */
+    if (s->ring_cell)
+        return;
+
+    for (;;) {
+        while ((c = pa_asyncq_pop(s->lockfree_queue, FALSE))) {
+            lockfree_write_chunk(s, c);
+            written = TRUE;
+        }
+
+        if (pa_asyncq_read_before_poll(s->lockfree_queue) >= 0)
+            break;
+    }
+
+    s->lockfree_waiting = TRUE;
+
+    if (written)
+        lockfree_publish_timing(s);
+}
+
+static void lockfree_io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_stream *s = userdata;
+
+    pa_assert(m);
+    pa_assert(e);
+    pa_assert(s);
+    pa_assert(s->lockfree_io_event == e);
+
+    pa_stream_ref(s);
+    lockfree_flush(s);
+    pa_stream_unref(s);
+}
+
+int pa_stream_enable_lockfree(pa_stream *s) {
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_UNCONNECTED || s->state == PA_STREAM_CREATING || s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction != PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
+
+    if (s->timing_aupdate)
+        return 0;
+
+    /* Only the playback side needs a queue, the direction is not known
+     * before the stream is connected, though */
+    if (s->direction != PA_STREAM_RECORD) {
+        PA_CHECK_VALIDITY(s->context, s->lockfree_queue = pa_asyncq_new(LOCKFREE_QUEUE_SIZE), PA_ERR_INTERNAL);
+
+        /* The context might go away before the stream does */
+        s->lockfree_mempool = pa_mempool_ref(s->context->mempool);
+
+        pa_assert_se(pa_asyncq_read_before_poll(s->lockfree_queue) == 0);
+        s->lockfree_waiting = TRUE;
+
+        pa_atomic_store(&s->lockfree_credit, (int) s->requested_bytes);
+
+        s->lockfree_io_event = s->mainloop->io_new(s->mainloop, pa_asyncq_read_fd(s->lockfree_queue), PA_IO_EVENT_INPUT, lockfree_io_callback, s);
+        pa_atomic_store(&s->lockfree_ready, s->state == PA_STREAM_READY);
+    }
+
+    s->timing_aupdate = pa_aupdate_new();
+    lockfree_publish_timing(s);
+
+    return 0;
+}
+
+int pa_stream_write_lockfree(pa_stream *s, const void *data, size_t nbytes) {
+    pa_memchunk *c;
+    void *d;
+
+    pa_assert(s);
+    pa_assert(data);
+
+    /* Called from the submitting thread, which does not hold the lock,
+     * so we must not touch the context error, the stream state or
+     * anything else the main loop thread changes */
+
+    if (!s->lockfree_queue || !pa_atomic_load(&s->lockfree_ready) || s->direction != PA_STREAM_PLAYBACK)
+        return -PA_ERR_BADSTATE;
+
+    if (nbytes <= 0 || nbytes % pa_frame_size(&s->sample_spec) != 0)
+        return -PA_ERR_INVALID;
+
+    if (nbytes > pa_mempool_block_size_max(s->lockfree_mempool))
+        return -PA_ERR_TOOLARGE;
+
+    if (!(c = pa_flist_pop(PA_STATIC_FLIST_GET(lockfree_chunks))))
+        c = pa_xnew(pa_memchunk, 1);
+
+    /* Allocating from the pool is lock-free */
+    c->memblock = pa_memblock_new(s->lockfree_mempool, nbytes);
+    c->index = 0;
+    c->length = nbytes;
+
+    d = pa_memblock_acquire(c->memblock);
+    memcpy(d, data, nbytes);
+    pa_memblock_release(c->memblock);
+
+    /* Account for the data before the main loop can see it, so that
+     * readers never see it drained but not submitted */
+    pa_atomic_add(&s->lockfree_submitted, (int) nbytes);
+
+    if (pa_asyncq_push(s->lockfree_queue, c, FALSE) < 0) {
+        pa_atomic_sub(&s->lockfree_submitted, (int) nbytes);
+        lockfree_chunk_free(c);
+        return -PA_ERR_BUSY;
+    }
+
+    pa_atomic_sub(&s->lockfree_credit, (int) nbytes);
+
+    return 0;
+}
+
+size_t pa_stream_writable_size_lockfree(pa_stream *s) {
+    int credit;
+
+    pa_assert(s);
+
+    if (!s->lockfree_queue || !pa_atomic_load(&s->lockfree_ready) || s->direction != PA_STREAM_PLAYBACK)
+        return 0;
+
+    /* What the server asked for, minus everything written since, no
+     * matter whether the event loop already passed it on */
+    credit = pa_atomic_load(&s->lockfree_credit);
+
+    return credit > 0 ? (size_t) credit : 0;
+}
+
+int pa_stream_get_latency_lockfree(pa_stream *s, pa_usec_t *r_usec, int *negative) {
+    pa_stream_timing_snapshot t;
+    int64_t latency;
+    pa_usec_t now;
+    unsigned j;
+
+    pa_assert(s);
+    pa_assert(r_usec);
+
+    if (!s->timing_aupdate)
+        return -PA_ERR_BADSTATE;
+
+    j = pa_aupdate_read_begin(s->timing_aupdate);
+    t = s->timing_snapshot[j];
+    pa_aupdate_read_end(s->timing_aupdate);
+
+    if (!t.valid)
+        return -PA_ERR_NODATA;
+
+    latency = t.latency;
+    now = pa_rtclock_now();
+
+    /* Extrapolate like the smoother would: the time advances, and on
+     * playback whatever was queued since then adds up */
+    if (s->direction == PA_STREAM_PLAYBACK) {
+        uint32_t pending;
+
+        pending = (uint32_t) pa_atomic_load(&s->lockfree_submitted) - t.drained;
+        latency += (int64_t) pa_bytes_to_usec(pending, &s->sample_spec);
+
+        if (t.running && now > t.taken)
+            latency -= (int64_t) (now - t.taken);
+    } else if (t.running && now > t.taken)
+        latency += (int64_t) (now - t.taken);
+
+    if (negative)
+        *negative = 0;
+
+    if (latency >= 0)
+        *r_usec = (pa_usec_t) latency;
+    else if (negative && s->direction == PA_STREAM_RECORD) {
+        *negative = 1;
+        *r_usec = (pa_usec_t) -latency;
+    } else
+        *r_usec = 0;
 
     return 0;
 }
@@ -1424,6 +2601,7 @@ int pa_stream_peek(pa_stream *s, const void **data, size_t *length) {
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->n_peekv_chunks <= 0, PA_ERR_BADSTATE);
 
     if (!s->peek_memchunk.memblock) {
 
@@ -1442,6 +2620,52 @@ int pa_stream_peek(pa_stream *s, const void **data, size_t *length) {
     return 0;
 }
 
+int pa_stream_peekv(pa_stream *s, pa_stream_iovec *iov, unsigned *n) {
+    unsigned i;
+
+    pa_assert(s);
+    pa_assert(PA_REFCNT_VALUE(s) >= 1);
+    pa_assert(iov);
+    pa_assert(n);
+
+    PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, !s->peek_memchunk.memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, *n > 0, PA_ERR_INVALID);
+
+    /* Peeking again without dropping returns the same fragments, but
+     * may not return more than were asked for the first time */
+    if (s->n_peekv_chunks <= 0) {
+
+        if (*n > s->n_peekv_allocated) {
+            s->n_peekv_allocated = *n;
+            s->peekv_chunks = pa_xrenew(pa_memchunk, s->peekv_chunks, s->n_peekv_allocated);
+        }
+
+        s->n_peekv_chunks = pa_memblockq_peekv(s->record_memblockq, s->peekv_chunks, *n);
+
+        for (i = 0; i < s->n_peekv_chunks; i++)
+            if (s->peekv_chunks[i].memblock)
+                pa_memblock_acquire(s->peekv_chunks[i].memblock);
+    }
+
+    *n = PA_MIN(*n, s->n_peekv_chunks);
+
+    for (i = 0; i < *n; i++) {
+        pa_memchunk *c = s->peekv_chunks + i;
+
+        /* Holes have no data */
+        iov[i].data = c->memblock ? (uint8_t*) pa_memblock_acquire(c->memblock) + c->index : NULL;
+        iov[i].length = c->length;
+
+        if (c->memblock)
+            pa_memblock_release(c->memblock);
+    }
+
+    return 0;
+}
+
 int pa_stream_drop(pa_stream *s) {
     pa_assert(s);
     pa_assert(PA_REFCNT_VALUE(s) >= 1);
@@ -1449,7 +2673,23 @@ int pa_stream_drop(pa_stream *s) {
     PA_CHECK_VALIDITY(s->context, !pa_detect_fork(), PA_ERR_FORKED);
     PA_CHECK_VALIDITY(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY(s->context, s->direction == PA_STREAM_RECORD, PA_ERR_BADSTATE);
-    PA_CHECK_VALIDITY(s->context, s->peek_memchunk.memblock, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY(s->context, s->peek_memchunk.memblock || s->n_peekv_chunks > 0, PA_ERR_BADSTATE);
+
+    if (s->n_peekv_chunks > 0) {
+        size_t length = 0;
+        unsigned i;
+
+        for (i = 0; i < s->n_peekv_chunks; i++)
+            length += s->peekv_chunks[i].length;
+
+        pa_memblockq_drop(s->record_memblockq, length);
+
+        if (s->timing_info_valid && !s->timing_info.read_index_corrupt)
+            s->timing_info.read_index += (int64_t) length;
+
+        peekv_release(s);
+        return 0;
+    }
 
     pa_memblockq_drop(s->record_memblockq, s->peek_memchunk.length);
 
@@ -1499,6 +2739,10 @@ pa_operation * pa_stream_drain(pa_stream *s, pa_stream_success_cb_t cb, void *us
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->direction == PA_STREAM_PLAYBACK, PA_ERR_BADSTATE);
 
+    /* The drain needs to come after everything queued lock-free */
+    if (s->lockfree_queue)
+        lockfree_flush(s);
+
     /* Ask for a timing update before we cork/uncork to get the best
      * accuracy for the transport latency suitable for the
      * check_smoother_status() call in the started callback */
@@ -1506,9 +2750,10 @@ pa_operation * pa_stream_drain(pa_stream *s, pa_stream_success_cb_t cb, void *us
 
     o = pa_operation_new(s->context, s, (pa_operation_cb_t) cb, userdata);
 
+    /* And after what still waits for room in the ring */
     t = pa_tagstruct_command(s->context, PA_COMMAND_DRAIN_PLAYBACK_STREAM, &tag);
     pa_tagstruct_putu32(t, s->channel);
-    pa_pstream_send_tagstruct(s->context->pstream, t);
+    ring_send_command(s, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_stream_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
     /* This might cause the read index to conitnue again, hence
@@ -1579,6 +2824,41 @@ static pa_usec_t calc_time(pa_stream *s, pa_bool_t ignore_transport) {
     return usec;
 }
 
+static void update_smoother(pa_stream *s) {
+    pa_timing_info *i = &s->timing_info;
+    pa_usec_t u, x;
+
+    if (!s->smoother)
+        return;
+
+    u = x = pa_rtclock_now() - i->transport_usec;
+
+    if (s->direction == PA_STREAM_PLAYBACK && s->context->version >= 13) {
+        pa_usec_t su;
+
+        /* If we weren't playing then it will take some time
+         * until the audio will actually come out through the
+         * speakers. Since we follow that timing here, we need
+         * to try to fix this up */
+
+        su = pa_bytes_to_usec((uint64_t) i->since_underrun, &s->sample_spec);
+
+        if (su < i->sink_usec)
+            x += i->sink_usec - su;
+    }
+
+    if (!i->playing)
+        pa_smoother_pause(s->smoother, x);
+
+    /* Update the smoother */
+    if ((s->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
+        (s->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
+        pa_smoother_put(s->smoother, u, calc_time(s, TRUE));
+
+    if (i->playing)
+        pa_smoother_resume(s->smoother, x, TRUE);
+}
+
 static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_operation *o = userdata;
     struct timeval local, remote, now;
@@ -1717,41 +2997,13 @@ static void stream_get_timing_info_callback(pa_pdispatch *pd, uint32_t command,
                 i->read_index -= (int64_t) pa_memblockq_get_length(o->stream->record_memblockq);
         }
 
-        /* Update smoother */
-        if (o->stream->smoother) {
-            pa_usec_t u, x;
-
-            u = x = pa_rtclock_now() - i->transport_usec;
-
-            if (o->stream->direction == PA_STREAM_PLAYBACK && o->context->version >= 13) {
-                pa_usec_t su;
-
-                /* If we weren't playing then it will take some time
-                 * until the audio will actually come out through the
-                 * speakers. Since we follow that timing here, we need
-                 * to try to fix this up */
-
-                su = pa_bytes_to_usec((uint64_t) i->since_underrun, &o->stream->sample_spec);
-
-                if (su < i->sink_usec)
-                    x += i->sink_usec - su;
-            }
-
-            if (!i->playing)
-                pa_smoother_pause(o->stream->smoother, x);
-
-            /* Update the smoother */
-            if ((o->stream->direction == PA_STREAM_PLAYBACK && !i->read_index_corrupt) ||
-                (o->stream->direction == PA_STREAM_RECORD && !i->write_index_corrupt))
-                pa_smoother_put(o->stream->smoother, u, calc_time(o->stream, TRUE));
-
-            if (i->playing)
-                pa_smoother_resume(o->stream->smoother, x, TRUE);
-        }
+        update_smoother(o->stream);
     }
 
     o->stream->auto_timing_update_requested = FALSE;
 
+    lockfree_publish_timing(o->stream);
+
     if (o->stream->latency_update_callback)
         o->stream->latency_update_callback(o->stream, o->stream->latency_update_userdata);
 
@@ -2078,7 +3330,7 @@ pa_operation* pa_stream_cork(pa_stream *s, int b, pa_stream_success_cb_t cb, voi
             &tag);
     pa_tagstruct_putu32(t, s->channel);
     pa_tagstruct_put_boolean(t, !!b);
-    pa_pstream_send_tagstruct(s->context->pstream, t);
+    ring_send_command(s, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_stream_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
     check_smoother_status(s, FALSE, FALSE, FALSE);
@@ -2105,7 +3357,7 @@ static pa_operation* stream_send_simple_command(pa_stream *s, uint32_t command,
 
     t = pa_tagstruct_command(s->context, command, &tag);
     pa_tagstruct_putu32(t, s->channel);
-    pa_pstream_send_tagstruct(s->context->pstream, t);
+    ring_send_command(s, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_stream_simple_ack_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
 
     return o;
@@ -2121,6 +3373,10 @@ pa_operation* pa_stream_flush(pa_stream *s, pa_stream_success_cb_t cb, void *use
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->state == PA_STREAM_READY, PA_ERR_BADSTATE);
     PA_CHECK_VALIDITY_RETURN_NULL(s->context, s->direction != PA_STREAM_UPLOAD, PA_ERR_BADSTATE);
 
+    /* Send out what was queued lock-free so far, the flush drops it */
+    if (s->lockfree_queue)
+        lockfree_flush(s);
+
     /* Ask for a timing update *before* the flush, so that the
      * transport usec is as up to date as possible when we get the
      * underflow message and update the smoother status*/
@@ -2131,6 +3387,12 @@ pa_operation* pa_stream_flush(pa_stream *s, pa_stream_success_cb_t cb, void *use
 
     if (s->direction == PA_STREAM_PLAYBACK) {
 
+        /* Whatever did not make it into the ring yet is dropped
+         * right away and the flush queued behind it goes out now,
+         * what did is dropped by the server, which empties the ring
+         * before it flushes */
+        ring_drop_pending(s);
+
         if (s->write_index_corrections[s->current_write_index_correction].valid)
             s->write_index_corrections[s->current_write_index_correction].corrupt = TRUE;
 
@@ -188,6 +188,11 @@
  * record. Make sure you do not overflow the playback buffers as data will be
  * dropped.
  *
+ * Applications that keep their audio in several separate buffers can use
+ * pa_stream_writev() and pa_stream_peekv() to transfer all of them in one
+ * call. Non-interleaved audio with one buffer per channel can be written
+ * with pa_stream_write_planar().
+ *
  * \section bufctl_sec Buffer Control
  *
  * The transfer buffers can be controlled through a number of operations:
@@ -334,6 +339,13 @@ typedef void (*pa_stream_notify_cb_t)(pa_stream *p, void *userdata);
  * it doesn't know. \since 0.9.15 */
 typedef void (*pa_stream_event_cb_t)(pa_stream *p, const char *name, pa_proplist *pl, void *userdata);
 
+/** A fragment of audio data, as passed to pa_stream_writev() and
+ * returned by pa_stream_peekv(). \since 0.9.22 */
+typedef struct pa_stream_iovec {
+    const void *data;   /**< Start of the fragment, NULL for a hole in a recording stream */
+    size_t length;      /**< Length of the fragment in bytes */
+} pa_stream_iovec;
+
 /** Create a new, unconnected stream with the specified name and
  * sample type. It is recommended to use pa_stream_new_with_proplist()
  * instead and specify some initial properties. */
@@ -416,7 +428,13 @@ int pa_stream_is_corked(pa_stream *s);
  * absolute device volume. Since 0.9.20 it is an absolute volume when
  * the sink is in flat volume mode, and relative otherwise, thus
  * making sure the volume passed here has always the same semantics as
- * the volume passed to pa_context_set_sink_input_volume(). */
+ * the volume passed to pa_context_set_sink_input_volume().
+ *
+ * Since 0.9.22 a stream may be connected right after
+ * pa_context_connect(), before the context is ready. On local
+ * connections the request to create the stream is then sent along with
+ * the authentication, which saves short-lived clients a few round
+ * trips. The same applies to pa_stream_connect_record(). */
 int pa_stream_connect_playback(
         pa_stream *s                  /**< The stream to connect to a sink */,
         const char *dev               /**< Name of the sink to connect to, or NULL for default */ ,
@@ -508,6 +526,66 @@ int pa_stream_write(
         int64_t offset,          /**< Offset for seeking, must be 0 for upload streams */
         pa_seek_mode_t seek      /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
 
+/** Write the concatenation of n fragments to the server, like a single
+ * pa_stream_write() of all of them. If free_cb is non-NULL it is
+ * called for the data of each fragment once that has been written
+ * out, and the fragments are passed on as they are without being
+ * copied. Otherwise the fragments are gathered into as few internal
+ * buffers as possible. The seek applies to the first fragment. May
+ * not be called between pa_stream_begin_write() and
+ * pa_stream_write(). \since 0.9.22 */
+int pa_stream_writev(
+        pa_stream *p                 /**< The stream to use */,
+        const pa_stream_iovec *iov   /**< The fragments to write */,
+        unsigned n                   /**< The number of fragments */,
+        pa_free_cb_t free_cb         /**< A cleanup routine for the data of each fragment or NULL to request an internal copy */,
+        int64_t offset,              /**< Offset for seeking, must be 0 for upload streams */
+        pa_seek_mode_t seek          /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
+
+/** Write nframes frames of non-interleaved (planar) data to the
+ * server. planes contains one array of samples in the stream's sample
+ * format for each channel, in the order of the stream's channel
+ * map. The samples are interleaved directly into the buffers that are
+ * passed to the server, so that applications that keep their audio in
+ * separate channels don't need to interleave it into a buffer of their
+ * own first. The data is always copied. The seek applies to the first
+ * frame. If this fails after some of the frames were written, those
+ * stay written. May not be called between pa_stream_begin_write() and
+ * pa_stream_write(). \since 0.9.22 */
+int pa_stream_write_planar(
+        pa_stream *p                 /**< The stream to use */,
+        const void *planes[]         /**< One pointer to the samples of each channel */,
+        size_t nframes               /**< The number of frames to write */,
+        int64_t offset,              /**< Offset for seeking, must be 0 for upload streams */
+        pa_seek_mode_t seek          /**< Seek mode, must be PA_SEEK_RELATIVE for upload streams */);
+
+/** Prepare the stream for pa_stream_write_lockfree() and
+ * pa_stream_get_latency_lockfree(). These two may be called from a
+ * thread that does not hold the lock of a pa_threaded_mainloop, such
+ * as an audio thread with real-time constraints. They never block and
+ * never wait for the event loop thread, which picks up the written
+ * data the next time it runs. Call this with the lock held, before or
+ * after connecting the stream. \since 0.9.22 */
+int pa_stream_enable_lockfree(pa_stream *p);
+
+/** Queue some data for playback without taking the lock of the event
+ * loop. The data is always copied. Only one thread may call this at a
+ * time. Returns a negative error code and leaves the context error
+ * untouched on failure: -PA_ERR_BUSY if the event loop did not catch
+ * up with previous writes yet, -PA_ERR_BADSTATE if the stream is not
+ * ready or pa_stream_enable_lockfree() was not called,
+ * -PA_ERR_TOOLARGE if nbytes does not fit into a single memory
+ * block of the context's memory pool. The data ends up in the stream at
+ * the current write index, as with pa_stream_write() with 0 and
+ * PA_SEEK_RELATIVE. The stream may be disconnected or fail at the
+ * same time; from then on -PA_ERR_BADSTATE is returned and data that
+ * was not sent yet is dropped. The caller needs to hold a reference to
+ * the stream, though. \since 0.9.22 */
+int pa_stream_write_lockfree(
+        pa_stream *p             /**< The stream to use */,
+        const void *data         /**< The data to write */,
+        size_t nbytes            /**< The length of the data to write in bytes*/);
+
 /** Read the next fragment from the buffer (for recording streams).
  * data will point to the actual data and nbytes will contain the size
  * of the data in bytes (which can be less or more than a complete
@@ -519,13 +597,32 @@ int pa_stream_peek(
         const void **data            /**< Pointer to pointer that will point to data */,
         size_t *nbytes               /**< The length of the data read in bytes */);
 
+/** Like pa_stream_peek(), but returns up to *n consecutive fragments
+ * at once, without copying them. On return *n contains the number of
+ * fragments stored in iov, 0 if no data is available. A fragment with
+ * a NULL data pointer is a hole in the buffer of the given
+ * length. pa_stream_drop() removes all of them from the buffer. It is
+ * invalid to mix this with pa_stream_peek() before calling
+ * pa_stream_drop(). \since 0.9.22 */
+int pa_stream_peekv(
+        pa_stream *p                 /**< The stream to use */,
+        pa_stream_iovec *iov         /**< Array that receives the fragments */,
+        unsigned *n                  /**< The size of iov on input, the number of fragments on return */);
+
 /** Remove the current fragment on record streams. It is invalid to do this without first
- * calling pa_stream_peek(). */
+ * calling pa_stream_peek() or pa_stream_peekv(). */
 int pa_stream_drop(pa_stream *p);
 
 /** Return the number of bytes that may be written using pa_stream_write() */
 size_t pa_stream_writable_size(pa_stream *p);
 
+/** Return the number of bytes that may be written using
+ * pa_stream_write_lockfree(). Like that function this may be called
+ * without holding the lock of the event loop. Returns 0 if
+ * pa_stream_enable_lockfree() was not called or the stream is not
+ * ready. \since 0.9.22 */
+size_t pa_stream_writable_size_lockfree(pa_stream *p);
+
 /** Return the number of bytes that may be read using pa_stream_peek()*/
 size_t pa_stream_readable_size(pa_stream *p);
 
@@ -672,6 +769,13 @@ int pa_stream_get_time(pa_stream *s, pa_usec_t *r_usec);
  * pa_stream_get_timing_info() and pa_stream_get_time(). */
 int pa_stream_get_latency(pa_stream *s, pa_usec_t *r_usec, int *negative);
 
+/** Like pa_stream_get_latency(), but may be called without holding
+ * the lock of the event loop. It works on a snapshot of the timing
+ * data that is published whenever it changes, plus what was written
+ * with pa_stream_write_lockfree() since. Returns a negative error code
+ * and leaves the context error untouched on failure. \since 0.9.22 */
+int pa_stream_get_latency_lockfree(pa_stream *s, pa_usec_t *r_usec, int *negative);
+
 /** Return the latest raw timing data structure. The returned pointer
  * points to an internal read-only instance of the timing
  * structure. The user should make a copy of this structure if he
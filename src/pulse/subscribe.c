@@ -36,8 +36,6 @@
 
 void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_context *c = userdata;
-    pa_subscription_event_type_t e;
-    uint32_t idx;
 
     pa_assert(pd);
     pa_assert(command == PA_COMMAND_SUBSCRIBE_EVENT);
@@ -47,15 +45,27 @@ void pa_command_subscribe_event(pa_pdispatch *pd, uint32_t command, uint32_t tag
 
     pa_context_ref(c);
 
-    if (pa_tagstruct_getu32(t, &e) < 0 ||
-        pa_tagstruct_getu32(t, &idx) < 0 ||
-        !pa_tagstruct_eof(t)) {
-        pa_context_fail(c, PA_ERR_PROTOCOL);
-        goto finish;
-    }
+    /* Since protocol v17 the server batches several events into a
+     * single packet */
+    do {
+        pa_subscription_event_type_t e;
+        uint32_t idx;
 
-    if (c->subscribe_callback)
-        c->subscribe_callback(c, e, idx, c->subscribe_userdata);
+        if (pa_tagstruct_getu32(t, &e) < 0 ||
+            pa_tagstruct_getu32(t, &idx) < 0 ||
+            (c->version < 17 && !pa_tagstruct_eof(t))) {
+            pa_context_fail(c, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        if (c->subscribe_callback)
+            c->subscribe_callback(c, e, idx, c->subscribe_userdata);
+
+        /* The callback might have disconnected us */
+        if (c->state != PA_CONTEXT_READY)
+            goto finish;
+
+    } while (!pa_tagstruct_eof(t));
 
 finish:
     pa_context_unref(c);
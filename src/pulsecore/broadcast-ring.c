@@ -0,0 +1,220 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+
+#include "broadcast-ring.h"
+
+/* Sequence numbers are free running unsigned counters, the slot of a
+ * sequence number is seq % n_slots. Since we only ever look at
+ * differences between sequence numbers, and n_slots is a power of
+ * two, wrap-around is harmless. */
+
+struct pa_broadcast_ring_reader {
+    pa_broadcast_ring *ring;
+
+    /* Sequence number of the next chunk to read. Written by the
+     * reader, read by the writer. */
+    pa_atomic_t cursor;
+
+    PA_LLIST_FIELDS(pa_broadcast_ring_reader);
+};
+
+struct pa_broadcast_ring {
+    unsigned n_slots;
+    pa_memchunk *slots;
+
+    /* Sequence number of the next chunk to push. Written by the
+     * writer, read by the readers. */
+    pa_atomic_t write_seq;
+
+    /* Only accessed by the writer */
+    PA_LLIST_HEAD(pa_broadcast_ring_reader, readers);
+};
+
+pa_broadcast_ring* pa_broadcast_ring_new(unsigned n_slots) {
+    pa_broadcast_ring *r;
+
+    pa_assert(n_slots > 0);
+    pa_assert(pa_is_power_of_two(n_slots));
+
+    r = pa_xnew0(pa_broadcast_ring, 1);
+    r->n_slots = n_slots;
+    r->slots = pa_xnew0(pa_memchunk, n_slots);
+    pa_atomic_store(&r->write_seq, 0);
+    PA_LLIST_HEAD_INIT(pa_broadcast_ring_reader, r->readers);
+
+    return r;
+}
+
+void pa_broadcast_ring_free(pa_broadcast_ring *r) {
+    unsigned i;
+
+    pa_assert(r);
+    pa_assert(!r->readers);
+
+    for (i = 0; i < r->n_slots; i++)
+        if (r->slots[i].memblock)
+            pa_memblock_unref(r->slots[i].memblock);
+
+    pa_xfree(r->slots);
+    pa_xfree(r);
+}
+
+/* Returns the sequence number of the slowest reader */
+static unsigned min_cursor(pa_broadcast_ring *r, unsigned write_seq) {
+    pa_broadcast_ring_reader *k;
+    unsigned lag = 0;
+
+    /* The reader furthest behind is the one with the largest
+     * distance to the write position */
+    PA_LLIST_FOREACH(k, r->readers) {
+        unsigned l = write_seq - (unsigned) pa_atomic_load(&k->cursor);
+
+        if (l > lag)
+            lag = l;
+    }
+
+    return write_seq - lag;
+}
+
+pa_bool_t pa_broadcast_ring_is_full(pa_broadcast_ring *r) {
+    unsigned write_seq;
+
+    pa_assert(r);
+
+    write_seq = (unsigned) pa_atomic_load(&r->write_seq);
+
+    return write_seq - min_cursor(r, write_seq) >= r->n_slots;
+}
+
+size_t pa_broadcast_ring_get_length(pa_broadcast_ring *r) {
+    unsigned write_seq, seq;
+    size_t length = 0;
+
+    pa_assert(r);
+
+    write_seq = (unsigned) pa_atomic_load(&r->write_seq);
+
+    for (seq = min_cursor(r, write_seq); seq != write_seq; seq++)
+        length += r->slots[seq % r->n_slots].length;
+
+    return length;
+}
+
+void pa_broadcast_ring_push(pa_broadcast_ring *r, const pa_memchunk *chunk) {
+    unsigned write_seq;
+    pa_memchunk *slot;
+
+    pa_assert(r);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(chunk->length > 0);
+    pa_assert(!pa_broadcast_ring_is_full(r));
+
+    write_seq = (unsigned) pa_atomic_load(&r->write_seq);
+    slot = r->slots + (write_seq % r->n_slots);
+
+    /* All readers have passed this slot, so we may drop the old
+     * block. Readers took their own references. */
+    if (slot->memblock)
+        pa_memblock_unref(slot->memblock);
+
+    *slot = *chunk;
+    pa_memblock_ref(slot->memblock);
+
+    /* Publish the slot. The atomic operation implies a full memory
+     * barrier, so the slot contents are visible before the new write
+     * position is. */
+    pa_atomic_store(&r->write_seq, (int) (write_seq + 1));
+}
+
+pa_broadcast_ring_reader* pa_broadcast_ring_reader_new(pa_broadcast_ring *r) {
+    pa_broadcast_ring_reader *k;
+
+    pa_assert(r);
+
+    k = pa_xnew0(pa_broadcast_ring_reader, 1);
+    k->ring = r;
+    pa_atomic_store(&k->cursor, pa_atomic_load(&r->write_seq));
+
+    PA_LLIST_PREPEND(pa_broadcast_ring_reader, r->readers, k);
+
+    return k;
+}
+
+void pa_broadcast_ring_reader_free(pa_broadcast_ring_reader *k) {
+    pa_assert(k);
+
+    PA_LLIST_REMOVE(pa_broadcast_ring_reader, k->ring->readers, k);
+    pa_xfree(k);
+}
+
+int pa_broadcast_ring_reader_pop(pa_broadcast_ring_reader *k, pa_memchunk *chunk) {
+    unsigned cursor;
+
+    pa_assert(k);
+    pa_assert(chunk);
+
+    cursor = (unsigned) pa_atomic_load(&k->cursor);
+
+    if (cursor == (unsigned) pa_atomic_load(&k->ring->write_seq))
+        return -1;
+
+    /* The writer won't touch this slot before we moved our cursor
+     * past it */
+    *chunk = k->ring->slots[cursor % k->ring->n_slots];
+    pa_memblock_ref(chunk->memblock);
+
+    pa_atomic_store(&k->cursor, (int) (cursor + 1));
+
+    return 0;
+}
+
+size_t pa_broadcast_ring_reader_get_length(pa_broadcast_ring_reader *k) {
+    unsigned write_seq, seq;
+    size_t length = 0;
+
+    pa_assert(k);
+
+    write_seq = (unsigned) pa_atomic_load(&k->ring->write_seq);
+
+    /* The slots between our cursor and the write position stay
+     * untouched until we read them */
+    for (seq = (unsigned) pa_atomic_load(&k->cursor); seq != write_seq; seq++)
+        length += k->ring->slots[seq % k->ring->n_slots].length;
+
+    return length;
+}
+
+unsigned pa_broadcast_ring_get_n_slots(pa_broadcast_ring *r) {
+    pa_assert(r);
+
+    return r->n_slots;
+}
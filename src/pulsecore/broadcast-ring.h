@@ -0,0 +1,72 @@
+#ifndef foopulsebroadcastringhfoo
+#define foopulsebroadcastringhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/def.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memchunk.h>
+
+/* A lock-free ring of memchunks with a single writer and any number
+ * of readers, each of which gets to see every chunk pushed after it
+ * was added. Every reader has its own read cursor and may run in its
+ * own thread. A slot is reused only after all readers have passed
+ * it, hence the writer never overwrites data that is still to be
+ * read, and readers never wait for each other.
+ *
+ * Readers are added and removed from the writer's thread, and only
+ * while the reader is not being used by its own thread. Waking up
+ * the other side is left to the caller. */
+
+/* What module-combine uses: the number of chunks the writer may be
+ * ahead of the slowest reader, and how many blocks of the size last
+ * asked for it tries to keep ready */
+#define PA_BROADCAST_RING_COMBINE_SLOTS 32
+#define PA_BROADCAST_RING_COMBINE_RENDER_AHEAD 2
+
+typedef struct pa_broadcast_ring pa_broadcast_ring;
+typedef struct pa_broadcast_ring_reader pa_broadcast_ring_reader;
+
+/* n_slots needs to be a power of two */
+pa_broadcast_ring* pa_broadcast_ring_new(unsigned n_slots);
+void pa_broadcast_ring_free(pa_broadcast_ring *r);
+
+/* For the writing side */
+pa_bool_t pa_broadcast_ring_is_full(pa_broadcast_ring *r);
+void pa_broadcast_ring_push(pa_broadcast_ring *r, const pa_memchunk *chunk);
+
+/* Number of bytes that the slowest reader has not read yet */
+size_t pa_broadcast_ring_get_length(pa_broadcast_ring *r);
+
+/* Readers start with the next chunk pushed */
+pa_broadcast_ring_reader* pa_broadcast_ring_reader_new(pa_broadcast_ring *r);
+void pa_broadcast_ring_reader_free(pa_broadcast_ring_reader *k);
+
+/* For the reading side. Returns a new reference in chunk */
+int pa_broadcast_ring_reader_pop(pa_broadcast_ring_reader *k, pa_memchunk *chunk);
+
+/* Number of bytes this reader has not read yet */
+size_t pa_broadcast_ring_reader_get_length(pa_broadcast_ring_reader *k);
+
+unsigned pa_broadcast_ring_get_n_slots(pa_broadcast_ring *r);
+
+#endif
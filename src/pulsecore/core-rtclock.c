@@ -34,11 +34,36 @@
 #endif
 
 #include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-error.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/mutex.h>
 
 #include "core-rtclock.h"
 
+/* While the virtual clock is enabled pa_rtclock_get() returns
+ * virtual_now, which only moves when all participants are idle. It
+ * then jumps right to the earliest deadline any of them waits for. */
+
+struct pa_rtclock_participant {
+    pa_bool_t idle;
+    pa_usec_t deadline;
+
+    PA_LLIST_FIELDS(pa_rtclock_participant);
+};
+
+/* Only set before any threads are started, hence no locking */
+static pa_bool_t virtual_clock = FALSE;
+
+static pa_static_mutex virtual_mutex = PA_STATIC_MUTEX_INIT;
+static pa_usec_t virtual_now = 0;
+static unsigned n_participants = 0, n_idle = 0, n_holds = 0;
+static PA_LLIST_HEAD(pa_rtclock_participant, participants) = NULL;
+
+static struct timeval *get_system_time(struct timeval *tv);
+
 pa_usec_t pa_rtclock_age(const struct timeval *tv) {
     struct timeval now;
     pa_assert(tv);
@@ -47,6 +72,23 @@ pa_usec_t pa_rtclock_age(const struct timeval *tv) {
 }
 
 struct timeval *pa_rtclock_get(struct timeval *tv) {
+
+    if (PA_UNLIKELY(virtual_clock)) {
+        pa_mutex *m;
+        pa_usec_t now;
+
+        m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+        pa_mutex_lock(m);
+        now = virtual_now;
+        pa_mutex_unlock(m);
+
+        return pa_timeval_store(tv, now);
+    }
+
+    return get_system_time(tv);
+}
+
+static struct timeval *get_system_time(struct timeval *tv) {
 #ifdef HAVE_CLOCK_GETTIME
     struct timespec ts;
 
@@ -76,6 +118,138 @@ struct timeval *pa_rtclock_get(struct timeval *tv) {
 #endif
 }
 
+void pa_rtclock_virtual_enable(void) {
+    struct timeval tv;
+
+    if (virtual_clock)
+        return;
+
+    /* Start where the real clock is right now, so that time doesn't
+     * jump backwards */
+    virtual_now = pa_timeval_load(get_system_time(&tv));
+    virtual_clock = TRUE;
+
+    pa_log_info("Using a virtual clock, running faster than real time.");
+}
+
+pa_bool_t pa_rtclock_is_virtual(void) {
+    return virtual_clock;
+}
+
+pa_rtclock_participant* pa_rtclock_participant_new(void) {
+    pa_rtclock_participant *p;
+    pa_mutex *m;
+
+    pa_assert(virtual_clock);
+
+    p = pa_xnew0(pa_rtclock_participant, 1);
+
+    /* Until it runs for the first time the participant doesn't hold
+     * back the clock */
+    p->idle = TRUE;
+    p->deadline = PA_USEC_INVALID;
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    PA_LLIST_PREPEND(pa_rtclock_participant, participants, p);
+    n_participants++;
+    n_idle++;
+    pa_mutex_unlock(m);
+
+    return p;
+}
+
+void pa_rtclock_participant_free(pa_rtclock_participant *p) {
+    pa_mutex *m;
+
+    pa_assert(p);
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    PA_LLIST_REMOVE(pa_rtclock_participant, participants, p);
+    n_participants--;
+    if (p->idle)
+        n_idle--;
+    pa_mutex_unlock(m);
+
+    pa_xfree(p);
+}
+
+pa_usec_t pa_rtclock_participant_idle(pa_rtclock_participant *p, pa_usec_t deadline) {
+    pa_mutex *m;
+    pa_usec_t now;
+
+    pa_assert(p);
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if (!p->idle) {
+        p->idle = TRUE;
+        n_idle++;
+    }
+
+    p->deadline = deadline;
+
+    if (n_idle >= n_participants && n_holds <= 0) {
+        pa_rtclock_participant *i;
+        pa_usec_t next = PA_USEC_INVALID;
+
+        /* Nobody is doing anything, so skip ahead to whatever is
+         * going to happen next */
+        PA_LLIST_FOREACH(i, participants)
+            if (i->deadline < next)
+                next = i->deadline;
+
+        if (next != PA_USEC_INVALID && next > virtual_now)
+            virtual_now = next;
+    }
+
+    now = virtual_now;
+    pa_mutex_unlock(m);
+
+    return now;
+}
+
+void pa_rtclock_participant_busy(pa_rtclock_participant *p) {
+    pa_mutex *m;
+
+    pa_assert(p);
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+
+    if (p->idle) {
+        p->idle = FALSE;
+        n_idle--;
+    }
+
+    pa_mutex_unlock(m);
+}
+
+void pa_rtclock_virtual_hold(void) {
+    pa_mutex *m;
+
+    pa_assert(virtual_clock);
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    n_holds++;
+    pa_mutex_unlock(m);
+}
+
+void pa_rtclock_virtual_release(void) {
+    pa_mutex *m;
+
+    pa_assert(virtual_clock);
+
+    m = pa_static_mutex_get(&virtual_mutex, FALSE, FALSE);
+    pa_mutex_lock(m);
+    pa_assert(n_holds > 0);
+    n_holds--;
+    pa_mutex_unlock(m);
+}
+
 pa_bool_t pa_rtclock_hrtimer(void) {
 #ifdef HAVE_CLOCK_GETTIME
     struct timespec ts;
@@ -35,6 +35,34 @@ pa_usec_t pa_rtclock_age(const struct timeval *tv);
 pa_bool_t pa_rtclock_hrtimer(void);
 void pa_rtclock_hrtimer_enable(void);
 
+/* For rendering faster than real time: pa_rtclock_get() follows a
+ * virtual clock that jumps forward whenever all participants (the
+ * rtpoll loops of the IO threads and the main loop) are idle. Needs to be enabled
+ * before any threads are started. */
+void pa_rtclock_virtual_enable(void);
+pa_bool_t pa_rtclock_is_virtual(void);
+
+typedef struct pa_rtclock_participant pa_rtclock_participant;
+
+pa_rtclock_participant* pa_rtclock_participant_new(void);
+void pa_rtclock_participant_free(pa_rtclock_participant *p);
+
+/* The participant has nothing to do before deadline (PA_USEC_INVALID
+ * if it only waits for I/O). Returns the virtual time, after moving
+ * it forward if everybody is idle. */
+pa_usec_t pa_rtclock_participant_idle(pa_rtclock_participant *p, pa_usec_t deadline);
+void pa_rtclock_participant_busy(pa_rtclock_participant *p);
+
+/* As long as anybody holds the virtual clock it doesn't move, even if
+ * all participants are idle. For waiting on things outside of the
+ * participants, such as clients that still owe us data. */
+void pa_rtclock_virtual_hold(void);
+void pa_rtclock_virtual_release(void);
+
+/* How long participants and main loops sleep for real at most while
+ * the virtual clock is enabled, to give clients a chance to keep up */
+#define PA_RTCLOCK_VIRTUAL_SLICE_USEC (1*PA_USEC_PER_MSEC)
+
 /* timer with a resolution better than this are considered high-resolution */
 #define PA_HRTIMER_THRESHOLD_USEC 10
 
@@ -55,16 +55,366 @@
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
+#include <pulsecore/sound-file-cache.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/resampler.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
 
 #include "core-scache.h"
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* How many converted copies we keep per sample */
+#define N_CONVERTED_MAX 4
+
+struct pa_scache_converted {
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+
+    /* NULL memblock while the conversion is still running */
+    pa_memchunk memchunk;
+    pa_scache_job *job;
+
+    PA_LLIST_FIELDS(pa_scache_converted);
+};
+
+struct pa_scache_pending {
+    uint32_t sink_index;
+    pa_volume_t volume;
+    pa_proplist *proplist;
+
+    pa_scache_play_cb_t cb;
+    void *userdata;
+
+    PA_LLIST_FIELDS(pa_scache_pending);
+};
+
+typedef enum job_type {
+    JOB_LOAD,
+    JOB_CONVERT
+} job_type_t;
+
+/* Everything but entry and converted is owned by the loader thread
+ * while the job is running there */
+struct pa_scache_job {
+    job_type_t type;
+
+    /* Only accessed from the main thread, reset when the entry goes
+     * away in the meantime */
+    pa_scache_entry *entry;
+    pa_scache_converted *converted;
+
+    pa_mempool *mempool;
+
+    /* JOB_LOAD */
+    char *filename;
+    pa_proplist *proplist;
+
+    /* JOB_CONVERT: memchunk is converted from sample_spec/channel_map
+     * to target_spec/target_map, and replaced by the result */
+    pa_sample_spec sample_spec, target_spec;
+    pa_channel_map channel_map, target_map;
+    pa_resample_method_t resample_method;
+    pa_resample_flags_t resample_flags;
+
+    pa_memchunk memchunk;
+    int result;
+};
+
+/* A thread that loads lazy samples from disk and converts samples to
+ * the sample specs of the sinks they are played on, so that neither
+ * blocks the main loop */
+typedef struct scache_loader {
+    pa_msgobject parent;
+
+    pa_core *core;
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+} scache_loader;
+
+PA_DEFINE_PRIVATE_CLASS(scache_loader, pa_msgobject);
+#define SCACHE_LOADER(o) (scache_loader_cast(o))
+
+enum {
+    LOADER_MESSAGE_RUN,  /* to the loader thread */
+    LOADER_MESSAGE_DONE, /* back to the main thread */
+    LOADER_MESSAGE_MAX
+};
+
+static void job_done(pa_core *c, pa_scache_job *j);
+
+static void job_free(void *p) {
+    pa_scache_job *j = p;
+
+    pa_assert(j);
+
+    /* The entry must have let go of us already */
+    pa_assert(!j->entry || j->entry->load_job != j);
+    pa_assert(!j->converted || j->converted->job != j);
+
+    pa_xfree(j->filename);
+
+    if (j->proplist)
+        pa_proplist_free(j->proplist);
+
+    if (j->memchunk.memblock)
+        pa_memblock_unref(j->memchunk.memblock);
+
+    pa_xfree(j);
+}
+
+/* Called from the loader thread */
+static int job_convert(pa_scache_job *j) {
+    pa_resampler *r;
+    size_t max, idx = 0, length = 0, allocated;
+    uint8_t *data;
+
+    if (!(r = pa_resampler_new(j->mempool,
+                               &j->sample_spec, &j->channel_map,
+                               &j->target_spec, &j->target_map,
+                               j->resample_method, j->resample_flags)))
+        return -1;
+
+    max = pa_resampler_max_block_size(r);
+    allocated = pa_resampler_result(r, j->memchunk.length) + 64 * pa_frame_size(&j->target_spec);
+    data = pa_xmalloc(allocated);
+
+    while (idx < j->memchunk.length) {
+        pa_memchunk in, out;
+
+        in = j->memchunk;
+        in.index += idx;
+        in.length = PA_MIN(j->memchunk.length - idx, max);
+
+        pa_resampler_run(r, &in, &out);
+        idx += in.length;
+
+        if (!out.memblock)
+            continue;
+
+        if (length + out.length > allocated) {
+            allocated = (length + out.length) * 2;
+            data = pa_xrealloc(data, allocated);
+        }
+
+        memcpy(data + length, (uint8_t*) pa_memblock_acquire(out.memblock) + out.index, out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        length += out.length;
+    }
+
+    pa_resampler_free(r);
+
+    if (length <= 0) {
+        pa_xfree(data);
+        return -1;
+    }
+
+    pa_memblock_unref(j->memchunk.memblock);
+    j->memchunk.memblock = pa_memblock_new_malloced(j->mempool, data, length);
+    j->memchunk.index = 0;
+    j->memchunk.length = length;
+
+    return 0;
+}
+
+/* Called from the loader thread */
+static void job_run(pa_scache_job *j) {
+    pa_usec_t t;
+
+    pa_assert(j);
+
+    t = pa_rtclock_now();
+
+    if (j->type == JOB_LOAD) {
+        j->proplist = pa_proplist_new();
+        j->result = pa_sound_file_cache_load(j->mempool, j->filename, &j->sample_spec, &j->channel_map, &j->memchunk, j->proplist);
+
+        pa_log_debug("Loaded %s in %0.1f ms.", j->filename, (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC);
+    } else {
+        char a[PA_SAMPLE_SPEC_SNPRINT_MAX], b[PA_SAMPLE_SPEC_SNPRINT_MAX];
+
+        j->result = job_convert(j);
+
+        pa_log_debug("Converted sample from %s to %s in %0.1f ms.",
+                     pa_sample_spec_snprint(a, sizeof(a), &j->sample_spec),
+                     pa_sample_spec_snprint(b, sizeof(b), &j->target_spec),
+                     (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC);
+    }
+}
+
+static int loader_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    scache_loader *l = SCACHE_LOADER(o);
+
+    scache_loader_assert_ref(l);
+
+    switch (code) {
+
+        case LOADER_MESSAGE_RUN:
+
+            /* Called from the loader thread. Hand the job back when we
+             * are done, the main thread frees it. */
+            job_run(data);
+            pa_asyncmsgq_post(l->thread_mq.outq, PA_MSGOBJECT(l), LOADER_MESSAGE_DONE, data, 0, NULL, job_free);
+            return 0;
+
+        case LOADER_MESSAGE_DONE:
+            job_done(l->core, data);
+            return 0;
+    }
+
+    return -1;
+}
+
+static void loader_thread_func(void *userdata) {
+    scache_loader *l = userdata;
+
+    pa_assert(l);
+
+    pa_log_debug("Sample cache loader starting up");
+
+    pa_thread_mq_install(&l->thread_mq);
+
+    for (;;) {
+        int ret;
+
+        if ((ret = pa_rtpoll_run(l->rtpoll, TRUE)) < 0)
+            break;
+
+        if (ret == 0)
+            goto finish;
+    }
+
+    /* We got an error, wait until we are told to quit */
+    pa_asyncmsgq_wait_for(l->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_log_debug("Sample cache loader shutting down");
+}
+
+static scache_loader* loader_get(pa_core *c) {
+    scache_loader *l;
+
+    pa_assert(c);
+
+    if (c->scache_loader)
+        return SCACHE_LOADER(c->scache_loader);
+
+    l = pa_msgobject_new(scache_loader);
+    l->parent.process_msg = loader_process_msg;
+    l->core = c;
+    l->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&l->thread_mq, c->mainloop, l->rtpoll);
+
+    if (!(l->thread = pa_thread_new(loader_thread_func, l))) {
+        pa_log("Failed to create sample cache loader thread.");
+
+        pa_thread_mq_done(&l->thread_mq);
+        pa_rtpoll_free(l->rtpoll);
+        scache_loader_unref(l);
+        return NULL;
+    }
+
+    c->scache_loader = PA_MSGOBJECT(l);
+    return l;
+}
+
+static void loader_free(pa_core *c) {
+    scache_loader *l;
+
+    pa_assert(c);
+
+    if (!c->scache_loader)
+        return;
+
+    l = SCACHE_LOADER(c->scache_loader);
+
+    /* Jobs that are still queued are run before this returns */
+    pa_asyncmsgq_send(l->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(l->thread);
+
+    /* This dispatches the results that are still queued for us */
+    pa_thread_mq_done(&l->thread_mq);
+    pa_rtpoll_free(l->rtpoll);
+
+    c->scache_loader = NULL;
+    scache_loader_unref(l);
+}
+
+static pa_bool_t job_submit(pa_core *c, pa_scache_job *j) {
+    scache_loader *l;
+
+    pa_assert(c);
+    pa_assert(j);
+
+    if (!(l = loader_get(c)))
+        return FALSE;
+
+    j->mempool = c->mempool;
+    pa_asyncmsgq_post(l->thread_mq.inq, PA_MSGOBJECT(l), LOADER_MESSAGE_RUN, j, 0, NULL, NULL);
+
+    return TRUE;
+}
+
+static void converted_free(pa_scache_entry *e, pa_scache_converted *cv) {
+    pa_assert(e);
+    pa_assert(cv);
+
+    PA_LLIST_REMOVE(pa_scache_converted, e->converted, cv);
+    pa_assert(e->n_converted > 0);
+    e->n_converted--;
+
+    /* The loader still has it, it will drop the result */
+    if (cv->job) {
+        cv->job->converted = NULL;
+        cv->job->entry = NULL;
+    }
+
+    if (cv->memchunk.memblock)
+        pa_memblock_unref(cv->memchunk.memblock);
+
+    pa_xfree(cv);
+}
+
+static void pending_free(pa_scache_entry *e, pa_scache_pending *pe, int r) {
+    pa_assert(e);
+    pa_assert(pe);
+
+    PA_LLIST_REMOVE(pa_scache_pending, e->pending, pe);
+
+    if (r < 0 && pe->cb)
+        pe->cb(e->core, r, PA_INVALID_INDEX, pe->userdata);
+
+    if (pe->proplist)
+        pa_proplist_free(pe->proplist);
+    pa_xfree(pe);
+}
+
+/* Drops everything derived from the memchunk of the entry */
+static void entry_reset(pa_scache_entry *e) {
+    pa_assert(e);
+
+    while (e->converted)
+        converted_free(e, e->converted);
+
+    if (e->load_job) {
+        e->load_job->entry = NULL;
+        e->load_job = NULL;
+    }
+
+    while (e->pending)
+        pending_free(e, e->pending, -1);
+}
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -80,6 +430,8 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
+    entry_reset(e);
+
     pa_namereg_unregister(e->core, e->name);
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
@@ -98,6 +450,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
     pa_assert(name);
 
     if ((e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE))) {
+        entry_reset(e);
+
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
@@ -119,6 +473,11 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         e->core = c;
         e->proplist = pa_proplist_new();
 
+        PA_LLIST_HEAD_INIT(pa_scache_converted, e->converted);
+        e->n_converted = 0;
+        e->load_job = NULL;
+        PA_LLIST_HEAD_INIT(pa_scache_pending, e->pending);
+
         pa_idxset_put(c->scache, e, &e->index);
 
         pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_NEW, e->index);
@@ -221,7 +580,7 @@ int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint3
     p = pa_proplist_new();
     pa_proplist_sets(p, PA_PROP_MEDIA_FILENAME, filename);
 
-    if (pa_sound_file_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
+    if (pa_sound_file_cache_load(c->mempool, filename, &ss, &map, &chunk, p) < 0) {
         pa_proplist_free(p);
         return -1;
     }
@@ -290,48 +649,132 @@ void pa_scache_free_all(pa_core *c) {
     while ((e = pa_idxset_steal_first(c->scache, NULL)))
         free_entry(e);
 
+    loader_free(c);
+
     if (c->scache_auto_unload_event) {
         c->mainloop->time_free(c->scache_auto_unload_event);
         c->scache_auto_unload_event = NULL;
     }
 }
 
-int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
-    pa_scache_entry *e;
-    pa_cvolume r;
-    pa_proplist *merged;
-    pa_bool_t pass_volume;
+/* Applies a freshly loaded sample to a lazy entry */
+static void entry_loaded(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map, pa_memchunk *chunk) {
+    pa_channel_map old_channel_map;
 
-    pa_assert(c);
-    pa_assert(name);
+    pa_assert(e);
+    pa_assert(!e->memchunk.memblock);
+
+    old_channel_map = e->channel_map;
+
+    e->sample_spec = *ss;
+    e->channel_map = *map;
+    e->memchunk = *chunk;
+    pa_memchunk_reset(chunk);
+
+    pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
+
+    if (e->volume_is_set) {
+        if (pa_cvolume_valid(&e->volume))
+            pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
+        else
+            pa_cvolume_reset(&e->volume, e->sample_spec.channels);
+    }
+}
+
+/* Returns the copy of the sample in the sample spec of the sink, if
+ * there is one. Otherwise starts converting it in the background for
+ * the next time. */
+static pa_scache_converted* entry_get_converted(pa_scache_entry *e, pa_sink *sink) {
+    pa_scache_converted *cv;
+    pa_scache_job *j;
+    uint64_t l;
+
+    pa_assert(e);
     pa_assert(sink);
 
-    if (!(e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE)))
-        return -1;
+    if (pa_sample_spec_equal(&e->sample_spec, &sink->sample_spec) &&
+        pa_channel_map_equal(&e->channel_map, &sink->channel_map))
+        return NULL;
 
-    merged = pa_proplist_new();
-    pa_proplist_setf(merged, PA_PROP_MEDIA_NAME, "Sample %s", name);
+    for (cv = e->converted; cv; cv = cv->next)
+        if (pa_sample_spec_equal(&cv->sample_spec, &sink->sample_spec) &&
+            pa_channel_map_equal(&cv->channel_map, &sink->channel_map))
+            break;
 
-    if (e->lazy && !e->memchunk.memblock) {
-        pa_channel_map old_channel_map = e->channel_map;
+    if (cv) {
+        if (!cv->memchunk.memblock)
+            return NULL;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
-            goto fail;
+        /* Most recently used first */
+        PA_LLIST_REMOVE(pa_scache_converted, e->converted, cv);
+        PA_LLIST_PREPEND(pa_scache_converted, e->converted, cv);
 
-        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
+        return cv;
+    }
 
-        if (e->volume_is_set) {
-            if (pa_cvolume_valid(&e->volume))
-                pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
-            else
-                pa_cvolume_reset(&e->volume, e->sample_spec.channels);
-        }
+    l = ((uint64_t) (e->memchunk.length / pa_frame_size(&e->sample_spec)) * sink->sample_spec.rate / e->sample_spec.rate) * pa_frame_size(&sink->sample_spec);
+    if (l > PA_SCACHE_ENTRY_SIZE_MAX)
+        return NULL;
+
+    if (e->n_converted >= N_CONVERTED_MAX) {
+        pa_scache_converted *last;
+
+        for (last = e->converted; last->next; last = last->next)
+            ;
+
+        if (last->job)
+            return NULL;
+
+        converted_free(e, last);
     }
 
-    if (!e->memchunk.memblock)
-        goto fail;
+    cv = pa_xnew0(pa_scache_converted, 1);
+    cv->sample_spec = sink->sample_spec;
+    cv->channel_map = sink->channel_map;
+    pa_memchunk_reset(&cv->memchunk);
+
+    j = pa_xnew0(pa_scache_job, 1);
+    j->type = JOB_CONVERT;
+    j->entry = e;
+    j->converted = cv;
+    j->sample_spec = e->sample_spec;
+    j->channel_map = e->channel_map;
+    j->target_spec = sink->sample_spec;
+    j->target_map = sink->channel_map;
+    j->resample_method = e->core->resample_method;
+    j->resample_flags =
+        (e->core->disable_remixing ? PA_RESAMPLER_NO_REMIX : 0) |
+        (e->core->disable_lfe_remixing ? PA_RESAMPLER_NO_LFE : 0);
+    j->memchunk = e->memchunk;
+    pa_memblock_ref(j->memchunk.memblock);
+
+    if (!job_submit(e->core, j)) {
+        job_free(j);
+        pa_xfree(cv);
+        return NULL;
+    }
+
+    cv->job = j;
+    PA_LLIST_PREPEND(pa_scache_converted, e->converted, cv);
+    e->n_converted++;
+
+    return NULL;
+}
 
-    pa_log_debug("Playing sample \"%s\" on \"%s\"", name, sink->name);
+static int entry_play(pa_scache_entry *e, pa_sink *sink, pa_volume_t volume, pa_proplist *merged, pa_proplist *p, uint32_t *sink_input_idx) {
+    pa_scache_converted *cv;
+    const pa_sample_spec *ss;
+    const pa_channel_map *map;
+    const pa_memchunk *chunk;
+    pa_cvolume r;
+    pa_bool_t pass_volume;
+
+    pa_assert(e);
+    pa_assert(e->memchunk.memblock);
+    pa_assert(sink);
+    pa_assert(merged);
+
+    pa_log_debug("Playing sample \"%s\" on \"%s\"", e->name, sink->name);
 
     pass_volume = TRUE;
 
@@ -345,26 +788,243 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     else
         pass_volume = FALSE;
 
+    /* If we have it in the format of the sink already, playing it
+     * doesn't need a resampler */
+    if ((cv = entry_get_converted(e, sink))) {
+        ss = &cv->sample_spec;
+        map = &cv->channel_map;
+        chunk = &cv->memchunk;
+
+        if (pass_volume)
+            pa_cvolume_remap(&r, &e->channel_map, map);
+    } else {
+        ss = &e->sample_spec;
+        map = &e->channel_map;
+        chunk = &e->memchunk;
+    }
+
     pa_proplist_update(merged, PA_UPDATE_REPLACE, e->proplist);
 
     if (p)
         pa_proplist_update(merged, PA_UPDATE_REPLACE, p);
 
-    if (pa_play_memchunk(sink, &e->sample_spec, &e->channel_map, &e->memchunk, pass_volume ? &r : NULL, merged, sink_input_idx) < 0)
-        goto fail;
-
-    pa_proplist_free(merged);
+    if (pa_play_memchunk(sink, ss, map, chunk, pass_volume ? &r : NULL, merged, sink_input_idx) < 0)
+        return -1;
 
     if (e->lazy)
         time(&e->last_used_time);
 
     return 0;
+}
+
+/* Plays what was queued up while the sample was being loaded. file_pl
+ * is what the sound file told us about itself. */
+static void entry_play_pending(pa_scache_entry *e, pa_proplist *file_pl) {
+    pa_assert(e);
+    pa_assert(e->memchunk.memblock);
+
+    while (e->pending) {
+        pa_scache_pending *pe = e->pending;
+        pa_proplist *merged;
+        pa_sink *sink;
+        uint32_t idx = PA_INVALID_INDEX;
+        int r = -1;
+
+        merged = pa_proplist_new();
+        pa_proplist_setf(merged, PA_PROP_MEDIA_NAME, "Sample %s", e->name);
+        if (file_pl)
+            pa_proplist_update(merged, PA_UPDATE_MERGE, file_pl);
+
+        /* The sink might have gone away in the meantime */
+        if ((sink = pa_idxset_get_by_index(e->core->sinks, pe->sink_index)))
+            r = entry_play(e, sink, pe->volume, merged, pe->proplist, &idx);
+
+        pa_proplist_free(merged);
+
+        if (pe->cb)
+            pe->cb(e->core, r, idx, pe->userdata);
+
+        pending_free(e, pe, 0);
+    }
+}
+
+static void job_done(pa_core *c, pa_scache_job *j) {
+    pa_scache_entry *e;
+
+    pa_assert(c);
+    pa_assert(j);
+
+    if (!(e = j->entry))
+        return;
+
+    if (j->type == JOB_CONVERT) {
+        pa_scache_converted *cv = j->converted;
+
+        pa_assert(cv);
+        pa_assert(cv->job == j);
+
+        /* job_free() must not look at cv anymore, it might be gone by
+         * then */
+        cv->job = NULL;
+        j->converted = NULL;
+        j->entry = NULL;
+
+        if (j->result < 0) {
+            pa_log_warn("Failed to convert sample \"%s\".", e->name);
+            converted_free(e, cv);
+            return;
+        }
+
+        cv->memchunk = j->memchunk;
+        pa_memchunk_reset(&j->memchunk);
+        return;
+    }
+
+    pa_assert(e->load_job == j);
+    e->load_job = NULL;
+
+    if (j->result < 0) {
+        pa_log_warn("Failed to load sample \"%s\" from %s.", e->name, j->filename);
+
+        while (e->pending)
+            pending_free(e, e->pending, -1);
+
+        return;
+    }
+
+    entry_loaded(e, &j->sample_spec, &j->channel_map, &j->memchunk);
+    entry_play_pending(e, j->proplist);
+}
+
+int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
+    pa_scache_entry *e;
+    pa_proplist *merged;
+
+    pa_assert(c);
+    pa_assert(name);
+    pa_assert(sink);
+
+    if (!(e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE)))
+        return -1;
+
+    merged = pa_proplist_new();
+    pa_proplist_setf(merged, PA_PROP_MEDIA_NAME, "Sample %s", name);
+
+    if (e->lazy && !e->memchunk.memblock) {
+        pa_sample_spec ss;
+        pa_channel_map map;
+        pa_memchunk chunk;
+
+        if (pa_sound_file_cache_load(c->mempool, e->filename, &ss, &map, &chunk, merged) < 0)
+            goto fail;
+
+        entry_loaded(e, &ss, &map, &chunk);
+
+        /* We beat the loader thread to it */
+        if (e->load_job) {
+            pa_scache_job *j = e->load_job;
+
+            e->load_job = NULL;
+            j->entry = NULL;
+
+            entry_play_pending(e, merged);
+        }
+    }
+
+    if (!e->memchunk.memblock)
+        goto fail;
+
+    if (entry_play(e, sink, volume, merged, p, sink_input_idx) < 0)
+        goto fail;
+
+    pa_proplist_free(merged);
+
+    return 0;
 
 fail:
     pa_proplist_free(merged);
     return -1;
 }
 
+static int play_now(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, pa_scache_play_cb_t cb, void *userdata) {
+    uint32_t idx = PA_INVALID_INDEX;
+    int r;
+
+    r = pa_scache_play_item(c, name, sink, volume, p, &idx);
+
+    if (cb)
+        cb(c, r, idx, userdata);
+
+    return 0;
+}
+
+int pa_scache_play_item_async(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, pa_scache_play_cb_t cb, void *userdata) {
+    pa_scache_entry *e;
+    pa_scache_pending *pe;
+
+    pa_assert(c);
+    pa_assert(name);
+    pa_assert(sink);
+
+    if (!(e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE)))
+        return -1;
+
+    if (!e->lazy || e->memchunk.memblock)
+        return play_now(c, name, sink, volume, p, cb, userdata);
+
+    pe = pa_xnew0(pa_scache_pending, 1);
+    pe->sink_index = sink->index;
+    pe->volume = volume;
+    pe->proplist = p ? pa_proplist_copy(p) : NULL;
+    pe->cb = cb;
+    pe->userdata = userdata;
+
+    PA_LLIST_PREPEND(pa_scache_pending, e->pending, pe);
+
+    if (!e->load_job) {
+        pa_scache_job *j;
+
+        j = pa_xnew0(pa_scache_job, 1);
+        j->type = JOB_LOAD;
+        j->entry = e;
+        j->filename = pa_xstrdup(e->filename);
+
+        if (!job_submit(c, j)) {
+            job_free(j);
+
+            /* No thread, so do it the old way */
+            pending_free(e, pe, 0);
+
+            return play_now(c, name, sink, volume, p, cb, userdata);
+        }
+
+        e->load_job = j;
+    }
+
+    return 0;
+}
+
+void pa_scache_cancel_pending(pa_core *c, void *userdata) {
+    pa_scache_entry *e;
+    uint32_t idx;
+
+    pa_assert(c);
+
+    if (!c->scache)
+        return;
+
+    for (e = pa_idxset_first(c->scache, &idx); e; e = pa_idxset_next(c->scache, &idx)) {
+        pa_scache_pending *pe, *n;
+
+        for (pe = e->pending; pe; pe = n) {
+            n = pe->next;
+
+            if (pe->userdata == userdata)
+                pending_free(e, pe, 0);
+        }
+    }
+}
+
 int pa_scache_play_item_by_name(pa_core *c, const char *name, const char*sink_name, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
     pa_sink *sink;
 
@@ -438,6 +1098,9 @@ void pa_scache_unload_unused(pa_core *c) {
         if (e->last_used_time + c->scache_idle_time > now)
             continue;
 
+        while (e->converted)
+            converted_free(e, e->converted);
+
         pa_memblock_unref(e->memchunk.memblock);
         pa_memchunk_reset(&e->memchunk);
 
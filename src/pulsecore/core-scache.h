@@ -24,11 +24,16 @@
 ***/
 
 #include <pulsecore/core.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/memchunk.h>
 #include <pulsecore/sink.h>
 
 #define PA_SCACHE_ENTRY_SIZE_MAX (1024*1024*16)
 
+typedef struct pa_scache_converted pa_scache_converted;
+typedef struct pa_scache_pending pa_scache_pending;
+typedef struct pa_scache_job pa_scache_job;
+
 typedef struct pa_scache_entry {
     uint32_t index;
     pa_core *core;
@@ -47,8 +52,21 @@ typedef struct pa_scache_entry {
     time_t last_used_time;
 
     pa_proplist *proplist;
+
+    /* Copies of memchunk in the sample specs of the sinks it was
+     * played on, most recently used first */
+    PA_LLIST_HEAD(pa_scache_converted, converted);
+    unsigned n_converted;
+
+    /* Set while a lazy sample is loaded in the background, and the
+     * plays that wait for it */
+    pa_scache_job *load_job;
+    PA_LLIST_HEAD(pa_scache_pending, pending);
 } pa_scache_entry;
 
+/* r is negative if the sample could not be played */
+typedef void (*pa_scache_play_cb_t)(pa_core *c, int r, uint32_t sink_input_idx, void *userdata);
+
 int pa_scache_add_item(pa_core *c, const char *name, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p, uint32_t *idx);
 int pa_scache_add_file(pa_core *c, const char *name, const char *filename, uint32_t *idx);
 int pa_scache_add_file_lazy(pa_core *c, const char *name, const char *filename, uint32_t *idx);
@@ -58,6 +76,17 @@ int pa_scache_add_directory_lazy(pa_core *c, const char *pathname);
 int pa_scache_remove_item(pa_core *c, const char *name);
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx);
 int pa_scache_play_item_by_name(pa_core *c, const char *name, const char*sink_name, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx);
+
+/* Like pa_scache_play_item(), but lazy samples that still need to be
+ * loaded are loaded in a background thread. cb is called once the
+ * sample started playing, which might happen before this function
+ * returns. Returns negative if there is no such sample, in which case
+ * cb is not called. */
+int pa_scache_play_item_async(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, pa_scache_play_cb_t cb, void *userdata);
+
+/* Forget about all plays started with pa_scache_play_item_async() for
+ * this userdata that are still waiting for their sample */
+void pa_scache_cancel_pending(pa_core *c, void *userdata);
 void pa_scache_free_all(pa_core *c);
 
 const char *pa_scache_get_name_by_id(pa_core *c, uint32_t id);
@@ -26,8 +26,10 @@
 #include <stdio.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
 
 #include <pulsecore/queue.h>
+#include <pulsecore/hashmap.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
@@ -38,16 +40,31 @@
  * register a callback function that is called whenever an event
  * matching a subscription mask happens. The execution of the callback
  * function is postponed to the next main loop iteration, i.e. is not
- * called from within the stack frame the entity was created in. */
+ * called from within the stack frame the entity was created in.
+ *
+ * Subscribers created with pa_subscription_new_coalesced() get their
+ * own event queue in which only the latest event for each object is
+ * kept. That queue is delivered in one go, at most once per
+ * configured interval, which keeps event storms (e.g. volume sliders
+ * being dragged) from hitting every client with every event. */
 
 struct pa_subscription {
     pa_core *core;
     pa_bool_t dead;
 
     pa_subscription_cb_t callback;
+    pa_subscription_flush_cb_t flush_callback;
     void *userdata;
     pa_subscription_mask_t mask;
 
+    /* Only used for coalescing subscribers */
+    pa_bool_t coalesce;
+    pa_usec_t interval, next_delivery;
+    pa_time_event *time_event;
+    pa_hashmap *pending_by_object;
+    PA_LLIST_HEAD(pa_subscription_event, pending);
+    pa_subscription_event *pending_last;
+
     PA_LLIST_FIELDS(pa_subscription);
 };
 
@@ -70,7 +87,7 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     pa_assert(m);
     pa_assert(callback);
 
-    s = pa_xnew(pa_subscription, 1);
+    s = pa_xnew0(pa_subscription, 1);
     s->core = c;
     s->dead = FALSE;
     s->callback = callback;
@@ -81,6 +98,35 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     return s;
 }
 
+static unsigned object_hash_func(const void *p) {
+    const pa_subscription_event *e = p;
+
+    return (unsigned) e->index * 31U + (unsigned) (e->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static int object_compare_func(const void *a, const void *b) {
+    const pa_subscription_event *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return (int) (x->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) - (int) (y->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+/* Allocate a new subscription object with its own coalescing event queue */
+pa_subscription* pa_subscription_new_coalesced(pa_core *c, pa_subscription_mask_t m, pa_usec_t interval, pa_subscription_cb_t callback, pa_subscription_flush_cb_t flush_callback, void *userdata) {
+    pa_subscription *s;
+
+    s = pa_subscription_new(c, m, callback, userdata);
+    s->flush_callback = flush_callback;
+    s->coalesce = TRUE;
+    s->interval = interval;
+    s->next_delivery = 0;
+    s->pending_by_object = pa_hashmap_new(object_hash_func, object_compare_func);
+
+    return s;
+}
+
 /* Free a subscription object, effectively marking it for deletion */
 void pa_subscription_free(pa_subscription*s) {
     pa_assert(s);
@@ -90,10 +136,34 @@ void pa_subscription_free(pa_subscription*s) {
     sched_event(s->core);
 }
 
+static void remove_pending(pa_subscription *s, pa_subscription_event *e) {
+    pa_assert(s);
+    pa_assert(e);
+
+    if (pa_hashmap_get(s->pending_by_object, e) == e)
+        pa_hashmap_remove(s->pending_by_object, e);
+
+    if (!e->next)
+        s->pending_last = e->prev;
+
+    PA_LLIST_REMOVE(pa_subscription_event, s->pending, e);
+    pa_xfree(e);
+}
+
 static void free_subscription(pa_subscription *s) {
     pa_assert(s);
     pa_assert(s->core);
 
+    if (s->coalesce) {
+        while (s->pending)
+            remove_pending(s, s->pending);
+
+        pa_hashmap_free(s->pending_by_object, NULL, NULL);
+
+        if (s->time_event)
+            s->core->mainloop->time_free(s->time_event);
+    }
+
     PA_LLIST_REMOVE(pa_subscription, s->core->subscriptions, s);
     pa_xfree(s);
 }
@@ -153,6 +223,127 @@ static void dump_event(const char * prefix, pa_subscription_event*e) {
 }
 #endif
 
+/* Add an event to the private queue of a coalescing subscriber,
+ * merging it with what is already queued for the same object */
+static void queue_pending(pa_subscription *s, pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_event k, *e;
+
+    pa_assert(s);
+    pa_assert(s->coalesce);
+
+    k.type = t;
+    k.index = idx;
+
+    if ((e = pa_hashmap_get(s->pending_by_object, &k))) {
+        pa_subscription_event_type_t old = e->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+        switch (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) {
+
+            case PA_SUBSCRIPTION_EVENT_CHANGE:
+                /* A queued "new" or "change" event already tells the
+                 * subscriber to look at the current state */
+                if (old != PA_SUBSCRIPTION_EVENT_REMOVE)
+                    return;
+
+                /* The object got replaced by a new one with the same
+                 * index: keep the removal in the queue, but track the
+                 * change from now on */
+                pa_hashmap_remove(s->pending_by_object, e);
+                break;
+
+            case PA_SUBSCRIPTION_EVENT_REMOVE:
+                if (old == PA_SUBSCRIPTION_EVENT_REMOVE)
+                    return;
+
+                remove_pending(s, e);
+
+                /* The subscriber never learnt about this object, so
+                 * there is nothing to remove either */
+                if (old == PA_SUBSCRIPTION_EVENT_NEW)
+                    return;
+                break;
+
+            default:
+                /* A "new" event for an index that is queued for
+                 * removal: keep the removal in the queue, but only
+                 * track the new object from now on */
+                pa_hashmap_remove(s->pending_by_object, e);
+                break;
+        }
+    }
+
+    e = pa_xnew(pa_subscription_event, 1);
+    e->core = s->core;
+    e->type = t;
+    e->index = idx;
+
+    PA_LLIST_INSERT_AFTER(pa_subscription_event, s->pending, s->pending_last, e);
+    s->pending_last = e;
+
+    pa_assert_se(pa_hashmap_put(s->pending_by_object, e, e) >= 0);
+}
+
+/* Hand the private queue of a coalescing subscriber to its callback */
+static void deliver_pending(pa_subscription *s) {
+    pa_subscription_event *e;
+    pa_bool_t any = FALSE;
+
+    pa_assert(s);
+    pa_assert(s->coalesce);
+
+    /* Detach the queue first, the callbacks might post new events */
+    while ((e = s->pending)) {
+        pa_subscription_event_type_t t = e->type;
+        uint32_t idx = e->index;
+
+        remove_pending(s, e);
+
+        if (!s->dead) {
+            s->callback(s->core, t, idx, s->userdata);
+            any = TRUE;
+        }
+    }
+
+    if (any && !s->dead && s->flush_callback)
+        s->flush_callback(s->core, s->userdata);
+
+    s->next_delivery = s->interval > 0 ? pa_rtclock_now() + s->interval : 0;
+}
+
+static void time_cb(pa_mainloop_api *m, pa_time_event *te, const struct timeval *tv, void *userdata) {
+    pa_subscription *s = userdata;
+
+    pa_assert(s);
+    pa_assert(s->time_event == te);
+
+    m->time_restart(te, NULL);
+
+    if (!s->dead)
+        deliver_pending(s);
+}
+
+/* Either deliver the queue of a coalescing subscriber right away or
+ * arm its timer if the last delivery was too recent */
+static void sched_pending(pa_subscription *s) {
+    pa_usec_t now;
+
+    pa_assert(s);
+    pa_assert(s->coalesce);
+
+    if (!s->pending || s->dead)
+        return;
+
+    if (s->interval <= 0 || (now = pa_rtclock_now()) >= s->next_delivery) {
+        deliver_pending(s);
+        return;
+    }
+
+    if (s->time_event)
+        pa_core_rttime_restart(s->core, s->time_event, s->next_delivery);
+    else
+        s->time_event = pa_core_rttime_new(s->core, s->next_delivery, time_cb, s);
+}
+
 /* Deferred callback for dispatching subscirption events */
 static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
     pa_core *c = userdata;
@@ -171,8 +362,12 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
         for (s = c->subscriptions; s; s = s->next) {
 
-            if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
-                s->callback(c, e->type, e->index, s->userdata);
+            if (!s->dead && pa_subscription_match_flags(s->mask, e->type)) {
+                if (s->coalesce)
+                    queue_pending(s, e->type, e->index);
+                else
+                    s->callback(c, e->type, e->index, s->userdata);
+            }
         }
 
 #ifdef DEBUG
@@ -181,6 +376,12 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
         free_event(e);
     }
 
+    /* Flush or schedule the queues of coalescing subscribers */
+
+    for (s = c->subscriptions; s; s = s->next)
+        if (s->coalesce)
+            sched_pending(s);
+
     /* Remove dead subscriptions */
 
     s = c->subscriptions;
@@ -29,8 +29,15 @@ typedef struct pa_subscription_event pa_subscription_event;
 #include <pulsecore/native-common.h>
 
 typedef void (*pa_subscription_cb_t)(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata);
+typedef void (*pa_subscription_flush_cb_t)(pa_core *c, void *userdata);
 
 pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m,  pa_subscription_cb_t cb, void *userdata);
+
+/* Like pa_subscription_new(), but events are queued per subscriber
+ * and coalesced: for each object only the latest state is kept. The
+ * queue is delivered at most once every interval usec, each batch is
+ * terminated by a call to flush_cb (which may be NULL). */
+pa_subscription* pa_subscription_new_coalesced(pa_core *c, pa_subscription_mask_t m, pa_usec_t interval, pa_subscription_cb_t cb, pa_subscription_flush_cb_t flush_cb, void *userdata);
 void pa_subscription_free(pa_subscription*s);
 void pa_subscription_free_all(pa_core *c);
 
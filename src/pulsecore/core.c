@@ -119,6 +119,7 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
 
     c->module_defer_unload_event = NULL;
     c->scache_auto_unload_event = NULL;
+    c->scache_loader = NULL;
 
     c->subscription_defer_event = NULL;
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
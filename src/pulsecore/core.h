@@ -148,6 +148,9 @@ struct pa_core {
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
 
+    /* Loads and converts samples in the background, see core-scache.c */
+    pa_msgobject *scache_loader;
+
     int exit_idle_time, scache_idle_time;
 
     pa_bool_t flat_volumes:1;
@@ -0,0 +1,735 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/log.h>
+#include <pulsecore/thread.h>
+
+#include "database.h"
+
+/* The database file is a header followed by a log of records, each
+ * of which is
+ *
+ *   [type: 1 byte][key length: 4 bytes LE][data length: 4 bytes LE][key][data]
+ *
+ * Changes are only ever appended to the file, and replayed in order
+ * when the file is loaded. A torn record at the end of the file (from
+ * a crash in the middle of a write) is dropped. Once the file has
+ * grown considerably bigger than its live contents, a snapshot of the
+ * current entries is written to a new file by a background thread,
+ * which then replaces the old log. */
+
+#define LOG_MAGIC "PALOG\001\0\0"
+#define HEADER_SIZE 8
+#define RECORD_HEADER_SIZE 9
+
+/* Don't fsync() more often than this */
+#define FSYNC_INTERVAL_USEC (1*PA_USEC_PER_SEC)
+
+/* Compact the log once it is larger than COMPACT_MIN_SIZE and more
+ * than COMPACT_RATIO times the size of its live contents */
+#define COMPACT_MIN_SIZE (64*1024)
+#define COMPACT_RATIO 2
+
+enum {
+    RECORD_SET = 1,
+    RECORD_UNSET = 2,
+    RECORD_CLEAR = 3
+};
+
+enum {
+    COMPACT_RUNNING,
+    COMPACT_DONE,
+    COMPACT_FAILED
+};
+
+typedef struct buffer {
+    uint8_t *data;
+    size_t length, allocated;
+} buffer;
+
+typedef struct log_data {
+    char *filename;
+    char *tmp_filename;
+    pa_hashmap *map;
+    pa_bool_t read_only;
+
+    int fd;
+
+    /* Bytes written to the log file so far, and bytes the file would
+     * take if it was compacted now */
+    size_t file_size;
+    size_t live_size;
+
+    /* Records not written to the file yet */
+    buffer pending;
+
+    pa_bool_t needs_fsync;
+    pa_usec_t last_fsync;
+
+    /* The compactor thread only touches compact_fd and snapshot. Once
+     * it is done, the records in since_snapshot are appended to the
+     * new file before it replaces the old one. */
+    pa_thread *compactor;
+    pa_atomic_t compactor_state;
+    int compact_fd;
+    buffer snapshot;
+    buffer since_snapshot;
+} log_data;
+
+typedef struct entry {
+    pa_datum key;
+    pa_datum data;
+} entry;
+
+void pa_datum_free(pa_datum *d) {
+    pa_assert(d);
+
+    pa_xfree(d->data);
+    d->data = NULL;
+    d->size = 0;
+}
+
+static int compare_func(const void *a, const void *b) {
+    const pa_datum *aa, *bb;
+
+    aa = (const pa_datum*)a;
+    bb = (const pa_datum*)b;
+
+    if (aa->size != bb->size)
+        return aa->size > bb->size ? 1 : -1;
+
+    return memcmp(aa->data, bb->data, aa->size);
+}
+
+/* pa_idxset_string_hash_func modified for our use */
+static unsigned hash_func(const void *p) {
+    const pa_datum *d;
+    unsigned hash = 0;
+    const char *c;
+    unsigned i;
+
+    d = (const pa_datum*)p;
+    c = d->data;
+
+    for (i = 0; i < d->size; i++) {
+        hash = 31 * hash + (unsigned) *c;
+        c++;
+    }
+
+    return hash;
+}
+
+static entry* new_entry(const pa_datum *key, const pa_datum *data) {
+    entry *e;
+
+    pa_assert(key);
+    pa_assert(data);
+
+    e = pa_xnew0(entry, 1);
+    e->key.data = key->size > 0 ? pa_xmemdup(key->data, key->size) : NULL;
+    e->key.size = key->size;
+    e->data.data = data->size > 0 ? pa_xmemdup(data->data, data->size) : NULL;
+    e->data.size = data->size;
+    return e;
+}
+
+static void free_entry(entry *e) {
+    if (e) {
+        pa_xfree(e->key.data);
+        pa_xfree(e->data.data);
+        pa_xfree(e);
+    }
+}
+
+static size_t record_size(const entry *e) {
+    return RECORD_HEADER_SIZE + e->key.size + e->data.size;
+}
+
+static void buffer_append(buffer *b, const void *data, size_t length) {
+    pa_assert(b);
+
+    if (b->length + length > b->allocated) {
+        b->allocated = PA_MAX(b->length + length, b->allocated * 2);
+        b->data = pa_xrealloc(b->data, b->allocated);
+    }
+
+    memcpy(b->data + b->length, data, length);
+    b->length += length;
+}
+
+static void buffer_free(buffer *b) {
+    pa_assert(b);
+
+    pa_xfree(b->data);
+    b->data = NULL;
+    b->length = b->allocated = 0;
+}
+
+static int write_buffer(int fd, const buffer *b) {
+
+    if (b->length <= 0)
+        return 0;
+
+    return pa_loop_write(fd, b->data, b->length, NULL) == (ssize_t) b->length ? 0 : -1;
+}
+
+static void append_record(buffer *b, uint8_t type, const pa_datum *key, const pa_datum *data) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    uint32_t u;
+
+    header[0] = type;
+    u = PA_UINT32_TO_LE((uint32_t) (key ? key->size : 0));
+    memcpy(header + 1, &u, 4);
+    u = PA_UINT32_TO_LE((uint32_t) (data ? data->size : 0));
+    memcpy(header + 5, &u, 4);
+
+    buffer_append(b, header, sizeof(header));
+
+    if (key && key->size > 0)
+        buffer_append(b, key->data, key->size);
+    if (data && data->size > 0)
+        buffer_append(b, data->data, data->size);
+}
+
+/* Replaces any existing entry with the same key */
+static void map_put(log_data *db, entry *e) {
+    entry *old;
+
+    if ((old = pa_hashmap_remove(db->map, &e->key))) {
+        db->live_size -= record_size(old);
+        free_entry(old);
+    }
+
+    pa_assert_se(pa_hashmap_put(db->map, &e->key, e) >= 0);
+    db->live_size += record_size(e);
+}
+
+static int map_remove(log_data *db, const pa_datum *key) {
+    entry *e;
+
+    if (!(e = pa_hashmap_remove(db->map, key)))
+        return -1;
+
+    db->live_size -= record_size(e);
+    free_entry(e);
+
+    return 0;
+}
+
+static void map_clear(log_data *db) {
+    entry *e;
+
+    while ((e = pa_hashmap_steal_first(db->map)))
+        free_entry(e);
+
+    db->live_size = HEADER_SIZE;
+}
+
+/* Replays the log in one pass over the mapped file. Returns the
+ * number of bytes that make up complete and valid records. */
+static size_t replay(log_data *db, const uint8_t *p, size_t length) {
+    const uint8_t *start = p, *end = p + length;
+
+    if (length < HEADER_SIZE || memcmp(p, LOG_MAGIC, HEADER_SIZE) != 0)
+        return 0;
+
+    p += HEADER_SIZE;
+
+    while ((size_t) (end - p) >= RECORD_HEADER_SIZE) {
+        uint32_t key_length, data_length;
+        pa_datum key, data;
+        uint8_t type;
+
+        type = p[0];
+        memcpy(&key_length, p + 1, 4);
+        memcpy(&data_length, p + 5, 4);
+        key_length = PA_UINT32_FROM_LE(key_length);
+        data_length = PA_UINT32_FROM_LE(data_length);
+
+        if (type < RECORD_SET || type > RECORD_CLEAR)
+            break;
+
+        if ((size_t) (end - p) - RECORD_HEADER_SIZE < key_length ||
+            (size_t) (end - p) - RECORD_HEADER_SIZE - key_length < data_length)
+            break;
+
+        key.data = (void*) (p + RECORD_HEADER_SIZE);
+        key.size = key_length;
+        data.data = (void*) (p + RECORD_HEADER_SIZE + key_length);
+        data.size = data_length;
+
+        switch (type) {
+            case RECORD_SET:
+                map_put(db, new_entry(&key, &data));
+                break;
+
+            case RECORD_UNSET:
+                map_remove(db, &key);
+                break;
+
+            case RECORD_CLEAR:
+                map_clear(db);
+                break;
+        }
+
+        p += RECORD_HEADER_SIZE + key_length + data_length;
+    }
+
+    return (size_t) (p - start);
+}
+
+static int load(log_data *db) {
+    struct stat st;
+    size_t valid = 0;
+
+    pa_assert(db);
+    pa_assert(db->fd >= 0);
+
+    if (fstat(db->fd, &st) < 0) {
+        pa_log_warn("fstat() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (st.st_size > 0) {
+        void *p;
+
+        if ((p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, db->fd, 0)) == MAP_FAILED) {
+            pa_log_warn("mmap() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        valid = replay(db, p, (size_t) st.st_size);
+        munmap(p, (size_t) st.st_size);
+
+        if (valid < (size_t) st.st_size)
+            pa_log_warn("Dropping %lu bytes of invalid data at the end of %s.",
+                        (unsigned long) ((size_t) st.st_size - valid), db->filename);
+    }
+
+    db->file_size = valid;
+
+    if (db->read_only)
+        return 0;
+
+    if (valid < (size_t) st.st_size && ftruncate(db->fd, (off_t) valid) < 0) {
+        pa_log_warn("ftruncate() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (valid == 0) {
+        if (pa_loop_write(db->fd, LOG_MAGIC, HEADER_SIZE, NULL) != HEADER_SIZE) {
+            pa_log_warn("Failed to write header to %s: %s", db->filename, pa_cstrerror(errno));
+            return -1;
+        }
+
+        db->file_size = HEADER_SIZE;
+        db->needs_fsync = TRUE;
+    }
+
+    return 0;
+}
+
+static int do_fsync(log_data *db) {
+
+    if (fsync(db->fd) < 0) {
+        pa_log_warn("fsync() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    db->needs_fsync = FALSE;
+    db->last_fsync = pa_rtclock_now();
+
+    return 0;
+}
+
+static void compact_thread(void *userdata) {
+    log_data *db = userdata;
+    int state = COMPACT_FAILED;
+
+    if (write_buffer(db->compact_fd, &db->snapshot) >= 0 && fsync(db->compact_fd) >= 0)
+        state = COMPACT_DONE;
+
+    pa_atomic_store(&db->compactor_state, state);
+}
+
+static void start_compaction(log_data *db) {
+    void *state = NULL;
+    entry *e;
+
+    pa_assert(!db->compactor);
+
+    buffer_append(&db->snapshot, LOG_MAGIC, HEADER_SIZE);
+
+    while ((e = pa_hashmap_iterate(db->map, &state, NULL)))
+        append_record(&db->snapshot, RECORD_SET, &e->key, &e->data);
+
+    if ((db->compact_fd = open(db->tmp_filename, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_NOCTTY, 0600)) < 0) {
+        pa_log_warn("Failed to open %s: %s", db->tmp_filename, pa_cstrerror(errno));
+        buffer_free(&db->snapshot);
+        return;
+    }
+
+    pa_make_fd_cloexec(db->compact_fd);
+
+    pa_atomic_store(&db->compactor_state, COMPACT_RUNNING);
+
+    if (!(db->compactor = pa_thread_new(compact_thread, db))) {
+        pa_log_warn("Failed to start compactor thread.");
+        pa_close(db->compact_fd);
+        db->compact_fd = -1;
+        unlink(db->tmp_filename);
+        buffer_free(&db->snapshot);
+    }
+}
+
+/* Picks up the result of the compactor thread, if there is one. If
+ * wait is TRUE, waits for the thread to finish. */
+static void finish_compaction(log_data *db, pa_bool_t wait) {
+
+    if (!db->compactor)
+        return;
+
+    if (!wait && pa_atomic_load(&db->compactor_state) == COMPACT_RUNNING)
+        return;
+
+    pa_thread_free(db->compactor);
+    db->compactor = NULL;
+
+    if (pa_atomic_load(&db->compactor_state) != COMPACT_DONE) {
+        pa_log_warn("Failed to write %s.", db->tmp_filename);
+        goto fail;
+    }
+
+    /* Bring the snapshot up to date with what was added to the old
+     * log in the meantime */
+    if (write_buffer(db->compact_fd, &db->since_snapshot) < 0 || fsync(db->compact_fd) < 0) {
+        pa_log_warn("Failed to write %s: %s", db->tmp_filename, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (rename(db->tmp_filename, db->filename) < 0) {
+        pa_log_warn("Failed to rename %s: %s", db->tmp_filename, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    pa_log_debug("Compacted %s from %lu to %lu bytes.", db->filename,
+                 (unsigned long) db->file_size,
+                 (unsigned long) (db->snapshot.length + db->since_snapshot.length));
+
+    pa_close(db->fd);
+    db->fd = db->compact_fd;
+    db->compact_fd = -1;
+    db->file_size = db->snapshot.length + db->since_snapshot.length;
+    db->needs_fsync = FALSE;
+    db->last_fsync = pa_rtclock_now();
+
+    buffer_free(&db->snapshot);
+    buffer_free(&db->since_snapshot);
+    return;
+
+fail:
+    pa_close(db->compact_fd);
+    db->compact_fd = -1;
+    unlink(db->tmp_filename);
+
+    buffer_free(&db->snapshot);
+    buffer_free(&db->since_snapshot);
+}
+
+static int flush(log_data *db) {
+
+    if (db->pending.length <= 0)
+        return 0;
+
+    if (write_buffer(db->fd, &db->pending) < 0) {
+        pa_log_warn("Failed to write to %s: %s", db->filename, pa_cstrerror(errno));
+
+        /* Don't leave a partial record behind, so that we can retry
+         * with the next sync */
+        if (ftruncate(db->fd, (off_t) db->file_size) < 0)
+            pa_log_warn("ftruncate() failed: %s", pa_cstrerror(errno));
+
+        return -1;
+    }
+
+    if (db->compactor)
+        buffer_append(&db->since_snapshot, db->pending.data, db->pending.length);
+
+    db->file_size += db->pending.length;
+    db->pending.length = 0;
+    db->needs_fsync = TRUE;
+
+    return 0;
+}
+
+pa_database* pa_database_open(const char *fn, pa_bool_t for_write) {
+    char *path;
+    log_data *db;
+    int fd;
+
+    pa_assert(fn);
+
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".simplelog", fn);
+    errno = 0;
+
+    fd = open(path, (for_write ? O_RDWR|O_CREAT|O_APPEND : O_RDONLY)|O_NOCTTY, 0600);
+
+    if (fd < 0 && errno != ENOENT) {
+        if (errno == 0)
+            errno = EIO;
+        pa_xfree(path);
+        return NULL;
+    }
+
+    if (fd >= 0)
+        pa_make_fd_cloexec(fd);
+
+    db = pa_xnew0(log_data, 1);
+    db->map = pa_hashmap_new(hash_func, compare_func);
+    db->filename = path;
+    db->tmp_filename = pa_sprintf_malloc("%s.tmp", db->filename);
+    db->read_only = !for_write;
+    db->fd = fd;
+    db->compact_fd = -1;
+    db->live_size = HEADER_SIZE;
+    db->last_fsync = pa_rtclock_now();
+
+    if (db->fd >= 0 && load(db) < 0) {
+        pa_database_close((pa_database*) db);
+        errno = EIO;
+        return NULL;
+    }
+
+    return (pa_database*) db;
+}
+
+void pa_database_close(pa_database *database) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+
+    if (!db->read_only) {
+        finish_compaction(db, TRUE);
+
+        if (db->fd >= 0 && flush(db) >= 0 && db->needs_fsync)
+            do_fsync(db);
+    }
+
+    /* Don't use pa_database_clear() here, that would log a CLEAR
+     * record */
+    while ((e = pa_hashmap_steal_first(db->map)))
+        free_entry(e);
+
+    if (db->fd >= 0)
+        pa_close(db->fd);
+
+    buffer_free(&db->pending);
+    pa_xfree(db->filename);
+    pa_xfree(db->tmp_filename);
+    pa_hashmap_free(db->map, NULL, NULL);
+    pa_xfree(db);
+}
+
+pa_datum* pa_database_get(pa_database *database, const pa_datum *key, pa_datum* data) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    e = pa_hashmap_get(db->map, key);
+
+    if (!e)
+        return NULL;
+
+    data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+    data->size = e->data.size;
+
+    return data;
+}
+
+int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum* data, pa_bool_t overwrite) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (db->read_only)
+        return -1;
+
+    if (!overwrite && pa_hashmap_get(db->map, key))
+        return -1;
+
+    map_put(db, new_entry(key, data));
+    append_record(&db->pending, RECORD_SET, key, data);
+
+    return 0;
+}
+
+int pa_database_unset(pa_database *database, const pa_datum *key) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (map_remove(db, key) < 0)
+        return -1;
+
+    if (!db->read_only)
+        append_record(&db->pending, RECORD_UNSET, key, NULL);
+
+    return 0;
+}
+
+int pa_database_clear(pa_database *database) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+
+    map_clear(db);
+
+    if (!db->read_only)
+        append_record(&db->pending, RECORD_CLEAR, NULL, NULL);
+
+    return 0;
+}
+
+signed pa_database_size(pa_database *database) {
+    log_data *db = (log_data*)database;
+    pa_assert(db);
+
+    return (signed) pa_hashmap_size(db->map);
+}
+
+pa_datum* pa_database_first(pa_database *database, pa_datum *key, pa_datum *data) {
+    log_data *db = (log_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    e = pa_hashmap_first(db->map);
+
+    if (!e)
+        return NULL;
+
+    key->data = e->key.size > 0 ? pa_xmemdup(e->key.data, e->key.size) : NULL;
+    key->size = e->key.size;
+
+    if (data) {
+        data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+        data->size = e->data.size;
+    }
+
+    return key;
+}
+
+pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    log_data *db = (log_data*)database;
+    entry *e;
+    entry *search;
+    void *state;
+    pa_bool_t pick_now;
+
+    pa_assert(db);
+    pa_assert(next);
+
+    if (!key)
+        return pa_database_first(database, next, data);
+
+    search = pa_hashmap_get(db->map, key);
+
+    state = NULL;
+    pick_now = FALSE;
+
+    while ((e = pa_hashmap_iterate(db->map, &state, NULL))) {
+        if (pick_now)
+            break;
+
+        if (search == e)
+            pick_now = TRUE;
+    }
+
+    if (!pick_now || !e)
+        return NULL;
+
+    next->data = e->key.size > 0 ? pa_xmemdup(e->key.data, e->key.size) : NULL;
+    next->size = e->key.size;
+
+    if (data) {
+        data->data = e->data.size > 0 ? pa_xmemdup(e->data.data, e->data.size) : NULL;
+        data->size = e->data.size;
+    }
+
+    return next;
+}
+
+/* Appends all changes since the last call to the log. To batch up
+ * fsync()s, the file is only flushed to disk if the last fsync() is
+ * older than FSYNC_INTERVAL_USEC; the data is still written to the
+ * kernel right away, so it survives a crash of the daemon. Whatever
+ * is left is flushed when the database is closed. */
+int pa_database_sync(pa_database *database) {
+    log_data *db = (log_data*)database;
+
+    pa_assert(db);
+
+    if (db->read_only)
+        return 0;
+
+    finish_compaction(db, FALSE);
+
+    if (flush(db) < 0)
+        return -1;
+
+    if (db->needs_fsync && pa_rtclock_now() >= db->last_fsync + FSYNC_INTERVAL_USEC)
+        if (do_fsync(db) < 0)
+            return -1;
+
+    if (!db->compactor &&
+        db->file_size >= COMPACT_MIN_SIZE &&
+        db->file_size > COMPACT_RATIO * db->live_size)
+        start_compaction(db);
+
+    return 0;
+}
@@ -0,0 +1,540 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#else
+#include <pulsecore/poll.h>
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/refcnt.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/shared.h>
+#include <pulsecore/thread.h>
+
+#include "io-pool.h"
+
+#define MAX_WORKERS 64U
+
+struct worker {
+    pa_io_pool *pool;
+    unsigned index;
+
+    pa_thread *thread;
+    pa_fdsem *wakeup;
+
+    /* Protected by the mutex */
+    pa_mutex *mutex;
+    PA_LLIST_HEAD(pa_io_pool_job, incoming);
+    unsigned n_jobs;
+    pa_bool_t quit;
+
+    /* Only accessed from the worker thread */
+    PA_LLIST_HEAD(pa_io_pool_job, jobs);
+    struct pollfd *pollfd;
+    unsigned n_pollfd_alloc;
+    pa_io_pool_job **due;
+    unsigned n_due_alloc;
+    pa_rtclock_participant *participant;
+};
+
+struct pa_io_pool_job {
+    struct worker *worker;
+
+    pa_module *module;
+    pa_rtpoll *rtpoll;
+    pa_thread_mq *mq;
+    pa_io_pool_cb_t cb;
+    void *userdata;
+
+    pa_semaphore *finished;
+
+    /* Only accessed from the worker thread */
+    pa_bool_t polling:1;
+    pa_bool_t due:1;
+    pa_bool_t failed:1;
+    pa_usec_t deadline;
+    unsigned pollfd_idx, n_pollfd;
+    int n_events;
+
+    PA_LLIST_FIELDS(pa_io_pool_job);
+};
+
+struct pa_io_pool {
+    PA_REFCNT_DECLARE;
+
+    pa_core *core;
+
+    unsigned n_workers;
+    struct worker *workers;
+};
+
+static void job_fail(pa_io_pool_job *j) {
+    pa_assert(j);
+
+    if (j->failed)
+        return;
+
+    j->failed = TRUE;
+
+    /* Like a regular IO thread would, we ask the main thread to
+     * unload us, and keep processing messages until we get
+     * PA_MESSAGE_SHUTDOWN */
+    pa_asyncmsgq_post(j->mq->outq, PA_MSGOBJECT(j->worker->pool->core), PA_CORE_MESSAGE_UNLOAD_MODULE, j->module, 0, NULL, NULL);
+}
+
+/* Runs the job until it wants to sleep again. Returns FALSE when the
+ * job's loop has been terminated. */
+static pa_bool_t job_run(pa_io_pool_job *j) {
+    int r;
+
+    pa_assert(j);
+
+    if (j->polling) {
+        j->polling = FALSE;
+
+        if ((r = pa_rtpoll_after_poll(j->rtpoll, j->n_events)) < 0)
+            job_fail(j);
+        else if (r == 0)
+            return FALSE;
+    }
+
+    for (;;) {
+        pa_bool_t do_poll;
+
+        if (!j->failed && j->cb(j, j->userdata) < 0)
+            job_fail(j);
+
+        r = pa_rtpoll_before_poll(j->rtpoll, &do_poll);
+
+        if (do_poll) {
+            j->polling = TRUE;
+            j->deadline = pa_rtpoll_get_next_elapse(j->rtpoll);
+            return TRUE;
+        }
+
+        if (r < 0)
+            job_fail(j);
+        else if (r == 0)
+            return FALSE;
+    }
+}
+
+static int job_compare(const void *a, const void *b) {
+    const pa_io_pool_job *x = *(pa_io_pool_job* const*) a, *y = *(pa_io_pool_job* const*) b;
+
+    /* Jobs that were just added have no deadline yet, they come
+     * first */
+    if (x->deadline < y->deadline)
+        return -1;
+    if (x->deadline > y->deadline)
+        return 1;
+    return 0;
+}
+
+static int do_poll(struct pollfd *pollfd, unsigned n, pa_usec_t timeout) {
+#ifdef HAVE_PPOLL
+    struct timespec ts;
+
+    if (timeout != PA_USEC_INVALID)
+        pa_timespec_store(&ts, timeout);
+
+    return ppoll(pollfd, n, timeout != PA_USEC_INVALID ? &ts : NULL, NULL);
+#else
+    return poll(pollfd, n, timeout != PA_USEC_INVALID ? (int) (timeout / PA_USEC_PER_MSEC) : -1);
+#endif
+}
+
+/* Waits until the earliest deadline or until an fd becomes ready */
+static int worker_poll(struct worker *w, unsigned n, pa_usec_t deadline) {
+    pa_usec_t now;
+    int r;
+
+    pa_assert(w);
+
+    /* With the virtual clock we behave like a pa_rtpoll does, see
+     * there */
+    if (w->participant && deadline != 0) {
+
+        for (;;) {
+            if ((r = do_poll(w->pollfd, n, PA_RTCLOCK_VIRTUAL_SLICE_USEC)) != 0)
+                break;
+
+            if (pa_rtclock_participant_idle(w->participant, deadline) >= deadline)
+                break;
+        }
+
+        pa_rtclock_participant_busy(w->participant);
+        return r;
+    }
+
+    if (deadline == PA_USEC_INVALID)
+        return do_poll(w->pollfd, n, PA_USEC_INVALID);
+
+    now = pa_rtclock_now();
+    return do_poll(w->pollfd, n, deadline > now ? deadline - now : 0);
+}
+
+static void worker_func(void *userdata) {
+    struct worker *w = userdata;
+
+    pa_assert(w);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    {
+        cpu_set_t mask;
+
+        CPU_ZERO(&mask);
+        CPU_SET((size_t) w->index, &mask);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) != 0)
+            pa_log_warn("Failed to pin IO worker to CPU %u.", w->index);
+    }
+#endif
+
+    if (w->pool->core->realtime_scheduling)
+        pa_make_realtime(w->pool->core->realtime_priority);
+
+    pa_log_debug("IO worker %u starting up", w->index);
+
+    for (;;) {
+        pa_io_pool_job *j, *n;
+        unsigned n_due = 0, n_pollfd, k;
+        pa_usec_t deadline = PA_USEC_INVALID, now;
+        pa_bool_t quit;
+        int r;
+
+        /* Pick up new jobs */
+        pa_mutex_lock(w->mutex);
+
+        while ((j = w->incoming)) {
+            PA_LLIST_REMOVE(pa_io_pool_job, w->incoming, j);
+            PA_LLIST_PREPEND(pa_io_pool_job, w->jobs, j);
+
+            j->due = TRUE;
+            j->deadline = 0;
+        }
+
+        if (w->n_due_alloc < w->n_jobs) {
+            w->n_due_alloc = w->n_jobs * 2;
+            w->due = pa_xrenew(pa_io_pool_job*, w->due, w->n_due_alloc);
+        }
+
+        quit = w->quit;
+        pa_mutex_unlock(w->mutex);
+
+        /* The pool is only freed after all jobs are gone */
+        if (quit) {
+            pa_assert(!w->jobs);
+            break;
+        }
+
+        /* Run everything that woke up, earliest deadline first */
+        for (j = w->jobs; j; j = j->next)
+            if (j->due)
+                w->due[n_due++] = j;
+
+        qsort(w->due, n_due, sizeof(pa_io_pool_job*), job_compare);
+
+        for (k = 0; k < n_due; k++) {
+            pa_bool_t running;
+
+            j = w->due[k];
+            j->due = FALSE;
+
+            pa_thread_mq_install(j->mq);
+            running = job_run(j);
+            pa_thread_mq_uninstall();
+
+            if (!running) {
+                PA_LLIST_REMOVE(pa_io_pool_job, w->jobs, j);
+
+                pa_mutex_lock(w->mutex);
+                w->n_jobs--;
+                pa_mutex_unlock(w->mutex);
+
+                /* From here on j belongs to pa_io_pool_job_free() */
+                pa_semaphore_post(j->finished);
+            }
+        }
+
+        /* Merge the fds of all jobs into one array, our own wakeup fd
+         * goes first */
+        n_pollfd = 1;
+
+        for (j = w->jobs; j; j = j->next) {
+            struct pollfd *f;
+            unsigned m;
+
+            pa_assert(j->polling);
+
+            f = pa_rtpoll_get_pollfd(j->rtpoll, &m);
+
+            if (n_pollfd + m > w->n_pollfd_alloc) {
+                w->n_pollfd_alloc = (n_pollfd + m) * 2;
+                w->pollfd = pa_xrenew(struct pollfd, w->pollfd, w->n_pollfd_alloc);
+            }
+
+            if (m > 0)
+                memcpy(w->pollfd + n_pollfd, f, m * sizeof(struct pollfd));
+
+            j->pollfd_idx = n_pollfd;
+            j->n_pollfd = m;
+            n_pollfd += m;
+
+            if (j->deadline < deadline)
+                deadline = j->deadline;
+        }
+
+        w->pollfd[0].fd = pa_fdsem_get(w->wakeup);
+        w->pollfd[0].events = POLLIN;
+        w->pollfd[0].revents = 0;
+
+        if (pa_fdsem_before_poll(w->wakeup) < 0)
+            continue;
+
+        r = worker_poll(w, n_pollfd, deadline);
+
+        pa_fdsem_after_poll(w->wakeup);
+
+        if (r < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                pa_log_error("poll(): %s", pa_cstrerror(errno));
+
+            continue;
+        }
+
+        /* Hand the results back to the jobs */
+        now = pa_rtclock_now();
+
+        for (j = w->jobs; j; j = n) {
+            struct pollfd *f;
+            unsigned m;
+
+            n = j->next;
+
+            f = pa_rtpoll_get_pollfd(j->rtpoll, &m);
+            pa_assert(m == j->n_pollfd);
+
+            j->n_events = 0;
+
+            for (k = 0; k < m; k++) {
+                f[k].revents = w->pollfd[j->pollfd_idx + k].revents;
+
+                if (f[k].revents)
+                    j->n_events++;
+            }
+
+            if (j->n_events > 0 || j->deadline <= now)
+                j->due = TRUE;
+        }
+    }
+
+    pa_log_debug("IO worker %u shutting down", w->index);
+}
+
+static pa_io_pool* io_pool_new(pa_core *c) {
+    pa_io_pool *p;
+    unsigned i;
+
+    pa_assert(c);
+
+    p = pa_xnew0(pa_io_pool, 1);
+    PA_REFCNT_INIT(p);
+    p->core = c;
+    p->n_workers = PA_MIN(pa_ncpus(), MAX_WORKERS);
+    p->workers = pa_xnew0(struct worker, p->n_workers);
+
+    for (i = 0; i < p->n_workers; i++) {
+        struct worker *w = p->workers + i;
+
+        w->pool = p;
+        w->index = i;
+        w->mutex = pa_mutex_new(FALSE, TRUE);
+        pa_assert_se(w->wakeup = pa_fdsem_new());
+
+        w->n_pollfd_alloc = 32;
+        w->pollfd = pa_xnew(struct pollfd, w->n_pollfd_alloc);
+
+        if (pa_rtclock_is_virtual())
+            w->participant = pa_rtclock_participant_new();
+
+        if (!(w->thread = pa_thread_new(worker_func, w)))
+            pa_log("Failed to create IO worker thread.");
+    }
+
+    pa_log_info("Started %u shared IO workers.", p->n_workers);
+
+    return p;
+}
+
+pa_io_pool* pa_io_pool_get(pa_core *c) {
+    pa_io_pool *p;
+
+    pa_assert(c);
+
+    if ((p = pa_shared_get(c, "io-pool")))
+        return pa_io_pool_ref(p);
+
+    p = io_pool_new(c);
+    pa_assert_se(pa_shared_set(c, "io-pool", p) >= 0);
+
+    return p;
+}
+
+pa_io_pool* pa_io_pool_ref(pa_io_pool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    PA_REFCNT_INC(p);
+
+    return p;
+}
+
+void pa_io_pool_unref(pa_io_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
+
+    pa_assert_se(pa_shared_remove(p->core, "io-pool") >= 0);
+
+    for (i = 0; i < p->n_workers; i++) {
+        struct worker *w = p->workers + i;
+
+        pa_mutex_lock(w->mutex);
+        pa_assert(w->n_jobs == 0);
+        w->quit = TRUE;
+        pa_mutex_unlock(w->mutex);
+
+        pa_fdsem_post(w->wakeup);
+
+        if (w->thread)
+            pa_thread_free(w->thread);
+
+        if (w->participant)
+            pa_rtclock_participant_free(w->participant);
+
+        pa_fdsem_free(w->wakeup);
+        pa_mutex_free(w->mutex);
+        pa_xfree(w->pollfd);
+        pa_xfree(w->due);
+    }
+
+    pa_xfree(p->workers);
+    pa_xfree(p);
+}
+
+unsigned pa_io_pool_get_n_workers(pa_io_pool *p) {
+    pa_assert(p);
+
+    return p->n_workers;
+}
+
+pa_io_pool_job* pa_io_pool_job_new(pa_io_pool *p, pa_module *m, pa_rtpoll *rtpoll, pa_thread_mq *mq, pa_io_pool_cb_t cb, void *userdata) {
+    pa_io_pool_job *j;
+    struct worker *w = NULL;
+    unsigned i, min_jobs = (unsigned) -1;
+
+    pa_assert(p);
+    pa_assert(rtpoll);
+    pa_assert(mq);
+    pa_assert(cb);
+
+    /* Put the job on the least busy worker */
+    for (i = 0; i < p->n_workers; i++) {
+        unsigned n_jobs;
+
+        if (!p->workers[i].thread)
+            continue;
+
+        pa_mutex_lock(p->workers[i].mutex);
+        n_jobs = p->workers[i].n_jobs;
+        pa_mutex_unlock(p->workers[i].mutex);
+
+        if (n_jobs < min_jobs) {
+            min_jobs = n_jobs;
+            w = p->workers + i;
+        }
+    }
+
+    if (!w)
+        return NULL;
+
+    j = pa_xnew0(pa_io_pool_job, 1);
+    j->worker = w;
+    j->module = m;
+    j->rtpoll = rtpoll;
+    j->mq = mq;
+    j->cb = cb;
+    j->userdata = userdata;
+    j->finished = pa_semaphore_new(0);
+
+    pa_io_pool_ref(p);
+
+    pa_mutex_lock(w->mutex);
+    PA_LLIST_PREPEND(pa_io_pool_job, w->incoming, j);
+    w->n_jobs++;
+    pa_mutex_unlock(w->mutex);
+
+    pa_fdsem_post(w->wakeup);
+
+    pa_log_debug("Running IO job on worker %u", w->index);
+
+    return j;
+}
+
+void pa_io_pool_job_free(pa_io_pool_job *j) {
+    pa_assert(j);
+
+    pa_semaphore_wait(j->finished);
+    pa_semaphore_free(j->finished);
+
+    pa_io_pool_unref(j->worker->pool);
+    pa_xfree(j);
+}
@@ -0,0 +1,64 @@
+#ifndef foopulseiopoolhfoo
+#define foopulseiopoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulsecore/core.h>
+#include <pulsecore/module.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread-mq.h>
+
+/* A fixed set of IO threads, one per CPU and pinned to it, shared by
+ * all sinks and sources that ask for it. Instead of running its own
+ * thread each device registers a job, consisting of its rtpoll and a
+ * callback that does what the body of the thread loop would do
+ * between two calls to pa_rtpoll_run(). Each worker polls on the
+ * rtpolls of all its jobs at once, and runs the jobs that woke up in
+ * the order of their timer deadlines.
+ *
+ * A job always stays on the same worker, hence everything that is
+ * only accessed from the IO thread (thread_info and friends) still
+ * is accessed from a single thread only. The job's pa_thread_mq is
+ * installed before the callback is called. */
+
+typedef struct pa_io_pool pa_io_pool;
+typedef struct pa_io_pool_job pa_io_pool_job;
+
+/* Return negative on failure. In that case the module is unloaded,
+ * and the callback is not called anymore, but messages are still
+ * dispatched until PA_MESSAGE_SHUTDOWN is received. */
+typedef int (*pa_io_pool_cb_t)(pa_io_pool_job *j, void *userdata);
+
+/* There is only one pool per core, which is created on first use */
+pa_io_pool* pa_io_pool_get(pa_core *c);
+pa_io_pool* pa_io_pool_ref(pa_io_pool *p);
+void pa_io_pool_unref(pa_io_pool *p);
+
+unsigned pa_io_pool_get_n_workers(pa_io_pool *p);
+
+/* The callback is called for the first time from the worker thread
+ * right after the job has been picked up. To stop the job send
+ * PA_MESSAGE_SHUTDOWN to the job's thread_mq, then call
+ * pa_io_pool_job_free() which waits until the worker let go of the
+ * job, similar to pa_thread_free(). */
+pa_io_pool_job* pa_io_pool_job_new(pa_io_pool *p, pa_module *m, pa_rtpoll *rtpoll, pa_thread_mq *mq, pa_io_pool_cb_t cb, void *userdata);
+void pa_io_pool_job_free(pa_io_pool_job *j);
+
+#endif
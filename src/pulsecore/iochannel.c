@@ -313,13 +313,61 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
     return r;
 }
 
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, const int *fds, unsigned n_fds) {
+    ssize_t r;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        uint8_t data[CMSG_SPACE(sizeof(int) * PA_IOCHANNEL_MAX_FDS)];
+    } cmsg;
+
+    pa_assert(io);
+    pa_assert(data);
+    pa_assert(l);
+    pa_assert(io->ofd >= 0);
+    pa_assert(fds);
+    pa_assert(n_fds > 0);
+    pa_assert(n_fds <= PA_IOCHANNEL_MAX_FDS);
+
+    memset(&iov, 0, sizeof(iov));
+    iov.iov_base = (void*) data;
+    iov.iov_len = l;
+
+    memset(&cmsg, 0, sizeof(cmsg));
+    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+    cmsg.hdr.cmsg_level = SOL_SOCKET;
+    cmsg.hdr.cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(&cmsg.hdr), fds, sizeof(int) * n_fds);
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = NULL;
+    mh.msg_namelen = 0;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = &cmsg;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+    mh.msg_flags = 0;
+
+    if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0) {
+        io->writable = FALSE;
+        enable_mainloop_sources(io);
+    }
+
+    return r;
+}
+
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid) {
+    return pa_iochannel_read_with_fds(io, data, l, creds, creds_valid, NULL, NULL);
+}
+
+ssize_t pa_iochannel_read_with_fds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid, int *fds, unsigned *n_fds) {
     ssize_t r;
     struct msghdr mh;
     struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_IOCHANNEL_MAX_FDS)];
     } cmsg;
 
     pa_assert(io);
@@ -328,6 +376,7 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     pa_assert(io->ifd >= 0);
     pa_assert(creds);
     pa_assert(creds_valid);
+    pa_assert(!fds == !n_fds);
 
     memset(&iov, 0, sizeof(iov));
     iov.iov_base = data;
@@ -344,7 +393,13 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     mh.msg_controllen = sizeof(cmsg);
     mh.msg_flags = 0;
 
-    if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
+#ifdef MSG_CMSG_CLOEXEC
+    r = recvmsg(io->ifd, &mh, MSG_CMSG_CLOEXEC);
+#else
+    r = recvmsg(io->ifd, &mh, 0);
+#endif
+
+    if (r >= 0) {
         struct cmsghdr *cmh;
 
         *creds_valid = 0;
@@ -359,7 +414,24 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
                 creds->gid = u.gid;
                 creds->uid = u.uid;
                 *creds_valid = TRUE;
-                break;
+
+            } else if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_RIGHTS) {
+                unsigned n, k;
+                int passed[PA_IOCHANNEL_MAX_FDS];
+
+                n = (unsigned) ((cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                n = PA_MIN(n, (unsigned) PA_IOCHANNEL_MAX_FDS);
+                memcpy(passed, CMSG_DATA(cmh), sizeof(int) * n);
+
+                for (k = 0; k < n; k++) {
+                    pa_make_fd_cloexec(passed[k]);
+
+                    /* Don't leak fds the caller isn't interested in */
+                    if (!fds || *n_fds >= PA_IOCHANNEL_MAX_FDS)
+                        pa_close(passed[k]);
+                    else
+                        fds[(*n_fds)++] = passed[k];
+                }
             }
         }
 
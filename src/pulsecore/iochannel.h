@@ -62,6 +62,20 @@ int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
 ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+
+/* The maximum number of file descriptors that may be passed along
+ * with a single write */
+#define PA_IOCHANNEL_MAX_FDS 4
+
+/* Pass file descriptors to the peer of a local socket. The fds are
+ * duplicated by the kernel, the caller stays the owner of them. */
+ssize_t pa_iochannel_write_with_fds(pa_iochannel*io, const void*data, size_t l, const int *fds, unsigned n_fds);
+
+/* Like pa_iochannel_read_with_creds(), but also collect file
+ * descriptors passed by the peer. Received fds are appended to fds,
+ * *n_fds is incremented accordingly and is never increased beyond
+ * PA_IOCHANNEL_MAX_FDS. Surplus fds are closed. */
+ssize_t pa_iochannel_read_with_fds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid, int *fds, unsigned *n_fds);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
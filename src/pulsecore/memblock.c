@@ -61,6 +61,10 @@
 #define PA_MEMIMPORT_SLOTS_MAX 160
 #define PA_MEMIMPORT_SEGMENTS_MAX 16
 
+/* How many segments we received as fds we keep mapped after their
+ * last user went away */
+#define PA_MEMFD_SEGMENTS_UNUSED_MAX 4
+
 struct pa_memblock {
     PA_REFCNT_DECLARE; /* the reference counter */
     pa_mempool *pool;
@@ -94,6 +98,24 @@ struct pa_memimport_segment {
     pa_shm memory;
     pa_memtrap *trap;
     unsigned n_blocks;
+
+    /* Set for segments that were registered as fds. These stay
+     * attached until the import goes away, their mapping is shared
+     * via the pool's memfd segment cache. */
+    struct memfd_segment *memfd;
+};
+
+/* A mapping of a segment we received as an fd. They are remembered by
+ * the identity of the file behind the fd, so that a segment that is
+ * registered more than once (e.g. by a reconnecting client) is mapped
+ * only once. */
+struct memfd_segment {
+    char *identity;
+    pa_shm memory;
+    pa_memtrap *trap;
+    unsigned n_ref;
+
+    PA_LLIST_FIELDS(struct memfd_segment);
 };
 
 /* A collection of multiple segments */
@@ -137,6 +159,8 @@ struct pa_memexport {
 };
 
 struct pa_mempool {
+    PA_REFCNT_DECLARE;
+
     pa_semaphore *semaphore;
     pa_mutex *mutex;
 
@@ -152,6 +176,12 @@ struct pa_mempool {
     /* A list of free slots that may be reused */
     pa_flist *free_slots;
 
+    /* Mapped fd segments, by identity. Those without users are kept
+     * on the unused list, most recently used first */
+    pa_hashmap *memfd_segments;
+    PA_LLIST_HEAD(struct memfd_segment, unused_memfd_segments);
+    unsigned n_unused_memfd_segments;
+
     pa_mempool_stat stat;
 };
 
@@ -711,6 +741,7 @@ pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
 
     p = pa_xnew(pa_mempool, 1);
+    PA_REFCNT_INIT(p);
 
     p->mutex = pa_mutex_new(TRUE, TRUE);
     p->semaphore = pa_semaphore_new(0);
@@ -748,11 +779,111 @@ pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
 
     p->free_slots = pa_flist_new(p->n_blocks);
 
+    p->memfd_segments = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+    PA_LLIST_HEAD_INIT(struct memfd_segment, p->unused_memfd_segments);
+    p->n_unused_memfd_segments = 0;
+
+    return p;
+}
+
+/* Should be called with the pool locked */
+static void memfd_segment_free(pa_mempool *p, struct memfd_segment *m) {
+    pa_assert(p);
+    pa_assert(m);
+    pa_assert(m->n_ref == 0);
+
+    PA_LLIST_REMOVE(struct memfd_segment, p->unused_memfd_segments, m);
+    p->n_unused_memfd_segments--;
+
+    pa_hashmap_remove(p->memfd_segments, m->identity);
+
+    if (m->trap)
+        pa_memtrap_remove(m->trap);
+
+    pa_shm_free(&m->memory);
+    pa_xfree(m->identity);
+    pa_xfree(m);
+}
+
+/* Should be called with the pool locked. Takes ownership of fd. */
+static struct memfd_segment* memfd_segment_get(pa_mempool *p, int fd) {
+    struct memfd_segment *m;
+    char identity[64];
+
+    pa_assert(p);
+    pa_assert(fd >= 0);
+
+    if (pa_shm_get_fd_identity(fd, identity, sizeof(identity)) < 0) {
+        pa_close(fd);
+        return NULL;
+    }
+
+    if ((m = pa_hashmap_get(p->memfd_segments, identity))) {
+
+        /* We already have this one mapped */
+        pa_close(fd);
+
+        if (m->n_ref++ == 0) {
+            PA_LLIST_REMOVE(struct memfd_segment, p->unused_memfd_segments, m);
+            p->n_unused_memfd_segments--;
+        }
+
+        return m;
+    }
+
+    m = pa_xnew0(struct memfd_segment, 1);
+
+    if (pa_shm_attach_fd(&m->memory, fd, FALSE) < 0) {
+        pa_close(fd);
+        pa_xfree(m);
+        return NULL;
+    }
+
+    m->identity = pa_xstrdup(identity);
+    m->trap = pa_memtrap_add(m->memory.ptr, m->memory.size);
+    m->n_ref = 1;
+
+    pa_hashmap_put(p->memfd_segments, m->identity, m);
+
+    return m;
+}
+
+/* Should be called with the pool locked */
+static void memfd_segment_put(pa_mempool *p, struct memfd_segment *m) {
+    pa_assert(p);
+    pa_assert(m);
+    pa_assert(m->n_ref >= 1);
+
+    if (--m->n_ref > 0)
+        return;
+
+    PA_LLIST_PREPEND(struct memfd_segment, p->unused_memfd_segments, m);
+    p->n_unused_memfd_segments++;
+
+    while (p->n_unused_memfd_segments > PA_MEMFD_SEGMENTS_UNUSED_MAX) {
+        struct memfd_segment *last;
+
+        for (last = p->unused_memfd_segments; last->next; last = last->next)
+            ;
+
+        memfd_segment_free(p, last);
+    }
+}
+
+pa_mempool* pa_mempool_ref(pa_mempool *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    PA_REFCNT_INC(p);
     return p;
 }
 
 void pa_mempool_free(pa_mempool *p) {
     pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) >= 1);
+
+    if (PA_REFCNT_DEC(p) > 0)
+        return;
 
     pa_mutex_lock(p->mutex);
 
@@ -810,6 +941,12 @@ void pa_mempool_free(pa_mempool *p) {
 /*         PA_DEBUG_TRAP; */
     }
 
+    while (p->unused_memfd_segments)
+        memfd_segment_free(p, p->unused_memfd_segments);
+
+    pa_assert(pa_hashmap_isempty(p->memfd_segments));
+    pa_hashmap_free(p->memfd_segments, NULL, NULL);
+
     pa_shm_free(&p->memory);
 
     pa_mutex_free(p->mutex);
@@ -867,6 +1004,16 @@ int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id) {
     return 0;
 }
 
+/* No lock necessary */
+int pa_mempool_get_memfd(pa_mempool *p) {
+    pa_assert(p);
+
+    if (!p->memory.shared)
+        return -1;
+
+    return p->memory.fd;
+}
+
 /* No lock necessary */
 pa_bool_t pa_mempool_is_shared(pa_mempool *p) {
     pa_assert(p);
@@ -924,7 +1071,14 @@ static void segment_detach(pa_memimport_segment *seg) {
     pa_assert(seg);
 
     pa_hashmap_remove(seg->import->segments, PA_UINT32_TO_PTR(seg->memory.id));
-    pa_shm_free(&seg->memory);
+
+    if (seg->memfd) {
+        /* The mapping belongs to the cache */
+        pa_mutex_lock(seg->import->pool->mutex);
+        memfd_segment_put(seg->import->pool, seg->memfd);
+        pa_mutex_unlock(seg->import->pool->mutex);
+    } else
+        pa_shm_free(&seg->memory);
 
     if (seg->trap)
         pa_memtrap_remove(seg->trap);
@@ -932,10 +1086,54 @@ static void segment_detach(pa_memimport_segment *seg) {
     pa_xfree(seg);
 }
 
+/* Self-locked. Takes ownership of fd. */
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int fd) {
+    pa_memimport_segment *seg;
+    struct memfd_segment *m;
+    int ret = -1;
+
+    pa_assert(i);
+    pa_assert(fd >= 0);
+
+    pa_mutex_lock(i->mutex);
+
+    if (pa_hashmap_get(i->segments, PA_UINT32_TO_PTR(shm_id)) ||
+        pa_hashmap_size(i->segments) >= PA_MEMIMPORT_SEGMENTS_MAX) {
+        pa_close(fd);
+        goto finish;
+    }
+
+    pa_mutex_lock(i->pool->mutex);
+    m = memfd_segment_get(i->pool, fd);
+    pa_mutex_unlock(i->pool->mutex);
+
+    if (!m)
+        goto finish;
+
+    seg = pa_xnew0(pa_memimport_segment, 1);
+    seg->import = i;
+    seg->memfd = m;
+    seg->memory = m->memory;
+    seg->memory.id = shm_id;
+
+    /* This reference keeps the segment attached until the import
+     * goes away, even if no block refers to it for a while */
+    seg->n_blocks = 1;
+
+    pa_hashmap_put(i->segments, PA_UINT32_TO_PTR(shm_id), seg);
+    ret = 0;
+
+finish:
+    pa_mutex_unlock(i->mutex);
+
+    return ret;
+}
+
 /* Self-locked. Not multiple-caller safe */
 void pa_memimport_free(pa_memimport *i) {
     pa_memexport *e;
     pa_memblock *b;
+    pa_memimport_segment *seg;
 
     pa_assert(i);
 
@@ -944,7 +1142,12 @@ void pa_memimport_free(pa_memimport *i) {
     while ((b = pa_hashmap_first(i->blocks)))
         memblock_replace_import(b);
 
-    pa_assert(pa_hashmap_size(i->segments) == 0);
+    /* Drop the references registered fd segments hold on themselves */
+    while ((seg = pa_hashmap_first(i->segments))) {
+        pa_assert(seg->memfd);
+        pa_assert(seg->n_blocks == 1);
+        segment_detach(seg);
+    }
 
     pa_mutex_unlock(i->mutex);
 
@@ -1163,6 +1366,28 @@ static pa_memblock *memblock_shared_copy(pa_mempool *p, pa_memblock *b) {
     return n;
 }
 
+/* No lock necessary. Returns the fd of the segment b would be exported
+ * from if that is an anonymous segment that the other side cannot
+ * look up by its id, -1 otherwise. */
+int pa_memexport_get_memfd(pa_memexport *e, pa_memblock *b, uint32_t *shm_id) {
+    pa_shm *memory;
+
+    pa_assert(e);
+    pa_assert(b);
+    pa_assert(shm_id);
+    pa_assert(b->pool == e->pool);
+
+    if (b->type == PA_MEMBLOCK_IMPORTED) {
+        pa_assert(b->per_type.imported.segment);
+        memory = &b->per_type.imported.segment->memory;
+    } else
+        /* Everything else ends up in our pool when exported */
+        memory = &e->pool->memory;
+
+    *shm_id = memory->id;
+    return memory->fd;
+}
+
 /* Self-locked */
 int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t * size) {
     pa_shm *memory;
@@ -116,12 +116,16 @@ pa_mempool * pa_memblock_get_pool(pa_memblock *b);
 
 pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
-/* The memory block manager */
+/* The memory block manager. Whoever needs the pool to stay around
+ * can take a reference, pa_mempool_free() drops one and frees the
+ * pool with the last. */
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size);
+pa_mempool* pa_mempool_ref(pa_mempool *p);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
 int pa_mempool_get_shm_id(pa_mempool *p, uint32_t *id);
+int pa_mempool_get_memfd(pa_mempool *p);
 pa_bool_t pa_mempool_is_shared(pa_mempool *p);
 size_t pa_mempool_block_size_max(pa_mempool *p);
 
@@ -131,10 +135,15 @@ void pa_memimport_free(pa_memimport *i);
 pa_memblock* pa_memimport_get(pa_memimport *i, uint32_t block_id, uint32_t shm_id, size_t offset, size_t size);
 int pa_memimport_process_revoke(pa_memimport *i, uint32_t block_id);
 
+/* Segments the other side passed as fd need to be registered before
+ * blocks can be imported from them. Takes ownership of fd. */
+int pa_memimport_attach_memfd(pa_memimport *i, uint32_t shm_id, int fd);
+
 /* For sending blocks to other nodes */
 pa_memexport* pa_memexport_new(pa_mempool *p, pa_memexport_revoke_cb_t cb, void *userdata);
 void pa_memexport_free(pa_memexport *e);
 int pa_memexport_put(pa_memexport *e, pa_memblock *b, uint32_t *block_id, uint32_t *shm_id, size_t *offset, size_t *size);
+int pa_memexport_get_memfd(pa_memexport *e, pa_memblock *b, uint32_t *shm_id);
 int pa_memexport_process_release(pa_memexport *e, uint32_t id);
 
 #endif
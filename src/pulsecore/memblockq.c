@@ -35,6 +35,7 @@
 #include <pulsecore/mcalign.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/trace.h>
 
 #include "memblockq.h"
 
@@ -56,6 +57,7 @@ struct pa_memblockq {
     pa_memchunk silence;
     pa_mcalign *mcalign;
     int64_t missing, requested;
+    uint32_t trace_object;
 };
 
 pa_memblockq* pa_memblockq_new(
@@ -84,6 +86,7 @@ pa_memblockq* pa_memblockq_new(
                  (unsigned long) maxlength, (unsigned long) tlength, (unsigned long) base, (unsigned long) prebuf, (unsigned long) minreq, (unsigned long) maxrewind);
 
     bq->missing = bq->requested = 0;
+    bq->trace_object = PA_INVALID_INDEX;
     bq->maxlength = bq->tlength = bq->prebuf = bq->minreq = bq->maxrewind = 0;
     bq->in_prebuf = TRUE;
 
@@ -435,6 +438,10 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 finish:
 
     write_index_changed(bq, old, TRUE);
+
+    if (bq->trace_object != PA_INVALID_INDEX)
+        pa_trace(PA_TRACE_PUSH, bq->trace_object, uchunk->length, bq->write_index);
+
     return 0;
 }
 
@@ -527,6 +534,68 @@ int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk) {
     return 0;
 }
 
+unsigned pa_memblockq_peekv(pa_memblockq* bq, pa_memchunk *chunks, unsigned n) {
+    struct list_item *q;
+    int64_t idx;
+    unsigned i;
+
+    pa_assert(bq);
+    pa_assert(chunks || n == 0);
+
+    if (update_prebuf(bq))
+        return 0;
+
+    fix_current_read(bq);
+
+    q = bq->current_read;
+    idx = bq->read_index;
+
+    for (i = 0; i < n; i++) {
+        pa_memchunk *c = chunks + i;
+
+        if (!q || q->index > idx) {
+            size_t length;
+
+            /* A hole, or the end of the queue */
+            if (q)
+                length = (size_t) (q->index - idx);
+            else if (bq->write_index > idx)
+                length = (size_t) (bq->write_index - idx);
+            else
+                break;
+
+            if (bq->silence.memblock) {
+                *c = bq->silence;
+                pa_memblock_ref(c->memblock);
+
+                if (length < c->length)
+                    c->length = length;
+            } else {
+                c->memblock = NULL;
+                c->index = 0;
+                c->length = length;
+            }
+
+        } else {
+            int64_t d;
+
+            *c = q->chunk;
+            pa_memblock_ref(c->memblock);
+
+            pa_assert(idx >= q->index);
+            d = idx - q->index;
+            c->index += (size_t) d;
+            c->length -= (size_t) d;
+
+            q = q->next;
+        }
+
+        idx += (int64_t) c->length;
+    }
+
+    return i;
+}
+
 void pa_memblockq_drop(pa_memblockq *bq, size_t length) {
     int64_t old;
     pa_assert(bq);
@@ -946,3 +1015,9 @@ size_t pa_memblockq_get_base(pa_memblockq *bq) {
 
     return bq->base;
 }
+
+void pa_memblockq_set_trace_object(pa_memblockq *bq, uint32_t idx) {
+    pa_assert(bq);
+
+    bq->trace_object = idx;
+}
@@ -95,6 +95,12 @@ void pa_memblockq_seek(pa_memblockq *bq, int64_t offset, pa_seek_mode_t seek, pa
  * was passed we return the length of the hole in chunk->length. */
 int pa_memblockq_peek(pa_memblockq* bq, pa_memchunk *chunk);
 
+/* Like pa_memblockq_peek(), but returns copies of up to n consecutive
+ * chunks starting at the read index, up to the write index. Holes are
+ * returned as in pa_memblockq_peek(). Returns the number of chunks
+ * filled in, 0 if prebuffering is active or nothing is queued. */
+unsigned pa_memblockq_peekv(pa_memblockq* bq, pa_memchunk *chunks, unsigned n);
+
 /* Drop the specified bytes from the queue. */
 void pa_memblockq_drop(pa_memblockq *bq, size_t length);
 
@@ -182,4 +188,8 @@ pa_bool_t pa_memblockq_prebuf_active(pa_memblockq *bq);
 /* Return how many items are currently stored in the queue */
 unsigned pa_memblockq_get_nblocks(pa_memblockq *bq);
 
+/* Record every push in the stream timing trace, as an event of the
+ * sink input with the specified index */
+void pa_memblockq_set_trace_object(pa_memblockq *bq, uint32_t idx);
+
 #endif
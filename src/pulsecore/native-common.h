@@ -23,9 +23,13 @@
   USA.
 ***/
 
+#include <inttypes.h>
+
 #include <pulse/cdecl.h>
 #include <pulse/def.h>
 
+#include <pulsecore/macro.h>
+
 PA_C_DECL_BEGIN
 
 enum {
@@ -169,6 +173,11 @@ enum {
     PA_COMMAND_SET_SINK_PORT,
     PA_COMMAND_SET_SOURCE_PORT,
 
+    /* Supported since protocol v17 (0.9.22) */
+    PA_COMMAND_CREATE_PLAYBACK_RING,
+    PA_COMMAND_GET_TRACE,
+    PA_COMMAND_SET_TRACE,
+
     PA_COMMAND_MAX
 };
 
@@ -182,6 +191,20 @@ enum {
 
 #define PA_NATIVE_DEFAULT_UNIX_SOCKET "native"
 
+/* Each cell of a playback ring (see PA_COMMAND_CREATE_PLAYBACK_RING)
+ * starts with this header, the audio data follows right after it */
+typedef struct pa_native_ring_cell {
+    uint32_t length;
+    uint32_t seek;
+    int64_t offset;
+} pa_native_ring_cell;
+
+#define PA_NATIVE_RING_CELL_HEADER_SIZE PA_ALIGN(sizeof(pa_native_ring_cell))
+
+/* Limits for the ring geometry a client may ask for */
+#define PA_NATIVE_RING_N_CELLS_MAX 256
+#define PA_NATIVE_RING_CELL_SIZE_MAX (64*1024)
+
 PA_C_DECL_END
 
 #endif
@@ -184,7 +184,12 @@ static const char *command_names[PA_COMMAND_MAX] = {
 
     /* Supported since protocol v16 (0.9.16) */
     [PA_COMMAND_SET_SINK_PORT] = "SET_SINK_PORT",
-    [PA_COMMAND_SET_SOURCE_PORT] = "SET_SOURCE_PORT"
+    [PA_COMMAND_SET_SOURCE_PORT] = "SET_SOURCE_PORT",
+
+    /* Supported since protocol v17 (0.9.22) */
+    [PA_COMMAND_CREATE_PLAYBACK_RING] = "CREATE_PLAYBACK_RING",
+    [PA_COMMAND_GET_TRACE] = "GET_TRACE",
+    [PA_COMMAND_SET_TRACE] = "SET_TRACE"
 };
 
 #endif
@@ -216,14 +216,20 @@ void* pa_prioq_remove(pa_prioq *q, pa_prioq_item *i) {
 
     } else {
 
+        pa_prioq_item *l;
+
         /* We are not the last entry, we need to replace ourselves
          * with the last node and reshuffle */
 
-        q->items[i->idx] = q->items[q->n_items-1];
-        q->items[i->idx]->idx = i->idx;
+        l = q->items[q->n_items-1];
+        q->items[i->idx] = l;
+        l->idx = i->idx;
         q->n_items--;
 
-        shuffle_down(q, i->idx);
+        /* The last node might be smaller than our parent if we
+         * weren't the top, so it might need to move either way */
+        shuffle_down(q, l->idx);
+        shuffle_up(q, l);
     }
 
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
@@ -74,6 +74,9 @@
 
 #define MAX_CACHE_SAMPLE_SIZE (2048000)
 
+/* Don't read more than this many times before handing data to the IO thread */
+#define MAX_READS_PER_POST 16
+
 #define DEFAULT_SINK_LATENCY (150*PA_USEC_PER_MSEC)
 #define DEFAULT_SOURCE_LATENCY (150*PA_USEC_PER_MSEC)
 
@@ -991,6 +994,20 @@ static void client_kill_cb(pa_client *c) {
 
 /*** pa_iochannel callbacks ***/
 
+/* Hand the data read so far to the IO thread with a single message */
+static void post_chunk(connection *c, pa_memchunk *chunk) {
+    connection_assert_ref(c);
+    pa_assert(chunk);
+
+    if (chunk->length <= 0)
+        return;
+
+    pa_asyncmsgq_post(c->sink_input->sink->asyncmsgq, PA_MSGOBJECT(c->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
+    pa_atomic_sub(&c->playback.missing, (int) chunk->length);
+
+    pa_memchunk_reset(chunk);
+}
+
 static int do_read(connection *c) {
     connection_assert_ref(c);
 
@@ -1121,10 +1138,8 @@ static int do_read(connection *c) {
 
     } else if (c->state == ESD_STREAMING_DATA && c->sink_input) {
         pa_memchunk chunk;
-        ssize_t r;
         size_t l;
-        void *p;
-        size_t space = 0;
+        unsigned n;
 
         pa_assert(c->input_memblockq);
 
@@ -1133,47 +1148,67 @@ static int do_read(connection *c) {
         if (!(l = (size_t) pa_atomic_load(&c->playback.missing)))
             return 0;
 
-        if (c->playback.current_memblock) {
+        /* Read straight into the current mempool slot and merge
+         * consecutive reads into a single chunk, so that all data
+         * currently available is posted with one message. */
+        pa_memchunk_reset(&chunk);
+
+        for (n = 0; n < MAX_READS_PER_POST && l > 0; n++) {
+            size_t space = 0, k;
+            ssize_t r;
+            void *p;
 
-            space = pa_memblock_get_length(c->playback.current_memblock) - c->playback.memblock_index;
+            if (c->playback.current_memblock) {
 
-            if (space <= 0) {
-                pa_memblock_unref(c->playback.current_memblock);
-                c->playback.current_memblock = NULL;
+                space = pa_memblock_get_length(c->playback.current_memblock) - c->playback.memblock_index;
+
+                if (space <= 0) {
+                    post_chunk(c, &chunk);
+
+                    pa_memblock_unref(c->playback.current_memblock);
+                    c->playback.current_memblock = NULL;
+                }
             }
-        }
 
-        if (!c->playback.current_memblock) {
-            pa_assert_se(c->playback.current_memblock = pa_memblock_new(c->protocol->core->mempool, (size_t) -1));
-            c->playback.memblock_index = 0;
+            if (!c->playback.current_memblock) {
+                pa_assert_se(c->playback.current_memblock = pa_memblock_new(c->protocol->core->mempool, (size_t) -1));
+                c->playback.memblock_index = 0;
 
-            space = pa_memblock_get_length(c->playback.current_memblock);
-        }
+                space = pa_memblock_get_length(c->playback.current_memblock);
+            }
 
-        if (l > space)
-            l = space;
+            k = PA_MIN(l, space);
 
-        p = pa_memblock_acquire(c->playback.current_memblock);
-        r = pa_iochannel_read(c->io, (uint8_t*) p+c->playback.memblock_index, l);
-        pa_memblock_release(c->playback.current_memblock);
+            p = pa_memblock_acquire(c->playback.current_memblock);
+            r = pa_iochannel_read(c->io, (uint8_t*) p+c->playback.memblock_index, k);
+            pa_memblock_release(c->playback.current_memblock);
 
-        if (r <= 0) {
+            if (r <= 0) {
 
-            if (r < 0 && (errno == EINTR || errno == EAGAIN))
-                return 0;
+                if (r < 0 && (errno == EINTR || errno == EAGAIN))
+                    break;
 
-            pa_log_debug("read(): %s", r < 0 ? pa_cstrerror(errno) : "EOF");
-            return -1;
-        }
+                post_chunk(c, &chunk);
 
-        chunk.memblock = c->playback.current_memblock;
-        chunk.index = c->playback.memblock_index;
-        chunk.length = (size_t) r;
+                pa_log_debug("read(): %s", r < 0 ? pa_cstrerror(errno) : "EOF");
+                return -1;
+            }
 
-        c->playback.memblock_index += (size_t) r;
+            if (!chunk.memblock) {
+                chunk.memblock = c->playback.current_memblock;
+                chunk.index = c->playback.memblock_index;
+            }
+
+            chunk.length += (size_t) r;
+            c->playback.memblock_index += (size_t) r;
+            l -= (size_t) r;
+
+            /* A short read means the socket has been drained */
+            if ((size_t) r < k)
+                break;
+        }
 
-        pa_asyncmsgq_post(c->sink_input->sink->asyncmsgq, PA_MSGOBJECT(c->sink_input), SINK_INPUT_MESSAGE_POST_DATA, NULL, 0, &chunk, NULL);
-        pa_atomic_sub(&c->playback.missing, (int) r);
+        post_chunk(c, &chunk);
     }
 
     return 0;
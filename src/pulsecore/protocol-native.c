@@ -29,6 +29,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#else
+#include <pulsecore/poll.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/version.h>
@@ -37,6 +43,7 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/native-common.h>
+#include <pulsecore/flist.h>
 #include <pulsecore/packet.h>
 #include <pulsecore/client.h>
 #include <pulsecore/source-output.h>
@@ -58,6 +65,11 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/trace.h>
+#include <pulsecore/shm.h>
+#include <pulsecore/shmasyncq.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/core-rtclock.h>
 
 #include "protocol-native.h"
 
@@ -72,6 +84,11 @@
 #define DEFAULT_PROCESS_MSEC 20   /* 20ms */
 #define DEFAULT_FRAGSIZE_MSEC DEFAULT_TLENGTH_MSEC
 
+/* Upper bound for the number of subscription events sent in a single
+ * packet, and for the configurable delivery interval */
+#define MAX_SUBSCRIPTION_BATCH 256
+#define MAX_SUBSCRIPTION_INTERVAL_MSEC 10000
+
 struct pa_native_protocol;
 
 typedef struct record_stream {
@@ -123,6 +140,13 @@ typedef struct playback_stream {
     pa_bool_t is_underrun:1;
     pa_bool_t drain_request:1;
     uint32_t drain_tag;
+
+    /* Only with the virtual clock, both owned by the IO thread. After
+     * a drain completed we don't wait for the client anymore until it
+     * writes again. */
+    pa_bool_t clock_held:1;
+    pa_bool_t drained:1;
+
     uint32_t syncid;
 
     pa_atomic_t missing;
@@ -134,11 +158,37 @@ typedef struct playback_stream {
     size_t render_memblockq_length;
     pa_usec_t current_sink_latency;
     uint64_t playing_for, underrun_for;
+
+    /* Bumped from the IO thread whenever the indexes jump, so that
+     * snapshots taken before can be recognized as stale */
+    pa_atomic_t timing_epoch;
+
+    /* If the client asked for it, the data is passed through a
+     * shared ring which the sink's IO thread reads directly. The
+     * segment and ring_requested are owned by the main thread, the
+     * queue and rtpoll item are only touched from the IO thread. */
+    pa_bool_t ring_requested;
+    pa_shm ring_shm;
+    pa_shmasyncq *ring;
+    pa_rtpoll_item *ring_rtpoll_item;
 } playback_stream;
 
 #define PLAYBACK_STREAM(o) (playback_stream_cast(o))
 PA_DEFINE_PRIVATE_CLASS(playback_stream, output_stream);
 
+/* Timing parameters taken by the IO thread along with a data request,
+ * sent with PA_COMMAND_REQUEST so that clients can interpolate without
+ * asking for them */
+typedef struct playback_timing {
+    int64_t read_index;
+    pa_usec_t sink_usec;
+    uint64_t underrun_for, playing_for;
+    struct timeval timestamp;
+    int epoch;
+} playback_timing;
+
+PA_STATIC_FLIST_DECLARE(playback_timings, 0, pa_xfree);
+
 typedef struct upload_stream {
     output_stream parent;
 
@@ -156,6 +206,13 @@ typedef struct upload_stream {
 #define UPLOAD_STREAM(o) (upload_stream_cast(o))
 PA_DEFINE_PRIVATE_CLASS(upload_stream, output_stream);
 
+/* A PLAY_SAMPLE that waits for the sample to be loaded */
+typedef struct play_sample_request {
+    pa_native_connection *connection;
+    uint32_t tag;
+    PA_LLIST_FIELDS(struct play_sample_request);
+} play_sample_request;
+
 struct pa_native_connection {
     pa_msgobject parent;
     pa_native_protocol *protocol;
@@ -169,7 +226,10 @@ struct pa_native_connection {
     pa_idxset *record_streams, *output_streams;
     uint32_t rrobin_index;
     pa_subscription *subscription;
+    pa_tagstruct *subscription_batch;
+    unsigned subscription_batch_n;
     pa_time_event *auth_timeout_event;
+    PA_LLIST_HEAD(play_sample_request, play_sample_requests);
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -199,7 +259,8 @@ enum {
     SINK_INPUT_MESSAGE_SEEK,
     SINK_INPUT_MESSAGE_PREBUF_FORCE,
     SINK_INPUT_MESSAGE_UPDATE_LATENCY,
-    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR
+    SINK_INPUT_MESSAGE_UPDATE_BUFFER_ATTR,
+    SINK_INPUT_MESSAGE_ATTACH_RING
 };
 
 enum {
@@ -228,6 +289,8 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_update_max_request_cb(pa_sink_input *i, size_t nbytes);
 static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_proplist *pl);
+static void sink_input_attach_cb(pa_sink_input *i);
+static void sink_input_detach_cb(pa_sink_input *i);
 
 static void native_connection_send_memblock(pa_native_connection *c);
 static void playback_stream_request_bytes(struct playback_stream*s);
@@ -281,6 +344,9 @@ static void command_remove_proplist(pa_pdispatch *pd, uint32_t command, uint32_t
 static void command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_create_playback_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_trace(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_set_trace(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 
 static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_ERROR] = NULL,
@@ -380,6 +446,10 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_SET_SINK_PORT] = command_set_sink_or_source_port,
     [PA_COMMAND_SET_SOURCE_PORT] = command_set_sink_or_source_port,
 
+    [PA_COMMAND_CREATE_PLAYBACK_RING] = command_create_playback_ring,
+    [PA_COMMAND_GET_TRACE] = command_get_trace,
+    [PA_COMMAND_SET_TRACE] = command_set_trace,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -744,10 +814,69 @@ static void playback_stream_free(pa_object* o) {
 
     playback_stream_unlink(s);
 
+    /* The sink input is gone, hence the IO thread doesn't access the
+     * ring anymore */
+    pa_assert(!s->ring_rtpoll_item);
+
+    if (s->ring)
+        pa_shmasyncq_free(s->ring);
+
+    if (s->ring_shm.ptr)
+        pa_shm_free(&s->ring_shm);
+
     pa_memblockq_free(s->memblockq);
     pa_xfree(s);
 }
 
+/* Called from IO context */
+static playback_timing* playback_timing_new(playback_stream *s) {
+    playback_timing *pt;
+
+    if (!(pt = pa_flist_pop(PA_STATIC_FLIST_GET(playback_timings))))
+        pt = pa_xnew(playback_timing, 1);
+
+    pt->read_index = pa_memblockq_get_read_index(s->memblockq);
+    pt->sink_usec =
+        pa_sink_get_latency_within_thread(s->sink_input->sink) +
+        pa_bytes_to_usec(pa_memblockq_get_length(s->sink_input->thread_info.render_memblockq), &s->sink_input->sink->sample_spec);
+    pt->underrun_for = s->sink_input->thread_info.underrun_for;
+    pt->playing_for = s->sink_input->thread_info.playing_for;
+    pt->epoch = pa_atomic_load(&s->timing_epoch);
+    pa_gettimeofday(&pt->timestamp);
+
+    return pt;
+}
+
+/* Called from main context */
+static void playback_timing_free(void *p) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(playback_timings), p) < 0)
+        pa_xfree(p);
+}
+
+/* Called from main context */
+static void playback_stream_put_timing(playback_stream *s, pa_tagstruct *t, playback_timing *pt) {
+    playback_stream_assert_ref(s);
+    pa_assert(t);
+
+    /* If the indexes jumped since the snapshot was taken the client
+     * has to ask for them */
+    if (!pt || pt->epoch != pa_atomic_load(&s->timing_epoch)) {
+        pa_tagstruct_put_boolean(t, FALSE);
+        return;
+    }
+
+    pa_tagstruct_put_boolean(t, TRUE);
+    pa_tagstruct_put_usec(t, pt->sink_usec);
+    pa_tagstruct_put_boolean(t,
+                             pt->playing_for > 0 &&
+                             pa_sink_get_state(s->sink_input->sink) == PA_SINK_RUNNING &&
+                             pa_sink_input_get_state(s->sink_input) == PA_SINK_INPUT_RUNNING);
+    pa_tagstruct_put_timeval(t, &pt->timestamp);
+    pa_tagstruct_puts64(t, pt->read_index);
+    pa_tagstruct_putu64(t, pt->underrun_for);
+    pa_tagstruct_putu64(t, pt->playing_for);
+}
+
 /* Called from main context */
 static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata, int64_t offset, pa_memchunk *chunk) {
     playback_stream *s = PLAYBACK_STREAM(o);
@@ -775,6 +904,10 @@ static int playback_stream_process_msg(pa_msgobject *o, int code, void*userdata,
             pa_tagstruct_putu32(t, (uint32_t) -1); /* tag */
             pa_tagstruct_putu32(t, s->index);
             pa_tagstruct_putu32(t, (uint32_t) l);
+
+            if (s->connection->version >= 17)
+                playback_stream_put_timing(s, t, userdata);
+
             pa_pstream_send_tagstruct(s->connection->pstream, t);
 
 /*             pa_log("Requesting %lu bytes", (unsigned long) l); */
@@ -1077,10 +1210,17 @@ static playback_stream* playback_stream_new(
     s->sink_input = sink_input;
     s->is_underrun = TRUE;
     s->drain_request = FALSE;
+    s->clock_held = FALSE;
+    s->drained = FALSE;
     pa_atomic_store(&s->missing, 0);
+    pa_atomic_store(&s->timing_epoch, 0);
     s->buffer_attr = *a;
     s->adjust_latency = adjust_latency;
     s->early_requests = early_requests;
+    s->ring_requested = FALSE;
+    pa_zero(s->ring_shm);
+    s->ring = NULL;
+    s->ring_rtpoll_item = NULL;
 
     s->sink_input->parent.process_msg = sink_input_process_msg;
     s->sink_input->pop = sink_input_pop_cb;
@@ -1091,6 +1231,8 @@ static playback_stream* playback_stream_new(
     s->sink_input->moving = sink_input_moving_cb;
     s->sink_input->suspend = sink_input_suspend_cb;
     s->sink_input->send_event = sink_input_send_event_cb;
+    s->sink_input->attach = sink_input_attach_cb;
+    s->sink_input->detach = sink_input_detach_cb;
     s->sink_input->userdata = s;
 
     start_index = ssync ? pa_memblockq_get_read_index(ssync->memblockq) : 0;
@@ -1110,6 +1252,7 @@ static playback_stream* playback_stream_new(
     pa_memblock_unref(silence.memblock);
 
     pa_memblockq_get_attr(s->memblockq, &s->buffer_attr);
+    pa_memblockq_set_trace_object(s->memblockq, sink_input->index);
 
     *missing = (uint32_t) pa_memblockq_pop_missing(s->memblockq);
 
@@ -1130,6 +1273,31 @@ static playback_stream* playback_stream_new(
     return s;
 }
 
+/* Called from IO context. With the virtual clock time must not move
+ * on while the client still owes us data, or we would render silence
+ * where a real time run plays what the client sent. That's the case
+ * while we are running and the client has been asked for data, or has
+ * not sent anything yet. */
+static void playback_stream_update_clock_hold(playback_stream *s, pa_bool_t running) {
+    pa_bool_t hold = FALSE;
+
+    if (!pa_rtclock_is_virtual())
+        return;
+
+    if (running && !s->drain_request && !s->drained)
+        hold =
+            !pa_memblockq_is_readable(s->memblockq) ||
+            pa_memblockq_get_length(s->memblockq) + pa_memblockq_get_minreq(s->memblockq) <= pa_memblockq_get_tlength(s->memblockq);
+
+    if (hold == s->clock_held)
+        return;
+
+    if ((s->clock_held = hold))
+        pa_rtclock_virtual_hold();
+    else
+        pa_rtclock_virtual_release();
+}
+
 /* Called from IO context */
 static void playback_stream_request_bytes(playback_stream *s) {
     size_t m, minreq;
@@ -1137,6 +1305,10 @@ static void playback_stream_request_bytes(playback_stream *s) {
 
     playback_stream_assert_ref(s);
 
+    playback_stream_update_clock_hold(s,
+                                      s->sink_input->thread_info.attached &&
+                                      s->sink_input->thread_info.state == PA_SINK_INPUT_RUNNING);
+
     m = pa_memblockq_pop_missing(s->memblockq);
 
     /* pa_log("request_bytes(%lu) (tlength=%lu minreq=%lu length=%lu really missing=%lli)", */
@@ -1154,9 +1326,11 @@ static void playback_stream_request_bytes(playback_stream *s) {
     previous_missing = pa_atomic_add(&s->missing, (int) m);
     minreq = pa_memblockq_get_minreq(s->memblockq);
 
+    pa_trace(PA_TRACE_REQUEST, s->sink_input->index, m, previous_missing + (int) m);
+
     if (pa_memblockq_prebuf_active(s->memblockq) ||
         (previous_missing < (int) minreq && previous_missing + (int) m >= (int) minreq))
-        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_REQUEST_DATA, NULL, 0, NULL, NULL);
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_REQUEST_DATA, playback_timing_new(s), 0, NULL, playback_timing_free);
 }
 
 /* Called from main context */
@@ -1217,9 +1391,22 @@ static void native_connection_unlink(pa_native_connection *c) {
         else
             upload_stream_unlink(UPLOAD_STREAM(o));
 
+    while (c->play_sample_requests) {
+        play_sample_request *q = c->play_sample_requests;
+
+        pa_scache_cancel_pending(c->protocol->core, q);
+        PA_LLIST_REMOVE(play_sample_request, c->play_sample_requests, q);
+        pa_xfree(q);
+    }
+
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
+    if (c->subscription_batch) {
+        pa_tagstruct_free(c->subscription_batch);
+        c->subscription_batch = NULL;
+    }
+
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
@@ -1290,6 +1477,8 @@ static void native_connection_send_memblock(pa_native_connection *c) {
 static void handle_seek(playback_stream *s, int64_t indexw) {
     playback_stream_assert_ref(s);
 
+    pa_atomic_inc(&s->timing_epoch);
+
 /*     pa_log("handle_seek: %llu -- %i", (unsigned long long) s->sink_input->thread_info.underrun_for, pa_memblockq_is_readable(s->memblockq)); */
 
     if (s->sink_input->thread_info.underrun_for > 0) {
@@ -1329,6 +1518,147 @@ static void flush_write_no_account(pa_memblockq *q) {
     pa_memblockq_flush_write(q, FALSE);
 }
 
+/* Called from thread context */
+static void handle_post_data(playback_stream *s, const pa_memchunk *chunk) {
+    int64_t windex;
+
+    playback_stream_assert_ref(s);
+    pa_assert(chunk);
+
+    windex = pa_memblockq_get_write_index(s->memblockq);
+
+/*     pa_log("sink input post: %lu %lli", (unsigned long) chunk->length, (long long) windex); */
+
+    s->drained = FALSE;
+
+    if (pa_memblockq_push_align(s->memblockq, chunk) < 0) {
+
+        if (pa_log_ratelimit())
+            pa_log_warn("Failed to push data into queue");
+        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
+        pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
+    }
+
+    handle_seek(s, windex);
+
+/*     pa_log("sink input post2: %lu", (unsigned long) pa_memblockq_get_length(s->memblockq)); */
+}
+
+/* Called from thread context. Moves everything the client put into
+ * the ring over into our memblockq. Returns the number of cells
+ * processed. */
+static unsigned ring_drain(playback_stream *s) {
+    void *d;
+    size_t max_length;
+    unsigned n = 0;
+
+    playback_stream_assert_ref(s);
+
+    if (!s->ring)
+        return 0;
+
+    max_length = pa_shmasyncq_get_element_size(s->ring) - PA_NATIVE_RING_CELL_HEADER_SIZE;
+
+    while ((d = pa_shmasyncq_pop_begin(s->ring, FALSE))) {
+        pa_native_ring_cell cell;
+
+        /* The client may modify the cell while we look at it, hence
+         * we work on a private copy of the header */
+        memcpy(&cell, d, sizeof(cell));
+
+        if (cell.length > max_length || cell.seek > PA_SEEK_RELATIVE_END) {
+            if (pa_log_ratelimit())
+                pa_log_warn("Client put invalid cell into playback ring, ignoring.");
+
+            pa_shmasyncq_pop_commit(s->ring);
+            n++;
+            continue;
+        }
+
+        if (cell.seek != PA_SEEK_RELATIVE || cell.offset != 0) {
+            int64_t windex;
+
+            windex = pa_memblockq_get_write_index(s->memblockq);
+            pa_memblockq_seek(s->memblockq, cell.offset, (pa_seek_mode_t) cell.seek, cell.seek == PA_SEEK_RELATIVE);
+            handle_seek(s, windex);
+        }
+
+        if (cell.length > 0) {
+            pa_memchunk chunk;
+            void *p;
+
+            /* The cell is recycled as soon as we commit it, so we
+             * need to copy the data once into a block of our own */
+            chunk.memblock = pa_memblock_new(s->sink_input->core->mempool, cell.length);
+            chunk.index = 0;
+            chunk.length = cell.length;
+
+            p = pa_memblock_acquire(chunk.memblock);
+            memcpy(p, (uint8_t*) d + PA_NATIVE_RING_CELL_HEADER_SIZE, cell.length);
+            pa_memblock_release(chunk.memblock);
+
+            handle_post_data(s, &chunk);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        pa_shmasyncq_pop_commit(s->ring);
+        n++;
+    }
+
+    return n;
+}
+
+/* Called from thread context */
+static int ring_before(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
+
+    playback_stream_assert_ref(s);
+
+    if (pa_shmasyncq_read_before_poll(s->ring) < 0)
+        return 1; /* 1 means immediate restart of the loop */
+
+    return 0;
+}
+
+/* Called from thread context */
+static void ring_after(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
+
+    playback_stream_assert_ref(s);
+
+    pa_shmasyncq_read_after_poll(s->ring);
+}
+
+/* Called from thread context */
+static int ring_work(pa_rtpoll_item *i) {
+    playback_stream *s = pa_rtpoll_item_get_userdata(i);
+
+    playback_stream_assert_ref(s);
+
+    ring_drain(s);
+    return 0;
+}
+
+/* Called from thread context */
+static void ring_attach(playback_stream *s) {
+    struct pollfd *pollfd;
+
+    playback_stream_assert_ref(s);
+    pa_assert(s->ring);
+    pa_assert(!s->ring_rtpoll_item);
+
+    s->ring_rtpoll_item = pa_rtpoll_item_new(s->sink_input->sink->thread_info.rtpoll, PA_RTPOLL_NORMAL, 1);
+
+    pollfd = pa_rtpoll_item_get_pollfd(s->ring_rtpoll_item, NULL);
+    pollfd->fd = pa_shmasyncq_read_fd(s->ring);
+    pollfd->events = POLLIN;
+
+    pa_rtpoll_item_set_before_callback(s->ring_rtpoll_item, ring_before);
+    pa_rtpoll_item_set_after_callback(s->ring_rtpoll_item, ring_after);
+    pa_rtpoll_item_set_work_callback(s->ring_rtpoll_item, ring_work);
+    pa_rtpoll_item_set_userdata(s->ring_rtpoll_item, s);
+}
+
 /* Called from thread context */
 static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_sink_input *i = PA_SINK_INPUT(o);
@@ -1343,6 +1673,10 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
         case SINK_INPUT_MESSAGE_SEEK: {
             int64_t windex;
 
+            /* The client wrote whatever is in the ring before it asked
+             * for the seek */
+            ring_drain(s);
+
             windex = pa_memblockq_get_write_index(s->memblockq);
 
             /* The client side is incapable of accounting correctly
@@ -1355,29 +1689,21 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             return 0;
         }
 
-        case SINK_INPUT_MESSAGE_POST_DATA: {
-            int64_t windex;
-
+        case SINK_INPUT_MESSAGE_POST_DATA:
             pa_assert(chunk);
 
-            windex = pa_memblockq_get_write_index(s->memblockq);
-
-/*             pa_log("sink input post: %lu %lli", (unsigned long) chunk->length, (long long) windex); */
-
-            if (pa_memblockq_push_align(s->memblockq, chunk) < 0) {
-
-                if (pa_log_ratelimit())
-                    pa_log_warn("Failed to push data into queue");
-                pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_OVERFLOW, NULL, 0, NULL, NULL);
-                pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
-            }
+            handle_post_data(s, chunk);
+            return 0;
 
-            handle_seek(s, windex);
+        case SINK_INPUT_MESSAGE_ATTACH_RING:
+            pa_assert(!s->ring);
+            s->ring = userdata;
 
-/*             pa_log("sink input post2: %lu", (unsigned long) pa_memblockq_get_length(s->memblockq)); */
+            if (i->thread_info.attached)
+                ring_attach(s);
 
+            ring_drain(s);
             return 0;
-        }
 
         case SINK_INPUT_MESSAGE_DRAIN:
         case SINK_INPUT_MESSAGE_FLUSH:
@@ -1406,6 +1732,16 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                     pa_assert_not_reached();
             }
 
+            /* Keep the commands ordered with the data the clients put
+             * into the rings before sending them */
+            ring_drain(s);
+
+            for (isync = i->sync_prev; isync; isync = isync->sync_prev)
+                ring_drain(PLAYBACK_STREAM(isync->userdata));
+
+            for (isync = i->sync_next; isync; isync = isync->sync_next)
+                ring_drain(PLAYBACK_STREAM(isync->userdata));
+
             windex = pa_memblockq_get_write_index(s->memblockq);
             func(s->memblockq);
             handle_seek(s, windex);
@@ -1426,12 +1762,15 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
             }
 
             if (code == SINK_INPUT_MESSAGE_DRAIN) {
-                if (!pa_memblockq_is_readable(s->memblockq))
+                if (!pa_memblockq_is_readable(s->memblockq)) {
+                    s->drained = TRUE;
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_DRAIN_ACK, userdata, 0, NULL, NULL);
-                else {
+                } else {
                     s->drain_tag = PA_PTR_TO_UINT(userdata);
                     s->drain_request = TRUE;
                 }
+
+                playback_stream_update_clock_hold(s, i->thread_info.attached && i->thread_info.state == PA_SINK_INPUT_RUNNING);
             }
 
             return 0;
@@ -1457,6 +1796,8 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
 
             handle_seek(s, windex);
 
+            playback_stream_update_clock_hold(s, PA_PTR_TO_UINT(userdata) == PA_SINK_INPUT_RUNNING);
+
             /* Fall through to the default handler */
             break;
         }
@@ -1492,6 +1833,9 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
 /*     pa_log("%s, pop(): %lu", pa_proplist_gets(i->proplist, PA_PROP_MEDIA_NAME), (unsigned long) pa_memblockq_get_length(s->memblockq)); */
 
+    /* Pick up what the client put into the ring since we last woke up */
+    ring_drain(s);
+
     if (pa_memblockq_is_readable(s->memblockq))
         s->is_underrun = FALSE;
     else {
@@ -1500,6 +1844,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
 
         if (s->drain_request && pa_sink_input_safe_to_remove(i)) {
             s->drain_request = FALSE;
+            s->drained = TRUE;
             pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_DRAIN_ACK, PA_UINT_TO_PTR(s->drain_tag), 0, NULL, NULL);
         } else if (!s->is_underrun)
             pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(s), PLAYBACK_STREAM_MESSAGE_UNDERFLOW, NULL, 0, NULL, NULL);
@@ -1610,6 +1955,34 @@ static void sink_input_send_event_cb(pa_sink_input *i, const char *event, pa_pro
     pa_pstream_send_tagstruct(s->connection->pstream, t);
 }
 
+/* Called from thread context */
+static void sink_input_attach_cb(pa_sink_input *i) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    if (s->ring)
+        ring_attach(s);
+}
+
+/* Called from thread context */
+static void sink_input_detach_cb(pa_sink_input *i) {
+    playback_stream *s;
+
+    pa_sink_input_assert_ref(i);
+    s = PLAYBACK_STREAM(i->userdata);
+    playback_stream_assert_ref(s);
+
+    if (s->ring_rtpoll_item) {
+        pa_rtpoll_item_free(s->ring_rtpoll_item);
+        s->ring_rtpoll_item = NULL;
+    }
+
+    playback_stream_update_clock_hold(s, FALSE);
+}
+
 /* Called from main context */
 static void sink_input_suspend_cb(pa_sink_input *i, pa_bool_t suspend) {
     playback_stream *s;
@@ -1639,6 +2012,9 @@ static void sink_input_moving_cb(pa_sink_input *i, pa_sink *dest) {
     s = PLAYBACK_STREAM(i->userdata);
     playback_stream_assert_ref(s);
 
+    /* Snapshots still queued were taken on the old sink */
+    pa_atomic_inc(&s->timing_epoch);
+
     if (!dest)
         return;
 
@@ -2409,6 +2785,12 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_log_debug("Negotiated SHM: %s", pa_yes_no(do_shm));
     pa_pstream_enable_shm(c->pstream, do_shm);
 
+#ifdef HAVE_CREDS
+    /* Newer clients accept our pool as fd, too */
+    if (do_shm && c->version >= 17)
+        pa_pstream_enable_memfd(c->pstream);
+#endif
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, PA_PROTOCOL_VERSION | (do_shm ? 0x80000000 : 0));
 
@@ -2552,6 +2934,65 @@ static void command_stat(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static void put_trace_cb(unsigned thread, const pa_trace_event *events, unsigned n, void *userdata) {
+    pa_tagstruct *reply = userdata;
+    unsigned i;
+
+    if (n <= 0)
+        return;
+
+    pa_tagstruct_putu32(reply, thread);
+    pa_tagstruct_putu32(reply, n);
+
+    for (i = 0; i < n; i++) {
+        pa_tagstruct_put_usec(reply, events[i].time);
+        pa_tagstruct_putu32(reply, (uint32_t) events[i].type);
+        pa_tagstruct_putu32(reply, events[i].object);
+        pa_tagstruct_puts64(reply, events[i].a);
+        pa_tagstruct_puts64(reply, events[i].b);
+    }
+}
+
+static void command_get_trace(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (!pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    reply = reply_new(tag);
+    pa_trace_dump(put_trace_cb, reply);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+static void command_set_trace(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_bool_t enable;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_get_boolean(t, &enable) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+
+    pa_log_info("Stream timing trace %s.", enable ? "enabled" : "disabled");
+    pa_trace_set_enabled(enable);
+
+    pa_pstream_send_simple_ack(c->pstream, tag);
+}
+
 static void command_get_playback_latency(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     pa_tagstruct *reply;
@@ -2729,15 +3170,40 @@ static void command_finish_upload_stream(pa_pdispatch *pd, uint32_t command, uin
     upload_stream_unlink(s);
 }
 
+static void play_sample_cb(pa_core *core, int r, uint32_t idx, void *userdata) {
+    play_sample_request *q = userdata;
+    pa_native_connection *c;
+    pa_tagstruct *reply;
+
+    pa_assert(q);
+
+    c = q->connection;
+    pa_native_connection_assert_ref(c);
+
+    PA_LLIST_REMOVE(play_sample_request, c->play_sample_requests, q);
+
+    if (r < 0)
+        pa_pstream_send_error(c->pstream, q->tag, PA_ERR_NOENTITY);
+    else {
+        reply = reply_new(q->tag);
+
+        if (c->version >= 13)
+            pa_tagstruct_putu32(reply, idx);
+
+        pa_pstream_send_tagstruct(c->pstream, reply);
+    }
+
+    pa_xfree(q);
+}
+
 static void command_play_sample(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     uint32_t sink_index;
     pa_volume_t volume;
     pa_sink *sink;
     const char *name, *sink_name;
-    uint32_t idx;
+    play_sample_request *q;
     pa_proplist *p;
-    pa_tagstruct *reply;
 
     pa_native_connection_assert_ref(c);
     pa_assert(t);
@@ -2775,20 +3241,21 @@ static void command_play_sample(pa_pdispatch *pd, uint32_t command, uint32_t tag
 
     pa_proplist_update(p, PA_UPDATE_MERGE, c->client->proplist);
 
-    if (pa_scache_play_item(c->protocol->core, name, sink, volume, p, &idx) < 0) {
+    /* Lazy samples are loaded in the background, we reply once that
+     * is done */
+    q = pa_xnew(play_sample_request, 1);
+    q->connection = c;
+    q->tag = tag;
+    PA_LLIST_PREPEND(play_sample_request, c->play_sample_requests, q);
+
+    if (pa_scache_play_item_async(c->protocol->core, name, sink, volume, p, play_sample_cb, q) < 0) {
+        PA_LLIST_REMOVE(play_sample_request, c->play_sample_requests, q);
+        pa_xfree(q);
+
         pa_pstream_send_error(c->pstream, tag, PA_ERR_NOENTITY);
-        pa_proplist_free(p);
-        return;
     }
 
     pa_proplist_free(p);
-
-    reply = reply_new(tag);
-
-    if (c->version >= 13)
-        pa_tagstruct_putu32(reply, idx);
-
-    pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
 static void command_remove_sample(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3302,18 +3769,37 @@ static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static void subscription_flush_cb(pa_core *core, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+
+    pa_native_connection_assert_ref(c);
+
+    if (!c->subscription_batch)
+        return;
+
+    pa_pstream_send_tagstruct(c->pstream, c->subscription_batch);
+    c->subscription_batch = NULL;
+    c->subscription_batch_n = 0;
+}
+
 static void subscription_cb(pa_core *core, pa_subscription_event_type_t e, uint32_t idx, void *userdata) {
-    pa_tagstruct *t;
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
     pa_native_connection_assert_ref(c);
 
-    t = pa_tagstruct_new(NULL, 0);
-    pa_tagstruct_putu32(t, PA_COMMAND_SUBSCRIBE_EVENT);
-    pa_tagstruct_putu32(t, (uint32_t) -1);
-    pa_tagstruct_putu32(t, e);
-    pa_tagstruct_putu32(t, idx);
-    pa_pstream_send_tagstruct(c->pstream, t);
+    /* Since v17 clients accept several events in one packet, so we
+     * collect them here and send them off in subscription_flush_cb() */
+    if (!c->subscription_batch) {
+        c->subscription_batch = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_putu32(c->subscription_batch, PA_COMMAND_SUBSCRIBE_EVENT);
+        pa_tagstruct_putu32(c->subscription_batch, (uint32_t) -1);
+    }
+
+    pa_tagstruct_putu32(c->subscription_batch, e);
+    pa_tagstruct_putu32(c->subscription_batch, idx);
+
+    if (c->version < 17 || ++c->subscription_batch_n >= MAX_SUBSCRIPTION_BATCH)
+        subscription_flush_cb(core, c);
 }
 
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3336,7 +3822,7 @@ static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag,
         pa_subscription_free(c->subscription);
 
     if (m != 0) {
-        c->subscription = pa_subscription_new(c->protocol->core, m, subscription_cb, c);
+        c->subscription = pa_subscription_new_coalesced(c->protocol->core, m, c->options->subscription_interval, subscription_cb, subscription_flush_cb, c);
         pa_assert(c->subscription);
     } else
         c->subscription = NULL;
@@ -4386,6 +4872,76 @@ static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command,
     pa_pstream_send_simple_ack(c->pstream, tag);
 }
 
+static void command_create_playback_ring(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    uint32_t channel, n_cells, cell_size;
+    playback_stream *s;
+#ifdef HAVE_CREDS
+    pa_tagstruct *reply;
+    pa_shmasyncq *ring;
+    int fds[3] = { -1, -1, -1 };
+#endif
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &channel) < 0 ||
+        pa_tagstruct_getu32(t, &n_cells) < 0 ||
+        pa_tagstruct_getu32(t, &cell_size) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream, c->version >= 17, tag, PA_ERR_NOTSUPPORTED);
+    s = pa_idxset_get_by_index(c->output_streams, channel);
+    CHECK_VALIDITY(c->pstream, s, tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, playback_stream_isinstance(s), tag, PA_ERR_NOENTITY);
+    CHECK_VALIDITY(c->pstream, !s->ring_requested, tag, PA_ERR_EXIST);
+    /* There is no IO thread to hand the ring to while the stream is
+     * being moved */
+    CHECK_VALIDITY(c->pstream, s->sink_input->sink, tag, PA_ERR_BADSTATE);
+    CHECK_VALIDITY(c->pstream, n_cells >= 2 && n_cells <= PA_NATIVE_RING_N_CELLS_MAX && !(n_cells & (n_cells - 1)), tag, PA_ERR_INVALID);
+    CHECK_VALIDITY(c->pstream, cell_size > PA_NATIVE_RING_CELL_HEADER_SIZE && cell_size <= PA_NATIVE_RING_CELL_SIZE_MAX, tag, PA_ERR_INVALID);
+
+#ifdef HAVE_CREDS
+    /* We need to pass the fds, hence this only works on local sockets */
+    CHECK_VALIDITY(c->pstream, c->is_local && pa_pstream_get_shm(c->pstream), tag, PA_ERR_NOTSUPPORTED);
+
+    cell_size = (uint32_t) PA_ALIGN(cell_size);
+
+    if (pa_shm_create_rw_fd(&s->ring_shm, PA_SHMASYNCQ_SIZE(n_cells, cell_size), &fds[0]) < 0) {
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INTERNAL);
+        return;
+    }
+
+    if (!(ring = pa_shmasyncq_new(n_cells, cell_size, s->ring_shm.ptr, fds+1))) {
+        pa_shm_free(&s->ring_shm);
+        pa_pstream_send_error(c->pstream, tag, PA_ERR_INTERNAL);
+        return;
+    }
+
+    /* From now on the ring belongs to the IO thread */
+    s->ring_requested = TRUE;
+    pa_assert_se(pa_asyncmsgq_send(s->sink_input->sink->asyncmsgq, PA_MSGOBJECT(s->sink_input), SINK_INPUT_MESSAGE_ATTACH_RING, ring, 0, NULL) == 0);
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu32(reply, n_cells);
+    pa_tagstruct_putu32(reply, cell_size);
+    pa_tagstruct_putu32(reply, (uint32_t) s->ring_shm.size);
+
+    /* On success the client now owns duplicates of the fds, ours stay
+     * with the segment and the ring. If sending fails the connection
+     * is dead anyway. */
+    pa_pstream_send_tagstruct_with_fds(c->pstream, reply, fds, 3);
+
+    pa_log_debug("Playback stream %u now reads data directly from a %u*%u byte ring.", s->index, n_cells, cell_size);
+#else
+    pa_pstream_send_error(c->pstream, tag, PA_ERR_NOTSUPPORTED);
+#endif
+}
+
 /*** pstream callbacks ***/
 
 static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
@@ -4628,6 +5184,9 @@ void pa_native_protocol_connect(pa_native_protocol *p, pa_iochannel *io, pa_nati
 
     c->rrobin_index = PA_IDXSET_INVALID;
     c->subscription = NULL;
+    c->subscription_batch = NULL;
+    c->subscription_batch_n = 0;
+    PA_LLIST_HEAD_INIT(play_sample_request, c->play_sample_requests);
 
     pa_idxset_put(p->connections, c, NULL);
 
@@ -4811,6 +5370,7 @@ void pa_native_options_unref(pa_native_options *o) {
 int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     pa_bool_t enabled;
     const char *acl;
+    uint32_t interval_msec;
 
     pa_assert(o);
     pa_assert(PA_REFCNT_VALUE(o) >= 1);
@@ -4873,6 +5433,15 @@ int pa_native_options_parse(pa_native_options *o, pa_core *c, pa_modargs *ma) {
     } else
           o->auth_cookie = NULL;
 
+    interval_msec = (uint32_t) (o->subscription_interval / PA_USEC_PER_MSEC);
+    if (pa_modargs_get_value_u32(ma, "subscription-interval-msec", &interval_msec) < 0 ||
+        interval_msec > MAX_SUBSCRIPTION_INTERVAL_MSEC) {
+        pa_log("subscription-interval-msec= expects a numeric argument between 0 and %u.", MAX_SUBSCRIPTION_INTERVAL_MSEC);
+        return -1;
+    }
+
+    o->subscription_interval = (pa_usec_t) interval_msec * PA_USEC_PER_MSEC;
+
     return 0;
 }
 
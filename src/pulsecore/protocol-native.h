@@ -47,6 +47,9 @@ typedef struct pa_native_options {
     char *auth_group;
     pa_ip_acl *auth_ip_acl;
     pa_auth_cookie *auth_cookie;
+
+    /* Minimum time between two subscription event deliveries to a client */
+    pa_usec_t subscription_interval;
 } pa_native_options;
 
 typedef enum pa_native_hook {
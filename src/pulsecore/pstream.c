@@ -26,7 +26,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
@@ -42,12 +44,15 @@
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/winsock.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
 #include <pulsecore/queue.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/creds.h>
 #include <pulsecore/refcnt.h>
 #include <pulsecore/flist.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/macro.h>
 
 #include "pstream.h"
@@ -56,6 +61,7 @@
 #define PA_FLAG_SHMDATA    0x80000000LU
 #define PA_FLAG_SHMRELEASE 0x40000000LU
 #define PA_FLAG_SHMREVOKE  0xC0000000LU
+#define PA_FLAG_SHMREGISTER 0x20000000LU
 #define PA_FLAG_SHMMASK    0xFF000000LU
 #define PA_FLAG_SEEKMASK   0x000000FFLU
 
@@ -90,7 +96,8 @@ struct item_info {
         PA_PSTREAM_ITEM_PACKET,
         PA_PSTREAM_ITEM_MEMBLOCK,
         PA_PSTREAM_ITEM_SHMRELEASE,
-        PA_PSTREAM_ITEM_SHMREVOKE
+        PA_PSTREAM_ITEM_SHMREVOKE,
+        PA_PSTREAM_ITEM_SHMREGISTER
     } type;
 
     /* packet info */
@@ -98,6 +105,9 @@ struct item_info {
 #ifdef HAVE_CREDS
     pa_bool_t with_creds;
     pa_creds creds;
+
+    unsigned n_fds;
+    int fds[PA_IOCHANNEL_MAX_FDS];
 #endif
 
     /* memblock info */
@@ -106,7 +116,7 @@ struct item_info {
     int64_t offset;
     pa_seek_mode_t seek_mode;
 
-    /* release/revoke info */
+    /* release/revoke info, shm id for registrations */
     uint32_t block_id;
 };
 
@@ -124,6 +134,7 @@ struct pa_pstream {
     struct {
         pa_pstream_descriptor descriptor;
         struct item_info* current;
+        struct item_info* postponed;
         uint32_t shm_info[PA_PSTREAM_SHM_MAX];
         void *data;
         size_t index;
@@ -166,6 +177,16 @@ struct pa_pstream {
 #ifdef HAVE_CREDS
     pa_creds read_creds, write_creds;
     pa_bool_t read_creds_valid, send_creds_now;
+
+    /* fds received along with the current frame */
+    unsigned n_read_fds;
+    int read_fds[PA_IOCHANNEL_MAX_FDS];
+    pa_bool_t send_fds_now;
+
+    /* Whether the other side accepts anonymous segments as fds, and
+     * the ids of those we already passed */
+    pa_bool_t use_memfd;
+    pa_idxset *registered_memfds;
 #endif
 };
 
@@ -246,6 +267,7 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     p->send_queue = pa_queue_new();
 
     p->write.current = NULL;
+    p->write.postponed = NULL;
     p->write.index = 0;
     pa_memchunk_reset(&p->write.memchunk);
     p->read.memblock = NULL;
@@ -279,10 +301,27 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
 #ifdef HAVE_CREDS
     p->send_creds_now = FALSE;
     p->read_creds_valid = FALSE;
+    p->send_fds_now = FALSE;
+    p->n_read_fds = 0;
+    p->use_memfd = FALSE;
+    p->registered_memfds = pa_idxset_new(NULL, NULL);
 #endif
     return p;
 }
 
+#ifdef HAVE_CREDS
+static void close_read_fds(pa_pstream *p) {
+    unsigned k;
+
+    pa_assert(p);
+
+    for (k = 0; k < p->n_read_fds; k++)
+        pa_close(p->read_fds[k]);
+
+    p->n_read_fds = 0;
+}
+#endif
+
 static void item_free(void *item, void *q) {
     struct item_info *i = item;
     pa_assert(i);
@@ -295,6 +334,11 @@ static void item_free(void *item, void *q) {
         pa_packet_unref(i->packet);
     }
 
+#ifdef HAVE_CREDS
+    for (; i->n_fds > 0; i->n_fds--)
+        pa_close(i->fds[i->n_fds-1]);
+#endif
+
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
         pa_xfree(i);
 }
@@ -309,6 +353,9 @@ static void pstream_free(pa_pstream *p) {
     if (p->write.current)
         item_free(p->write.current, NULL);
 
+    if (p->write.postponed)
+        item_free(p->write.postponed, NULL);
+
     if (p->write.memchunk.memblock)
         pa_memblock_unref(p->write.memchunk.memblock);
 
@@ -318,6 +365,11 @@ static void pstream_free(pa_pstream *p) {
     if (p->read.packet)
         pa_packet_unref(p->read.packet);
 
+#ifdef HAVE_CREDS
+    close_read_fds(p);
+    pa_idxset_free(p->registered_memfds, NULL, NULL);
+#endif
+
     pa_xfree(p);
 }
 
@@ -340,6 +392,8 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
 #ifdef HAVE_CREDS
     if ((i->with_creds = !!creds))
         i->creds = *creds;
+
+    i->n_fds = 0;
 #endif
 
     pa_queue_push(p->send_queue, i);
@@ -347,6 +401,57 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
     p->mainloop->defer_enable(p->defer_event, 1);
 }
 
+#ifdef HAVE_CREDS
+int pa_pstream_send_packet_with_fds(pa_pstream*p, pa_packet *packet, const int *fds, unsigned n_fds) {
+    struct item_info *i;
+    unsigned k;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(packet);
+    pa_assert(fds);
+    pa_assert(n_fds > 0);
+    pa_assert(n_fds <= PA_IOCHANNEL_MAX_FDS);
+
+    if (p->dead)
+        return -1;
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+
+    i->type = PA_PSTREAM_ITEM_PACKET;
+    i->with_creds = FALSE;
+
+    /* The fds might be closed by the caller before we get around to
+     * actually sending the packet, hence let's keep our own copies */
+    for (i->n_fds = 0; i->n_fds < n_fds; i->n_fds++)
+        if ((i->fds[i->n_fds] = dup(fds[i->n_fds])) < 0)
+            break;
+
+    if (i->n_fds < n_fds) {
+        pa_log_warn("dup() failed while passing fds: %s", pa_cstrerror(errno));
+
+        for (k = 0; k < i->n_fds; k++)
+            pa_close(i->fds[k]);
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
+            pa_xfree(i);
+
+        return -1;
+    }
+
+    for (k = 0; k < i->n_fds; k++)
+        pa_make_fd_cloexec(i->fds[k]);
+
+    i->packet = pa_packet_ref(packet);
+
+    pa_queue_push(p->send_queue, i);
+    p->mainloop->defer_enable(p->defer_event, 1);
+
+    return 0;
+}
+#endif
+
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek_mode, const pa_memchunk *chunk) {
     size_t length, idx;
     size_t bsm;
@@ -382,6 +487,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->seek_mode = seek_mode;
 #ifdef HAVE_CREDS
         i->with_creds = FALSE;
+        i->n_fds = 0;
 #endif
 
         pa_queue_push(p->send_queue, i);
@@ -409,6 +515,7 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     item->block_id = block_id;
 #ifdef HAVE_CREDS
     item->with_creds = FALSE;
+    item->n_fds = 0;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -446,6 +553,7 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     item->block_id = block_id;
 #ifdef HAVE_CREDS
     item->with_creds = FALSE;
+    item->n_fds = 0;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -465,15 +573,90 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
+/* Returns FALSE if b lives in an anonymous segment that we didn't
+ * pass to the other side, i.e. it would not be able to import it */
+static pa_bool_t memfd_is_known(pa_pstream *p, pa_memblock *b) {
+    uint32_t shm_id;
+
+    pa_assert(p);
+    pa_assert(p->export);
+
+    if (pa_memexport_get_memfd(p->export, b, &shm_id) < 0)
+        return TRUE;
+
+#ifdef HAVE_CREDS
+    return !!pa_idxset_get_by_data(p->registered_memfds, PA_UINT32_TO_PTR(shm_id), NULL);
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_CREDS
+/* Creates an item passing the segment b lives in to the other side,
+ * if that is necessary */
+static struct item_info *memfd_register_item(pa_pstream *p, pa_memblock *b) {
+    struct item_info *i;
+    uint32_t shm_id;
+    int fd;
+
+    pa_assert(p);
+    pa_assert(p->export);
+
+    if ((fd = pa_memexport_get_memfd(p->export, b, &shm_id)) < 0)
+        return NULL;
+
+    if (pa_idxset_get_by_data(p->registered_memfds, PA_UINT32_TO_PTR(shm_id), NULL))
+        return NULL;
+
+    if ((fd = dup(fd)) < 0) {
+        pa_log_warn("Failed to duplicate segment fd: %s", pa_cstrerror(errno));
+        return NULL;
+    }
+
+    pa_make_fd_cloexec(fd);
+
+    if (!(i = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        i = pa_xnew(struct item_info, 1);
+
+    i->type = PA_PSTREAM_ITEM_SHMREGISTER;
+    i->block_id = shm_id;
+    i->with_creds = FALSE;
+    i->fds[0] = fd;
+    i->n_fds = 1;
+
+    pa_idxset_put(p->registered_memfds, PA_UINT32_TO_PTR(shm_id), NULL);
+
+    return i;
+}
+#endif
+
 static void prepare_next_write_item(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    p->write.current = pa_queue_pop(p->send_queue);
+    /* An item that had to wait for a segment registration goes first */
+    if (p->write.postponed) {
+        p->write.current = p->write.postponed;
+        p->write.postponed = NULL;
+    } else
+        p->write.current = pa_queue_pop(p->send_queue);
 
     if (!p->write.current)
         return;
 
+#ifdef HAVE_CREDS
+    /* If the block lives in an anonymous segment the other side
+     * doesn't know yet, pass the segment first */
+    if (p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK && p->use_shm && p->use_memfd) {
+        struct item_info *i;
+
+        if ((i = memfd_register_item(p, p->write.current->chunk.memblock))) {
+            p->write.postponed = p->write.current;
+            p->write.current = i;
+        }
+    }
+#endif
+
     p->write.index = 0;
     p->write.data = NULL;
     pa_memchunk_reset(&p->write.memchunk);
@@ -500,6 +683,12 @@ static void prepare_next_write_item(pa_pstream *p) {
         p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
         p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
 
+    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREGISTER) {
+
+        /* The fd travels along with the descriptor */
+        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREGISTER);
+        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+
     } else {
         uint32_t flags;
         pa_bool_t send_payload = TRUE;
@@ -513,7 +702,7 @@ static void prepare_next_write_item(pa_pstream *p) {
 
         flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
 
-        if (p->use_shm) {
+        if (p->use_shm && memfd_is_known(p, p->write.current->chunk.memblock)) {
             uint32_t block_id, shm_id;
             size_t offset, length;
 
@@ -554,6 +743,9 @@ static void prepare_next_write_item(pa_pstream *p) {
 #ifdef HAVE_CREDS
     if ((p->send_creds_now = p->write.current->with_creds))
         p->write_creds = p->write.current->creds;
+
+    p->send_fds_now = p->write.current->n_fds > 0;
+    pa_assert(!p->send_creds_now || !p->send_fds_now);
 #endif
 }
 
@@ -598,6 +790,12 @@ static int do_write(pa_pstream *p) {
             goto fail;
 
         p->send_creds_now = FALSE;
+    } else if (p->send_fds_now) {
+
+        if ((r = pa_iochannel_write_with_fds(p->io, d, l, p->write.current->fds, p->write.current->n_fds)) < 0)
+            goto fail;
+
+        p->send_fds_now = FALSE;
     } else
 #endif
 
@@ -662,7 +860,7 @@ static int do_read(pa_pstream *p) {
     {
         pa_bool_t b = 0;
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
+        if ((r = pa_iochannel_read_with_fds(p->io, d, l, &p->read_creds, &b, p->read_fds, &p->n_read_fds)) <= 0)
             goto fail;
 
         p->read_creds_valid = p->read_creds_valid || b;
@@ -709,6 +907,29 @@ static int do_read(pa_pstream *p) {
             pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
 
             goto frame_done;
+
+        } else if (flags == PA_FLAG_SHMREGISTER) {
+
+            /* This is a SHM segment registration frame with no
+             * payload, the segment fd came along with it */
+
+#ifdef HAVE_CREDS
+            if (p->n_read_fds != 1) {
+                pa_log_warn("Received SHM segment registration frame without fd.");
+                return -1;
+            }
+
+            pa_assert(p->import);
+
+            p->n_read_fds = 0;
+            if (pa_memimport_attach_memfd(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]), p->read_fds[0]) < 0)
+                pa_log_warn("Failed to attach SHM segment passed by the other side.");
+
+            goto frame_done;
+#else
+            pa_log_warn("Received SHM segment registration frame on a system without fd passing.");
+            return -1;
+#endif
         }
 
         length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
@@ -875,6 +1096,9 @@ frame_done:
 
 #ifdef HAVE_CREDS
     p->read_creds_valid = FALSE;
+
+    /* Close all fds the packet handler didn't take */
+    close_read_fds(p);
 #endif
 
     return 0;
@@ -934,6 +1158,23 @@ void pa_pstream_set_revoke_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb,
     p->release_callback_userdata = userdata;
 }
 
+#ifdef HAVE_CREDS
+int pa_pstream_take_fds(pa_pstream *p, int *fds, unsigned n_fds) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(fds);
+    pa_assert(n_fds > 0);
+
+    if (p->n_read_fds != n_fds)
+        return -1;
+
+    memcpy(fds, p->read_fds, sizeof(int) * n_fds);
+    p->n_read_fds = 0;
+
+    return 0;
+}
+#endif
+
 pa_bool_t pa_pstream_is_pending(pa_pstream *p) {
     pa_bool_t b;
 
@@ -1018,6 +1259,15 @@ void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable) {
     }
 }
 
+#ifdef HAVE_CREDS
+void pa_pstream_enable_memfd(pa_pstream *p) {
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    p->use_memfd = TRUE;
+}
+#endif
+
 pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -50,6 +50,19 @@ void pa_pstream_unref(pa_pstream*p);
 void pa_pstream_unlink(pa_pstream *p);
 
 void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds);
+
+#ifdef HAVE_CREDS
+/* Send a packet and pass the specified fds along with it. The fds
+ * are duplicated, so the caller stays owner of them. Only works on
+ * local sockets. */
+int pa_pstream_send_packet_with_fds(pa_pstream*p, pa_packet *packet, const int *fds, unsigned n_fds);
+
+/* May only be called from within the packet callback: take ownership
+ * of the fds that have been passed along with the current
+ * packet. Fails if not exactly n_fds fds were received. Fds that are
+ * not taken are closed after the callback returns. */
+int pa_pstream_take_fds(pa_pstream *p, int *fds, unsigned n_fds);
+#endif
 void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk);
 void pa_pstream_send_release(pa_pstream *p, uint32_t block_id);
 void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id);
@@ -64,6 +77,13 @@ void pa_pstream_set_revoke_callback(pa_pstream *p, pa_pstream_block_id_cb_t cb,
 pa_bool_t pa_pstream_is_pending(pa_pstream *p);
 
 void pa_pstream_enable_shm(pa_pstream *p, pa_bool_t enable);
+
+#ifdef HAVE_CREDS
+/* Tell the pstream that the other side accepts anonymous SHM
+ * segments passed as fds. Otherwise blocks in such segments are
+ * copied into the stream. */
+void pa_pstream_enable_memfd(pa_pstream *p);
+#endif
 pa_bool_t pa_pstream_get_shm(pa_pstream *p);
 
 #endif
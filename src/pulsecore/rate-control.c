@@ -0,0 +1,136 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/macro.h>
+
+#include "rate-control.h"
+
+/* The latency error e (in s) changes with the rate deviation u we
+ * apply and the drift d between the clocks: de/dt = d - u. With
+ * u = KP*e + KI*integral(e) this is a damped oscillator, which is
+ * critically damped for KI = KP^2/4. With KP = 2/s a latency error
+ * decays with a time constant of 1s, which is still slow enough for
+ * the noise of the latency measurements to be inaudible. */
+#define KP 2.0
+#define KI (KP*KP/4)
+
+struct pa_rate_control {
+    double base_rate;
+    pa_usec_t interval;
+    double max_deviation;
+
+    /* Minimum latency seen since window_start */
+    pa_bool_t in_window;
+    pa_usec_t window_start;
+    pa_usec_t window_min;
+
+    double integral;
+    double deviation;
+};
+
+pa_rate_control* pa_rate_control_new(uint32_t base_rate, pa_usec_t interval, double max_deviation) {
+    pa_rate_control *c;
+
+    pa_assert(base_rate > 0);
+    pa_assert(interval > 0);
+    pa_assert(max_deviation > 0 && max_deviation < 1);
+
+    c = pa_xnew0(pa_rate_control, 1);
+    c->base_rate = (double) base_rate;
+    c->interval = interval;
+    c->max_deviation = max_deviation;
+
+    return c;
+}
+
+void pa_rate_control_free(pa_rate_control *c) {
+    pa_assert(c);
+
+    pa_xfree(c);
+}
+
+void pa_rate_control_reset(pa_rate_control *c) {
+    pa_assert(c);
+
+    c->in_window = FALSE;
+    c->integral = 0;
+    c->deviation = 0;
+}
+
+pa_bool_t pa_rate_control_update(pa_rate_control *c, pa_usec_t now, pa_usec_t latency, pa_usec_t target, double *rate) {
+    double error, dt, integral, u;
+
+    pa_assert(c);
+    pa_assert(rate);
+
+    if (!c->in_window) {
+        c->in_window = TRUE;
+        c->window_start = now;
+        c->window_min = latency;
+        return FALSE;
+    }
+
+    /* The minimum filters out the jitter caused by block-wise
+     * transfers, it is what the buffer can be trimmed to */
+    if (latency < c->window_min)
+        c->window_min = latency;
+
+    if (now < c->window_start + c->interval)
+        return FALSE;
+
+    error = ((double) c->window_min - (double) target) / PA_USEC_PER_SEC;
+    dt = (double) (now - c->window_start) / PA_USEC_PER_SEC;
+
+    integral = c->integral + KI * error * dt;
+    u = KP * error + integral;
+
+    /* Clamp, and don't wind up the integral any further while we are
+     * saturated, so that we don't overshoot when we come back */
+    if (u > c->max_deviation) {
+        u = c->max_deviation;
+        if (integral < c->integral)
+            c->integral = integral;
+    } else if (u < -c->max_deviation) {
+        u = -c->max_deviation;
+        if (integral > c->integral)
+            c->integral = integral;
+    } else
+        c->integral = integral;
+
+    c->deviation = u;
+
+    c->window_start = now;
+    c->window_min = latency;
+
+    *rate = c->base_rate * (1.0 + u);
+    return TRUE;
+}
+
+double pa_rate_control_get_rate(pa_rate_control *c) {
+    pa_assert(c);
+
+    return c->base_rate * (1.0 + c->deviation);
+}
@@ -0,0 +1,51 @@
+#ifndef foopulseratecontrolhfoo
+#define foopulseratecontrolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulsecore/macro.h>
+
+/* Compensates the clock drift between two devices by varying the
+ * input rate of a resampler. Feed it the latency between the two
+ * devices as often as convenient, usually once for each block
+ * rendered, and it will return a new, possibly fractional, rate once
+ * every interval. The rate is derived from the minimum latency seen
+ * in the last interval by a PI controller, so that it converges to
+ * zero latency error even with a constant drift. Not thread safe,
+ * it's meant to be used from a single IO thread. */
+
+typedef struct pa_rate_control pa_rate_control;
+
+/* max_deviation is the maximum relative deviation from base_rate we
+ * may apply, e.g. 0.01 for 1% */
+pa_rate_control* pa_rate_control_new(uint32_t base_rate, pa_usec_t interval, double max_deviation);
+void pa_rate_control_free(pa_rate_control *c);
+
+/* Returns TRUE and stores the new rate in *rate if it should be
+ * applied now */
+pa_bool_t pa_rate_control_update(pa_rate_control *c, pa_usec_t now, pa_usec_t latency, pa_usec_t target, double *rate);
+
+/* Forget all history, e.g. after a discontinuity */
+void pa_rate_control_reset(pa_rate_control *c);
+
+double pa_rate_control_get_rate(pa_rate_control *c);
+
+#endif
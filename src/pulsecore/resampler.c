@@ -45,12 +45,21 @@
 /* Number of samples of extra space we allow the resamplers to return */
 #define EXTRA_FRAMES 128
 
+/* Resolution of fractional input rates, in 1/x Hz */
+#define RATE_FRAC_SCALE 100
+
 struct pa_resampler {
     pa_resample_method_t method;
     pa_resample_flags_t flags;
 
     pa_sample_spec i_ss, o_ss;
     pa_channel_map i_cm, o_cm;
+
+    /* The exact input rate, which might have a fractional part. In
+     * i_rate_frac we store it in units of 1/RATE_FRAC_SCALE Hz, which
+     * is what we compare, and in i_ss.rate the rounded value. */
+    double i_rate;
+    uint32_t i_rate_frac;
     size_t i_fz, o_fz, w_sz;
     pa_mempool *mempool;
 
@@ -211,6 +220,8 @@ pa_resampler* pa_resampler_new(
     /* Fill sample specs */
     r->i_ss = *a;
     r->o_ss = *b;
+    r->i_rate = (double) a->rate;
+    r->i_rate_frac = a->rate * RATE_FRAC_SCALE;
 
     /* set up the remap structure */
     r->remap.i_ss = &r->i_ss;
@@ -326,10 +337,31 @@ void pa_resampler_set_input_rate(pa_resampler *r, uint32_t rate) {
     pa_assert(r);
     pa_assert(rate > 0);
 
-    if (r->i_ss.rate == rate)
+    if (r->i_rate_frac == rate * RATE_FRAC_SCALE)
         return;
 
     r->i_ss.rate = rate;
+    r->i_rate = (double) rate;
+    r->i_rate_frac = rate * RATE_FRAC_SCALE;
+
+    r->impl_update_rates(r);
+}
+
+void pa_resampler_set_input_rate_fine(pa_resampler *r, double rate) {
+    uint32_t frac;
+
+    pa_assert(r);
+    pa_assert(rate >= 1.0);
+
+    /* Changes below the resolution are not worth a rate update */
+    frac = (uint32_t) (rate * RATE_FRAC_SCALE + 0.5);
+
+    if (r->i_rate_frac == frac)
+        return;
+
+    r->i_ss.rate = (uint32_t) (rate + 0.5);
+    r->i_rate = rate;
+    r->i_rate_frac = frac;
 
     r->impl_update_rates(r);
 }
@@ -1238,7 +1270,7 @@ static void libsamplerate_resample(pa_resampler *r, const pa_memchunk *input, un
 static void libsamplerate_update_rates(pa_resampler *r) {
     pa_assert(r);
 
-    pa_assert_se(src_set_ratio(r->src.state, (double) r->o_ss.rate / r->i_ss.rate) == 0);
+    pa_assert_se(src_set_ratio(r->src.state, (double) r->o_ss.rate / r->i_rate) == 0);
 }
 
 static void libsamplerate_reset(pa_resampler *r) {
@@ -1318,7 +1350,17 @@ static void speex_resample_int(pa_resampler *r, const pa_memchunk *input, unsign
 static void speex_update_rates(pa_resampler *r) {
     pa_assert(r);
 
-    pa_assert_se(speex_resampler_set_rate(r->speex.state, r->i_ss.rate, r->o_ss.rate) == 0);
+    if (r->i_rate_frac == r->i_ss.rate * RATE_FRAC_SCALE) {
+        pa_assert_se(speex_resampler_set_rate(r->speex.state, r->i_ss.rate, r->o_ss.rate) == 0);
+        return;
+    }
+
+    /* Speex takes the ratio as a fraction, so pass the input rate in
+     * units of 1/RATE_FRAC_SCALE Hz */
+    pa_assert_se(speex_resampler_set_rate_frac(r->speex.state,
+                                               (spx_uint32_t) r->i_rate_frac,
+                                               (spx_uint32_t) r->o_ss.rate * RATE_FRAC_SCALE,
+                                               r->i_ss.rate, r->o_ss.rate) == 0);
 }
 
 static void speex_reset(pa_resampler *r) {
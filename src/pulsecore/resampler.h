@@ -81,6 +81,12 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out);
 /* Change the input rate of the resampler object */
 void pa_resampler_set_input_rate(pa_resampler *r, uint32_t rate);
 
+/* Change the input rate of the resampler object to a possibly
+ * fractional value. Only the speex and libsamplerate backends make
+ * use of the fractional part, the others round to the nearest
+ * integer rate. */
+void pa_resampler_set_input_rate_fine(pa_resampler *r, double rate);
+
 /* Change the output rate of the resampler object */
 void pa_resampler_set_output_rate(pa_resampler *r, uint32_t rate);
 
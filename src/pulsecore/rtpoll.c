@@ -65,6 +65,9 @@ struct pa_rtpoll {
     pa_bool_t quit:1;
     pa_bool_t timer_elapsed:1;
 
+    /* Only with the virtual clock */
+    pa_rtclock_participant *participant;
+
 #ifdef DEBUG_TIMING
     pa_usec_t timestamp;
     pa_usec_t slept, awake;
@@ -101,6 +104,9 @@ pa_rtpoll *pa_rtpoll_new(void) {
     p->pollfd = pa_xnew(struct pollfd, p->n_pollfd_alloc);
     p->pollfd2 = pa_xnew(struct pollfd, p->n_pollfd_alloc);
 
+    if (pa_rtclock_is_virtual())
+        p->participant = pa_rtclock_participant_new();
+
 #ifdef DEBUG_TIMING
     p->timestamp = pa_rtclock_now();
 #endif
@@ -179,6 +185,9 @@ void pa_rtpoll_free(pa_rtpoll *p) {
     pa_xfree(p->pollfd);
     pa_xfree(p->pollfd2);
 
+    if (p->participant)
+        pa_rtclock_participant_free(p->participant);
+
     pa_xfree(p);
 }
 
@@ -209,14 +218,80 @@ static void reset_all_revents(pa_rtpoll *p) {
     }
 }
 
-int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
+/* timeout == NULL means sleeping until an event happens */
+static int rtpoll_poll(pa_rtpoll *p, const struct timeval *timeout) {
+#ifdef HAVE_PPOLL
+    struct timespec ts;
+
+    if (timeout) {
+        ts.tv_sec = timeout->tv_sec;
+        ts.tv_nsec = timeout->tv_usec * 1000;
+    }
+
+    return ppoll(p->pollfd, p->n_pollfd_used, timeout ? &ts : NULL, NULL);
+#else
+    return poll(p->pollfd, p->n_pollfd_used, timeout ? (int) ((timeout->tv_sec*1000) + (timeout->tv_usec / 1000)) : -1);
+#endif
+}
+
+/* With the virtual clock we don't sleep until the timer elapses.
+ * Instead we wait for events in short real time slices. Once a slice
+ * passed without any event we are idle, and the clock may skip ahead
+ * to our deadline. */
+static int rtpoll_poll_virtual(pa_rtpoll *p) {
+    struct timeval slice;
+    pa_usec_t deadline;
+    int r;
+
+    deadline = p->timer_enabled ? pa_timeval_load(&p->next_elapse) : PA_USEC_INVALID;
+    pa_timeval_store(&slice, PA_RTCLOCK_VIRTUAL_SLICE_USEC);
+
+    for (;;) {
+        if ((r = rtpoll_poll(p, &slice)) != 0)
+            break;
+
+        if (pa_rtclock_participant_idle(p->participant, deadline) >= deadline)
+            break;
+    }
+
+    pa_rtclock_participant_busy(p->participant);
+
+    return r;
+}
+
+static int rtpoll_finish(pa_rtpoll *p, int r) {
+    pa_rtpoll_item *i;
+
+    pa_assert(p);
+
+    p->running = FALSE;
+
+    if (p->scan_for_dead) {
+        pa_rtpoll_item *n;
+
+        p->scan_for_dead = FALSE;
+
+        for (i = p->items; i; i = n) {
+            n = i->next;
+
+            if (i->dead)
+                rtpoll_item_destroy(i);
+        }
+    }
+
+    return r < 0 ? r : !p->quit;
+}
+
+int pa_rtpoll_before_poll(pa_rtpoll *p, pa_bool_t *do_poll) {
     pa_rtpoll_item *i;
     int r = 0;
-    struct timeval timeout;
 
     pa_assert(p);
+    pa_assert(do_poll);
     pa_assert(!p->running);
 
+    *do_poll = FALSE;
+
     p->running = TRUE;
     p->timer_elapsed = FALSE;
 
@@ -276,6 +351,57 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     if (p->rebuild_needed)
         rtpoll_rebuild(p);
 
+    *do_poll = TRUE;
+    return 1;
+
+finish:
+    return rtpoll_finish(p, r);
+}
+
+int pa_rtpoll_after_poll(pa_rtpoll *p, int r) {
+    pa_rtpoll_item *i;
+
+    pa_assert(p);
+    pa_assert(p->running);
+
+    p->timer_elapsed = r == 0;
+
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            r = 0;
+        else
+            pa_log_error("poll(): %s", pa_cstrerror(errno));
+
+        reset_all_revents(p);
+    }
+
+    /* Let's tell everyone that we left the sleep */
+    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
+
+        if (i->dead)
+            continue;
+
+        if (!i->after_cb)
+            continue;
+
+        i->after_cb(i);
+    }
+
+    return rtpoll_finish(p, r);
+}
+
+int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
+    pa_bool_t do_poll;
+    int r;
+    struct timeval timeout;
+
+    pa_assert(p);
+
+    r = pa_rtpoll_before_poll(p, &do_poll);
+
+    if (!do_poll)
+        return r;
+
     pa_zero(timeout);
 
     /* Calculate timeout */
@@ -296,18 +422,10 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
 #endif
 
     /* OK, now let's sleep */
-#ifdef HAVE_PPOLL
-    {
-        struct timespec ts;
-        ts.tv_sec = timeout.tv_sec;
-        ts.tv_nsec = timeout.tv_usec * 1000;
-        r = ppoll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? &ts : NULL, NULL);
-    }
-#else
-    r = poll(p->pollfd, p->n_pollfd_used, (!wait_op || p->quit || p->timer_enabled) ? (int) ((timeout.tv_sec*1000) + (timeout.tv_usec / 1000)) : -1);
-#endif
-
-    p->timer_elapsed = r == 0;
+    if (p->participant && wait_op && !p->quit && (!p->timer_enabled || timeout.tv_sec > 0 || timeout.tv_usec > 0))
+        r = rtpoll_poll_virtual(p);
+    else
+        r = rtpoll_poll(p, (!wait_op || p->quit || p->timer_enabled) ? &timeout : NULL);
 
 #ifdef DEBUG_TIMING
     {
@@ -321,45 +439,28 @@ int pa_rtpoll_run(pa_rtpoll *p, pa_bool_t wait_op) {
     }
 #endif
 
-    if (r < 0) {
-        if (errno == EAGAIN || errno == EINTR)
-            r = 0;
-        else
-            pa_log_error("poll(): %s", pa_cstrerror(errno));
-
-        reset_all_revents(p);
-    }
-
-    /* Let's tell everyone that we left the sleep */
-    for (i = p->items; i && i->priority < PA_RTPOLL_NEVER; i = i->next) {
-
-        if (i->dead)
-            continue;
-
-        if (!i->after_cb)
-            continue;
-
-        i->after_cb(i);
-    }
-
-finish:
+    return pa_rtpoll_after_poll(p, r);
+}
 
-    p->running = FALSE;
+struct pollfd *pa_rtpoll_get_pollfd(pa_rtpoll *p, unsigned *n_fds) {
+    pa_assert(p);
+    pa_assert(p->running);
+    pa_assert(n_fds);
 
-    if (p->scan_for_dead) {
-        pa_rtpoll_item *n;
+    *n_fds = p->n_pollfd_used;
+    return p->pollfd;
+}
 
-        p->scan_for_dead = FALSE;
+pa_usec_t pa_rtpoll_get_next_elapse(pa_rtpoll *p) {
+    pa_assert(p);
 
-        for (i = p->items; i; i = n) {
-            n = i->next;
+    if (p->quit)
+        return 0;
 
-            if (i->dead)
-                rtpoll_item_destroy(i);
-        }
-    }
+    if (!p->timer_enabled)
+        return PA_USEC_INVALID;
 
-    return r < 0 ? r : !p->quit;
+    return pa_timeval_load(&p->next_elapse);
 }
 
 void pa_rtpoll_set_timer_absolute(pa_rtpoll *p, pa_usec_t usec) {
@@ -69,6 +69,25 @@ void pa_rtpoll_free(pa_rtpoll *p);
  * cleanly. */
 int pa_rtpoll_run(pa_rtpoll *f, pa_bool_t wait);
 
+/* pa_rtpoll_run() split in two, for running the loop from a thread
+ * that polls on more than one rtpoll at a time. If *do_poll is FALSE
+ * on return the iteration is already complete and the return value
+ * is as for pa_rtpoll_run(). Otherwise the caller shall poll() on the
+ * fds returned by pa_rtpoll_get_pollfd() until the time returned by
+ * pa_rtpoll_get_next_elapse() and then pass the number of fds with
+ * events (or 0 on timeout, or negative with errno set on failure) to
+ * pa_rtpoll_after_poll(). */
+int pa_rtpoll_before_poll(pa_rtpoll *p, pa_bool_t *do_poll);
+int pa_rtpoll_after_poll(pa_rtpoll *p, int r);
+
+/* Only valid between pa_rtpoll_before_poll() and
+ * pa_rtpoll_after_poll(). Don't save the pointer anywhere. */
+struct pollfd *pa_rtpoll_get_pollfd(pa_rtpoll *p, unsigned *n_fds);
+
+/* Returns 0 if the loop shall not sleep, PA_USEC_INVALID if no timer
+ * is set */
+pa_usec_t pa_rtpoll_get_next_elapse(pa_rtpoll *p);
+
 void pa_rtpoll_set_timer_absolute(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_relative(pa_rtpoll *p, pa_usec_t usec);
 void pa_rtpoll_set_timer_disabled(pa_rtpoll *p);
@@ -39,6 +39,10 @@
 #include <sys/mman.h>
 #endif
 
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
 /* This is deprecated on glibc but is still used by FreeBSD */
 #if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
 # define MAP_ANONYMOUS MAP_ANON
@@ -60,6 +64,31 @@
 #define MADV_REMOVE 9
 #endif
 
+#if defined(__linux__) && defined(__NR_memfd_create) && defined(HAVE_SHM_OPEN)
+/* On Linux we can create anonymous segments that are not visible in
+ * the file system and may only be shared by passing the fd along */
+#define HAVE_MEMFD 1
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#endif
+#ifndef F_SEAL_SEAL
+#define F_SEAL_SEAL 0x0001
+#endif
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#endif
+#ifndef F_SEAL_GROW
+#define F_SEAL_GROW 0x0004
+#endif
+#endif
+
 /* 1 GiB at max */
 #define MAX_SHM_SIZE (PA_ALIGN(1024*1024*1024))
 
@@ -95,6 +124,70 @@ static char *segment_name(char *fn, size_t l, unsigned id) {
     return fn;
 }
 
+#ifdef HAVE_SHM_OPEN
+/* Creates an anonymous segment that is only reachable through the fd
+ * kept in m->fd. Segments that are shared with less trusted peers are
+ * sealed, so that the size may not change under their feet. */
+static int create_memfd(pa_shm *m, size_t size, pa_bool_t named_fallback) {
+    int fd = -1;
+
+    pa_assert(m);
+    pa_assert(size > 0);
+
+    pa_random(&m->id, sizeof(m->id));
+
+#ifdef HAVE_MEMFD
+    if ((fd = (int) syscall(__NR_memfd_create, "pulseaudio", MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0 && errno != ENOSYS)
+        pa_log("memfd_create() failed: %s", pa_cstrerror(errno));
+#endif
+
+    if (fd < 0) {
+        char fn[32];
+
+        if (!named_fallback)
+            return -1;
+
+        /* Without memfd we create a named segment and unlink it
+         * right-away, which has the same effect, minus the seals. */
+        segment_name(fn, sizeof(fn), m->id);
+
+        if ((fd = shm_open(fn, O_RDWR|O_CREAT|O_EXCL, 0600)) < 0) {
+            pa_log("shm_open() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
+
+        shm_unlink(fn);
+        pa_make_fd_cloexec(fd);
+    }
+
+    m->size = size;
+
+    if (ftruncate(fd, (off_t) m->size) < 0) {
+        pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+#ifdef HAVE_MEMFD
+    /* This fails for the shm_open() fallback, which is OK */
+    (void) fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL);
+#endif
+
+    if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    m->fd = fd;
+    m->do_unlink = FALSE;
+
+    return 0;
+
+fail:
+    pa_close(fd);
+    return -1;
+}
+#endif
+
 int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
     char fn[32];
     int fd = -1;
@@ -104,9 +197,7 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
     pa_assert(size <= MAX_SHM_SIZE);
     pa_assert(mode >= 0600);
 
-    /* Each time we create a new SHM area, let's first drop all stale
-     * ones */
-    pa_shm_cleanup();
+    m->fd = -1;
 
     /* Round up to make it page aligned */
     size = PA_PAGE_ALIGN(size);
@@ -139,6 +230,16 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
 #ifdef HAVE_SHM_OPEN
         struct shm_marker *marker;
 
+        /* Anonymous segments cannot go stale, so try those first */
+        if (create_memfd(m, size, FALSE) >= 0) {
+            m->shared = TRUE;
+            return 0;
+        }
+
+        /* Each time we create a new named SHM area, let's first drop
+         * all stale ones */
+        pa_shm_cleanup();
+
         pa_random(&m->id, sizeof(m->id));
         segment_name(fn, sizeof(fn), m->id);
 
@@ -211,6 +312,9 @@ void pa_shm_free(pa_shm *m) {
         if (munmap(m->ptr, PA_PAGE_ALIGN(m->size)) < 0)
             pa_log("munmap() failed: %s", pa_cstrerror(errno));
 
+        if (m->fd >= 0)
+            pa_close(m->fd);
+
         if (m->do_unlink) {
             char fn[32];
 
@@ -226,6 +330,7 @@ void pa_shm_free(pa_shm *m) {
     }
 
     pa_zero(*m);
+    m->fd = -1;
 }
 
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
@@ -283,6 +388,7 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
 
     pa_assert(m);
 
+    m->fd = -1;
     segment_name(fn, sizeof(fn), m->id = id);
 
     if ((fd = shm_open(fn, O_RDONLY, 0)) < 0) {
@@ -324,12 +430,86 @@ fail:
     return -1;
 }
 
+int pa_shm_create_rw_fd(pa_shm *m, size_t size, int *ret_fd) {
+    pa_assert(m);
+    pa_assert(ret_fd);
+    pa_assert(size > 0);
+    pa_assert(size <= MAX_SHM_SIZE);
+
+    if (create_memfd(m, PA_PAGE_ALIGN(size), TRUE) < 0)
+        return -1;
+
+    m->shared = TRUE;
+    *ret_fd = m->fd;
+
+    return 0;
+}
+
+int pa_shm_attach_fd(pa_shm *m, int fd, pa_bool_t writable) {
+    struct stat st;
+
+    pa_assert(m);
+    pa_assert(fd >= 0);
+
+    if (fstat(fd, &st) < 0) {
+        pa_log("fstat() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (st.st_size <= 0 ||
+        st.st_size > (off_t) MAX_SHM_SIZE ||
+        PA_ALIGN((size_t) st.st_size) != (size_t) st.st_size) {
+        pa_log("Invalid shared memory segment size");
+        return -1;
+    }
+
+    m->id = 0;
+    m->size = (size_t) st.st_size;
+
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    m->fd = fd;
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+
+    return 0;
+}
+
+int pa_shm_get_fd_identity(int fd, char *buf, size_t l) {
+    struct stat st;
+
+    pa_assert(fd >= 0);
+    pa_assert(buf);
+    pa_assert(l > 0);
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    pa_snprintf(buf, l, "%llu:%llu", (unsigned long long) st.st_dev, (unsigned long long) st.st_ino);
+    return 0;
+}
+
 #else /* HAVE_SHM_OPEN */
 
 int pa_shm_attach_ro(pa_shm *m, unsigned id) {
     return -1;
 }
 
+int pa_shm_create_rw_fd(pa_shm *m, size_t size, int *ret_fd) {
+    return -1;
+}
+
+int pa_shm_attach_fd(pa_shm *m, int fd, pa_bool_t writable) {
+    return -1;
+}
+
+int pa_shm_get_fd_identity(int fd, char *buf, size_t l) {
+    return -1;
+}
+
 #endif /* HAVE_SHM_OPEN */
 
 int pa_shm_cleanup(void) {
@@ -30,13 +30,29 @@ typedef struct pa_shm {
     unsigned id;
     void *ptr;
     size_t size;
+    int fd; /* Only set for anonymous segments, -1 otherwise */
     pa_bool_t do_unlink:1;
     pa_bool_t shared:1;
 } pa_shm;
 
+/* Shared segments are created anonymously (memfd) if the system
+ * supports it. These cannot be attached by id, the fd stored in
+ * m->fd needs to be passed to the other side instead. */
 int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode);
 int pa_shm_attach_ro(pa_shm *m, unsigned id);
 
+/* Create an anonymous shared segment that may only be accessed
+ * through the returned fd, i.e. by passing it to another process. The
+ * fd stays owned by the segment. */
+int pa_shm_create_rw_fd(pa_shm *m, size_t size, int *fd);
+
+/* Map the segment behind fd. On success the segment owns the fd. */
+int pa_shm_attach_fd(pa_shm *m, int fd, pa_bool_t writable);
+
+/* Writes a string to buf that identifies the file behind fd, so that
+ * segments received more than once may be recognized. */
+int pa_shm_get_fd_identity(int fd, char *buf, size_t l);
+
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
 void pa_shm_free(pa_shm *m);
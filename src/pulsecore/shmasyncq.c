@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -33,7 +34,7 @@
 #include <pulsecore/core-util.h>
 #include <pulse/xmalloc.h>
 
-#include "fdsem.h"
+#include "shmasyncq.h"
 
 /* For debugging purposes we can define _Y to put and extra thread
  * yield between each operation. */
@@ -46,28 +47,38 @@
 #define _Y do { } while(0)
 #endif
 
+/* Upper limit for queues we are asked to open */
+#define N_ELEMENTS_MAX 4096
+#define ELEMENT_SIZE_MAX (1024*1024)
 
 struct pa_shmasyncq {
     pa_fdsem *read_fdsem, *write_fdsem;
     pa_shmasyncq_data *data;
+
+    /* Private copies of the header, so that the other side cannot
+     * make us access memory outside of the segment */
+    unsigned n_elements;
+    size_t element_size;
+
+    unsigned read_idx, write_idx;
 };
 
-static int is_power_of_two(unsigned size) {
+static pa_bool_t is_power_of_two(unsigned size) {
     return !(size & (size - 1));
 }
 
-static int reduce(pa_shmasyncq *l, int value) {
-    return value & (unsigned) (l->n_elements - 1);
+static unsigned reduce(pa_shmasyncq *l, unsigned value) {
+    return value & (l->n_elements - 1);
 }
 
 static pa_atomic_t* get_cell(pa_shmasyncq *l, unsigned i) {
-    pa_assert(i < l->data->n_elements);
+    pa_assert(i < l->n_elements);
 
-    return (pa_atomic_t*) ((uint8*t) l->data + PA_ALIGN(sizeof(pa_shmasyncq_data)) + i * (PA_ALIGN(sizeof(pa_atomic_t)) + PA_ALIGN(element_size)))
+    return (pa_atomic_t*) ((uint8_t*) l->data + PA_ALIGN(sizeof(pa_shmasyncq_data)) + i * PA_SHMASYNCQ_CELL_SIZE(l->element_size));
 }
 
 static void *get_cell_data(pa_atomic_t *a) {
-    return (uint8_t*) a + PA_ALIGN(sizeof(atomic_t));
+    return (uint8_t*) a + PA_ALIGN(sizeof(pa_atomic_t));
 }
 
 pa_shmasyncq *pa_shmasyncq_new(unsigned n_elements, size_t element_size, void *data, int fd[2]) {
@@ -79,20 +90,22 @@ pa_shmasyncq *pa_shmasyncq_new(unsigned n_elements, size_t element_size, void *d
     pa_assert(data);
     pa_assert(fd);
 
-    l = pa_xnew(pa_shmasyncq, 1);
+    memset(data, 0, PA_SHMASYNCQ_SIZE(n_elements, element_size));
 
+    l = pa_xnew0(pa_shmasyncq, 1);
     l->data = data;
-    memset(data, 0, PA_SHMASYNCQ_SIZE(n_elements, element_size));
+    l->n_elements = n_elements;
+    l->element_size = element_size;
 
-    l->data->n_elements = n_elements;
-    l->data->element_size = element_size;
+    l->data->n_elements = (uint32_t) n_elements;
+    l->data->element_size = (uint32_t) element_size;
 
-    if (!(l->read_fdsem = pa_fdsem_new_shm(&d->read_fdsem_data, &fd[0]))) {
+    if (!(l->read_fdsem = pa_fdsem_new_shm(&l->data->read_fdsem_data, &fd[0]))) {
         pa_xfree(l);
         return NULL;
     }
 
-    if (!(l->write_fdsem = pa_fdsem_new(&d->write_fdsem_data, &fd[1]))) {
+    if (!(l->write_fdsem = pa_fdsem_new_shm(&l->data->write_fdsem_data, &fd[1]))) {
         pa_fdsem_free(l->read_fdsem);
         pa_xfree(l);
         return NULL;
@@ -101,120 +114,208 @@ pa_shmasyncq *pa_shmasyncq_new(unsigned n_elements, size_t element_size, void *d
     return l;
 }
 
-void pa_shmasyncq_free(pa_shmasyncq *l, pa_free_cb_t free_cb) {
-    pa_assert(l);
+pa_shmasyncq *pa_shmasyncq_open(void *data, size_t size, int fd[2]) {
+    pa_shmasyncq *l;
+    pa_shmasyncq_data *d = data;
+    unsigned n_elements;
+    size_t element_size;
+
+    pa_assert(data);
+    pa_assert(fd);
+    pa_assert(fd[0] >= 0);
+    pa_assert(fd[1] >= 0);
 
-    if (free_cb) {
-        void *p;
+    if (size < PA_ALIGN(sizeof(pa_shmasyncq_data)))
+        goto fail;
 
-        while ((p = pa_shmasyncq_pop(l, 0)))
-            free_cb(p);
+    n_elements = d->n_elements;
+    element_size = d->element_size;
+
+    if (n_elements <= 0 || n_elements > N_ELEMENTS_MAX || !is_power_of_two(n_elements) ||
+        element_size <= 0 || element_size > ELEMENT_SIZE_MAX ||
+        PA_SHMASYNCQ_SIZE(n_elements, element_size) > size) {
+        pa_log_warn("Invalid shared queue header.");
+        goto fail;
+    }
+
+    l = pa_xnew0(pa_shmasyncq, 1);
+    l->data = d;
+    l->n_elements = n_elements;
+    l->element_size = element_size;
+
+    if (!(l->read_fdsem = pa_fdsem_open_shm(&d->read_fdsem_data, fd[0]))) {
+        pa_xfree(l);
+        goto fail;
+    }
+
+    if (!(l->write_fdsem = pa_fdsem_open_shm(&d->write_fdsem_data, fd[1]))) {
+        pa_fdsem_free(l->read_fdsem);
+        pa_xfree(l);
+        pa_close(fd[1]);
+        return NULL;
     }
 
+    return l;
+
+fail:
+    pa_close(fd[0]);
+    pa_close(fd[1]);
+    return NULL;
+}
+
+void pa_shmasyncq_free(pa_shmasyncq *l) {
+    pa_assert(l);
+
     pa_fdsem_free(l->read_fdsem);
     pa_fdsem_free(l->write_fdsem);
     pa_xfree(l);
 }
 
-int pa_shmasyncq_push(pa_shmasyncq*l, void *p, int wait) {
-    int idx;
-    pa_atomic_ptr_t *cells;
+unsigned pa_shmasyncq_get_n_elements(pa_shmasyncq *l) {
+    pa_assert(l);
+
+    return l->n_elements;
+}
 
+size_t pa_shmasyncq_get_element_size(pa_shmasyncq *l) {
     pa_assert(l);
-    pa_assert(p);
 
-    cells = PA_SHMASYNCQ_CELLS(l);
+    return l->element_size;
+}
+
+void* pa_shmasyncq_push_begin(pa_shmasyncq *l, pa_bool_t wait_op) {
+    pa_atomic_t *cell;
+
+    pa_assert(l);
 
     _Y;
-    idx = reduce(l, l->write_idx);
+    cell = get_cell(l, reduce(l, l->write_idx));
 
-    if (!pa_atomic_ptr_cmpxchg(&cells[idx], NULL, p)) {
+    if (pa_atomic_load(cell)) {
 
-        if (!wait)
-            return -1;
+        if (!wait_op)
+            return NULL;
 
 /*         pa_log("sleeping on push"); */
 
         do {
             pa_fdsem_wait(l->read_fdsem);
-        } while (!pa_atomic_ptr_cmpxchg(&cells[idx], NULL, p));
+        } while (pa_atomic_load(cell));
     }
 
+    return get_cell_data(cell);
+}
+
+void pa_shmasyncq_push_commit(pa_shmasyncq *l) {
+    pa_atomic_t *cell;
+
+    pa_assert(l);
+
+    cell = get_cell(l, reduce(l, l->write_idx));
+
+    /* Guaranteed to succeed if we only have a single writer */
+    pa_assert_se(pa_atomic_cmpxchg(cell, 0, 1));
+
     _Y;
     l->write_idx++;
 
     pa_fdsem_post(l->write_fdsem);
-
-    return 0;
 }
 
-void* pa_shmasyncq_pop(pa_shmasyncq*l, int wait) {
-    int idx;
-    void *ret;
-    pa_atomic_ptr_t *cells;
+void* pa_shmasyncq_pop_begin(pa_shmasyncq *l, pa_bool_t wait_op) {
+    pa_atomic_t *cell;
 
     pa_assert(l);
 
-    cells = PA_SHMASYNCQ_CELLS(l);
-
     _Y;
-    idx = reduce(l, l->read_idx);
+    cell = get_cell(l, reduce(l, l->read_idx));
 
-    if (!(ret = pa_atomic_ptr_load(&cells[idx]))) {
+    if (!pa_atomic_load(cell)) {
 
-        if (!wait)
+        if (!wait_op)
             return NULL;
 
 /*         pa_log("sleeping on pop"); */
 
         do {
             pa_fdsem_wait(l->write_fdsem);
-        } while (!(ret = pa_atomic_ptr_load(&cells[idx])));
+        } while (!pa_atomic_load(cell));
     }
 
-    pa_assert(ret);
+    return get_cell_data(cell);
+}
+
+void pa_shmasyncq_pop_commit(pa_shmasyncq *l) {
+    pa_atomic_t *cell;
 
-    /* Guaranteed to succeed if we only have a single reader */
-    pa_assert_se(pa_atomic_ptr_cmpxchg(&cells[idx], ret, NULL));
+    pa_assert(l);
+
+    cell = get_cell(l, reduce(l, l->read_idx));
+
+    /* We don't assert here: the cell flag lives in memory the other
+     * side can write to, so we don't trust it. */
+    pa_atomic_store(cell, 0);
 
     _Y;
     l->read_idx++;
 
     pa_fdsem_post(l->read_fdsem);
-
-    return ret;
 }
 
-int pa_shmasyncq_get_fd(pa_shmasyncq *q) {
+int pa_shmasyncq_read_fd(pa_shmasyncq *q) {
     pa_assert(q);
 
     return pa_fdsem_get(q->write_fdsem);
 }
 
-int pa_shmasyncq_before_poll(pa_shmasyncq *l) {
-    int idx;
-    pa_atomic_ptr_t *cells;
+int pa_shmasyncq_read_before_poll(pa_shmasyncq *l) {
+    pa_atomic_t *cell;
 
     pa_assert(l);
 
-    cells = PA_SHMASYNCQ_CELLS(l);
-
     _Y;
-    idx = reduce(l, l->read_idx);
+    cell = get_cell(l, reduce(l, l->read_idx));
 
     for (;;) {
-        if (pa_atomic_ptr_load(&cells[idx]))
+        if (pa_atomic_load(cell))
             return -1;
 
         if (pa_fdsem_before_poll(l->write_fdsem) >= 0)
             return 0;
     }
-
-    return 0;
 }
 
-void pa_shmasyncq_after_poll(pa_shmasyncq *l) {
+void pa_shmasyncq_read_after_poll(pa_shmasyncq *l) {
     pa_assert(l);
 
     pa_fdsem_after_poll(l->write_fdsem);
 }
+
+int pa_shmasyncq_write_fd(pa_shmasyncq *q) {
+    pa_assert(q);
+
+    return pa_fdsem_get(q->read_fdsem);
+}
+
+int pa_shmasyncq_write_before_poll(pa_shmasyncq *l) {
+    pa_atomic_t *cell;
+
+    pa_assert(l);
+
+    _Y;
+    cell = get_cell(l, reduce(l, l->write_idx));
+
+    for (;;) {
+        if (!pa_atomic_load(cell))
+            return -1;
+
+        if (pa_fdsem_before_poll(l->read_fdsem) >= 0)
+            return 0;
+    }
+}
+
+void pa_shmasyncq_write_after_poll(pa_shmasyncq *l) {
+    pa_assert(l);
+
+    pa_fdsem_after_poll(l->read_fdsem);
+}
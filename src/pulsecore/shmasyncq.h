@@ -25,36 +25,68 @@
 #include <sys/types.h>
 
 #include <pulse/def.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/fdsem.h>
 #include <pulsecore/macro.h>
 
-/* Similar to pa_asyncq, but stores data in a shared memory segment */
-
-
-struct pa_shmasyncq_data {
-    unsigned n_elements;
-    size_t element_size;
-    unsigned read_idx;
-    unsigned write_idx;
+/* Similar to pa_asyncq, but stores data in a shared memory segment
+ * and hence may be used between two processes. Unlike pa_asyncq the
+ * elements are not pointers but fixed size cells that are filled in
+ * place: the producer calls push_begin() to get a pointer to the
+ * next free cell, writes into it and calls push_commit() to hand it
+ * over. The consumer does the same with pop_begin()/pop_commit().
+ *
+ * There may only be a single producer and a single consumer. Both
+ * sides keep their own private index, only the cell state flags are
+ * shared. Waking up the other side happens through two pa_fdsem
+ * objects that live in the shared segment, too. */
+
+typedef struct pa_shmasyncq_data {
+    uint32_t n_elements;
+    uint32_t element_size;
     pa_fdsem_data read_fdsem_data, write_fdsem_data;
-};
+} pa_shmasyncq_data;
+
+#define PA_SHMASYNCQ_CELL_SIZE(element_size) (PA_ALIGN(sizeof(pa_atomic_t)) + PA_ALIGN(element_size))
+#define PA_SHMASYNCQ_SIZE(n_elements, element_size) (PA_ALIGN(sizeof(pa_shmasyncq_data)) + ((n_elements) * PA_SHMASYNCQ_CELL_SIZE(element_size)))
 
 #define PA_SHMASYNCQ_DEFAULT_N_ELEMENTS 128
-#define PA_SHMASYNCQ_SIZE(n_elements, element_size) (PA_ALIGN(sizeof(pa_shmasyncq_data)) + (((n_elements) * (PA_ALIGN(sizeof(pa_atomic_t)) + PA_ALIGN(element_size)))))
 #define PA_SHMASYNCQ_DEFAULT_SIZE(element_size) PA_SHMASYNCQ_SIZE(PA_SHMASYNCQ_DEFAULT_N_ELEMENTS, element_size)
 
 typedef struct pa_shmasyncq pa_shmasyncq;
 
+/* Initialize a new queue in the memory pointed to by data, which
+ * needs to be at least PA_SHMASYNCQ_SIZE() bytes large. Two event
+ * fds are created which need to be passed to the other side, which
+ * then can use pa_shmasyncq_open() to access the queue. The fds
+ * stay owned by the queue object. */
 pa_shmasyncq *pa_shmasyncq_new(unsigned n_elements, size_t element_size, void *data, int fd[2]);
-void pa_shmasyncq_free(pa_shmasyncq* q, pa_free_cb_t free_cb);
+
+/* Open a queue that has been initialized by the other side. size is
+ * the size of the memory area, which is validated against the
+ * header. The fds are owned by the queue object afterwards, even on
+ * failure. */
+pa_shmasyncq *pa_shmasyncq_open(void *data, size_t size, int fd[2]);
+
+void pa_shmasyncq_free(pa_shmasyncq* q);
+
+unsigned pa_shmasyncq_get_n_elements(pa_shmasyncq *q);
+size_t pa_shmasyncq_get_element_size(pa_shmasyncq *q);
 
 void* pa_shmasyncq_pop_begin(pa_shmasyncq *q, pa_bool_t wait);
 void pa_shmasyncq_pop_commit(pa_shmasyncq *q);
 
-int* pa_shmasyncq_push_begin(pa_shmasyncq *q, pa_bool_t wait);
+void* pa_shmasyncq_push_begin(pa_shmasyncq *q, pa_bool_t wait);
 void pa_shmasyncq_push_commit(pa_shmasyncq *q);
 
-int pa_shmasyncq_get_fd(pa_shmasyncq *q);
-int pa_shmasyncq_before_poll(pa_shmasyncq *a);
-void pa_shmasyncq_after_poll(pa_shmasyncq *a);
+/* Wakeup handling for the consumer: poll on the read fd */
+int pa_shmasyncq_read_fd(pa_shmasyncq *q);
+int pa_shmasyncq_read_before_poll(pa_shmasyncq *q);
+void pa_shmasyncq_read_after_poll(pa_shmasyncq *q);
+
+/* Wakeup handling for the producer: poll on the write fd */
+int pa_shmasyncq_write_fd(pa_shmasyncq *q);
+int pa_shmasyncq_write_before_poll(pa_shmasyncq *q);
+void pa_shmasyncq_write_after_poll(pa_shmasyncq *q);
 
 #endif
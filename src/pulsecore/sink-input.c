@@ -38,6 +38,7 @@
 #include <pulsecore/play-memblockq.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/trace.h>
 
 #include "sink-input.h"
 
@@ -660,8 +661,10 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink frames */, p
 
             pa_memblockq_seek(i->thread_info.render_memblockq, (int64_t) slength, PA_SEEK_RELATIVE, TRUE);
             i->thread_info.playing_for = 0;
-            if (i->thread_info.underrun_for != (uint64_t) -1)
+            if (i->thread_info.underrun_for != (uint64_t) -1) {
                 i->thread_info.underrun_for += ilength;
+                pa_trace(PA_TRACE_UNDERRUN, i->index, slength, i->thread_info.underrun_for);
+            }
             break;
         }
 
@@ -750,6 +753,8 @@ void pa_sink_input_peek(pa_sink_input *i, size_t slength /* in sink frames */, p
     if (chunk->length > block_size_max_sink)
         chunk->length = block_size_max_sink;
 
+    pa_trace(PA_TRACE_PEEK, i->index, slength, chunk->length);
+
     /* Let's see if we had to apply the volume adjustment ourselves,
      * or if this can be done by the sink for us */
 
@@ -1119,6 +1124,19 @@ int pa_sink_input_set_rate(pa_sink_input *i, uint32_t rate) {
     return 0;
 }
 
+/* Called from thread context */
+void pa_sink_input_set_rate_within_thread(pa_sink_input *i, double rate) {
+    pa_sink_input_assert_ref(i);
+    pa_sink_input_assert_io_context(i);
+    pa_assert(rate >= 1.0);
+
+    if (!i->thread_info.resampler)
+        return;
+
+    i->thread_info.sample_spec.rate = (uint32_t) (rate + 0.5);
+    pa_resampler_set_input_rate_fine(i->thread_info.resampler, rate);
+}
+
 /* Called from main context */
 void pa_sink_input_set_name(pa_sink_input *i, const char *name) {
     const char *old;
@@ -377,6 +377,11 @@ int pa_sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int64_t
 
 pa_usec_t pa_sink_input_set_requested_latency_within_thread(pa_sink_input *i, pa_usec_t usec);
 
+/* Like pa_sink_input_set_rate(), but takes fractional rates and
+ * applies them immediately. Does nothing if the input has no
+ * resampler. */
+void pa_sink_input_set_rate_within_thread(pa_sink_input *i, double rate);
+
 pa_bool_t pa_sink_input_safe_to_remove(pa_sink_input *i);
 
 pa_memchunk* pa_sink_input_get_silence(pa_sink_input *i, pa_memchunk *ret);
@@ -43,6 +43,7 @@
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/play-memblockq.h>
+#include <pulsecore/trace.h>
 
 #include "sink.h"
 
@@ -722,8 +723,10 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     if (s->thread_info.state == PA_SINK_SUSPENDED)
         return;
 
-    if (nbytes > 0)
+    if (nbytes > 0) {
         pa_log_debug("Processing rewind...");
+        pa_trace(PA_TRACE_REWIND, s->index, nbytes, 0);
+    }
 
     PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
         pa_sink_input_assert_ref(i);
@@ -877,6 +880,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t block_size_max;
+    pa_usec_t t;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -896,6 +900,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_sink_ref(s);
 
+    t = pa_trace_now();
+
     if (length <= 0)
         length = pa_frame_align(MIX_BUFFER_LENGTH, &s->sample_spec);
 
@@ -954,6 +960,9 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     inputs_drop(s, info, n, result);
 
+    if (t > 0)
+        pa_trace(PA_TRACE_RENDER, s->index, result->length, pa_rtclock_now() - t);
+
     pa_sink_unref(s);
 }
 
@@ -962,6 +971,7 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
     pa_mix_info info[MAX_MIX_CHANNELS];
     unsigned n;
     size_t length, block_size_max;
+    pa_usec_t t;
 
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
@@ -981,6 +991,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_sink_ref(s);
 
+    t = pa_trace_now();
+
     length = target->length;
     block_size_max = pa_mempool_block_size_max(s->core->mempool);
     if (length > block_size_max)
@@ -1039,6 +1051,9 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     inputs_drop(s, info, n, target);
 
+    if (t > 0)
+        pa_trace(PA_TRACE_RENDER, s->index, target->length, pa_rtclock_now() - t);
+
     pa_sink_unref(s);
 }
 
@@ -1162,6 +1177,35 @@ pa_usec_t pa_sink_get_latency_within_thread(pa_sink *s) {
     return usec;
 }
 
+/* Called from IO thread */
+pa_usec_t pa_sink_get_render_ahead_within_thread(pa_sink *s) {
+    pa_sink_input *i;
+    void *state = NULL;
+    pa_usec_t ahead = (pa_usec_t) -1;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    PA_HASHMAP_FOREACH(i, s->thread_info.inputs, state) {
+        pa_usec_t r[2] = { 0, 0 };
+        pa_msgobject *o;
+
+        if (i->thread_info.state != PA_SINK_INPUT_RUNNING)
+            continue;
+
+        o = PA_MSGOBJECT(i);
+
+        /* The inputs report what they have queued as their latency */
+        if (o->process_msg(o, PA_SINK_INPUT_MESSAGE_GET_LATENCY, r, 0, NULL) < 0)
+            return 0;
+
+        if (r[0] < ahead)
+            ahead = r[0];
+    }
+
+    return ahead;
+}
+
 /* Called from main context */
 static void compute_reference_ratios(pa_sink *s) {
     uint32_t idx;
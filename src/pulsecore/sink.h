@@ -349,6 +349,11 @@ void pa_sink_set_max_request_within_thread(pa_sink *s, size_t max_request);
 void pa_sink_set_latency_range_within_thread(pa_sink *s, pa_usec_t min_latency, pa_usec_t max_latency);
 void pa_sink_set_fixed_latency_within_thread(pa_sink *s, pa_usec_t latency);
 
+/* How far ahead the sink may render without letting any of the
+ * running inputs underrun, i.e. the smallest amount of data queued
+ * by any of them. (pa_usec_t) -1 if no input is running. */
+pa_usec_t pa_sink_get_render_ahead_within_thread(pa_sink *s);
+
 /*** To be called exclusively by sink input drivers, from IO context */
 
 void pa_sink_request_rewind(pa_sink*s, size_t nbytes);
@@ -0,0 +1,363 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <pulse/proplist.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/util.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sound-file.h>
+
+#include "sound-file-cache.h"
+
+#define CACHE_DIR "sample-cache"
+#define CACHE_MAGIC "PASMPL1"
+
+/* A cache file consists of this header, the path of the sound file and
+ * the proplist it was loaded with as NUL terminated strings, and the
+ * PCM data starting at the next page boundary. Everything is in host
+ * byte order, which is why the directory is per machine. */
+typedef struct cache_header {
+    char magic[8];
+    uint64_t data_offset;
+    uint64_t data_length;
+    uint64_t file_mtime;
+    uint64_t file_size;
+    uint32_t path_length;
+    uint32_t proplist_length;
+    uint32_t format;
+    uint32_t rate;
+    uint8_t channels;
+    uint8_t map[PA_CHANNELS_MAX];
+} cache_header;
+
+#ifdef HAVE_SYS_MMAN_H
+
+static char *cache_path(const char *fname) {
+    char *dir, *fn, *r;
+
+    if (!(dir = pa_state_path(CACHE_DIR, TRUE)))
+        return NULL;
+
+    if (pa_make_secure_dir(dir, 0700U, (uid_t) -1, (gid_t) -1) < 0) {
+        pa_log_warn("Failed to create sample cache directory %s: %s", dir, pa_cstrerror(errno));
+        pa_xfree(dir);
+        return NULL;
+    }
+
+    /* The hash keeps the name unique, the rest is for humans */
+    fn = pa_path_get_filename(fname);
+    r = pa_sprintf_malloc("%s" PA_PATH_SEP "%08x-%s", dir, pa_idxset_string_hash_func(fname), fn);
+    pa_xfree(dir);
+
+    return r;
+}
+
+static void unmap_cb(void *p) {
+    const cache_header *h = p;
+
+    pa_assert(h);
+
+    pa_assert_se(munmap(p, (size_t) (h->data_offset + h->data_length)) == 0);
+}
+
+static int cache_map(
+        pa_mempool *pool,
+        const char *cpath,
+        const char *fname,
+        const struct stat *st,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    struct stat cst;
+    const cache_header *h;
+    const char *s;
+    pa_sample_spec tss;
+    pa_channel_map tmap;
+    pa_proplist *tp = NULL;
+    void *data;
+    size_t length;
+    unsigned c;
+    int fd;
+
+    if ((fd = open(cpath, O_RDONLY|O_NOCTTY
+#ifdef O_CLOEXEC
+                   |O_CLOEXEC
+#endif
+                   )) < 0)
+        return -1;
+
+    if (fstat(fd, &cst) < 0 || cst.st_size < (off_t) sizeof(cache_header)) {
+        pa_close(fd);
+        return -1;
+    }
+
+    length = (size_t) cst.st_size;
+    data = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    pa_close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    h = data;
+
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->data_offset + h->data_length != length ||
+        h->data_length == 0 ||
+        h->data_offset < sizeof(cache_header) + h->path_length + h->proplist_length ||
+        h->path_length == 0 || h->proplist_length == 0)
+        goto fail;
+
+    /* Is it for this version of the file? */
+    s = (const char*) data + sizeof(cache_header);
+
+    if (s[h->path_length-1] != 0 ||
+        !pa_streq(s, fname) ||
+        h->file_mtime != (uint64_t) st->st_mtime ||
+        h->file_size != (uint64_t) st->st_size)
+        goto fail;
+
+    tss.format = (pa_sample_format_t) h->format;
+    tss.rate = h->rate;
+    tss.channels = h->channels;
+
+    if (!pa_sample_spec_valid(&tss) ||
+        h->data_length % pa_frame_size(&tss) != 0)
+        goto fail;
+
+    pa_channel_map_init(&tmap);
+    tmap.channels = h->channels;
+    for (c = 0; c < h->channels; c++)
+        tmap.map[c] = (pa_channel_position_t) h->map[c];
+
+    if (!pa_channel_map_valid(&tmap))
+        goto fail;
+
+    s += h->path_length;
+
+    if (s[h->proplist_length-1] != 0 ||
+        !(tp = pa_proplist_from_string(s)))
+        goto fail;
+
+    *ss = tss;
+    *map = tmap;
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, tp);
+    pa_proplist_free(tp);
+
+    /* The header stays mapped, unmap_cb() needs it */
+    chunk->memblock = pa_memblock_new_user(pool, data, length, unmap_cb, TRUE);
+    chunk->index = (size_t) h->data_offset;
+    chunk->length = (size_t) h->data_length;
+
+    return 0;
+
+fail:
+    pa_log_debug("Sample cache file %s is stale.", cpath);
+
+    munmap(data, length);
+    return -1;
+}
+
+static int cache_write(
+        const char *cpath,
+        const char *fname,
+        const struct stat *st,
+        const pa_sample_spec *ss,
+        const pa_channel_map *map,
+        const pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    cache_header h;
+    char *t, *pl;
+    static const uint8_t zero[256];
+    size_t l;
+    unsigned c;
+    int fd, r = -1;
+    ssize_t w;
+    void *d;
+
+    t = pa_sprintf_malloc("%s.XXXXXX", cpath);
+
+    if ((fd = mkstemp(t)) < 0) {
+        pa_log_warn("Failed to create sample cache file %s: %s", t, pa_cstrerror(errno));
+        pa_xfree(t);
+        return -1;
+    }
+
+    pl = pa_proplist_to_string(p);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.path_length = (uint32_t) strlen(fname) + 1;
+    h.proplist_length = (uint32_t) strlen(pl) + 1;
+    h.data_offset = PA_PAGE_ALIGN(sizeof(h) + h.path_length + h.proplist_length);
+    h.data_length = chunk->length;
+    h.file_mtime = (uint64_t) st->st_mtime;
+    h.file_size = (uint64_t) st->st_size;
+    h.format = (uint32_t) ss->format;
+    h.rate = ss->rate;
+    h.channels = ss->channels;
+    for (c = 0; c < map->channels; c++)
+        h.map[c] = (uint8_t) map->map[c];
+
+    if (pa_loop_write(fd, &h, sizeof(h), NULL) != (ssize_t) sizeof(h) ||
+        pa_loop_write(fd, fname, h.path_length, NULL) != (ssize_t) h.path_length ||
+        pa_loop_write(fd, pl, h.proplist_length, NULL) != (ssize_t) h.proplist_length)
+        goto finish;
+
+    for (l = sizeof(h) + h.path_length + h.proplist_length; l < h.data_offset; l += (size_t) w) {
+        size_t n = PA_MIN(sizeof(zero), (size_t) h.data_offset - l);
+
+        if ((w = pa_loop_write(fd, zero, n, NULL)) != (ssize_t) n)
+            goto finish;
+    }
+
+    d = pa_memblock_acquire(chunk->memblock);
+    w = pa_loop_write(fd, (uint8_t*) d + chunk->index, chunk->length, NULL);
+    pa_memblock_release(chunk->memblock);
+
+    if (w != (ssize_t) chunk->length)
+        goto finish;
+
+    if (pa_close(fd) < 0) {
+        fd = -1;
+        goto finish;
+    }
+
+    fd = -1;
+
+    /* Atomically replace a stale version */
+    if (rename(t, cpath) < 0)
+        goto finish;
+
+    r = 0;
+
+finish:
+    if (r < 0) {
+        pa_log_warn("Failed to write sample cache file %s: %s", cpath, pa_cstrerror(errno));
+        unlink(t);
+    }
+
+    if (fd >= 0)
+        pa_close(fd);
+
+    pa_xfree(pl);
+    pa_xfree(t);
+
+    return r;
+}
+
+int pa_sound_file_cache_load(
+        pa_mempool *pool,
+        const char *fname,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    struct stat st;
+    char *cpath;
+    pa_memchunk decoded;
+    pa_proplist *fp;
+    pa_usec_t t;
+
+    pa_assert(pool);
+    pa_assert(fname);
+    pa_assert(ss);
+    pa_assert(chunk);
+
+    if (stat(fname, &st) < 0 || !(cpath = cache_path(fname)))
+        return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+
+    if (cache_map(pool, cpath, fname, &st, ss, map, chunk, p) >= 0) {
+        pa_log_debug("Loaded %s from sample cache %s.", fname, cpath);
+        pa_xfree(cpath);
+        return 0;
+    }
+
+    fp = pa_proplist_new();
+
+    if (pa_sound_file_load(pool, fname, ss, map, &decoded, fp) < 0) {
+        pa_proplist_free(fp);
+        pa_xfree(cpath);
+        return -1;
+    }
+
+    t = pa_rtclock_now();
+
+    /* Hand out the mapping rather than the decoded copy, so that it
+     * can be dropped from memory while the sample is idle */
+    if (cache_write(cpath, fname, &st, ss, map, &decoded, fp) >= 0 &&
+        cache_map(pool, cpath, fname, &st, ss, map, chunk, NULL) >= 0) {
+        pa_memblock_unref(decoded.memblock);
+
+        pa_log_debug("Wrote sample cache file %s in %0.1f ms.", cpath, (double) (pa_rtclock_now() - t) / PA_USEC_PER_MSEC);
+    } else
+        *chunk = decoded;
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, fp);
+
+    pa_proplist_free(fp);
+    pa_xfree(cpath);
+
+    return 0;
+}
+
+#else
+
+int pa_sound_file_cache_load(
+        pa_mempool *pool,
+        const char *fname,
+        pa_sample_spec *ss,
+        pa_channel_map *map,
+        pa_memchunk *chunk,
+        pa_proplist *p) {
+
+    return pa_sound_file_load(pool, fname, ss, map, chunk, p);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef foosoundfilecachehfoo
+#define foosoundfilecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+#include <pulse/proplist.h>
+#include <pulsecore/memchunk.h>
+
+/* Like pa_sound_file_load(), but keeps the decoded PCM data in a file
+ * in the state directory, keyed by the path, mtime and size of the
+ * sound file. The returned memchunk is a read-only mapping of that
+ * file, so an idle sample only costs page cache, and loading it again
+ * doesn't need decoding. Falls back to plain pa_sound_file_load() if
+ * the cache file cannot be written. */
+int pa_sound_file_cache_load(pa_mempool *pool, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p);
+
+#endif
@@ -42,6 +42,10 @@ void pa_thread_mq_done(pa_thread_mq *q);
 /* Install the specified pa_thread_mq object for the current thread */
 void pa_thread_mq_install(pa_thread_mq *q);
 
+/* Remove the pa_thread_mq object again, for threads that run the IO
+ * of more than one object */
+void pa_thread_mq_uninstall(void);
+
 /* Return the pa_thread_mq object that is set for the current thread */
 pa_thread_mq *pa_thread_mq_get(void);
 
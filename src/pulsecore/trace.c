@@ -0,0 +1,167 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/llist.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/thread.h>
+
+#include "trace.h"
+
+/* How often pa_trace_dump() copies a ring whose writer keeps lapping
+ * it before it gives up on that thread */
+#define MAX_DUMP_TRIES 10
+
+typedef struct trace_ring trace_ring;
+
+struct trace_ring {
+    unsigned thread;
+
+    /* Number of events ever recorded, only written by the owning
+     * thread */
+    pa_atomic_t n_written;
+
+    pa_trace_event events[PA_TRACE_RING_SIZE];
+
+    PA_LLIST_FIELDS(trace_ring);
+};
+
+pa_atomic_t pa_trace_enabled = PA_ATOMIC_INIT(0);
+
+/* Protects the list of rings, not their contents */
+static pa_static_mutex rings_mutex = PA_STATIC_MUTEX_INIT;
+static PA_LLIST_HEAD(trace_ring, rings) = NULL;
+static unsigned n_threads = 0;
+
+static pa_mutex *get_mutex(void) {
+    return pa_static_mutex_get(&rings_mutex, FALSE, FALSE);
+}
+
+/* Called when a thread that recorded events exits */
+static void ring_free(void *p) {
+    trace_ring *r = p;
+    pa_mutex *m;
+
+    m = get_mutex();
+    pa_mutex_lock(m);
+    PA_LLIST_REMOVE(trace_ring, rings, r);
+    pa_mutex_unlock(m);
+
+    pa_xfree(r);
+}
+
+PA_STATIC_TLS_DECLARE(trace_ring, ring_free);
+
+static trace_ring *ring_get(void) {
+    trace_ring *r;
+    pa_mutex *m;
+
+    if (PA_LIKELY((r = PA_STATIC_TLS_GET(trace_ring))))
+        return r;
+
+    r = pa_xnew0(trace_ring, 1);
+    pa_atomic_store(&r->n_written, 0);
+
+    m = get_mutex();
+    pa_mutex_lock(m);
+    r->thread = n_threads++;
+    PA_LLIST_PREPEND(trace_ring, rings, r);
+    pa_mutex_unlock(m);
+
+    PA_STATIC_TLS_SET(trace_ring, r);
+
+    return r;
+}
+
+void pa_trace_set_enabled(pa_bool_t b) {
+    pa_atomic_store(&pa_trace_enabled, !!b);
+}
+
+void pa_trace_record(pa_trace_event_type_t type, uint32_t object, int64_t a, int64_t b) {
+    trace_ring *r;
+    pa_trace_event *e;
+    unsigned n;
+
+    r = ring_get();
+
+    /* We are the only writer, so a plain load is fine here */
+    n = (unsigned) pa_atomic_load(&r->n_written);
+    e = r->events + (n % PA_TRACE_RING_SIZE);
+
+    e->time = pa_rtclock_now();
+    e->type = type;
+    e->object = object;
+    e->a = a;
+    e->b = b;
+
+    /* Publish the event, this implies a memory barrier */
+    pa_atomic_store(&r->n_written, (int) (n + 1));
+}
+
+void pa_trace_dump(pa_trace_dump_cb_t cb, void *userdata) {
+    pa_trace_event *events;
+    trace_ring *r;
+    pa_mutex *m;
+
+    pa_assert(cb);
+
+    events = pa_xnew(pa_trace_event, PA_TRACE_RING_SIZE);
+
+    m = get_mutex();
+    pa_mutex_lock(m);
+
+    for (r = rings; r; r = r->next) {
+        unsigned first, last, n, i, skip, tries;
+
+        for (tries = 0;; tries++) {
+            last = (unsigned) pa_atomic_load(&r->n_written);
+            first = last > PA_TRACE_RING_SIZE ? last - PA_TRACE_RING_SIZE : 0;
+
+            for (i = first; i < last; i++)
+                events[i - first] = r->events[i % PA_TRACE_RING_SIZE];
+
+            /* Whatever the writer went on to record meanwhile has
+             * overwritten the oldest events, and the slot of the next
+             * one might be half written */
+            n = (unsigned) pa_atomic_load(&r->n_written);
+            skip = n - first >= PA_TRACE_RING_SIZE ? n - first - PA_TRACE_RING_SIZE + 1 : 0;
+
+            if (last == first || skip < last - first)
+                break;
+
+            /* The writer lapped us while we were copying, so nothing
+             * we got can be trusted. Try again, but not forever. */
+            if (tries >= MAX_DUMP_TRIES)
+                break;
+        }
+
+        if (skip < last - first)
+            cb(r->thread, events + skip, last - first - skip, userdata);
+    }
+
+    pa_mutex_unlock(m);
+
+    pa_xfree(events);
+}
@@ -0,0 +1,63 @@
+#ifndef footracehfoo
+#define footracehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/def.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/macro.h>
+
+/* A binary trace of stream timing events. Every thread that records
+ * events gets a ring of its own, which only that thread writes to, so
+ * recording takes no locks. When the ring is full the oldest events
+ * are overwritten. Readers copy the rings out and drop whatever was
+ * overwritten while they did. */
+
+#define PA_TRACE_RING_SIZE 4096
+
+extern pa_atomic_t pa_trace_enabled;
+
+void pa_trace_set_enabled(pa_bool_t b);
+
+void pa_trace_record(pa_trace_event_type_t type, uint32_t object, int64_t a, int64_t b);
+
+/* Cheap enough to be left in the IO threads */
+#define pa_trace(type, object, a, b)                                    \
+    do {                                                                \
+        if (PA_UNLIKELY(pa_atomic_load(&pa_trace_enabled)))             \
+            pa_trace_record((type), (object), (int64_t) (a), (int64_t) (b)); \
+    } while (FALSE)
+
+/* Start time for events that measure a duration, 0 if tracing is off */
+static inline pa_usec_t pa_trace_now(void) {
+    return PA_UNLIKELY(pa_atomic_load(&pa_trace_enabled)) ? pa_rtclock_now() : 0;
+}
+
+typedef void (*pa_trace_dump_cb_t)(unsigned thread, const pa_trace_event *events, unsigned n, void *userdata);
+
+/* Calls cb once for every thread that recorded events, with the
+ * events in chronological order. A thread that records so fast that
+ * its ring cannot be copied consistently is left out. The callback
+ * must not record events itself. */
+void pa_trace_dump(pa_trace_dump_cb_t cb, void *userdata);
+
+#endif
@@ -0,0 +1,202 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/broadcast-ring.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/thread.h>
+
+/* Mimics module-combine with 8 null sink outputs, using the same ring
+ * parameters: one thread renders blocks into the ring, eight threads
+ * each consume one block per period, like a null sink would. See
+ * combine-bench for the real thing. Checks that every output sees every
+ * block in order and reports wakeup jitter, underruns and CPU
+ * usage. */
+
+#define N_OUTPUTS 8
+#define N_PERIODS 100
+#define PERIOD_USEC (10*PA_USEC_PER_MSEC)
+#define BLOCK_SIZE 1764 /* 10ms of S16LE stereo at 44.1 kHz */
+
+static pa_mempool *pool;
+static pa_broadcast_ring *ring;
+static pa_fdsem *need;
+static pa_atomic_t quit = PA_ATOMIC_INIT(0);
+static pa_usec_t start_time;
+
+struct output {
+    pa_broadcast_ring_reader *reader;
+    pa_thread *thread;
+    unsigned underruns;
+    pa_usec_t max_jitter, sum_jitter;
+};
+
+static struct output outputs[N_OUTPUTS];
+
+static void render_thread(void *userdata) {
+    uint32_t seq = 0;
+
+    while (!pa_atomic_load(&quit)) {
+
+        while (!pa_broadcast_ring_is_full(ring) &&
+               pa_broadcast_ring_get_length(ring) < BLOCK_SIZE * PA_BROADCAST_RING_COMBINE_RENDER_AHEAD) {
+            pa_memchunk chunk;
+            uint32_t *p;
+
+            chunk.memblock = pa_memblock_new(pool, BLOCK_SIZE);
+            chunk.index = 0;
+            chunk.length = BLOCK_SIZE;
+
+            p = pa_memblock_acquire(chunk.memblock);
+            memset(p, 0, BLOCK_SIZE);
+            p[0] = seq++;
+            pa_memblock_release(chunk.memblock);
+
+            pa_broadcast_ring_push(ring, &chunk);
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        pa_fdsem_wait(need);
+    }
+}
+
+static void output_thread(void *userdata) {
+    struct output *o = userdata;
+    uint32_t expected = 0;
+    unsigned i;
+
+    for (i = 0; i < N_PERIODS; i++) {
+        pa_usec_t deadline, now, jitter;
+        pa_memchunk chunk;
+
+        deadline = start_time + i * PERIOD_USEC;
+
+        if ((now = pa_rtclock_now()) < deadline) {
+            pa_usec_t d = deadline - now;
+            usleep((useconds_t) d);
+            now = pa_rtclock_now();
+        }
+
+        jitter = now - deadline;
+        o->sum_jitter += jitter;
+        if (jitter > o->max_jitter)
+            o->max_jitter = jitter;
+
+        if (pa_broadcast_ring_reader_pop(o->reader, &chunk) < 0)
+            o->underruns++;
+        else {
+            uint32_t *p;
+
+            pa_assert(chunk.length == BLOCK_SIZE);
+
+            p = pa_memblock_acquire(chunk.memblock);
+            pa_assert(p[0] == expected);
+            pa_memblock_release(chunk.memblock);
+            pa_memblock_unref(chunk.memblock);
+
+            expected++;
+        }
+
+        /* Ask for more data, without ever waiting for it */
+        if (pa_broadcast_ring_reader_get_length(o->reader) < BLOCK_SIZE * PA_BROADCAST_RING_COMBINE_RENDER_AHEAD)
+            pa_fdsem_post(need);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    pa_thread *renderer;
+    struct rusage ru;
+    double cpu;
+    unsigned i, underruns = 0;
+    pa_usec_t max_jitter = 0, sum_jitter = 0;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+    pa_assert_se(ring = pa_broadcast_ring_new(PA_BROADCAST_RING_COMBINE_SLOTS));
+    pa_assert_se(need = pa_fdsem_new());
+
+    /* Readers are registered before the writer starts */
+    for (i = 0; i < N_OUTPUTS; i++)
+        pa_assert_se(outputs[i].reader = pa_broadcast_ring_reader_new(ring));
+
+    pa_assert_se(renderer = pa_thread_new(render_thread, NULL));
+
+    start_time = pa_rtclock_now() + 20*PA_USEC_PER_MSEC;
+
+    for (i = 0; i < N_OUTPUTS; i++)
+        pa_assert_se(outputs[i].thread = pa_thread_new(output_thread, outputs + i));
+
+    for (i = 0; i < N_OUTPUTS; i++) {
+        pa_thread_free(outputs[i].thread);
+
+        pa_log_debug("output %u: %u underruns, jitter avg %llu usec, max %llu usec",
+                     i, outputs[i].underruns,
+                     (unsigned long long) (outputs[i].sum_jitter / N_PERIODS),
+                     (unsigned long long) outputs[i].max_jitter);
+
+        underruns += outputs[i].underruns;
+        sum_jitter += outputs[i].sum_jitter;
+
+        if (outputs[i].max_jitter > max_jitter)
+            max_jitter = outputs[i].max_jitter;
+    }
+
+    pa_atomic_store(&quit, 1);
+    pa_fdsem_post(need);
+    pa_thread_free(renderer);
+
+    pa_assert_se(getrusage(RUSAGE_SELF, &ru) >= 0);
+    cpu = (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / PA_USEC_PER_SEC +
+        (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / PA_USEC_PER_SEC;
+
+    pa_log_info("%u outputs, %u periods: %u underruns, jitter avg %llu usec, max %llu usec, CPU %0.3f s (%0.2f%%)",
+                N_OUTPUTS, N_PERIODS, underruns,
+                (unsigned long long) (sum_jitter / (N_OUTPUTS * N_PERIODS)),
+                (unsigned long long) max_jitter,
+                cpu, cpu * 100.0 * PA_USEC_PER_SEC / (double) (N_PERIODS * PERIOD_USEC));
+
+    for (i = 0; i < N_OUTPUTS; i++)
+        pa_broadcast_ring_reader_free(outputs[i].reader);
+
+    pa_broadcast_ring_free(ring);
+    pa_fdsem_free(need);
+    pa_mempool_free(pool);
+
+    return 0;
+}
@@ -0,0 +1,348 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Loads 8 null sinks and a module-combine sink on top of them into a
+ * running server, plays silence into the combine sink for a while and
+ * reports how steady the latency of each output is, and how much CPU
+ * time the server spent. The server's CPU time is read from /proc,
+ * hence that only works for a local server running as the same
+ * user. */
+
+#define N_OUTPUTS 8
+#define POLL_USEC (20*PA_USEC_PER_MSEC)
+#define RUN_USEC (10*PA_USEC_PER_SEC)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+struct output {
+    uint32_t sink_input;
+    unsigned n;
+    double sum;
+    pa_usec_t min, max;
+};
+
+static pa_mainloop_api *mainloop_api = NULL;
+static pa_context *context = NULL;
+static pa_stream *stream = NULL;
+static pa_time_event *poll_event = NULL;
+
+static uint32_t null_modules[N_OUTPUTS];
+static uint32_t combine_module = PA_INVALID_INDEX;
+static unsigned n_loaded = 0, n_unloaded = 0, n_to_unload = 0;
+
+static struct output outputs[N_OUTPUTS];
+static unsigned n_outputs = 0;
+
+static pa_usec_t start = 0;
+static double server_cpu_start;
+static int ret = 1;
+
+/* Returns the CPU time the server used so far, or a negative value if
+ * it cannot be determined */
+static double server_cpu(void) {
+    char *fn, *p, buf[1024];
+    unsigned long utime, stime;
+    unsigned pid;
+    FILE *f;
+    int r;
+
+    fn = pa_runtime_path("pid");
+    f = fopen(fn, "r");
+    pa_xfree(fn);
+
+    if (!f)
+        return -1;
+
+    r = fscanf(f, "%u", &pid);
+    fclose(f);
+
+    if (r != 1)
+        return -1;
+
+    pa_snprintf(buf, sizeof(buf), "/proc/%u/stat", pid);
+
+    if (!(f = fopen(buf, "r")))
+        return -1;
+
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    if (!p || !(p = strrchr(buf, ')')))
+        return -1;
+
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+static void unloaded_cb(pa_context *c, int success, void *userdata) {
+    if (!success)
+        pa_log("Failed to unload module: %s", pa_strerror(pa_context_errno(c)));
+
+    if (++n_unloaded >= n_to_unload)
+        mainloop_api->quit(mainloop_api, ret);
+}
+
+/* Removes whatever we loaded and quits once that is done */
+static void cleanup(void) {
+    unsigned i;
+
+    if (poll_event) {
+        mainloop_api->time_free(poll_event);
+        poll_event = NULL;
+    }
+
+    if (stream) {
+        pa_stream_disconnect(stream);
+        pa_stream_unref(stream);
+        stream = NULL;
+    }
+
+    /* The combine sink goes first, the null sinks are its outputs */
+    if (combine_module != PA_INVALID_INDEX) {
+        n_to_unload++;
+        pa_operation_unref(pa_context_unload_module(context, combine_module, unloaded_cb, NULL));
+    }
+
+    for (i = 0; i < n_loaded && i < N_OUTPUTS; i++) {
+        n_to_unload++;
+        pa_operation_unref(pa_context_unload_module(context, null_modules[i], unloaded_cb, NULL));
+    }
+
+    if (n_to_unload <= 0)
+        mainloop_api->quit(mainloop_api, ret);
+}
+
+static void report(void) {
+    double elapsed, scpu;
+    unsigned i;
+
+    elapsed = (double) (pa_rtclock_now() - start) / PA_USEC_PER_SEC;
+
+    for (i = 0; i < n_outputs; i++) {
+        struct output *o = outputs + i;
+
+        if (o->n <= 0)
+            continue;
+
+        pa_log_info("Output %u (sink input %u): latency %0.2f ms on average, min %0.2f ms, max %0.2f ms, jitter %0.2f ms",
+                    i, o->sink_input,
+                    o->sum / o->n / PA_USEC_PER_MSEC,
+                    (double) o->min / PA_USEC_PER_MSEC, (double) o->max / PA_USEC_PER_MSEC,
+                    (double) (o->max - o->min) / PA_USEC_PER_MSEC);
+    }
+
+    if (server_cpu_start >= 0 && (scpu = server_cpu()) >= 0) {
+        scpu -= server_cpu_start;
+        pa_log_info("%u outputs, %0.1f s: server used %0.2f s CPU (%0.1f%%)", n_outputs, elapsed, scpu, scpu * 100.0 / elapsed);
+    } else
+        pa_log_info("%u outputs, %0.1f s: server CPU time unknown", n_outputs, elapsed);
+
+    ret = n_outputs == N_OUTPUTS ? 0 : 1;
+}
+
+static void sink_input_info_cb(pa_context *c, const pa_sink_input_info *i, int eol, void *userdata) {
+    struct output *o = NULL;
+    pa_usec_t l;
+    unsigned j;
+
+    if (eol < 0) {
+        pa_log("Failed to get sink input info: %s", pa_strerror(pa_context_errno(c)));
+        cleanup();
+        return;
+    }
+
+    if (!i || i->owner_module != combine_module)
+        return;
+
+    for (j = 0; j < n_outputs; j++)
+        if (outputs[j].sink_input == i->index) {
+            o = outputs + j;
+            break;
+        }
+
+    if (!o) {
+        if (n_outputs >= N_OUTPUTS)
+            return;
+
+        o = outputs + n_outputs++;
+        o->sink_input = i->index;
+        o->min = (pa_usec_t) -1;
+    }
+
+    /* What is queued for this output plus what its null sink holds */
+    l = i->buffer_usec + i->sink_usec;
+
+    o->n++;
+    o->sum += (double) l;
+    o->min = PA_MIN(o->min, l);
+    o->max = PA_MAX(o->max, l);
+}
+
+static void poll_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval ntv;
+
+    if (pa_rtclock_now() - start >= RUN_USEC) {
+        report();
+        cleanup();
+        return;
+    }
+
+    pa_operation_unref(pa_context_get_sink_input_info_list(context, sink_input_info_cb, NULL));
+
+    a->time_restart(e, pa_timeval_rtstore(&ntv, pa_rtclock_now() + POLL_USEC, TRUE));
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *data;
+
+    pa_assert_se(pa_stream_begin_write(s, &data, &nbytes) == 0);
+    memset(data, 0, nbytes);
+    pa_assert_se(pa_stream_write(s, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) == 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    struct timeval tv;
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            pa_log_info("Playing into the combine sink for %0.0f s.", (double) RUN_USEC / PA_USEC_PER_SEC);
+
+            server_cpu_start = server_cpu();
+            start = pa_rtclock_now();
+            poll_event = mainloop_api->time_new(mainloop_api, pa_timeval_rtstore(&tv, start + POLL_USEC, TRUE), poll_cb, NULL);
+            break;
+
+        case PA_STREAM_FAILED:
+            pa_log("Stream error: %s", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+            cleanup();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void combine_loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    if (idx == PA_INVALID_INDEX) {
+        pa_log("Failed to load module-combine: %s", pa_strerror(pa_context_errno(c)));
+        cleanup();
+        return;
+    }
+
+    combine_module = idx;
+
+    pa_assert_se(stream = pa_stream_new(c, "combine-bench", &sample_spec, NULL));
+    pa_stream_set_state_callback(stream, stream_state_cb, NULL);
+    pa_stream_set_write_callback(stream, write_cb, NULL);
+    pa_assert_se(pa_stream_connect_playback(stream, "combine_bench", NULL, 0, NULL, NULL) == 0);
+}
+
+static void null_loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    char args[512];
+    unsigned i;
+    size_t l;
+
+    if (idx == PA_INVALID_INDEX) {
+        pa_log("Failed to load module-null-sink: %s", pa_strerror(pa_context_errno(c)));
+        cleanup();
+        return;
+    }
+
+    null_modules[PA_PTR_TO_UINT(userdata)] = idx;
+
+    if (++n_loaded < N_OUTPUTS)
+        return;
+
+    l = pa_snprintf(args, sizeof(args), "sink_name=combine_bench slaves=");
+
+    for (i = 0; i < N_OUTPUTS; i++)
+        l += pa_snprintf(args + l, sizeof(args) - l, "%scombine_bench_%u", i > 0 ? "," : "", i);
+
+    pa_operation_unref(pa_context_load_module(c, "module-combine", args, combine_loaded_cb, NULL));
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    unsigned i;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            for (i = 0; i < N_OUTPUTS; i++) {
+                char args[64];
+
+                pa_snprintf(args, sizeof(args), "sink_name=combine_bench_%u", i);
+                pa_operation_unref(pa_context_load_module(c, "module-null-sink", args, null_loaded_cb, PA_UINT_TO_PTR(i)));
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+            pa_log("Connection error: %s", pa_strerror(pa_context_errno(c)));
+            mainloop_api->quit(mainloop_api, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    int r = 1;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    mainloop_api = pa_mainloop_get_api(m);
+
+    pa_assert_se(context = pa_context_new(mainloop_api, "combine-bench"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) >= 0)
+        pa_mainloop_run(m, &r);
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_mainloop_free(m);
+
+    return r;
+}
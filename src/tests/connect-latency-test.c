@@ -0,0 +1,162 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Measures how long a client like a notification tool that plays a
+ * short beep takes from pa_context_connect() until its first sample is
+ * written: once connecting the stream after the context became ready,
+ * and once connecting it right away, so that its creation is pipelined
+ * with the handshake. Needs a running server. */
+
+#define N_RUNS 50
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_context *context = NULL;
+static pa_stream *stream = NULL;
+static pa_bool_t early, done, failed;
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    static uint8_t silence[441 * 4];
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            pa_assert_se(pa_stream_write(s, silence, sizeof(silence), NULL, 0, PA_SEEK_RELATIVE) == 0);
+            done = TRUE;
+            break;
+
+        case PA_STREAM_FAILED:
+            pa_log("Stream error: %s", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+            failed = TRUE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void connect_stream(void) {
+    pa_assert_se(stream = pa_stream_new(context, "connect-latency-test", &sample_spec, NULL));
+    pa_stream_set_state_callback(stream, stream_state_cb, NULL);
+    pa_assert_se(pa_stream_connect_playback(stream, NULL, NULL, 0, NULL, NULL) == 0);
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            if (!early)
+                connect_stream();
+            break;
+
+        case PA_CONTEXT_FAILED:
+            pa_log("Connection error: %s", pa_strerror(pa_context_errno(c)));
+            failed = TRUE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+static pa_usec_t run(pa_mainloop *m, pa_bool_t connect_early) {
+    pa_usec_t t;
+
+    early = connect_early;
+    done = failed = FALSE;
+
+    pa_assert_se(context = pa_context_new(pa_mainloop_get_api(m), "connect-latency-test"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    t = pa_rtclock_now();
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+        failed = TRUE;
+    else if (early)
+        connect_stream();
+
+    while (!done && !failed)
+        pa_assert_se(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+    t = pa_rtclock_now() - t;
+
+    if (stream) {
+        pa_stream_disconnect(stream);
+        pa_stream_unref(stream);
+        stream = NULL;
+    }
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    context = NULL;
+
+    return failed ? PA_USEC_INVALID : t;
+}
+
+int main(int argc, char *argv[]) {
+    static const char * const names[2] = { "after-ready", "early" };
+    pa_mainloop *m;
+    unsigned i, j;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+
+    for (j = 0; j < 2; j++) {
+        pa_usec_t sum = 0, min = (pa_usec_t) -1, max = 0;
+
+        for (i = 0; i < N_RUNS; i++) {
+            pa_usec_t t;
+
+            if ((t = run(m, j == 1)) == PA_USEC_INVALID) {
+                pa_mainloop_free(m);
+                return 1;
+            }
+
+            sum += t;
+            min = PA_MIN(min, t);
+            max = PA_MAX(max, t);
+        }
+
+        pa_log_info("%s: connect to first sample took %llu usec on average, min %llu, max %llu",
+                    names[j],
+                    (unsigned long long) (sum / N_RUNS),
+                    (unsigned long long) min,
+                    (unsigned long long) max);
+    }
+
+    pa_mainloop_free(m);
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Exercises the log database backend: overwrites, removals, reopening,
+ * compaction and recovery from a torn record at the end of the
+ * file. Also reports how long it takes to store and reload a
+ * stream-restore sized database. */
+
+#define N_KEYS 200
+#define N_ROUNDS 50
+
+static void make_datum(pa_datum *d, char *buf, size_t l, const char *fmt, unsigned i) {
+    pa_snprintf(buf, l, fmt, i);
+    d->data = buf;
+    d->size = strlen(buf);
+}
+
+static void check(pa_database *db, unsigned i, unsigned round) {
+    char kb[64], db_[64];
+    pa_datum key, expected, data;
+
+    make_datum(&key, kb, sizeof(kb), "sink-input-by-application-name:%u", i);
+    make_datum(&expected, db_, sizeof(db_), "volume %u", i * 1000 + round);
+
+    pa_assert_se(pa_database_get(db, &key, &data));
+    pa_assert_se(data.size == expected.size);
+    pa_assert_se(memcmp(data.data, expected.data, data.size) == 0);
+    pa_datum_free(&data);
+}
+
+static void store(pa_database *db, unsigned round) {
+    unsigned i;
+
+    for (i = 0; i < N_KEYS; i++) {
+        char kb[64], db_[64];
+        pa_datum key, data;
+
+        make_datum(&key, kb, sizeof(kb), "sink-input-by-application-name:%u", i);
+        make_datum(&data, db_, sizeof(db_), "volume %u", i * 1000 + round);
+
+        pa_assert_se(pa_database_set(db, &key, &data, TRUE) >= 0);
+    }
+
+    pa_assert_se(pa_database_sync(db) >= 0);
+}
+
+static off_t file_size(const char *fn) {
+    struct stat st;
+
+    pa_assert_se(stat(fn, &st) >= 0);
+    return st.st_size;
+}
+
+int main(int argc, char *argv[]) {
+    char *base, *fn;
+    pa_database *db;
+    pa_datum key, data;
+    char kb[64], db_[64];
+    pa_usec_t t;
+    unsigned i, round;
+    off_t size;
+    FILE *f;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    base = pa_sprintf_malloc("database-log-test-%lu", (unsigned long) getpid());
+    fn = pa_sprintf_malloc("%s."CANONICAL_HOST".simplelog", base);
+    unlink(fn);
+
+    /* Fill, overwrite and remove */
+    pa_assert_se(db = pa_database_open(base, TRUE));
+
+    /* Users of the database sync on a timer, give the compactor a
+     * chance to finish in between */
+    for (round = 0; round < N_ROUNDS; round++) {
+        t = pa_rtclock_now();
+        store(db, round);
+        pa_log_debug("Round %u: %u keys stored in %llu usec",
+                     round, N_KEYS, (unsigned long long) (pa_rtclock_now() - t));
+        usleep(10000);
+    }
+
+    make_datum(&key, kb, sizeof(kb), "sink-input-by-application-name:%u", 0);
+    make_datum(&data, db_, sizeof(db_), "volume %u", 0);
+    pa_assert_se(pa_database_set(db, &key, &data, FALSE) < 0);
+    pa_assert_se(pa_database_unset(db, &key) >= 0);
+    pa_assert_se(pa_database_unset(db, &key) < 0);
+    pa_assert_se(pa_database_size(db) == N_KEYS - 1);
+
+    pa_database_close(db);
+
+    /* Compaction must have kept the file from growing with every
+     * round */
+    size = file_size(fn);
+    pa_log_debug("Log file is %lu bytes", (unsigned long) size);
+    pa_assert_se(size < 4 * 64 * 1024);
+
+    /* Reopen and check that the last round survived */
+    t = pa_rtclock_now();
+    pa_assert_se(db = pa_database_open(base, FALSE));
+    pa_log_debug("Loaded in %llu usec", (unsigned long long) (pa_rtclock_now() - t));
+
+    pa_assert_se(pa_database_size(db) == N_KEYS - 1);
+    pa_assert_se(!pa_database_get(db, &key, &data));
+    for (i = 1; i < N_KEYS; i++)
+        check(db, i, N_ROUNDS - 1);
+
+    pa_database_close(db);
+
+    /* Simulate a crash in the middle of a write: the torn record is
+     * dropped, everything before it is kept */
+    size = file_size(fn);
+    pa_assert_se(f = fopen(fn, "a"));
+    pa_assert_se(fwrite("\001\020\000\000\000\020\000\000\000torn", 13, 1, f) == 1);
+    fclose(f);
+
+    pa_assert_se(db = pa_database_open(base, TRUE));
+    pa_assert_se(file_size(fn) == size);
+    pa_assert_se(pa_database_size(db) == N_KEYS - 1);
+
+    pa_assert_se(pa_database_clear(db) >= 0);
+    pa_assert_se(pa_database_size(db) == 0);
+    pa_database_close(db);
+
+    pa_assert_se(db = pa_database_open(base, FALSE));
+    pa_assert_se(pa_database_size(db) == 0);
+    pa_database_close(db);
+
+    unlink(fn);
+    pa_xfree(fn);
+    pa_xfree(base);
+
+    return 0;
+}
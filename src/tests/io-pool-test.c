@@ -0,0 +1,145 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/util.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core.h>
+#include <pulsecore/io-pool.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Runs 40 timer driven jobs, like 40 null sinks would be, on the
+ * shared IO workers. Checks that every job always runs on the same
+ * thread and reports how late the timers fire. */
+
+#define N_JOBS 40
+#define N_TICKS 50
+#define PERIOD_USEC (5*PA_USEC_PER_MSEC)
+
+struct job {
+    unsigned index;
+    pa_rtpoll *rtpoll;
+    pa_thread_mq mq;
+    pa_io_pool_job *job;
+
+    /* Only accessed from the worker */
+    pa_thread *thread;
+    pa_usec_t next;
+    unsigned ticks;
+    pa_usec_t max_late;
+};
+
+static struct job jobs[N_JOBS];
+static pa_atomic_t n_done = PA_ATOMIC_INIT(0);
+
+static int job_cb(pa_io_pool_job *j, void *userdata) {
+    struct job *u = userdata;
+    pa_usec_t now;
+
+    pa_assert(pa_thread_mq_get() == &u->mq);
+
+    if (!u->thread)
+        u->thread = pa_thread_self();
+
+    pa_assert(u->thread == pa_thread_self());
+
+    if (u->ticks >= N_TICKS)
+        return 0;
+
+    now = pa_rtclock_now();
+
+    if (u->next == 0)
+        u->next = now + PERIOD_USEC;
+    else if (now >= u->next) {
+        if (now - u->next > u->max_late)
+            u->max_late = now - u->next;
+
+        u->next += PERIOD_USEC;
+
+        if (++u->ticks >= N_TICKS) {
+            pa_rtpoll_set_timer_disabled(u->rtpoll);
+            pa_atomic_inc(&n_done);
+            return 0;
+        }
+    }
+
+    pa_rtpoll_set_timer_absolute(u->rtpoll, u->next);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    pa_core *c;
+    pa_io_pool *pool;
+    pa_usec_t max_late = 0;
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0));
+    pa_assert_se(pool = pa_io_pool_get(c));
+
+    for (i = 0; i < N_JOBS; i++) {
+        jobs[i].index = i;
+        jobs[i].rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&jobs[i].mq, pa_mainloop_get_api(m), jobs[i].rtpoll);
+        pa_assert_se(jobs[i].job = pa_io_pool_job_new(pool, NULL, jobs[i].rtpoll, &jobs[i].mq, job_cb, jobs + i));
+    }
+
+    while (pa_atomic_load(&n_done) < N_JOBS)
+        pa_msleep(10);
+
+    for (i = 0; i < N_JOBS; i++) {
+        pa_asyncmsgq_send(jobs[i].mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_io_pool_job_free(jobs[i].job);
+
+        pa_thread_mq_done(&jobs[i].mq);
+        pa_rtpoll_free(jobs[i].rtpoll);
+
+        pa_assert_se(jobs[i].ticks == N_TICKS);
+
+        if (jobs[i].max_late > max_late)
+            max_late = jobs[i].max_late;
+    }
+
+    pa_log_info("%u jobs on %u workers, %u ticks each: timers fired at most %llu usec late",
+                N_JOBS, pa_io_pool_get_n_workers(pool), N_TICKS, (unsigned long long) max_late);
+
+    pa_io_pool_unref(pool);
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+
+    return 0;
+}
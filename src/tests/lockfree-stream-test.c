@@ -0,0 +1,241 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+#include <pulse/thread-mainloop.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+
+/* Plays silence from a thread that behaves like an audio callback,
+ * once taking the lock of the threaded main loop for every period, and
+ * once with the lock-free calls. Meanwhile the main loop thread
+ * regularly keeps the lock for a while, like a slow callback of the
+ * application would. Reports how long the audio thread was stalled at
+ * worst in both cases. Finally disconnects the stream and frees the
+ * context while the audio thread is still writing. Needs a running
+ * server. */
+
+#define PERIOD_USEC (5*PA_USEC_PER_MSEC)
+#define N_PERIODS 400
+#define BUSY_USEC (2*PA_USEC_PER_MSEC)
+#define BUSY_INTERVAL_USEC (10*PA_USEC_PER_MSEC)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_threaded_mainloop *m = NULL;
+static pa_time_event *busy_event = NULL;
+static uint8_t silence[PERIOD_USEC * 44100 / PA_USEC_PER_SEC * 4];
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void busy_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval ntv;
+    pa_usec_t until;
+
+    /* We are called with the lock held */
+    until = pa_rtclock_now() + BUSY_USEC;
+    while (pa_rtclock_now() < until)
+        ;
+
+    a->time_restart(e, pa_timeval_rtstore(&ntv, pa_rtclock_now() + BUSY_INTERVAL_USEC, TRUE));
+}
+
+static pa_usec_t run(pa_stream *s, pa_bool_t lockfree, unsigned *n_busy) {
+    pa_usec_t next, max_stall = 0;
+    unsigned i;
+    size_t l;
+
+    l = pa_usec_to_bytes(PERIOD_USEC, &sample_spec);
+    pa_assert(l <= sizeof(silence));
+
+    *n_busy = 0;
+    next = pa_rtclock_now();
+
+    for (i = 0; i < N_PERIODS; i++) {
+        pa_usec_t t, latency;
+        int negative, r;
+
+        t = pa_rtclock_now();
+
+        if (lockfree) {
+            if ((r = pa_stream_write_lockfree(s, silence, l)) == -PA_ERR_BUSY)
+                (*n_busy)++;
+            else
+                pa_assert_se(r == 0);
+
+            r = pa_stream_get_latency_lockfree(s, &latency, &negative);
+            pa_assert_se(r == 0 || r == -PA_ERR_NODATA);
+        } else {
+            pa_threaded_mainloop_lock(m);
+            pa_assert_se(pa_stream_write(s, silence, l, NULL, 0, PA_SEEK_RELATIVE) == 0);
+            pa_stream_get_latency(s, &latency, &negative);
+            pa_threaded_mainloop_unlock(m);
+        }
+
+        t = pa_rtclock_now() - t;
+
+        if (t > max_stall)
+            max_stall = t;
+
+        next += PERIOD_USEC;
+        t = pa_rtclock_now();
+
+        if (next > t)
+            pa_msleep((unsigned long) ((next - t) / PA_USEC_PER_MSEC));
+    }
+
+    return max_stall;
+}
+
+static void writer_thread(void *userdata) {
+    pa_stream *s = userdata;
+    size_t l;
+    int r;
+
+    l = pa_usec_to_bytes(PERIOD_USEC, &sample_spec);
+
+    /* Keeps going until the stream is pulled away under our feet */
+    do {
+        r = pa_stream_write_lockfree(s, silence, l);
+        (void) pa_stream_writable_size_lockfree(s);
+    } while (r == 0 || r == -PA_ERR_BUSY);
+
+    pa_assert_se(r == -PA_ERR_BADSTATE);
+    pa_assert_se(pa_stream_writable_size_lockfree(s) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop_api *a;
+    pa_context *c;
+    pa_stream *s = NULL;
+    pa_thread *writer = NULL;
+    pa_usec_t locked, lockfree;
+    unsigned n_busy_locked, n_busy_lockfree;
+    struct timeval tv;
+    int ret = 1;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_threaded_mainloop_new());
+    a = pa_threaded_mainloop_get_api(m);
+
+    pa_assert_se(c = pa_context_new(a, argv[0]));
+    pa_context_set_state_callback(c, context_state_cb, NULL);
+
+    pa_threaded_mainloop_lock(m);
+    pa_assert_se(pa_threaded_mainloop_start(m) >= 0);
+
+    if (pa_context_connect(c, NULL, 0, NULL) < 0)
+        goto fail;
+
+    for (;;) {
+        pa_context_state_t state = pa_context_get_state(c);
+
+        if (state == PA_CONTEXT_READY)
+            break;
+
+        if (!PA_CONTEXT_IS_GOOD(state))
+            goto fail;
+
+        pa_threaded_mainloop_wait(m);
+    }
+
+    pa_assert_se(s = pa_stream_new(c, "lockfree-stream-test", &sample_spec, NULL));
+    pa_stream_set_state_callback(s, stream_state_cb, NULL);
+    pa_assert_se(pa_stream_enable_lockfree(s) == 0);
+
+    if (pa_stream_connect_playback(s, NULL, NULL, PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE, NULL, NULL) < 0)
+        goto fail;
+
+    for (;;) {
+        pa_stream_state_t state = pa_stream_get_state(s);
+
+        if (state == PA_STREAM_READY)
+            break;
+
+        if (!PA_STREAM_IS_GOOD(state))
+            goto fail;
+
+        pa_threaded_mainloop_wait(m);
+    }
+
+    busy_event = a->time_new(a, pa_timeval_rtstore(&tv, pa_rtclock_now() + BUSY_INTERVAL_USEC, TRUE), busy_cb, NULL);
+    pa_threaded_mainloop_unlock(m);
+
+    locked = run(s, FALSE, &n_busy_locked);
+    lockfree = run(s, TRUE, &n_busy_lockfree);
+
+    pa_log_info("Worst case stall per period: %llu usec with the lock, %llu usec lock-free (%u writes deferred)",
+                (unsigned long long) locked, (unsigned long long) lockfree, n_busy_lockfree);
+
+    pa_threaded_mainloop_lock(m);
+    a->time_free(busy_event);
+    pa_assert_se(writer = pa_thread_new(writer_thread, s));
+    pa_threaded_mainloop_unlock(m);
+
+    pa_msleep(20);
+
+    pa_threaded_mainloop_lock(m);
+    pa_stream_disconnect(s);
+
+    ret = 0;
+
+fail:
+    if (ret != 0)
+        pa_log("Connection failed: %s", pa_strerror(pa_context_errno(c)));
+
+    pa_context_disconnect(c);
+    pa_threaded_mainloop_unlock(m);
+    pa_threaded_mainloop_stop(m);
+
+    /* The writer may still be running while the context goes away */
+    pa_context_unref(c);
+
+    if (writer)
+        pa_thread_free(writer);
+
+    if (s)
+        pa_stream_unref(s);
+
+    pa_threaded_mainloop_free(m);
+
+    return ret;
+}
@@ -0,0 +1,267 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#else
+#include <pulsecore/poll.h>
+#endif
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Checks the time and IO event semantics of pa_mainloop with many
+ * events: time events fire in the order of their deadlines and only
+ * once, restarting and freeing them from callbacks works, and only the
+ * IO events that are ready are dispatched, both with and without a
+ * custom poll function. */
+
+#define N_TIMERS 2000
+#define N_PIPES 200
+#define SPREAD_USEC (100*PA_USEC_PER_MSEC)
+
+static pa_time_event *timers[N_TIMERS];
+static pa_usec_t deadlines[N_TIMERS];
+static unsigned fired[N_TIMERS];
+static pa_bool_t disabled[N_TIMERS];
+static pa_usec_t last_deadline;
+static unsigned n_fired, n_freed;
+
+static int pipes[N_PIPES][2];
+static pa_io_event *ios[N_PIPES];
+static unsigned io_fired[N_PIPES];
+
+static void timer_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    unsigned i = PA_PTR_TO_UINT(userdata);
+    struct timeval ttv = *tv;
+
+    pa_assert_se(timers[i] == e);
+    pa_assert_se(!disabled[i]);
+
+    ttv.tv_usec &= ~PA_TIMEVAL_RTCLOCK;
+    pa_assert_se(pa_timeval_load(&ttv) == deadlines[i]);
+
+    /* Deadlines are handed out in order */
+    pa_assert_se(deadlines[i] >= last_deadline);
+    last_deadline = deadlines[i];
+
+    fired[i]++;
+    n_fired++;
+
+    /* Every third timer frees the timer after it, which then must
+     * not fire anymore */
+    if (i % 3 == 0 && i + 1 < N_TIMERS && timers[i+1] && !fired[i+1] && !disabled[i+1]) {
+        a->time_free(timers[i+1]);
+        timers[i+1] = NULL;
+        n_freed++;
+    }
+}
+
+static pa_usec_t restarted_at;
+static unsigned n_restarted;
+
+static void restart_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval ntv;
+
+    n_restarted++;
+
+    /* Restarting with a time in the past must not make us loop within
+     * one dispatch */
+    if (n_restarted < 3)
+        a->time_restart(e, pa_timeval_rtstore(&ntv, restarted_at, TRUE));
+}
+
+static void io_cb(pa_mainloop_api *a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    unsigned i = PA_PTR_TO_UINT(userdata);
+    char c;
+
+    pa_assert_se(ios[i] == e);
+    pa_assert_se(f & PA_IO_EVENT_INPUT);
+    pa_assert_se(read(fd, &c, 1) == 1);
+
+    io_fired[i]++;
+}
+
+static unsigned n_polls;
+
+static int poll_func(struct pollfd *ufds, unsigned long nfds, int timeout, void *userdata) {
+    n_polls++;
+    return poll(ufds, nfds, timeout);
+}
+
+static void run_timers(pa_mainloop *m) {
+    pa_mainloop_api *a = pa_mainloop_get_api(m);
+    pa_usec_t now, t;
+    struct timeval tv;
+    unsigned i;
+
+    now = pa_rtclock_now();
+    last_deadline = 0;
+    n_fired = n_freed = 0;
+
+    for (i = 0; i < N_TIMERS; i++) {
+        fired[i] = 0;
+        disabled[i] = FALSE;
+        deadlines[i] = now + (pa_usec_t) (rand() % SPREAD_USEC);
+        pa_assert_se(timers[i] = a->time_new(a, pa_timeval_rtstore(&tv, deadlines[i], TRUE), timer_cb, PA_UINT_TO_PTR(i)));
+    }
+
+    /* Move some of them around, and disable a few */
+    for (i = 0; i < N_TIMERS; i += 7) {
+        deadlines[i] = now + (pa_usec_t) (rand() % SPREAD_USEC);
+        a->time_restart(timers[i], pa_timeval_rtstore(&tv, deadlines[i], TRUE));
+    }
+
+    for (i = 5; i < N_TIMERS; i += 50) {
+        a->time_restart(timers[i], NULL);
+        disabled[i] = TRUE;
+    }
+
+    t = pa_rtclock_now();
+    while (n_fired + n_freed < N_TIMERS - N_TIMERS / 50)
+        pa_assert_se(pa_mainloop_iterate(m, 1, NULL) >= 0);
+    t = pa_rtclock_now() - t;
+
+    for (i = 0; i < N_TIMERS; i++) {
+        if (disabled[i])
+            pa_assert_se(fired[i] == 0);
+        else if (timers[i])
+            pa_assert_se(fired[i] == 1);
+
+        if (timers[i])
+            a->time_free(timers[i]);
+    }
+
+    pa_log_info("%u timers fired, %u freed from callbacks, in %llu usec",
+                n_fired, n_freed, (unsigned long long) t);
+}
+
+static void run_restart(pa_mainloop *m) {
+    pa_mainloop_api *a = pa_mainloop_get_api(m);
+    pa_time_event *e;
+    struct timeval tv;
+
+    n_restarted = 0;
+    restarted_at = pa_rtclock_now();
+
+    pa_assert_se(e = a->time_new(a, pa_timeval_rtstore(&tv, restarted_at, TRUE), restart_cb, NULL));
+
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    pa_assert_se(n_restarted == 1);
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    pa_assert_se(n_restarted == 2);
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    pa_assert_se(n_restarted == 3);
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    pa_assert_se(n_restarted == 3);
+
+    a->time_free(e);
+}
+
+static void run_io(pa_mainloop *m) {
+    pa_mainloop_api *a = pa_mainloop_get_api(m);
+    pa_io_event *twin;
+    unsigned i, n = 0, k;
+
+    for (i = 0; i < N_PIPES; i++) {
+        pa_assert_se(pipe(pipes[i]) == 0);
+        pa_make_fd_nonblock(pipes[i][0]);
+        io_fired[i] = 0;
+        pa_assert_se(ios[i] = a->io_new(a, pipes[i][0], PA_IO_EVENT_INPUT, io_cb, PA_UINT_TO_PTR(i)));
+    }
+
+    /* Some with nothing to read, some that are not interested */
+    for (i = 0; i < N_PIPES; i += 3) {
+        pa_assert_se(write(pipes[i][1], "x", 1) == 1);
+        n++;
+    }
+
+    for (i = 1; i < N_PIPES; i += 9) {
+        pa_assert_se(write(pipes[i][1], "x", 1) == 1);
+        a->io_enable(ios[i], PA_IO_EVENT_NULL);
+    }
+
+    pa_assert_se(pa_mainloop_iterate(m, 1, NULL) == (int) n);
+
+    for (i = 0; i < N_PIPES; i++)
+        pa_assert_se(io_fired[i] == (i % 3 == 0 ? 1U : 0U));
+
+    /* Nothing is ready anymore */
+    pa_assert_se(pa_mainloop_iterate(m, 0, NULL) == 0);
+
+    /* Re-enabled ones fire now */
+    for (i = 1, k = 0; i < N_PIPES; i += 9, k++)
+        a->io_enable(ios[i], PA_IO_EVENT_INPUT);
+
+    pa_assert_se(pa_mainloop_iterate(m, 1, NULL) == (int) k);
+
+    /* Watching the same fd twice works too */
+    pa_assert_se(twin = a->io_new(a, pipes[2][0], PA_IO_EVENT_INPUT, io_cb, PA_UINT_TO_PTR(2)));
+    pa_assert_se(write(pipes[4][1], "x", 1) == 1);
+    pa_assert_se(pa_mainloop_iterate(m, 1, NULL) == 1);
+    pa_assert_se(io_fired[4] == 1);
+    a->io_free(twin);
+
+    for (i = 0; i < N_PIPES; i++) {
+        a->io_free(ios[i]);
+        pa_close_pipe(pipes[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand((unsigned) time(NULL));
+
+    pa_assert_se(m = pa_mainloop_new());
+    run_timers(m);
+    run_restart(m);
+    run_io(m);
+    pa_mainloop_free(m);
+
+    /* Same again, with a poll function like the threaded main loop
+     * uses */
+    pa_assert_se(m = pa_mainloop_new());
+    pa_mainloop_set_poll_func(m, poll_func, NULL);
+    run_timers(m);
+    run_restart(m);
+    run_io(m);
+    pa_mainloop_free(m);
+
+    pa_assert_se(n_polls > 0);
+
+    return 0;
+}
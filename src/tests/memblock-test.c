@@ -119,6 +119,16 @@ int main(int argc, char *argv[]) {
 
         pa_assert(import_b && import_c);
 
+        /* Anonymous segments cannot be looked up by id, they need to
+         * be passed explicitly */
+        if (pa_mempool_get_memfd(pool_a) >= 0) {
+            pa_assert_se(pa_memimport_attach_memfd(import_b, id_a, dup(pa_mempool_get_memfd(pool_a))) >= 0);
+            pa_assert_se(pa_memimport_attach_memfd(import_c, id_a, dup(pa_mempool_get_memfd(pool_a))) >= 0);
+        }
+
+        if (pa_mempool_get_memfd(pool_b) >= 0)
+            pa_assert_se(pa_memimport_attach_memfd(import_c, id_b, dup(pa_mempool_get_memfd(pool_b))) >= 0);
+
         r = pa_memexport_put(export_a, mb_a, &id, &shm_id, &offset, &size);
         pa_assert(r >= 0);
         pa_assert(shm_id == id_a);
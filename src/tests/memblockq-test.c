@@ -25,11 +25,12 @@
 #include <assert.h>
 #include <stdio.h>
 #include <signal.h>
+#include <string.h>
 
 #include <pulsecore/memblockq.h>
 #include <pulsecore/log.h>
 
-static void dump(pa_memblockq *bq) {
+static void dump(pa_memblockq *bq, char *t) {
     printf(">");
 
     for (;;) {
@@ -42,8 +43,12 @@ static void dump(pa_memblockq *bq) {
             break;
 
         q = pa_memblock_acquire(out.memblock);
-        for (e = (char*) q + out.index, n = 0; n < out.length; n++)
+        for (e = (char*) q + out.index, n = 0; n < out.length; n++) {
             printf("%c", *e);
+
+            if (t)
+                *(t++) = *e;
+        }
         pa_memblock_release(out.memblock);
 
         pa_memblock_unref(out.memblock);
@@ -51,6 +56,31 @@ static void dump(pa_memblockq *bq) {
     }
 
     printf("<\n");
+
+    if (t)
+        *t = 0;
+}
+
+/* Everything up to the write index in one go, without dropping it */
+static void peekv(pa_memblockq *bq, char *t) {
+    pa_memchunk chunks[64];
+    unsigned n, i;
+
+    n = pa_memblockq_peekv(bq, chunks, 64);
+    assert(n < 64);
+
+    for (i = 0; i < n; i++) {
+        void *q;
+
+        q = pa_memblock_acquire(chunks[i].memblock);
+        memcpy(t, (char*) q + chunks[i].index, chunks[i].length);
+        t += chunks[i].length;
+        pa_memblock_release(chunks[i].memblock);
+
+        pa_memblock_unref(chunks[i].memblock);
+    }
+
+    *t = 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -60,6 +90,7 @@ int main(int argc, char *argv[]) {
     pa_memblockq *bq;
     pa_memchunk chunk1, chunk2, chunk3, chunk4;
     pa_memchunk silence;
+    char v[128], d[128];
 
     pa_log_set_level(PA_LOG_DEBUG);
 
@@ -145,11 +176,15 @@ int main(int argc, char *argv[]) {
 
     pa_memblockq_seek(bq, 30, PA_SEEK_RELATIVE, TRUE);
 
-    dump(bq);
+    peekv(bq, v);
+    dump(bq, d);
+    assert(strcmp(v, d) == 0);
 
     pa_memblockq_rewind(bq, 52);
 
-    dump(bq);
+    peekv(bq, v);
+    dump(bq, d);
+    assert(strcmp(v, d) == 0);
 
     pa_memblockq_free(bq);
     pa_memblock_unref(silence.memblock);
@@ -0,0 +1,231 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/esound.h>
+
+/* Floods the ESD and/or the simple protocol with silence as fast as
+ * the server accepts it and reports the server's CPU time per MB of
+ * audio data. The modules need to be loaded with auth-anonymous=1 or
+ * ~/.esd_auth must be readable. Start like this:
+ *
+ *   protocol-flood-test <server pid> <esd socket|-> <simple socket|-> [MB]
+ *
+ * The simple protocol module is expected to use the default sample
+ * spec (s16le, 2ch, 44.1 kHz). */
+
+#define BUFSIZE (64*1024)
+
+static int connect_unix(const char *path) {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_un un;
+    } sa;
+    int fd;
+
+    if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "socket(): %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.un.sun_family = AF_UNIX;
+    strncpy(sa.un.sun_path, path, sizeof(sa.un.sun_path)-1);
+
+    if (connect(fd, &sa.sa, sizeof(sa.un)) < 0) {
+        fprintf(stderr, "connect(%s): %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int write_all(int fd, const void *data, size_t length) {
+    const uint8_t *p = data;
+
+    while (length > 0) {
+        ssize_t r;
+
+        if ((r = write(fd, p, length)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "write(): %s\n", strerror(errno));
+            return -1;
+        }
+
+        p += r;
+        length -= (size_t) r;
+    }
+
+    return 0;
+}
+
+static int esd_handshake(int fd) {
+    int32_t request, format, rate, ok = 0;
+    uint32_t endian = ESD_ENDIAN_KEY;
+    uint8_t key[ESD_KEY_LEN];
+    char name[ESD_NAME_MAX];
+    char fn[256];
+    const char *home;
+    int kfd;
+
+    memset(key, 0, sizeof(key));
+
+    if ((home = getenv("HOME"))) {
+        snprintf(fn, sizeof(fn), "%s/.esd_auth", home);
+
+        if ((kfd = open(fn, O_RDONLY)) >= 0) {
+            if (read(kfd, key, sizeof(key)) != sizeof(key))
+                memset(key, 0, sizeof(key));
+            close(kfd);
+        }
+    }
+
+    request = ESD_PROTO_CONNECT;
+    if (write_all(fd, &request, sizeof(request)) < 0 ||
+        write_all(fd, key, sizeof(key)) < 0 ||
+        write_all(fd, &endian, sizeof(endian)) < 0)
+        return -1;
+
+    if (read(fd, &ok, sizeof(ok)) != sizeof(ok) || !ok) {
+        fprintf(stderr, "ESD authentication failed.\n");
+        return -1;
+    }
+
+    request = ESD_PROTO_STREAM_PLAY;
+    format = ESD_BITS16|ESD_STEREO|ESD_STREAM|ESD_PLAY;
+    rate = ESD_DEFAULT_RATE;
+    memset(name, 0, sizeof(name));
+    strncpy(name, "protocol-flood-test", sizeof(name)-1);
+
+    if (write_all(fd, &request, sizeof(request)) < 0 ||
+        write_all(fd, &format, sizeof(format)) < 0 ||
+        write_all(fd, &rate, sizeof(rate)) < 0 ||
+        write_all(fd, name, sizeof(name)) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Returns utime+stime of the given process in seconds */
+static double process_cpu(pid_t pid) {
+    char fn[64], buf[1024], *p;
+    unsigned long utime, stime;
+    FILE *f;
+
+    snprintf(fn, sizeof(fn), "/proc/%lu/stat", (unsigned long) pid);
+
+    if (!(f = fopen(fn, "r")))
+        return -1;
+
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    /* Skip over the process name which might contain spaces */
+    if (!p || !(p = strrchr(buf, ')')))
+        return -1;
+
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+static void flood(const char *what, const char *path, pid_t pid, size_t mb) {
+    static uint8_t buf[BUFSIZE];
+    struct timeval start, end;
+    double cpu_start, cpu_end, elapsed;
+    size_t total = mb * 1024 * 1024, written = 0;
+    int fd;
+
+    if ((fd = connect_unix(path)) < 0)
+        return;
+
+    if (strcmp(what, "esd") == 0 && esd_handshake(fd) < 0) {
+        close(fd);
+        return;
+    }
+
+    cpu_start = process_cpu(pid);
+    pa_gettimeofday(&start);
+
+    while (written < total) {
+        size_t l = total - written > sizeof(buf) ? sizeof(buf) : total - written;
+
+        if (write_all(fd, buf, l) < 0)
+            break;
+
+        written += l;
+    }
+
+    pa_gettimeofday(&end);
+    cpu_end = process_cpu(pid);
+
+    close(fd);
+
+    elapsed = (double) pa_timeval_diff(&end, &start) / PA_USEC_PER_SEC;
+
+    fprintf(stderr, "%s: %lu bytes in %0.2f s (%0.1f KB/s), server CPU %0.3f s per MB\n",
+            what,
+            (unsigned long) written,
+            elapsed, (double) written / 1024 / elapsed,
+            cpu_start >= 0 && cpu_end >= 0 ? (cpu_end - cpu_start) * 1024 * 1024 / (double) written : -1);
+}
+
+int main(int argc, char *argv[]) {
+    pid_t pid;
+    size_t mb = 2;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <server pid> <esd socket|-> <simple socket|-> [MB]\n", argv[0]);
+        return 1;
+    }
+
+    pid = (pid_t) atoi(argv[1]);
+
+    if (argc > 4)
+        mb = (size_t) atoi(argv[4]);
+
+    assert(mb > 0);
+
+    if (strcmp(argv[2], "-"))
+        flood("esd", argv[2], pid, mb);
+
+    if (strcmp(argv[3], "-"))
+        flood("simple", argv[3], pid, mb);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <pulse/timeval.h>
+
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rate-control.h>
+
+/* Simulates a loopback between two devices whose clocks drift apart:
+ * the source delivers blocks at a slightly wrong pace, the sink pulls
+ * a block every period and resamples with the rate the controller
+ * gives us. Everything is driven by a virtual clock, so the test runs
+ * instantly. Checks that latency and rate settle within a few
+ * seconds. */
+
+#define RATE 48000
+#define PERIOD_USEC (10*PA_USEC_PER_MSEC)
+#define SOURCE_BLOCK_USEC (7*PA_USEC_PER_MSEC)
+#define TARGET_USEC (50*PA_USEC_PER_MSEC)
+#define INTERVAL_USEC (250*PA_USEC_PER_MSEC)
+#define MAX_DEVIATION 0.01
+#define DURATION_USEC (60*PA_USEC_PER_SEC)
+#define AVERAGE_USEC (20*PA_USEC_PER_SEC)
+
+/* Returns the time in usec after which the minimum latency in every
+ * interval stayed within 1ms of the target until the end of the
+ * simulation, and the average ratio over the last AVERAGE_USEC in
+ * *avg_ratio */
+static pa_usec_t simulate(double drift_ppm, double initial_latency_usec, double *avg_ratio) {
+    pa_rate_control *c;
+    pa_usec_t now, settled = 0, window_start = 0;
+    double rate = RATE;
+    double produced, consumed = 0, window_min = -1, ratio_sum = 0;
+    unsigned n_ratio = 0;
+
+    pa_assert_se(c = pa_rate_control_new(RATE, INTERVAL_USEC, MAX_DEVIATION));
+
+    /* Both counted in usec of source audio */
+    produced = initial_latency_usec;
+
+    for (now = 0; now < DURATION_USEC; now += PERIOD_USEC) {
+        double source_time, latency;
+
+        /* The source's clock runs at (1 + drift) times ours, and
+         * hands out its data in blocks whose size is unrelated to our
+         * period, so what we see is a sawtooth on top of the real
+         * latency */
+        source_time = (double) now * (1.0 + drift_ppm / 1000000.0);
+        latency = produced + source_time - fmod(source_time, SOURCE_BLOCK_USEC) - consumed;
+
+        /* The sink consumes one period of its own audio, which
+         * corresponds to rate/RATE periods of source audio */
+        consumed += PERIOD_USEC * rate / RATE;
+        latency -= PERIOD_USEC * rate / RATE;
+        pa_assert(latency > 0);
+
+        pa_rate_control_update(c, now, (pa_usec_t) latency, TARGET_USEC, &rate);
+
+        if (window_min < 0 || latency < window_min)
+            window_min = latency;
+
+        if (now >= window_start + INTERVAL_USEC) {
+
+            if (fabs(window_min - TARGET_USEC) >= PA_USEC_PER_MSEC)
+                settled = 0;
+            else if (settled == 0)
+                settled = now;
+
+            window_start = now;
+            window_min = -1;
+        }
+
+        if (now >= DURATION_USEC - AVERAGE_USEC) {
+            ratio_sum += rate / RATE;
+            n_ratio++;
+        }
+    }
+
+    *avg_ratio = ratio_sum / n_ratio;
+
+    pa_rate_control_free(c);
+
+    return settled;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        double drift_ppm;
+        double initial_latency_usec;
+    } cases[] = {
+        { 0, TARGET_USEC },
+        { 100, TARGET_USEC },
+        { -100, TARGET_USEC },
+        { 300, 80*PA_USEC_PER_MSEC },
+        { -300, 30*PA_USEC_PER_MSEC },
+        { 1000, 150*PA_USEC_PER_MSEC },
+    };
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (i = 0; i < PA_ELEMENTSOF(cases); i++) {
+        pa_usec_t settled;
+        double ratio, ratio_error_ppm;
+
+        settled = simulate(cases[i].drift_ppm, cases[i].initial_latency_usec, &ratio);
+        ratio_error_ppm = (ratio - 1.0) * 1000000.0 - cases[i].drift_ppm;
+
+        pa_log_debug("drift %+0.0f ppm, initial latency %0.0f ms: settled after %0.2f s, ratio error %+0.2f ppm",
+                     cases[i].drift_ppm,
+                     cases[i].initial_latency_usec / PA_USEC_PER_MSEC,
+                     (double) settled / PA_USEC_PER_SEC,
+                     ratio_error_ppm);
+
+        pa_assert(settled > 0);
+        pa_assert(settled <= 15*PA_USEC_PER_SEC);
+        pa_assert(fabs(ratio_error_ppm) < 10);
+    }
+
+    return 0;
+}
@@ -0,0 +1,290 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/sink.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+/* Plays a lazy sample through the background loader: the first play
+ * waits for the sample to be loaded, a play that is cancelled like on
+ * a client disconnect must never be reported, and a conversion to the
+ * sample spec of a sink that fails must be cleaned up properly. The
+ * sinks only process messages and never render anything. */
+
+#define N_FRAMES 4410
+
+struct test_sink {
+    pa_sink *sink;
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+};
+
+struct play {
+    unsigned n;
+    int r;
+    uint32_t idx;
+};
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+/* A 16 bit stereo WAV file at 44.1 kHz with a ramp */
+static void write_wav(const char *fn) {
+    uint8_t h[44];
+    unsigned i;
+    FILE *f;
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, 36 + N_FRAMES * 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32(h + 16, 16);
+    put_u16(h + 20, 1);
+    put_u16(h + 22, 2);
+    put_u32(h + 24, 44100);
+    put_u32(h + 28, 44100 * 4);
+    put_u16(h + 32, 4);
+    put_u16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, N_FRAMES * 4);
+
+    pa_assert_se(f = fopen(fn, "w"));
+    pa_assert_se(fwrite(h, sizeof(h), 1, f) == 1);
+
+    for (i = 0; i < N_FRAMES * 2; i++) {
+        uint8_t s[2];
+
+        put_u16(s, (uint16_t) i);
+        pa_assert_se(fwrite(s, 2, 1, f) == 1);
+    }
+
+    pa_assert_se(fclose(f) == 0);
+}
+
+/* Removes the files in dir and in its subdirectories, and dir itself */
+static void remove_dir(const char *dir) {
+    DIR *d;
+    struct dirent *de;
+
+    pa_assert_se(d = opendir(dir));
+
+    while ((de = readdir(d))) {
+        char *f;
+
+        if (de->d_name[0] == '.')
+            continue;
+
+        f = pa_sprintf_malloc("%s/%s", dir, de->d_name);
+
+        if (unlink(f) < 0)
+            remove_dir(f);
+
+        pa_xfree(f);
+    }
+
+    closedir(d);
+    pa_assert_se(rmdir(dir) == 0);
+}
+
+static void sink_thread_func(void *userdata) {
+    struct test_sink *t = userdata;
+
+    pa_thread_mq_install(&t->thread_mq);
+
+    /* Nothing but messages to process */
+    while (pa_rtpoll_run(t->rtpoll, TRUE) > 0)
+        ;
+}
+
+static struct test_sink* test_sink_new(pa_core *c, const char *name, uint32_t rate) {
+    struct test_sink *t;
+    pa_sink_new_data data;
+    pa_sample_spec ss;
+    pa_channel_map map;
+
+    ss.format = PA_SAMPLE_S16NE;
+    ss.rate = rate;
+    ss.channels = 2;
+    pa_channel_map_init_stereo(&map);
+
+    t = pa_xnew0(struct test_sink, 1);
+    t->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&t->thread_mq, c->mainloop, t->rtpoll);
+
+    pa_sink_new_data_init(&data);
+    data.driver = __FILE__;
+    pa_sink_new_data_set_name(&data, name);
+    pa_sink_new_data_set_sample_spec(&data, &ss);
+    pa_sink_new_data_set_channel_map(&data, &map);
+    pa_assert_se(t->sink = pa_sink_new(c, &data, 0));
+    pa_sink_new_data_done(&data);
+
+    pa_sink_set_asyncmsgq(t->sink, t->thread_mq.inq);
+    pa_sink_set_rtpoll(t->sink, t->rtpoll);
+
+    pa_assert_se(t->thread = pa_thread_new(sink_thread_func, t));
+    pa_sink_put(t->sink);
+
+    return t;
+}
+
+static void test_sink_free(struct test_sink *t) {
+    pa_sink_unlink(t->sink);
+
+    pa_asyncmsgq_send(t->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(t->thread);
+
+    pa_sink_unref(t->sink);
+    pa_thread_mq_done(&t->thread_mq);
+    pa_rtpoll_free(t->rtpoll);
+    pa_xfree(t);
+}
+
+static void play_cb(pa_core *c, int r, uint32_t sink_input_idx, void *userdata) {
+    struct play *p = userdata;
+
+    p->n++;
+    p->r = r;
+    p->idx = sink_input_idx;
+}
+
+int main(int argc, char *argv[]) {
+    char dir[] = "/tmp/scache-test.XXXXXX";
+    char *fn;
+    pa_mainloop *m;
+    pa_core *c;
+    struct test_sink *a, *b;
+    pa_scache_entry *e;
+    struct play played, cancelled, converted;
+    uint32_t idx;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    /* The sound file cache goes there too */
+    pa_assert_se(mkdtemp(dir));
+    pa_assert_se(setenv("PULSE_STATE_PATH", dir, 1) == 0);
+
+    fn = pa_sprintf_malloc("%s/test.wav", dir);
+    write_wav(fn);
+
+    pa_assert_se(m = pa_mainloop_new());
+    pa_assert_se(c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0));
+
+    /* a is in the sample spec of the sample, b is not */
+    a = test_sink_new(c, "a", 44100);
+    b = test_sink_new(c, "b", 48000);
+
+    pa_assert_se(pa_scache_add_file_lazy(c, "sample", fn, &idx) == 0);
+    pa_assert_se(e = pa_idxset_get_by_index(c->scache, idx));
+    pa_assert_se(!e->memchunk.memblock);
+
+    /* The play has to wait for the loader */
+    memset(&played, 0, sizeof(played));
+    pa_assert_se(pa_scache_play_item_async(c, "sample", a->sink, PA_VOLUME_NORM, NULL, play_cb, &played) == 0);
+    pa_assert_se(e->load_job);
+    pa_assert_se(e->pending);
+    pa_assert_se(played.n == 0);
+
+    while (played.n == 0)
+        pa_assert_se(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    pa_assert_se(played.n == 1);
+    pa_assert_se(played.r == 0);
+    pa_assert_se(pa_idxset_get_by_index(c->sink_inputs, played.idx));
+    pa_assert_se(e->memchunk.memblock);
+    pa_assert_se(e->memchunk.length == N_FRAMES * 4);
+    pa_assert_se(!e->load_job);
+    pa_assert_se(!e->pending);
+
+    /* Drop it again, and cancel the next play before it is loaded, as
+     * a disconnecting client would */
+    c->scache_idle_time = 0;
+    e->last_used_time = 0;
+    pa_scache_unload_unused(c);
+    pa_assert_se(!e->memchunk.memblock);
+
+    memset(&cancelled, 0, sizeof(cancelled));
+    pa_assert_se(pa_scache_play_item_async(c, "sample", a->sink, PA_VOLUME_NORM, NULL, play_cb, &cancelled) == 0);
+    pa_assert_se(e->load_job);
+
+    pa_scache_cancel_pending(c, &cancelled);
+    pa_assert_se(!e->pending);
+
+    while (e->load_job)
+        pa_assert_se(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    pa_assert_se(cancelled.n == 0);
+    pa_assert_se(e->memchunk.memblock);
+
+    /* Converting to the sample spec of b fails with a resampler that
+     * cannot change the rate. The play itself is done without the
+     * converted copy and fails for the same reason. */
+    c->resample_method = PA_RESAMPLER_COPY;
+
+    memset(&converted, 0, sizeof(converted));
+    pa_assert_se(pa_scache_play_item_async(c, "sample", b->sink, PA_VOLUME_NORM, NULL, play_cb, &converted) == 0);
+    pa_assert_se(converted.n == 1);
+    pa_assert_se(converted.r < 0);
+    pa_assert_se(e->n_converted == 1);
+
+    while (e->n_converted > 0)
+        pa_assert_se(pa_mainloop_iterate(m, TRUE, NULL) >= 0);
+
+    pa_assert_se(!e->converted);
+
+    test_sink_free(a);
+    test_sink_free(b);
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+
+    pa_xfree(fn);
+    remove_dir(dir);
+
+    return 0;
+}
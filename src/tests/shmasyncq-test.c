@@ -0,0 +1,111 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/shmasyncq.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
+
+#define N_ELEMENTS 8
+#define ELEMENT_SIZE 64
+#define N_ITEMS 10000
+
+static void producer(void *_q) {
+    pa_shmasyncq *q = _q;
+    unsigned i;
+
+    for (i = 0; i < N_ITEMS; i++) {
+        uint8_t *d;
+
+        pa_assert_se(d = pa_shmasyncq_push_begin(q, TRUE));
+        memset(d, (int) (i & 0xFF), ELEMENT_SIZE);
+        memcpy(d, &i, sizeof(i));
+        pa_shmasyncq_push_commit(q);
+    }
+
+    printf("pushed end\n");
+}
+
+static void consumer(void *_q) {
+    pa_shmasyncq *q = _q;
+    unsigned i;
+
+    usleep(100000);
+
+    for (i = 0; i < N_ITEMS; i++) {
+        uint8_t *d;
+        unsigned j;
+
+        pa_assert_se(d = pa_shmasyncq_pop_begin(q, TRUE));
+        memcpy(&j, d, sizeof(j));
+        pa_assert(j == i);
+        pa_assert(d[ELEMENT_SIZE-1] == (i & 0xFF));
+        pa_shmasyncq_pop_commit(q);
+    }
+
+    pa_assert(!pa_shmasyncq_pop_begin(q, FALSE));
+
+    printf("popped end\n");
+}
+
+int main(int argc, char *argv[]) {
+    pa_shmasyncq *w, *r;
+    pa_thread *t1, *t2;
+    void *data;
+    int fd[2], ofd[2];
+    size_t size;
+
+    size = PA_SHMASYNCQ_SIZE(N_ELEMENTS, ELEMENT_SIZE);
+    data = pa_xmalloc(size);
+
+    pa_assert_se(w = pa_shmasyncq_new(N_ELEMENTS, ELEMENT_SIZE, data, fd));
+
+    /* A truncated segment must be refused */
+    ofd[0] = dup(fd[0]);
+    ofd[1] = dup(fd[1]);
+    pa_assert_se(!pa_shmasyncq_open(data, size - 1, ofd));
+
+    ofd[0] = dup(fd[0]);
+    ofd[1] = dup(fd[1]);
+    pa_assert_se(r = pa_shmasyncq_open(data, size, ofd));
+
+    pa_assert_se(pa_shmasyncq_get_n_elements(r) == N_ELEMENTS);
+    pa_assert_se(pa_shmasyncq_get_element_size(r) == ELEMENT_SIZE);
+
+    pa_assert_se(t1 = pa_thread_new(producer, w));
+    pa_assert_se(t2 = pa_thread_new(consumer, r));
+
+    pa_thread_free(t1);
+    pa_thread_free(t2);
+
+    pa_shmasyncq_free(r);
+    pa_shmasyncq_free(w);
+    pa_xfree(data);
+
+    return 0;
+}
@@ -0,0 +1,284 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+#include <pulse/simple.h>
+#include <pulse/thread-mainloop.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/thread.h>
+
+/* Plays a pattern through a buffered pa_simple connection into a null
+ * sink and records the sink's monitor. The buffer attributes ask for
+ * more than fits into a single memory block at once, so the writer has
+ * to split its chunks. Checks that the pattern arrives complete and in
+ * order, that pa_simple_drain() does not return before the data that
+ * was queued lock-free is played, and that a write with a timeout
+ * returns early with a partial count. Needs a running server. */
+
+#define SINK_NAME "simple_buffered_test"
+#define PATTERN_USEC (2*PA_USEC_PER_SEC)
+#define RECORD_USEC (10*PA_USEC_PER_SEC)
+#define TIMEOUT_USEC (300*PA_USEC_PER_MSEC)
+#define LONG_WRITE_USEC (5*PA_USEC_PER_SEC)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_threaded_mainloop *m = NULL;
+static pa_context *context = NULL;
+static uint32_t module_index = PA_INVALID_INDEX;
+
+static pa_simple *recorder = NULL;
+static uint8_t *recorded = NULL;
+static size_t n_recorded = 0, record_length;
+static pa_atomic_t stop_recording = PA_ATOMIC_INIT(0);
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    module_index = idx;
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void unloaded_cb(pa_context *c, int success, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+/* Called with the lock held */
+static void wait_for(pa_operation *o) {
+    pa_assert(o);
+
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(m);
+
+    pa_operation_unref(o);
+}
+
+static pa_bool_t load_sink(void) {
+    pa_assert_se(m = pa_threaded_mainloop_new());
+    pa_assert_se(context = pa_context_new(pa_threaded_mainloop_get_api(m), "simple-buffered-test"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    pa_threaded_mainloop_lock(m);
+    pa_assert_se(pa_threaded_mainloop_start(m) >= 0);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+        goto fail;
+
+    for (;;) {
+        pa_context_state_t state = pa_context_get_state(context);
+
+        if (state == PA_CONTEXT_READY)
+            break;
+
+        if (!PA_CONTEXT_IS_GOOD(state))
+            goto fail;
+
+        pa_threaded_mainloop_wait(m);
+    }
+
+    wait_for(pa_context_load_module(context, "module-null-sink", "sink_name=" SINK_NAME " format=s16le rate=44100 channels=2", loaded_cb, NULL));
+
+    if (module_index == PA_INVALID_INDEX)
+        goto fail;
+
+    pa_threaded_mainloop_unlock(m);
+    return TRUE;
+
+fail:
+    pa_log("Failed to load module-null-sink: %s", pa_strerror(pa_context_errno(context)));
+    pa_threaded_mainloop_unlock(m);
+    return FALSE;
+}
+
+static void unload_sink(void) {
+    pa_threaded_mainloop_lock(m);
+
+    if (module_index != PA_INVALID_INDEX)
+        wait_for(pa_context_unload_module(context, module_index, unloaded_cb, NULL));
+
+    pa_context_disconnect(context);
+    pa_threaded_mainloop_unlock(m);
+    pa_threaded_mainloop_stop(m);
+
+    pa_context_unref(context);
+    pa_threaded_mainloop_free(m);
+}
+
+static void record_thread(void *userdata) {
+    size_t chunk;
+
+    chunk = pa_usec_to_bytes(PA_USEC_PER_SEC, &sample_spec);
+
+    /* Short timeouts, so that we notice quickly when we are done */
+    while (!pa_atomic_load(&stop_recording) && n_recorded < record_length) {
+        ssize_t r;
+        int error;
+
+        r = pa_simple_read_with_timeout(recorder, recorded + n_recorded, PA_MIN(chunk, record_length - n_recorded), 100*PA_USEC_PER_MSEC, &error);
+        pa_assert_se(r >= 0);
+        pa_assert_se((size_t) r % pa_frame_size(&sample_spec) == 0);
+
+        n_recorded += (size_t) r;
+    }
+}
+
+static size_t block_size_max(void) {
+    pa_mempool *pool;
+    size_t l;
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+    l = pa_mempool_block_size_max(pool);
+    pa_mempool_free(pool);
+
+    return l;
+}
+
+int main(int argc, char *argv[]) {
+    pa_simple *player = NULL;
+    pa_thread *t = NULL;
+    pa_buffer_attr attr;
+    int16_t *pattern;
+    size_t pattern_length, long_length, frame_size, k;
+    pa_usec_t before, elapsed;
+    ssize_t r;
+    int error, ret = 1;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    frame_size = pa_frame_size(&sample_spec);
+
+    if (!load_sink())
+        goto finish;
+
+    record_length = pa_usec_to_bytes(RECORD_USEC, &sample_spec);
+    recorded = pa_xmalloc(record_length);
+
+    if (!(recorder = pa_simple_new(NULL, "simple-buffered-test", PA_STREAM_RECORD, SINK_NAME ".monitor", "record", &sample_spec, NULL, NULL, &error))) {
+        pa_log("pa_simple_new() failed: %s", pa_strerror(error));
+        goto finish;
+    }
+
+    /* One request is worth two memory blocks, so the lock-free writes
+     * must be split to fit */
+    attr.maxlength = (uint32_t) -1;
+    attr.minreq = (uint32_t) (2 * block_size_max());
+    attr.tlength = 2 * attr.minreq;
+    attr.prebuf = (uint32_t) -1;
+    attr.fragsize = (uint32_t) -1;
+
+    if (!(player = pa_simple_new_buffered(NULL, "simple-buffered-test", PA_STREAM_PLAYBACK, SINK_NAME, "playback", &sample_spec, NULL, &attr, &error))) {
+        pa_log("pa_simple_new_buffered() failed: %s", pa_strerror(error));
+        goto finish;
+    }
+
+    pa_assert_se(t = pa_thread_new(record_thread, NULL));
+
+    long_length = pa_usec_to_bytes(LONG_WRITE_USEC, &sample_spec);
+    pattern_length = pa_usec_to_bytes(PATTERN_USEC, &sample_spec);
+    pattern = pa_xmalloc(long_length);
+
+    /* Never zero, so that we can tell where the stream starts in the
+     * recording */
+    for (k = 0; k < long_length / sizeof(int16_t); k++)
+        pattern[k] = (int16_t) (1000 + (k * 37) % 20000);
+
+    before = pa_rtclock_now();
+
+    if (pa_simple_write(player, pattern, pattern_length, &error) < 0 ||
+        pa_simple_drain(player, &error) < 0) {
+        pa_log("Playback failed: %s", pa_strerror(error));
+        goto finish_pattern;
+    }
+
+    /* If the drain overtook the data queued lock-free it would have
+     * returned before all of it was played */
+    elapsed = pa_rtclock_now() - before;
+    pa_log_info("Playing and draining %llu usec took %llu usec.", (unsigned long long) PATTERN_USEC, (unsigned long long) elapsed);
+    pa_assert_se(elapsed + 50*PA_USEC_PER_MSEC >= PATTERN_USEC);
+
+    /* Give the monitor a moment to pass on the tail */
+    pa_msleep(200);
+    pa_atomic_store(&stop_recording, 1);
+    pa_thread_free(t);
+    t = NULL;
+
+    for (k = 0; k < n_recorded && recorded[k] == 0; k++)
+        ;
+
+    pa_log_info("Recorded %lu bytes, the pattern starts at %lu.", (unsigned long) n_recorded, (unsigned long) k);
+    pa_assert_se(n_recorded - k >= pattern_length);
+    pa_assert_se(memcmp(recorded + k, pattern, pattern_length) == 0);
+
+    /* Much more than fits into the buffer, hence the timeout has to
+     * hit */
+    before = pa_rtclock_now();
+    r = pa_simple_write_with_timeout(player, pattern, long_length, TIMEOUT_USEC, &error);
+    elapsed = pa_rtclock_now() - before;
+
+    pa_log_info("Wrote %li of %lu bytes in %llu usec.", (long) r, (unsigned long) long_length, (unsigned long long) elapsed);
+    pa_assert_se(r > 0);
+    pa_assert_se((size_t) r < long_length);
+    pa_assert_se((size_t) r % frame_size == 0);
+    pa_assert_se(elapsed < TIMEOUT_USEC + PA_USEC_PER_SEC);
+
+    pa_assert_se(pa_simple_flush(player, &error) == 0);
+
+    ret = 0;
+
+finish_pattern:
+    pa_xfree(pattern);
+
+finish:
+    if (t) {
+        pa_atomic_store(&stop_recording, 1);
+        pa_thread_free(t);
+    }
+
+    if (player)
+        pa_simple_free(player);
+    if (recorder)
+        pa_simple_free(recorder);
+
+    pa_xfree(recorded);
+
+    if (m)
+        unload_sink();
+
+    return ret;
+}
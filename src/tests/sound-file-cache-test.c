@@ -0,0 +1,217 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <pulse/proplist.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/sound-file-cache.h>
+
+/* Loads a WAV file through the sample cache a few times: the first
+ * load decodes it and writes the cache file, the second one is served
+ * from the cache, and after the file changed it is decoded again. All
+ * of them have to yield the same PCM data as the file. */
+
+#define N_FRAMES 4410
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+/* A 16 bit stereo WAV file with a ramp starting at offset */
+static void write_wav(const char *fn, int16_t offset, time_t mtime, int16_t *pcm) {
+    uint8_t h[44];
+    struct utimbuf ut;
+    unsigned i;
+    FILE *f;
+
+    for (i = 0; i < N_FRAMES * 2; i++)
+        pcm[i] = (int16_t) (offset + (int16_t) i);
+
+    memcpy(h, "RIFF", 4);
+    put_u32(h + 4, 36 + N_FRAMES * 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_u32(h + 16, 16);
+    put_u16(h + 20, 1);
+    put_u16(h + 22, 2);
+    put_u32(h + 24, 44100);
+    put_u32(h + 28, 44100 * 4);
+    put_u16(h + 32, 4);
+    put_u16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put_u32(h + 40, N_FRAMES * 4);
+
+    pa_assert_se(f = fopen(fn, "w"));
+    pa_assert_se(fwrite(h, sizeof(h), 1, f) == 1);
+
+    /* The ramp is written as little endian samples */
+    for (i = 0; i < N_FRAMES * 2; i++) {
+        uint8_t s[2];
+
+        put_u16(s, (uint16_t) pcm[i]);
+        pa_assert_se(fwrite(s, 2, 1, f) == 1);
+    }
+
+    pa_assert_se(fclose(f) == 0);
+
+    ut.actime = ut.modtime = mtime;
+    pa_assert_se(utime(fn, &ut) == 0);
+}
+
+/* Counts the cache files, and removes them and their directory if
+ * asked to */
+static unsigned cache_files(const char *dir, pa_bool_t remove) {
+    DIR *d;
+    struct dirent *de;
+    unsigned n = 0;
+
+    /* The cache lives in a per machine subdirectory */
+    pa_assert_se(d = opendir(dir));
+
+    while ((de = readdir(d))) {
+        char *sub;
+        DIR *sd;
+        struct dirent *sde;
+
+        if (!strstr(de->d_name, "sample-cache"))
+            continue;
+
+        sub = pa_sprintf_malloc("%s/%s", dir, de->d_name);
+        pa_assert_se(sd = opendir(sub));
+
+        while ((sde = readdir(sd))) {
+            char *f;
+
+            if (sde->d_name[0] == '.')
+                continue;
+
+            n++;
+
+            if (remove) {
+                f = pa_sprintf_malloc("%s/%s", sub, sde->d_name);
+                pa_assert_se(unlink(f) == 0);
+                pa_xfree(f);
+            }
+        }
+
+        closedir(sd);
+
+        if (remove)
+            pa_assert_se(rmdir(sub) == 0);
+
+        pa_xfree(sub);
+    }
+
+    closedir(d);
+    return n;
+}
+
+static void check_load(pa_mempool *pool, const char *fn, const int16_t *pcm) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_memchunk chunk;
+    pa_proplist *p;
+    int16_t *d;
+
+    p = pa_proplist_new();
+    pa_assert_se(pa_sound_file_cache_load(pool, fn, &ss, &map, &chunk, p) == 0);
+
+    pa_assert_se(ss.format == PA_SAMPLE_S16NE);
+    pa_assert_se(ss.rate == 44100);
+    pa_assert_se(ss.channels == 2);
+    pa_assert_se(map.channels == 2);
+    pa_assert_se(chunk.length == N_FRAMES * pa_frame_size(&ss));
+
+    /* The data of a mapped cache file starts after the header */
+    pa_assert_se(chunk.index > 0);
+    pa_assert_se(pa_memblock_is_read_only(chunk.memblock));
+
+    d = (int16_t*) ((uint8_t*) pa_memblock_acquire(chunk.memblock) + chunk.index);
+    pa_assert_se(memcmp(d, pcm, chunk.length) == 0);
+    pa_memblock_release(chunk.memblock);
+
+    pa_memblock_unref(chunk.memblock);
+    pa_proplist_free(p);
+}
+
+int main(int argc, char *argv[]) {
+    char dir[] = "/tmp/sound-file-cache-test.XXXXXX";
+    char *fn;
+    static int16_t pcm[N_FRAMES * 2];
+    pa_mempool *pool;
+    time_t now;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(mkdtemp(dir));
+    pa_assert_se(setenv("PULSE_STATE_PATH", dir, 1) == 0);
+
+    fn = pa_sprintf_malloc("%s/test.wav", dir);
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+
+    now = time(NULL);
+
+    /* Decoded and cached */
+    write_wav(fn, 0, now - 100, pcm);
+    check_load(pool, fn, pcm);
+    pa_assert_se(cache_files(dir, FALSE) == 1);
+
+    /* From the cache */
+    check_load(pool, fn, pcm);
+    pa_assert_se(cache_files(dir, FALSE) == 1);
+
+    /* The file changed, so the cache file must not be used anymore */
+    write_wav(fn, 1000, now - 50, pcm);
+    check_load(pool, fn, pcm);
+    check_load(pool, fn, pcm);
+    pa_assert_se(cache_files(dir, FALSE) == 1);
+
+    pa_mempool_free(pool);
+
+    cache_files(dir, TRUE);
+    pa_assert_se(unlink(fn) == 0);
+    pa_assert_se(rmdir(dir) == 0);
+    pa_xfree(fn);
+
+    return 0;
+}
@@ -0,0 +1,155 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/timeval.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Posts a few sequences of events for the same objects and checks
+ * what a coalescing subscriber gets to see of them. The events are
+ * dispatched one by one, so that they are merged in the queue of the
+ * subscriber, not in the queue of the core. */
+
+#define SINK PA_SUBSCRIPTION_EVENT_SINK
+#define NEW PA_SUBSCRIPTION_EVENT_NEW
+#define CHANGE PA_SUBSCRIPTION_EVENT_CHANGE
+#define REMOVE PA_SUBSCRIPTION_EVENT_REMOVE
+
+#define N_MAX 16
+#define INTERVAL (50*PA_USEC_PER_MSEC)
+
+static pa_mainloop *mainloop;
+static pa_core *core;
+
+static pa_subscription_event_type_t types[N_MAX];
+static uint32_t indexes[N_MAX];
+static unsigned n_events = 0;
+static pa_bool_t flushed = FALSE;
+
+static void event_cb(pa_core *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    pa_assert_se(n_events < N_MAX);
+
+    types[n_events] = t;
+    indexes[n_events] = idx;
+    n_events++;
+}
+
+static void flush_cb(pa_core *c, void *userdata) {
+    flushed = TRUE;
+}
+
+static void post(pa_subscription_event_type_t t, uint32_t idx) {
+    pa_subscription_post(core, SINK|t, idx);
+
+    /* Let the core hand it to the subscriber */
+    pa_assert_se(pa_mainloop_iterate(mainloop, 0, NULL) >= 0);
+}
+
+/* Waits for the batch of what was posted since the last call and checks it against the n events passed
+ * as type/index pairs */
+static void check(unsigned n, ...) {
+    va_list ap;
+    unsigned i;
+
+    pa_assert(n > 0);
+
+    while (!flushed)
+        pa_assert_se(pa_mainloop_iterate(mainloop, 1, NULL) >= 0);
+
+    pa_assert_se(n_events == n);
+
+    va_start(ap, n);
+
+    for (i = 0; i < n; i++) {
+        pa_assert_se(types[i] == (pa_subscription_event_type_t) (SINK|va_arg(ap, int)));
+        pa_assert_se(indexes[i] == va_arg(ap, uint32_t));
+    }
+
+    va_end(ap);
+
+    n_events = 0;
+    flushed = FALSE;
+}
+
+int main(int argc, char *argv[]) {
+    pa_subscription *s;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(mainloop = pa_mainloop_new());
+    pa_assert_se(core = pa_core_new(pa_mainloop_get_api(mainloop), FALSE, 0));
+    pa_assert_se(s = pa_subscription_new_coalesced(core, PA_SUBSCRIPTION_MASK_SINK, INTERVAL, event_cb, flush_cb, NULL));
+
+    /* The first event goes out right away, everything after it waits
+     * for the interval to pass */
+    post(CHANGE, 0);
+    check(1, CHANGE, 0);
+
+    /* Changes of the same object are merged */
+    post(CHANGE, 1);
+    post(CHANGE, 2);
+    post(CHANGE, 1);
+    check(2, CHANGE, 1, CHANGE, 2);
+
+    /* An object that came and went is never seen, only the change of
+     * the other one */
+    post(NEW, 3);
+    post(CHANGE, 3);
+    post(CHANGE, 100);
+    post(REMOVE, 3);
+    check(1, CHANGE, 100);
+
+    /* A change after the removal belongs to a new object with the
+     * same index, both have to be delivered */
+    post(REMOVE, 4);
+    post(CHANGE, 4);
+    post(CHANGE, 4);
+    check(2, REMOVE, 4, CHANGE, 4);
+
+    /* Same for a new object */
+    post(REMOVE, 5);
+    post(NEW, 5);
+    post(CHANGE, 5);
+    check(2, REMOVE, 5, NEW, 5);
+
+    /* And it can go away again */
+    post(REMOVE, 6);
+    post(CHANGE, 6);
+    post(REMOVE, 6);
+    check(2, REMOVE, 6, REMOVE, 6);
+
+    pa_subscription_free(s);
+    pa_core_unref(core);
+    pa_mainloop_free(mainloop);
+
+    return 0;
+}
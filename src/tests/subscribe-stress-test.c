@@ -0,0 +1,296 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/mainloop.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+
+/* Connects NCLIENTS subscribers to a running server, one after the
+ * other so that we never exceed the listen backlog of the server, and
+ * then changes the volume of the default sink as fast as possible for
+ * a few seconds. Prints how many events were generated and delivered, and
+ * how much CPU time the server spent sending them and we spent
+ * receiving them. The server's CPU time is read from /proc, hence
+ * that only works for a local server running as the same user. */
+
+#define NCLIENTS 50
+#define DURATION_SEC 5
+#define PIPELINE 8
+
+static pa_mainloop_api *mainloop_api = NULL;
+static pa_context *driver = NULL;
+static pa_context *clients[NCLIENTS];
+
+static int n_connected = 0;
+static int n_ready = 0;
+static int n_in_flight = 0;
+static int running = 0;
+
+static unsigned long n_changes = 0, n_events = 0;
+static pa_usec_t start_time;
+static double server_cpu_start;
+
+static char *sink_name = NULL;
+static pa_cvolume sink_volume;
+
+static void drive(void);
+
+/* Returns the CPU time the server used so far, or a negative value if
+ * it cannot be determined */
+static double server_cpu(void) {
+    char *fn, *p, buf[1024];
+    unsigned long utime, stime;
+    unsigned pid;
+    FILE *f;
+    int r;
+
+    fn = pa_runtime_path("pid");
+    f = fopen(fn, "r");
+    pa_xfree(fn);
+
+    if (!f)
+        return -1;
+
+    r = fscanf(f, "%u", &pid);
+    fclose(f);
+
+    if (r != 1)
+        return -1;
+
+    pa_snprintf(buf, sizeof(buf), "/proc/%u/stat", pid);
+
+    if (!(f = fopen(buf, "r")))
+        return -1;
+
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    /* The process name may contain spaces, the fields we want follow
+     * the closing parenthesis */
+    if (!p || !(p = strrchr(buf, ')')))
+        return -1;
+
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+
+    return (double) (utime + stime) / (double) sysconf(_SC_CLK_TCK);
+}
+
+static void subscribe_cb(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *userdata) {
+    n_events++;
+}
+
+static void volume_cb(pa_context *c, int success, void *userdata) {
+    n_in_flight--;
+
+    if (!success) {
+        fprintf(stderr, "Failed to set volume: %s\n", pa_strerror(pa_context_errno(c)));
+        abort();
+    }
+
+    n_changes++;
+    drive();
+}
+
+/* Keep PIPELINE volume changes in flight while running */
+static void drive(void) {
+
+    while (running && n_in_flight < PIPELINE) {
+        pa_cvolume v = sink_volume;
+
+        /* Toggle between the original volume and a slightly lower one */
+        if ((n_changes + (unsigned long) n_in_flight) & 1)
+            pa_cvolume_dec(&v, 1);
+
+        pa_operation_unref(pa_context_set_sink_volume_by_name(driver, sink_name, &v, volume_cb, NULL));
+        n_in_flight++;
+    }
+}
+
+static void done_cb(pa_context *c, int success, void *userdata) {
+    mainloop_api->quit(mainloop_api, 0);
+}
+
+static void time_cb(pa_mainloop_api *m, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct rusage ru;
+    double elapsed, cpu, scpu;
+    char server[64];
+    int r;
+
+    running = 0;
+
+    elapsed = (double) (pa_timeval_load(tv) - start_time) / PA_USEC_PER_SEC;
+
+    r = getrusage(RUSAGE_SELF, &ru);
+    assert(r >= 0);
+    cpu = (double) ru.ru_utime.tv_sec + (double) ru.ru_utime.tv_usec / PA_USEC_PER_SEC +
+        (double) ru.ru_stime.tv_sec + (double) ru.ru_stime.tv_usec / PA_USEC_PER_SEC;
+
+    if (server_cpu_start >= 0 && (scpu = server_cpu()) >= 0) {
+        scpu -= server_cpu_start;
+        pa_snprintf(server, sizeof(server), "%0.2f s (%0.1f%%)", scpu, scpu * 100.0 / elapsed);
+    } else
+        pa_snprintf(server, sizeof(server), "unknown");
+
+    fprintf(stderr,
+            "%u clients, %0.1f s: %lu volume changes (%0.0f/s), %lu events delivered (%0.0f/s, %0.1f/s per client), server CPU %s, client CPU %0.2f s (%0.1f%%)\n",
+            NCLIENTS, elapsed,
+            n_changes, (double) n_changes / elapsed,
+            n_events, (double) n_events / elapsed, (double) n_events / elapsed / NCLIENTS,
+            server,
+            cpu, cpu * 100.0 / elapsed);
+
+    m->time_free(e);
+
+    /* Restore the original volume and quit */
+    pa_operation_unref(pa_context_set_sink_volume_by_name(driver, sink_name, &sink_volume, done_cb, NULL));
+}
+
+static void start(void) {
+    struct timeval tv;
+
+    fprintf(stderr, "All clients subscribed, changing volume of sink %s for %u s.\n", sink_name, DURATION_SEC);
+
+    server_cpu_start = server_cpu();
+
+    pa_gettimeofday(&tv);
+    start_time = pa_timeval_load(&tv);
+    pa_timeval_add(&tv, DURATION_SEC * PA_USEC_PER_SEC);
+    mainloop_api->time_new(mainloop_api, &tv, time_cb, NULL);
+
+    running = 1;
+    drive();
+}
+
+static void subscribed_cb(pa_context *c, int success, void *userdata) {
+    assert(success);
+
+    if (++n_ready == NCLIENTS + 1)
+        start();
+}
+
+static void sink_info_cb(pa_context *c, const pa_sink_info *i, int eol, void *userdata) {
+    if (eol < 0) {
+        fprintf(stderr, "Failed to get sink info: %s\n", pa_strerror(pa_context_errno(c)));
+        abort();
+    }
+
+    if (!i)
+        return;
+
+    sink_name = strdup(i->name);
+    sink_volume = i->volume;
+
+    if (++n_ready == NCLIENTS + 1)
+        start();
+}
+
+static pa_context *connect_context(const char *name);
+
+static void context_state_callback(pa_context *c, void *userdata) {
+    assert(c);
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_CONNECTING:
+        case PA_CONTEXT_AUTHORIZING:
+        case PA_CONTEXT_SETTING_NAME:
+        case PA_CONTEXT_TERMINATED:
+            break;
+
+        case PA_CONTEXT_READY:
+
+            if (c == driver)
+                pa_operation_unref(pa_context_get_sink_info_by_name(c, NULL, sink_info_cb, NULL));
+            else {
+                pa_context_set_subscribe_callback(c, subscribe_cb, NULL);
+                pa_operation_unref(pa_context_subscribe(c, PA_SUBSCRIPTION_MASK_ALL, subscribed_cb, NULL));
+            }
+
+            /* Now that this one is through, connect the next one */
+            if (n_connected < NCLIENTS) {
+                clients[n_connected] = connect_context("subscribe-stress-test");
+                n_connected++;
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+        default:
+            fprintf(stderr, "Context error: %s\n", pa_strerror(pa_context_errno(c)));
+            abort();
+    }
+}
+
+static pa_context *connect_context(const char *name) {
+    pa_context *c;
+
+    c = pa_context_new(mainloop_api, name);
+    assert(c);
+
+    pa_context_set_state_callback(c, context_state_callback, NULL);
+
+    if (pa_context_connect(c, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "pa_context_connect() failed.\n");
+        abort();
+    }
+
+    return c;
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop* m = NULL;
+    int i, ret = 0;
+
+    m = pa_mainloop_new();
+    assert(m);
+
+    mainloop_api = pa_mainloop_get_api(m);
+
+    driver = connect_context("subscribe-stress-test driver");
+
+    if (pa_mainloop_run(m, &ret) < 0)
+        fprintf(stderr, "pa_mainloop_run() failed.\n");
+
+    for (i = 0; i < n_connected; i++) {
+        pa_context_disconnect(clients[i]);
+        pa_context_unref(clients[i]);
+    }
+
+    pa_context_disconnect(driver);
+    pa_context_unref(driver);
+
+    free(sink_name);
+
+    pa_mainloop_free(m);
+
+    return ret;
+}
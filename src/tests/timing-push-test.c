@@ -0,0 +1,253 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+#include <pulse/internal.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Plays silence on many streams which all ask for their latency every
+ * few milliseconds, like a bunch of video players would. Counts how
+ * many timing updates the streams got, and how many of them had to be
+ * requested from the server, i.e. were not sent along with the data
+ * requests. The streams are spread over a few null sinks, since a sink
+ * takes no more than PA_MAX_INPUTS_PER_SINK of them. Needs a running
+ * server. */
+
+#define N_SINKS 4
+#define STREAMS_PER_SINK 25
+#define N_STREAMS (N_SINKS*STREAMS_PER_SINK)
+#define POLL_USEC (5*PA_USEC_PER_MSEC)
+#define RUN_USEC (10*PA_USEC_PER_SEC)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_context *context = NULL;
+static pa_stream *streams[N_STREAMS];
+static uint32_t modules[N_SINKS];
+static unsigned n_loaded = 0, n_unloaded = 0, n_ready = 0, n_updates = 0, n_polls = 0;
+static uint32_t ctag_start, n_requests = 0;
+static pa_usec_t start = 0, stop = 0;
+static pa_bool_t failed = FALSE;
+
+static void unloaded_cb(pa_context *c, int success, void *userdata) {
+    pa_mainloop_api *a = userdata;
+
+    if (++n_unloaded >= n_loaded)
+        a->quit(a, 0);
+}
+
+/* Removes the streams and the sinks, and quits once that is done */
+static void cleanup(pa_mainloop_api *a) {
+    static pa_bool_t done = FALSE;
+    unsigned i;
+
+    if (done)
+        return;
+
+    done = TRUE;
+
+    for (i = 0; i < N_STREAMS; i++)
+        if (streams[i]) {
+            pa_stream_set_state_callback(streams[i], NULL, NULL);
+            pa_stream_disconnect(streams[i]);
+            pa_stream_unref(streams[i]);
+            streams[i] = NULL;
+        }
+
+    if (n_loaded <= 0 || pa_context_get_state(context) != PA_CONTEXT_READY) {
+        a->quit(a, 0);
+        return;
+    }
+
+    for (i = 0; i < n_loaded; i++)
+        pa_operation_unref(pa_context_unload_module(context, modules[i], unloaded_cb, a));
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    void *data;
+
+    pa_assert_se(pa_stream_begin_write(s, &data, &nbytes) == 0);
+    memset(data, 0, nbytes);
+    pa_assert_se(pa_stream_write(s, data, nbytes, NULL, 0, PA_SEEK_RELATIVE) == 0);
+}
+
+static void latency_update_cb(pa_stream *s, void *userdata) {
+    if (start > 0)
+        n_updates++;
+}
+
+static void poll_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval ntv;
+    unsigned i;
+
+    for (i = 0; i < N_STREAMS; i++) {
+        pa_usec_t latency;
+        int negative;
+
+        pa_stream_get_latency(streams[i], &latency, &negative);
+    }
+
+    n_polls++;
+
+    if (pa_rtclock_now() - start >= RUN_USEC) {
+        /* While playing the only commands we sent were timing
+         * requests */
+        n_requests = context->ctag - ctag_start;
+        stop = pa_rtclock_now();
+
+        a->time_free(e);
+        cleanup(a);
+        return;
+    }
+
+    a->time_restart(e, pa_timeval_rtstore(&ntv, pa_rtclock_now() + POLL_USEC, TRUE));
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    pa_mainloop_api *a = userdata;
+    struct timeval tv;
+
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            if (++n_ready < N_STREAMS)
+                break;
+
+            /* Everything after this is timing traffic */
+            ctag_start = context->ctag;
+            start = pa_rtclock_now();
+
+            a->time_new(a, pa_timeval_rtstore(&tv, start + POLL_USEC, TRUE), poll_cb, NULL);
+            break;
+
+        case PA_STREAM_FAILED:
+            pa_log("Stream error: %s", pa_strerror(pa_context_errno(pa_stream_get_context(s))));
+            failed = TRUE;
+            cleanup(a);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    pa_mainloop_api *a = userdata;
+    unsigned i;
+
+    if (idx == PA_INVALID_INDEX) {
+        pa_log("Failed to load module-null-sink: %s", pa_strerror(pa_context_errno(c)));
+        failed = TRUE;
+        cleanup(a);
+        return;
+    }
+
+    modules[n_loaded] = idx;
+
+    if (++n_loaded < N_SINKS)
+        return;
+
+    for (i = 0; i < N_STREAMS; i++) {
+        char sink[64];
+
+        pa_snprintf(sink, sizeof(sink), "timing_push_test_%u", i / STREAMS_PER_SINK);
+
+        pa_assert_se(streams[i] = pa_stream_new(c, "timing-push-test", &sample_spec, NULL));
+        pa_stream_set_state_callback(streams[i], stream_state_cb, a);
+        pa_stream_set_write_callback(streams[i], write_cb, NULL);
+        pa_stream_set_latency_update_callback(streams[i], latency_update_cb, NULL);
+        pa_assert_se(pa_stream_connect_playback(streams[i], sink, NULL, PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE, NULL, NULL) == 0);
+    }
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_mainloop_api *a = userdata;
+    unsigned i;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            for (i = 0; i < N_SINKS; i++) {
+                char args[64];
+
+                pa_snprintf(args, sizeof(args), "sink_name=timing_push_test_%u", i);
+                pa_operation_unref(pa_context_load_module(c, "module-null-sink", args, loaded_cb, a));
+            }
+            break;
+
+        case PA_CONTEXT_FAILED:
+            pa_log("Connection error: %s", pa_strerror(pa_context_errno(c)));
+            failed = TRUE;
+            a->quit(a, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    double secs;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_mainloop_new());
+    a = pa_mainloop_get_api(m);
+
+    pa_assert_se(context = pa_context_new(a, "timing-push-test"));
+    pa_context_set_state_callback(context, context_state_cb, a);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+        failed = TRUE;
+    else
+        pa_mainloop_run(m, NULL);
+
+    if (!failed && stop > 0) {
+        secs = (double) (stop - start) / PA_USEC_PER_SEC;
+
+        pa_log_info("%u streams, %u latency polls in %0.1f s: %u timing updates, %u of them requested (%0.1f requests/s, %0.1f pushed updates/s)",
+                    N_STREAMS, n_polls * N_STREAMS, secs,
+                    n_updates, n_requests,
+                    n_requests / secs,
+                    (n_updates > n_requests ? n_updates - n_requests : 0) / secs);
+    }
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_mainloop_free(m);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/trace.h>
+
+/* Records events in the main thread and in a second one that keeps
+ * going while the trace is dumped. Every dump has to give each thread's
+ * events in order, with no gaps, and no more than fit in a ring. The
+ * second thread may record no more than half a ring per dump, so that
+ * it never laps the dump and every dump has events of both threads. */
+
+#define N_MAIN_EVENTS (PA_TRACE_RING_SIZE * 2 + 10)
+#define N_DUMPS 200
+#define EVENTS_PER_DUMP (PA_TRACE_RING_SIZE / 2)
+
+static pa_atomic_t quit = PA_ATOMIC_INIT(0);
+static pa_atomic_t budget = PA_ATOMIC_INIT(1);
+
+static void thread_func(void *userdata) {
+    int64_t i = 0;
+
+    while (!pa_atomic_load(&quit)) {
+
+        if (pa_atomic_load(&budget) <= 0) {
+            pa_thread_yield();
+            continue;
+        }
+
+        pa_trace(PA_TRACE_PEEK, 1, i++, 0);
+        pa_atomic_dec(&budget);
+    }
+}
+
+static void check_cb(unsigned thread, const pa_trace_event *events, unsigned n, void *userdata) {
+    unsigned *n_threads = userdata;
+    unsigned i;
+
+    pa_assert_se(n > 0);
+    pa_assert_se(n <= PA_TRACE_RING_SIZE);
+
+    for (i = 0; i < n; i++) {
+        pa_assert_se(events[i].object == events[0].object);
+
+        if (i > 0) {
+            pa_assert_se(events[i].a == events[i-1].a + 1);
+            pa_assert_se(events[i].time >= events[i-1].time);
+        }
+    }
+
+    /* The main thread's ring has wrapped, so only its newest events
+     * are left. The oldest slot of a full ring is never handed out, as
+     * it might be in the middle of being overwritten. */
+    if (events[0].object == 0) {
+        pa_assert_se(n == PA_TRACE_RING_SIZE - 1);
+        pa_assert_se(events[n-1].a == N_MAIN_EVENTS - 1);
+        pa_assert_se(events[n-1].type == PA_TRACE_PUSH);
+    }
+
+    (*n_threads)++;
+}
+
+int main(int argc, char *argv[]) {
+    pa_thread *t;
+    unsigned n_threads, i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    /* Nothing is recorded while tracing is off */
+    pa_trace(PA_TRACE_PUSH, 0, -1, 0);
+    n_threads = 0;
+    pa_trace_dump(check_cb, &n_threads);
+    pa_assert_se(n_threads == 0);
+
+    pa_trace_set_enabled(TRUE);
+
+    for (i = 0; i < N_MAIN_EVENTS; i++)
+        pa_trace(PA_TRACE_PUSH, 0, i, 0);
+
+    pa_assert_se(t = pa_thread_new(thread_func, NULL));
+
+    /* Wait for the first event of the second thread */
+    while (pa_atomic_load(&budget) > 0)
+        pa_thread_yield();
+
+    for (i = 0; i < N_DUMPS; i++) {
+        /* Let the second thread record while we dump */
+        pa_atomic_store(&budget, EVENTS_PER_DUMP);
+
+        n_threads = 0;
+        pa_trace_dump(check_cb, &n_threads);
+        pa_assert_se(n_threads == 2);
+    }
+
+    pa_atomic_store(&quit, 1);
+    pa_thread_free(t);
+
+    /* The second thread's ring went away with it */
+    n_threads = 0;
+    pa_trace_dump(check_cb, &n_threads);
+    pa_assert_se(n_threads == 1);
+
+    pa_trace_set_enabled(FALSE);
+
+    return 0;
+}
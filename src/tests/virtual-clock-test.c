@@ -0,0 +1,362 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Meant to be run against a server started with --virtual-clock:
+ * plays a file into a null sink twice, records the sink's monitor both
+ * times and checks that the two renderings are identical byte for
+ * byte. Without the virtual clock waiting for the client the second
+ * run would come out with underruns in different places. Also checks
+ * that each run took less time than the file plays for, as the virtual
+ * clock does not wait for the wall clock. */
+
+#define SINK_NAME "virtual_clock_test"
+#define N_FRAMES (44100*2)
+#define N_RUNS 2
+#define TIMEOUT_USEC (60*PA_USEC_PER_SEC)
+
+static const pa_sample_spec sample_spec = {
+    .format = PA_SAMPLE_S16LE,
+    .rate = 44100,
+    .channels = 2
+};
+
+static pa_mainloop_api *mainloop_api = NULL;
+static pa_context *context = NULL;
+static pa_stream *playback = NULL, *record = NULL;
+static pa_time_event *timeout_event = NULL;
+
+static uint32_t module_index = PA_INVALID_INDEX;
+static char file_name[] = "/tmp/virtual-clock-test-XXXXXX";
+static int fd = -1;
+static size_t file_length;
+
+static unsigned run = 0;
+static pa_usec_t run_start;
+static uint8_t *captured[N_RUNS];
+static size_t n_captured = 0;
+static pa_bool_t started = FALSE, eof = FALSE;
+
+static int ret = 1;
+
+static void start_run(void);
+
+static void unloaded_cb(pa_context *c, int success, void *userdata) {
+    mainloop_api->quit(mainloop_api, ret);
+}
+
+static void quit(int r) {
+    ret = r;
+
+    if (timeout_event) {
+        mainloop_api->time_free(timeout_event);
+        timeout_event = NULL;
+    }
+
+    if (module_index != PA_INVALID_INDEX) {
+        pa_operation_unref(pa_context_unload_module(context, module_index, unloaded_cb, NULL));
+        module_index = PA_INVALID_INDEX;
+    } else
+        mainloop_api->quit(mainloop_api, ret);
+}
+
+static void write_file(void) {
+    int16_t *d;
+    unsigned k;
+
+    pa_assert_se((fd = mkstemp(file_name)) >= 0);
+    unlink(file_name);
+
+    file_length = N_FRAMES * pa_frame_size(&sample_spec);
+    d = pa_xmalloc(file_length);
+
+    /* Never zero, so that we can tell where the stream starts in the
+     * recording */
+    for (k = 0; k < file_length / sizeof(int16_t); k++)
+        d[k] = (int16_t) (1000 + (k * 37) % 20000);
+
+    pa_assert_se(pa_loop_write(fd, d, file_length, NULL) == (ssize_t) file_length);
+    pa_xfree(d);
+}
+
+static void compare(void) {
+    size_t k;
+
+    for (k = 0; k < file_length; k++)
+        if (captured[0][k] != captured[1][k]) {
+            pa_log("Renderings differ at byte %lu.", (unsigned long) k);
+            quit(1);
+            return;
+        }
+
+    pa_log_info("Both renderings are identical.");
+    quit(0);
+}
+
+/* The stream is passed along, since by the time the drain completes
+ * the next run may have set up its own playback stream */
+static void drain_cb(pa_stream *s, int success, void *userdata) {
+    pa_stream *p = userdata;
+
+    pa_assert(s == p);
+
+    if (!success)
+        pa_log("Drain failed: %s", pa_strerror(pa_context_errno(context)));
+
+    pa_stream_disconnect(p);
+    pa_stream_unref(p);
+}
+
+static void write_cb(pa_stream *s, size_t nbytes, void *userdata) {
+
+    while (!eof && nbytes > 0) {
+        void *data;
+        size_t l = nbytes;
+        ssize_t r;
+
+        pa_assert_se(pa_stream_begin_write(s, &data, &l) == 0);
+        l = PA_MIN(l, nbytes);
+
+        if ((r = pa_loop_read(fd, data, l, NULL)) < 0) {
+            pa_log("read() failed: %s", pa_cstrerror(errno));
+            pa_stream_cancel_write(s);
+            quit(1);
+            return;
+        }
+
+        if (r > 0)
+            pa_assert_se(pa_stream_write(s, data, (size_t) r, NULL, 0, PA_SEEK_RELATIVE) == 0);
+        else
+            pa_stream_cancel_write(s);
+
+        nbytes -= (size_t) r;
+
+        if ((size_t) r < l) {
+            /* From now on the drain callback owns the stream */
+            eof = TRUE;
+            pa_assert(s == playback);
+            playback = NULL;
+
+            pa_operation_unref(pa_stream_drain(s, drain_cb, s));
+        }
+    }
+}
+
+static void append(const uint8_t *d, size_t n) {
+    uint8_t *buf = captured[run];
+
+    n = PA_MIN(n, file_length - n_captured);
+
+    if (d)
+        memcpy(buf + n_captured, d, n);
+    else
+        memset(buf + n_captured, 0, n);
+
+    n_captured += n;
+}
+
+static void read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    const void *data;
+    pa_usec_t elapsed;
+
+    while (pa_stream_readable_size(s) > 0 && n_captured < file_length) {
+        const uint8_t *d;
+
+        pa_assert_se(pa_stream_peek(s, &data, &nbytes) == 0);
+        d = data;
+
+        /* Skip the silence before the stream started */
+        if (!started && d) {
+            size_t k;
+
+            for (k = 0; k < nbytes && d[k] == 0; k++)
+                ;
+
+            if (k < nbytes) {
+                started = TRUE;
+                append(d + k, nbytes - k);
+            }
+
+        } else if (started)
+            append(d, nbytes);
+
+        pa_stream_drop(s);
+    }
+
+    if (n_captured < file_length)
+        return;
+
+    pa_stream_disconnect(record);
+    pa_stream_unref(record);
+    record = NULL;
+
+    elapsed = pa_rtclock_now() - run_start;
+    pa_log_info("Run %u rendered %0.2f s in %0.2f s.", run,
+                (double) pa_bytes_to_usec(file_length, &sample_spec) / PA_USEC_PER_SEC,
+                (double) elapsed / PA_USEC_PER_SEC);
+
+    if (elapsed >= pa_bytes_to_usec(file_length, &sample_spec)) {
+        pa_log("The virtual clock was not faster than real time.");
+        quit(1);
+        return;
+    }
+
+    if (++run < N_RUNS)
+        start_run();
+    else
+        compare();
+}
+
+static void playback_state_cb(pa_stream *s, void *userdata) {
+    if (pa_stream_get_state(s) == PA_STREAM_FAILED) {
+        pa_log("Playback stream failed: %s", pa_strerror(pa_context_errno(context)));
+        quit(1);
+    }
+}
+
+static void record_state_cb(pa_stream *s, void *userdata) {
+    switch (pa_stream_get_state(s)) {
+        case PA_STREAM_READY:
+            /* Only start playing once we are sure to catch all of
+             * it */
+            pa_assert_se(playback = pa_stream_new(context, "virtual-clock-test playback", &sample_spec, NULL));
+            pa_stream_set_state_callback(playback, playback_state_cb, NULL);
+            pa_stream_set_write_callback(playback, write_cb, NULL);
+            pa_assert_se(pa_stream_connect_playback(playback, SINK_NAME, NULL, 0, NULL, NULL) == 0);
+            break;
+
+        case PA_STREAM_FAILED:
+            pa_log("Record stream failed: %s", pa_strerror(pa_context_errno(context)));
+            quit(1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void start_run(void) {
+    pa_log_info("Starting run %u.", run);
+
+    pa_assert_se(lseek(fd, 0, SEEK_SET) == 0);
+    captured[run] = pa_xmalloc(file_length);
+    n_captured = 0;
+    started = eof = FALSE;
+    run_start = pa_rtclock_now();
+
+    pa_assert_se(record = pa_stream_new(context, "virtual-clock-test record", &sample_spec, NULL));
+    pa_stream_set_state_callback(record, record_state_cb, NULL);
+    pa_stream_set_read_callback(record, read_cb, NULL);
+    pa_assert_se(pa_stream_connect_record(record, SINK_NAME ".monitor", NULL, 0) == 0);
+}
+
+static void loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    if (idx == PA_INVALID_INDEX) {
+        pa_log("Failed to load module-null-sink: %s", pa_strerror(pa_context_errno(c)));
+        quit(1);
+        return;
+    }
+
+    module_index = idx;
+    start_run();
+}
+
+static void timeout_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    pa_log("Timed out in run %u with %lu of %lu bytes recorded.", run, (unsigned long) n_captured, (unsigned long) file_length);
+
+    timeout_event = NULL;
+    a->time_free(e);
+
+    quit(1);
+}
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    struct timeval tv;
+
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+            timeout_event = mainloop_api->time_new(mainloop_api, pa_timeval_rtstore(&tv, pa_rtclock_now() + TIMEOUT_USEC, TRUE), timeout_cb, NULL);
+
+            pa_operation_unref(pa_context_load_module(c, "module-null-sink", "sink_name=" SINK_NAME " format=s16le rate=44100 channels=2", loaded_cb, NULL));
+            break;
+
+        case PA_CONTEXT_FAILED:
+            pa_log("Connection error: %s", pa_strerror(pa_context_errno(c)));
+            mainloop_api->quit(mainloop_api, 1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    pa_mainloop *m;
+    unsigned i;
+    int r = 1;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    write_file();
+
+    pa_assert_se(m = pa_mainloop_new());
+    mainloop_api = pa_mainloop_get_api(m);
+
+    pa_assert_se(context = pa_context_new(mainloop_api, "virtual-clock-test"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) >= 0)
+        pa_mainloop_run(m, &r);
+
+    if (playback)
+        pa_stream_unref(playback);
+    if (record)
+        pa_stream_unref(record);
+
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    pa_mainloop_free(m);
+
+    for (i = 0; i < N_RUNS; i++)
+        pa_xfree(captured[i]);
+
+    pa_close(fd);
+
+    return r;
+}
@@ -0,0 +1,318 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/pulseaudio.h>
+#include <pulse/rtclock.h>
+#include <pulse/thread-mainloop.h>
+
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* Writes planar data with pa_stream_write_planar() into a null sink
+ * and records the sink's monitor, once in a 16 bit, a 32 bit and a 24
+ * bit format, which take the three different paths of interleaving.
+ * The recording has to match the planes interleaved byte by byte. The
+ * data is larger than a single buffer, so it is split into several
+ * writes. Needs a running server. */
+
+#define SINK_NAME "write_planar_test"
+#define N_CHANNELS 3
+#define N_FRAMES (44100*2)
+#define TIMEOUT_USEC (30*PA_USEC_PER_SEC)
+
+static const pa_sample_format_t formats[] = {
+    PA_SAMPLE_S16LE,
+    PA_SAMPLE_S32LE,
+    PA_SAMPLE_S24LE
+};
+
+static pa_threaded_mainloop *m = NULL;
+static pa_context *context = NULL;
+static uint32_t module_index = PA_INVALID_INDEX;
+static pa_bool_t timed_out = FALSE;
+
+static uint8_t *recorded = NULL;
+static size_t n_recorded = 0, length = 0;
+
+static void context_state_cb(pa_context *c, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void stream_state_cb(pa_stream *s, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void loaded_cb(pa_context *c, uint32_t idx, void *userdata) {
+    module_index = idx;
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void success_cb(pa_context *c, int success, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void drain_cb(pa_stream *s, int success, void *userdata) {
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void timeout_cb(pa_mainloop_api *a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    timed_out = TRUE;
+    pa_threaded_mainloop_signal(m, 0);
+}
+
+static void read_cb(pa_stream *s, size_t nbytes, void *userdata) {
+    const void *data;
+
+    while (pa_stream_readable_size(s) > 0 && n_recorded < length) {
+        const uint8_t *d;
+
+        pa_assert_se(pa_stream_peek(s, &data, &nbytes) == 0);
+
+        /* Skip the silence before the stream started */
+        if ((d = data)) {
+            if (n_recorded == 0)
+                for (; nbytes > 0 && *d == 0; d++, nbytes--)
+                    ;
+
+            nbytes = PA_MIN(nbytes, length - n_recorded);
+            memcpy(recorded + n_recorded, d, nbytes);
+            n_recorded += nbytes;
+        }
+
+        pa_stream_drop(s);
+    }
+
+    if (n_recorded >= length)
+        pa_threaded_mainloop_signal(m, 0);
+}
+
+/* Called with the lock held */
+static void wait_for(pa_operation *o) {
+    pa_assert(o);
+
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING && !timed_out)
+        pa_threaded_mainloop_wait(m);
+
+    if (pa_operation_get_state(o) == PA_OPERATION_RUNNING)
+        pa_operation_cancel(o);
+
+    pa_operation_unref(o);
+}
+
+/* Called with the lock held */
+static pa_bool_t wait_ready(pa_stream *s) {
+    for (;;) {
+        pa_stream_state_t state = pa_stream_get_state(s);
+
+        if (state == PA_STREAM_READY)
+            return TRUE;
+
+        if (!PA_STREAM_IS_GOOD(state) || timed_out)
+            return FALSE;
+
+        pa_threaded_mainloop_wait(m);
+    }
+}
+
+static pa_bool_t run(pa_sample_format_t format) {
+    pa_sample_spec ss;
+    pa_stream *playback = NULL, *record = NULL;
+    pa_mainloop_api *a;
+    pa_time_event *e;
+    struct timeval tv;
+    const void *planes[N_CHANNELS];
+    uint8_t *data[N_CHANNELS], *expected;
+    size_t sample_size, fs, k;
+    char *args;
+    unsigned c;
+    pa_bool_t ret = FALSE;
+
+    ss.format = format;
+    ss.rate = 44100;
+    ss.channels = N_CHANNELS;
+
+    sample_size = pa_sample_size(&ss);
+    fs = pa_frame_size(&ss);
+    length = N_FRAMES * fs;
+
+    /* Never zero, so that we can tell where the stream starts in the
+     * recording */
+    expected = pa_xmalloc(length);
+    for (c = 0; c < N_CHANNELS; c++) {
+        data[c] = pa_xmalloc(N_FRAMES * sample_size);
+
+        for (k = 0; k < N_FRAMES * sample_size; k++)
+            data[c][k] = (uint8_t) (1 + (k * 7 + c * 13) % 251);
+
+        for (k = 0; k < N_FRAMES; k++)
+            memcpy(expected + k * fs + c * sample_size, data[c] + k * sample_size, sample_size);
+
+        planes[c] = data[c];
+    }
+
+    recorded = pa_xmalloc(length);
+    n_recorded = 0;
+
+    pa_log_info("Testing %s.", pa_sample_format_to_string(format));
+
+    pa_threaded_mainloop_lock(m);
+
+    a = pa_threaded_mainloop_get_api(m);
+    e = a->time_new(a, pa_timeval_rtstore(&tv, pa_rtclock_now() + TIMEOUT_USEC, TRUE), timeout_cb, NULL);
+
+    args = pa_sprintf_malloc("sink_name=" SINK_NAME " format=%s rate=44100 channels=%u", pa_sample_format_to_string(format), N_CHANNELS);
+    module_index = PA_INVALID_INDEX;
+    wait_for(pa_context_load_module(context, "module-null-sink", args, loaded_cb, NULL));
+    pa_xfree(args);
+
+    if (module_index == PA_INVALID_INDEX) {
+        pa_log("Failed to load module-null-sink: %s", pa_strerror(pa_context_errno(context)));
+        goto finish;
+    }
+
+    /* Record first, so that we catch all of it */
+    pa_assert_se(record = pa_stream_new(context, "write-planar-test record", &ss, NULL));
+    pa_stream_set_state_callback(record, stream_state_cb, NULL);
+    pa_stream_set_read_callback(record, read_cb, NULL);
+    pa_assert_se(pa_stream_connect_record(record, SINK_NAME ".monitor", NULL, 0) == 0);
+
+    if (!wait_ready(record))
+        goto finish;
+
+    pa_assert_se(playback = pa_stream_new(context, "write-planar-test playback", &ss, NULL));
+    pa_stream_set_state_callback(playback, stream_state_cb, NULL);
+    pa_assert_se(pa_stream_connect_playback(playback, SINK_NAME, NULL, 0, NULL, NULL) == 0);
+
+    if (!wait_ready(playback))
+        goto finish;
+
+    pa_assert_se(pa_stream_write_planar(playback, planes, N_FRAMES, 0, PA_SEEK_RELATIVE) == 0);
+
+    /* Nothing may be left begun */
+    pa_assert_se(pa_stream_cancel_write(playback) < 0);
+
+    wait_for(pa_stream_drain(playback, drain_cb, NULL));
+
+    while (n_recorded < length && !timed_out)
+        pa_threaded_mainloop_wait(m);
+
+    if (n_recorded < length) {
+        pa_log("Timed out with %lu of %lu bytes recorded.", (unsigned long) n_recorded, (unsigned long) length);
+        goto finish;
+    }
+
+    for (k = 0; k < length; k++)
+        if (recorded[k] != expected[k]) {
+            pa_log("Recording differs at byte %lu.", (unsigned long) k);
+            goto finish;
+        }
+
+    ret = TRUE;
+
+finish:
+    if (playback) {
+        pa_stream_disconnect(playback);
+        pa_stream_unref(playback);
+    }
+
+    if (record) {
+        pa_stream_disconnect(record);
+        pa_stream_unref(record);
+    }
+
+    if (module_index != PA_INVALID_INDEX)
+        wait_for(pa_context_unload_module(context, module_index, success_cb, NULL));
+
+    a->time_free(e);
+
+    pa_threaded_mainloop_unlock(m);
+
+    for (c = 0; c < N_CHANNELS; c++)
+        pa_xfree(data[c]);
+
+    pa_xfree(expected);
+    pa_xfree(recorded);
+    recorded = NULL;
+
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned i;
+    int ret = 1;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pa_assert_se(m = pa_threaded_mainloop_new());
+    pa_assert_se(context = pa_context_new(pa_threaded_mainloop_get_api(m), "write-planar-test"));
+    pa_context_set_state_callback(context, context_state_cb, NULL);
+
+    pa_threaded_mainloop_lock(m);
+    pa_assert_se(pa_threaded_mainloop_start(m) >= 0);
+
+    if (pa_context_connect(context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0)
+        goto fail;
+
+    for (;;) {
+        pa_context_state_t state = pa_context_get_state(context);
+
+        if (state == PA_CONTEXT_READY)
+            break;
+
+        if (!PA_CONTEXT_IS_GOOD(state))
+            goto fail;
+
+        pa_threaded_mainloop_wait(m);
+    }
+
+    pa_threaded_mainloop_unlock(m);
+
+    for (i = 0; i < PA_ELEMENTSOF(formats); i++)
+        if (!run(formats[i]))
+            goto finish;
+
+    pa_log_info("All recordings match.");
+    ret = 0;
+    goto finish;
+
+fail:
+    pa_log("Connection failed: %s", pa_strerror(pa_context_errno(context)));
+    pa_threaded_mainloop_unlock(m);
+
+finish:
+    pa_threaded_mainloop_lock(m);
+    pa_context_disconnect(context);
+    pa_threaded_mainloop_unlock(m);
+    pa_threaded_mainloop_stop(m);
+
+    pa_context_unref(context);
+    pa_threaded_mainloop_free(m);
+
+    return ret;
+}
@@ -66,6 +66,7 @@ static uint32_t
 static uint32_t module_index;
 static pa_bool_t suspend;
 static pa_bool_t mute;
+static pa_bool_t trace;
 static pa_volume_t volume;
 
 static pa_proplist *proplist = NULL;
@@ -101,7 +102,9 @@ static enum {
     SET_SINK_INPUT_VOLUME,
     SET_SINK_MUTE,
     SET_SOURCE_MUTE,
-    SET_SINK_INPUT_MUTE
+    SET_SINK_INPUT_MUTE,
+    SET_TRACE,
+    GET_TRACE
 } action = NONE;
 
 static void quit(int ret) {
@@ -658,6 +661,44 @@ static void simple_callback(pa_context *c, int success, void *userdata) {
     complete_action();
 }
 
+static void get_trace_callback(pa_context *c, const pa_trace_info *i, int is_last, void *userdata) {
+    static const char * const type_names[] = {
+        [PA_TRACE_REQUEST] = "request",
+        [PA_TRACE_PUSH] = "push",
+        [PA_TRACE_PEEK] = "peek",
+        [PA_TRACE_UNDERRUN] = "underrun",
+        [PA_TRACE_REWIND] = "rewind",
+        [PA_TRACE_RENDER] = "render"
+    };
+    unsigned j;
+
+    if (is_last < 0) {
+        pa_log(_("Failed to get trace: %s"), pa_strerror(pa_context_errno(c)));
+        quit(1);
+        return;
+    }
+
+    if (is_last) {
+        complete_action();
+        return;
+    }
+
+    pa_assert(i);
+
+    /* One JSON object per line, so that it is easy to feed to other tools */
+    for (j = 0; j < i->n_events; j++) {
+        const pa_trace_event *e = i->events + j;
+
+        printf("{\"thread\": %u, \"time\": %llu, \"type\": \"%s\", \"object\": %u, \"a\": %lli, \"b\": %lli}\n",
+               i->thread,
+               (unsigned long long) e->time,
+               (unsigned) e->type < PA_ELEMENTSOF(type_names) ? type_names[e->type] : "unknown",
+               e->object,
+               (long long) e->a,
+               (long long) e->b);
+    }
+}
+
 static void index_callback(pa_context *c, uint32_t idx, void *userdata) {
     if (idx == PA_INVALID_INDEX) {
         pa_log(_("Failure: %s"), pa_strerror(pa_context_errno(c)));
@@ -843,6 +884,14 @@ static void context_state_callback(pa_context *c, void *userdata) {
                     break;
                 }
 
+                case SET_TRACE:
+                    pa_operation_unref(pa_context_set_trace(c, trace, simple_callback, NULL));
+                    break;
+
+                case GET_TRACE:
+                    pa_operation_unref(pa_context_get_trace(c, get_trace_callback, NULL));
+                    break;
+
                 default:
                     pa_assert_not_reached();
             }
@@ -886,7 +935,8 @@ static void help(const char *argv0) {
              "%s [options] set-sink-input-volume SINKINPUT VOLUME\n"
              "%s [options] set-sink-mute SINK 1|0\n"
              "%s [options] set-source-mute SOURCE 1|0\n"
-             "%s [options] set-sink-input-mute SINKINPUT 1|0\n\n"
+             "%s [options] set-sink-input-mute SINKINPUT 1|0\n"
+             "%s [options] trace start|stop|dump\n\n"
              "  -h, --help                            Show this help\n"
              "      --version                         Show version\n\n"
              "  -s, --server=SERVER                   The name of the server to connect to\n"
@@ -895,7 +945,7 @@ static void help(const char *argv0) {
            argv0, argv0, argv0, argv0, argv0,
            argv0, argv0, argv0, argv0, argv0,
            argv0, argv0, argv0, argv0, argv0,
-           argv0);
+           argv0, argv0);
 }
 
 enum {
@@ -1251,6 +1301,23 @@ int main(int argc, char *argv[]) {
 
             mute = b;
 
+        } else if (pa_streq(argv[optind], "trace")) {
+
+            if (argc != optind+2) {
+                pa_log(_("You have to specify start, stop or dump"));
+                goto quit;
+            }
+
+            if (pa_streq(argv[optind+1], "dump"))
+                action = GET_TRACE;
+            else if (pa_streq(argv[optind+1], "start") || pa_streq(argv[optind+1], "stop")) {
+                action = SET_TRACE;
+                trace = pa_streq(argv[optind+1], "start");
+            } else {
+                pa_log(_("Invalid trace action specification"));
+                goto quit;
+            }
+
         } else if (pa_streq(argv[optind], "help")) {
             help(bn);
             ret = 0;